@@ -0,0 +1,533 @@
+/******************************************************************************
+ * umqtt_bench.c - umqtt encode/decode microbenchmarks
+ *
+ * Copyright (c) 2017, Joseph Kroesche (tronics.kroesche.io)
+ * All rights reserved.
+ *
+ * This software is released under the FreeBSD license, found in the
+ * accompanying file LICENSE.txt and at the following URL:
+ *      http://www.freebsd.org/copyright/freebsd-license.html
+ *
+ * This software is provided as-is and without warranty.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "umqtt/umqtt.h"
+#include "loopback/loopback_broker.h"
+
+/*
+ * Microbenchmarks for the umqtt packet encode and decode paths.
+ *
+ * The transport works like the unit test mocks: writes are accepted and
+ * thrown away, reads never return anything, and malloc/free are counted.
+ * So the numbers are the cost of umqtt itself, with no network.
+ *
+ * The loopback benchmarks instead run a publisher and a subscriber
+ * through the in-process loopback broker, so each operation is a complete
+ * publish, delivery and (for QoS 1) acknowledgement.
+ *
+ * Each benchmark reports nanoseconds per operation and allocations per
+ * operation, as CSV (default) or JSON so runs can be compared.
+ *
+ * Usage: umqtt_bench [-f csv|json] [-n iterations]
+ */
+
+// default number of timed iterations for each benchmark
+#define DEFAULT_ITERATIONS 100000
+// iterations are reduced so no benchmark moves more than this many bytes
+#define MAX_BENCH_BYTES (256UL * 1024UL * 1024UL)
+#define MIN_ITERATIONS 100
+#define WARMUP_ITERATIONS 100
+
+#define MAX_SUB_TOPICS 100
+#define MAX_PAYLOAD (64UL * 1024UL)
+
+typedef enum
+{
+    FORMAT_CSV,
+    FORMAT_JSON,
+} Format_t;
+
+static Format_t format = FORMAT_CSV;
+static unsigned long baseIterations = DEFAULT_ITERATIONS;
+static bool firstResult = true;
+
+/*
+ * Transport and memory functions
+ */
+
+static unsigned long allocCount = 0;
+
+static void *
+benchMalloc(size_t size)
+{
+    ++allocCount;
+    return malloc(size);
+}
+
+static void
+benchFree(void *ptr)
+{
+    free(ptr);
+}
+
+// nothing is ever received
+static int
+benchReadPacket(void *hNet, uint8_t **ppBuf)
+{
+    (void)hNet;
+    *ppBuf = NULL;
+    return 0;
+}
+
+// everything written is accepted
+static int
+benchWritePacket(void *hNet, const uint8_t *pBuf, uint32_t len, bool isMore)
+{
+    (void)hNet; (void)pBuf; (void)isMore;
+    return len;
+}
+
+static umqtt_TransportConfig_t transport =
+{
+    NULL, benchMalloc, benchFree, benchReadPacket, benchWritePacket,
+    NULL, NULL, 0, NULL, NULL, NULL, NULL, 0
+};
+
+static unsigned long deliveryCount = 0;
+
+// incoming publish is only counted
+static void
+benchPublishCb(umqtt_Handle_t h, void *pUser, bool dup, bool retain, uint8_t qos,
+               const char *pTopic, uint16_t topicLen, const uint8_t *pMsg, uint16_t msgLen)
+{
+    (void)h; (void)pUser; (void)dup; (void)retain; (void)qos;
+    (void)pTopic; (void)topicLen; (void)pMsg; (void)msgLen;
+    ++deliveryCount;
+}
+
+static umqtt_Callbacks_t callbacks =
+{
+    NULL, benchPublishCb, NULL, NULL, NULL, NULL
+};
+
+/*
+ * Benchmark helpers
+ */
+
+// state used by a benchmark operation
+typedef struct
+{
+    umqtt_Handle_t h;
+    umqtt_Handle_t hSub;    // loopback subscriber
+    const char *name;
+    char *pTopic;
+    uint8_t *pPayload;
+    uint32_t payloadLen;
+    uint8_t qos;
+    char *topics[MAX_SUB_TOPICS];
+    uint8_t qoss[MAX_SUB_TOPICS];
+    uint32_t topicCount;
+    uint8_t pkt[MAX_SUB_TOPICS + 8];
+    uint32_t pktLen;
+} BenchCtx_t;
+
+typedef void (*BenchFn_t)(BenchCtx_t *pCtx);
+
+static uint64_t
+nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+// any umqtt error during a benchmark means the numbers are meaningless
+static void
+checkErr(BenchCtx_t *pCtx, umqtt_Error_t err)
+{
+    if (err != UMQTT_ERR_OK)
+    {
+        fprintf(stderr, "%s: %s\n", pCtx->name, umqtt_GetErrorString(err));
+        exit(1);
+    }
+}
+
+// scale down iteration count for benchmarks that move a lot of data
+static unsigned long
+iterationsFor(size_t bytesPerOp)
+{
+    unsigned long iters = baseIterations;
+    if ((bytesPerOp != 0) && ((bytesPerOp * iters) > MAX_BENCH_BYTES))
+    {
+        iters = MAX_BENCH_BYTES / bytesPerOp;
+        iters = (iters < MIN_ITERATIONS) ? MIN_ITERATIONS : iters;
+    }
+    return iters;
+}
+
+static void
+report(const char *name, unsigned long iters, uint64_t ns, unsigned long allocs)
+{
+    double nsPerOp = (double)ns / iters;
+    double allocsPerOp = (double)allocs / iters;
+    if (format == FORMAT_JSON)
+    {
+        printf("%s  {\"name\": \"%s\", \"iterations\": %lu, \"ns_per_op\": %.1f, \"allocs_per_op\": %.2f}",
+               firstResult ? "" : ",\n", name, iters, nsPerOp, allocsPerOp);
+    }
+    else
+    {
+        printf("%s,%lu,%.1f,%.2f\n", name, iters, nsPerOp, allocsPerOp);
+    }
+    firstResult = false;
+}
+
+static void
+runBench(BenchCtx_t *pCtx, BenchFn_t fn, unsigned long iters)
+{
+    for (unsigned long i = 0; i < WARMUP_ITERATIONS; i++)
+    {
+        fn(pCtx);
+    }
+    allocCount = 0;
+    uint64_t t0 = nowNs();
+    for (unsigned long i = 0; i < iters; i++)
+    {
+        fn(pCtx);
+    }
+    uint64_t t1 = nowNs();
+    report(pCtx->name, iters, t1 - t0, allocCount);
+}
+
+// new instance with a completed connection
+static umqtt_Handle_t
+newConnected(BenchCtx_t *pCtx)
+{
+    umqtt_Handle_t h = umqtt_New(&transport, &callbacks, NULL);
+    if (!h)
+    {
+        fprintf(stderr, "umqtt_New() failed\n");
+        exit(1);
+    }
+    umqtt_Error_t err = umqtt_Connect(h, true, false, 0, 60, "bench", NULL, NULL, 0, NULL, NULL);
+    checkErr(pCtx, err);
+    uint8_t connack[] = { 2 << 4, 2, 0, 0 };
+    err = umqtt_DecodePacket(h, connack, sizeof(connack));
+    checkErr(pCtx, err);
+    return h;
+}
+
+// new instance connected through the loopback broker
+static umqtt_Handle_t
+newLoopback(BenchCtx_t *pCtx, loopback_Broker_t *pBroker, umqtt_TransportConfig_t *pTransport)
+{
+    *pTransport = transport;
+    loopback_InitTransport(loopback_NewClient(pBroker), pTransport);
+    umqtt_Handle_t h = umqtt_New(pTransport, &callbacks, NULL);
+    if (!h)
+    {
+        fprintf(stderr, "umqtt_New() failed\n");
+        exit(1);
+    }
+    umqtt_Error_t err = umqtt_Connect(h, true, false, 0, 60, "bench", NULL, NULL, 0, NULL, NULL);
+    checkErr(pCtx, err);
+    checkErr(pCtx, umqtt_Run(h, 1000));
+    if (umqtt_GetConnectedStatus(h) != UMQTT_ERR_CONNECTED)
+    {
+        fprintf(stderr, "%s: loopback connect failed\n", pCtx->name);
+        exit(1);
+    }
+    return h;
+}
+
+// fill in an ack packet for a packet ID
+static void
+setAck(BenchCtx_t *pCtx, uint8_t type, uint16_t msgId)
+{
+    pCtx->pkt[0] = type << 4;
+    pCtx->pkt[1] = 2;
+    pCtx->pkt[2] = msgId >> 8;
+    pCtx->pkt[3] = msgId & 0xFF;
+    pCtx->pktLen = 4;
+}
+
+/*
+ * Benchmark operations
+ */
+
+// publish, and for QoS 1 the PUBACK that releases the packet
+static void
+opPublish(BenchCtx_t *pCtx)
+{
+    uint16_t msgId;
+    umqtt_Error_t err = umqtt_Publish(pCtx->h, pCtx->pTopic, pCtx->pPayload,
+                                      pCtx->payloadLen, pCtx->qos, false, &msgId);
+    checkErr(pCtx, err);
+    if (pCtx->qos)
+    {
+        setAck(pCtx, 4, msgId);
+        err = umqtt_DecodePacket(pCtx->h, pCtx->pkt, pCtx->pktLen);
+        checkErr(pCtx, err);
+    }
+}
+
+// subscribe and the SUBACK that releases the packet
+static void
+opSubscribe(BenchCtx_t *pCtx)
+{
+    uint16_t msgId;
+    umqtt_Error_t err = umqtt_Subscribe(pCtx->h, pCtx->topicCount, pCtx->topics,
+                                        pCtx->qoss, &msgId);
+    checkErr(pCtx, err);
+    pCtx->pkt[0] = 9 << 4;
+    pCtx->pkt[1] = 2 + pCtx->topicCount;
+    pCtx->pkt[2] = msgId >> 8;
+    pCtx->pkt[3] = msgId & 0xFF;
+    memset(&pCtx->pkt[4], 0, pCtx->topicCount);
+    err = umqtt_DecodePacket(pCtx->h, pCtx->pkt, 4 + pCtx->topicCount);
+    checkErr(pCtx, err);
+}
+
+// publish through the loopback broker, then let the subscriber take
+// delivery and the publisher take the PUBACK.  Ticks do not advance so
+// there are never any retries or pings.
+static void
+opLoopback(BenchCtx_t *pCtx)
+{
+    umqtt_Error_t err = umqtt_Publish(pCtx->h, pCtx->pTopic, pCtx->pPayload,
+                                      pCtx->payloadLen, pCtx->qos, false, NULL);
+    checkErr(pCtx, err);
+    checkErr(pCtx, umqtt_Run(pCtx->hSub, 1000));
+    checkErr(pCtx, umqtt_Run(pCtx->h, 1000));
+}
+
+// decode a prepared packet.  Acks for packet IDs that are not in flight
+// still go through the full decode and lookup, so the result is not
+// checked.
+static void
+opDecode(BenchCtx_t *pCtx)
+{
+    (void)umqtt_DecodePacket(pCtx->h, pCtx->pkt, pCtx->pktLen);
+}
+
+static void
+benchPublish(uint8_t qos, uint32_t topicLen, uint32_t payloadLen)
+{
+    static uint8_t payload[MAX_PAYLOAD];
+    char name[64];
+    BenchCtx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    snprintf(name, sizeof(name), "publish_qos%u_t%u_p%u", qos, topicLen, payloadLen);
+    ctx.name = name;
+    ctx.h = newConnected(&ctx);
+    ctx.pTopic = malloc(topicLen + 1);
+    memset(ctx.pTopic, 't', topicLen);
+    ctx.pTopic[topicLen] = 0;
+    memset(payload, 'p', payloadLen);
+    ctx.pPayload = payload;
+    ctx.payloadLen = payloadLen;
+    ctx.qos = qos;
+    runBench(&ctx, opPublish, iterationsFor(topicLen + payloadLen));
+    free(ctx.pTopic);
+    umqtt_Delete(ctx.h);
+}
+
+static void
+benchSubscribe(uint32_t count)
+{
+    char name[64];
+    BenchCtx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    snprintf(name, sizeof(name), "subscribe_%u", count);
+    ctx.name = name;
+    ctx.h = newConnected(&ctx);
+    for (uint32_t idx = 0; idx < count; idx++)
+    {
+        ctx.topics[idx] = malloc(24);
+        snprintf(ctx.topics[idx], 24, "bench/topic/%u", idx);
+        ctx.qoss[idx] = 1;
+    }
+    ctx.topicCount = count;
+    runBench(&ctx, opSubscribe, iterationsFor(count * 16));
+    for (uint32_t idx = 0; idx < count; idx++)
+    {
+        free(ctx.topics[idx]);
+    }
+    umqtt_Delete(ctx.h);
+}
+
+static void
+benchDecode(const char *name, const uint8_t *pPkt, uint32_t len)
+{
+    BenchCtx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.name = name;
+    ctx.h = newConnected(&ctx);
+    memcpy(ctx.pkt, pPkt, len);
+    ctx.pktLen = len;
+    runBench(&ctx, opDecode, iterationsFor(len));
+    umqtt_Delete(ctx.h);
+}
+
+static void
+benchLoopback(uint8_t qos, uint32_t payloadLen)
+{
+    static loopback_Broker_t broker;
+    static uint8_t payload[MAX_PAYLOAD];
+    umqtt_TransportConfig_t pubTransport;
+    umqtt_TransportConfig_t subTransport;
+    char name[64];
+    BenchCtx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    snprintf(name, sizeof(name), "loopback_qos%u_p%u", qos, payloadLen);
+    ctx.name = name;
+    loopback_Init(&broker);
+    ctx.h = newLoopback(&ctx, &broker, &pubTransport);
+    ctx.hSub = newLoopback(&ctx, &broker, &subTransport);
+
+    char *topics[1] = { "bench/loopback" };
+    uint8_t qoss[1] = { qos };
+    checkErr(&ctx, umqtt_Subscribe(ctx.hSub, 1, topics, qoss, NULL));
+    checkErr(&ctx, umqtt_Run(ctx.hSub, 1000));
+
+    ctx.pTopic = topics[0];
+    memset(payload, 'p', payloadLen);
+    ctx.pPayload = payload;
+    ctx.payloadLen = payloadLen;
+    ctx.qos = qos;
+    unsigned long iters = iterationsFor(payloadLen);
+    deliveryCount = 0;
+    runBench(&ctx, opLoopback, iters);
+
+    // every message must have made it through
+    if (deliveryCount != (iters + WARMUP_ITERATIONS))
+    {
+        fprintf(stderr, "%s: %lu of %lu messages delivered\n", name,
+                deliveryCount, iters + WARMUP_ITERATIONS);
+        exit(1);
+    }
+    umqtt_Delete(ctx.h);
+    umqtt_Delete(ctx.hSub);
+}
+
+static void
+runAll(void)
+{
+    static const uint32_t topicLens[] = { 8, 64 };
+    static const uint32_t payloadLens[] = { 8, 64, 512, 4096, 65536 };
+    static const uint32_t subCounts[] = { 1, 10, 100 };
+    static const uint32_t loopbackLens[] = { 8, 64, 512 };
+
+    for (uint8_t qos = 0; qos < 2; qos++)
+    {
+        for (unsigned int t = 0; t < sizeof(topicLens) / sizeof(topicLens[0]); t++)
+        {
+            for (unsigned int p = 0; p < sizeof(payloadLens) / sizeof(payloadLens[0]); p++)
+            {
+                benchPublish(qos, topicLens[t], payloadLens[p]);
+            }
+        }
+    }
+
+    for (unsigned int s = 0; s < sizeof(subCounts) / sizeof(subCounts[0]); s++)
+    {
+        benchSubscribe(subCounts[s]);
+    }
+
+    for (uint8_t qos = 0; qos < 2; qos++)
+    {
+        for (unsigned int p = 0; p < sizeof(loopbackLens) / sizeof(loopbackLens[0]); p++)
+        {
+            benchLoopback(qos, loopbackLens[p]);
+        }
+    }
+
+    // one of each packet type a client can receive
+    static const uint8_t connack[] = { 2 << 4, 2, 0, 0 };
+    static const uint8_t publish0[] =
+    { 3 << 4, 14, 0, 5, 't', 'o', 'p', 'i', 'c', 'm', 'e', 's', 's', 'a', 'g', 'e' };
+    static const uint8_t publish1[] =
+    { (3 << 4) | 2, 16, 0, 5, 't', 'o', 'p', 'i', 'c', 0x12, 0x34, 'm', 'e', 's', 's', 'a', 'g', 'e' };
+    static const uint8_t puback[] = { 4 << 4, 2, 0x12, 0x34 };
+    static const uint8_t pubrec[] = { 5 << 4, 2, 0x12, 0x34 };
+    static const uint8_t pubrel[] = { (6 << 4) | 2, 2, 0x12, 0x34 };
+    static const uint8_t pubcomp[] = { 7 << 4, 2, 0x12, 0x34 };
+    static const uint8_t suback[] = { 9 << 4, 3, 0x12, 0x34, 0 };
+    static const uint8_t unsuback[] = { 11 << 4, 2, 0x12, 0x34 };
+    static const uint8_t pingresp[] = { 13 << 4, 0 };
+    benchDecode("decode_connack", connack, sizeof(connack));
+    benchDecode("decode_publish_qos0", publish0, sizeof(publish0));
+    benchDecode("decode_publish_qos1", publish1, sizeof(publish1));
+    benchDecode("decode_puback", puback, sizeof(puback));
+    benchDecode("decode_pubrec", pubrec, sizeof(pubrec));
+    benchDecode("decode_pubrel", pubrel, sizeof(pubrel));
+    benchDecode("decode_pubcomp", pubcomp, sizeof(pubcomp));
+    benchDecode("decode_suback", suback, sizeof(suback));
+    benchDecode("decode_unsuback", unsuback, sizeof(unsuback));
+    benchDecode("decode_pingresp", pingresp, sizeof(pingresp));
+}
+
+static void
+usage(const char *exe)
+{
+    fprintf(stderr, "usage: %s [-f csv|json] [-n iterations]\n", exe);
+    exit(1);
+}
+
+int
+main(int argc, const char *argv[])
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if ((strcmp(argv[i], "-f") == 0) && ((i + 1) < argc))
+        {
+            ++i;
+            if (strcmp(argv[i], "json") == 0)
+            {
+                format = FORMAT_JSON;
+            }
+            else if (strcmp(argv[i], "csv") == 0)
+            {
+                format = FORMAT_CSV;
+            }
+            else
+            {
+                usage(argv[0]);
+            }
+        }
+        else if ((strcmp(argv[i], "-n") == 0) && ((i + 1) < argc))
+        {
+            baseIterations = strtoul(argv[++i], NULL, 0);
+            if (baseIterations == 0)
+            {
+                usage(argv[0]);
+            }
+        }
+        else
+        {
+            usage(argv[0]);
+        }
+    }
+
+    if (format == FORMAT_JSON)
+    {
+        printf("[\n");
+    }
+    else
+    {
+        printf("name,iterations,ns_per_op,allocs_per_op\n");
+    }
+    runAll();
+    if (format == FORMAT_JSON)
+    {
+        printf("\n]\n");
+    }
+    return 0;
+}
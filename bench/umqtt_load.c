@@ -0,0 +1,626 @@
+/******************************************************************************
+ * umqtt_load.c - umqtt end-to-end load test against a local broker
+ *
+ * Copyright (c) 2017, Joseph Kroesche (tronics.kroesche.io)
+ * All rights reserved.
+ *
+ * This software is released under the FreeBSD license, found in the
+ * accompanying file LICENSE.txt and at the following URL:
+ *      http://www.freebsd.org/copyright/freebsd-license.html
+ *
+ * This software is provided as-is and without warranty.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "umqtt/umqtt.h"
+
+/*
+ * Load test that connects a number of umqtt clients to an MQTT broker
+ * and drives publish streams through them for a fixed time.
+ *
+ * Reported at the end of the run:
+ * - messages per second, over all clients
+ * - publish to PUBACK (QoS 1) or PUBCOMP (QoS 2) latency percentiles
+ * - CPU time (user + system) per message, for this process only
+ *
+ * All clients run from one thread, so the result is what one core can
+ * sustain.  Each client paces its own publishes at the requested rate, or
+ * runs flat out when the rate is 0.  For QoS 1 and 2 the number of
+ * publishes waiting for PUBACK or PUBCOMP per client is limited by the
+ * umqtt in-flight window, and a full window holds the client back until
+ * one completes.
+ *
+ * Usage: umqtt_load [-H host] [-P port] [-c clients] [-q qos] [-s payload]
+ *                   [-r rate] [-w window] [-d seconds] [-f csv|json]
+ */
+
+#define DEFAULT_HOST "localhost"
+#define DEFAULT_PORT "1883"
+
+#define RX_BUF_SIZE 256
+#define MAX_CLIENTS 1000
+#define MAX_PAYLOAD (64UL * 1024UL)
+// latency samples kept for percentiles, any beyond this are not recorded
+#define MAX_SAMPLES (4UL * 1024UL * 1024UL)
+// time allowed for connect, and for outstanding PUBACKs at the end
+#define CONNECT_TIMEOUT_MS 10000
+#define DRAIN_TIMEOUT_MS 5000
+
+typedef struct
+{
+    const char *host;
+    const char *port;
+    unsigned int clients;
+    uint8_t qos;
+    uint32_t payloadLen;
+    uint32_t rate;          // publishes per second per client, 0 = no limit
+    unsigned int window;    // max QoS 1 or 2 publishes in flight
+    unsigned int seconds;
+    bool json;
+} LoadConfig_t;
+
+// one client connection
+typedef struct
+{
+    int sock;
+    umqtt_Handle_t h;
+    umqtt_TransportConfig_t transport;
+    char clientId[32];
+    char topic[32];
+    umqtt_TopicHandle_t hTopic;
+    bool connected;
+    unsigned int inflight;
+    uint64_t nextSendNs;
+    uint64_t sent;
+    uint64_t acked;
+    uint64_t *pSentNs;      // publish time indexed by packet ID
+} LoadClient_t;
+
+static LoadConfig_t cfg =
+{
+    DEFAULT_HOST, DEFAULT_PORT, 1, 1, 64, 0, 16, 10, false
+};
+
+static uint32_t *latencies = NULL;  // nanoseconds, saturated at 32 bits
+static unsigned long latencyCount = 0;
+static bool networkError = false;
+
+static uint64_t
+nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static uint32_t
+nowMs(void)
+{
+    return (uint32_t)(nowNs() / 1000000ULL);
+}
+
+static uint64_t
+cpuNs(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    uint64_t us = ((uint64_t)ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000ULL;
+    us += ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+    return us * 1000ULL;
+}
+
+/*
+ * Network functions
+ *
+ * The socket is left blocking so that a busy broker slows the publisher
+ * down instead of failing the write.  Reads do not wait.
+ */
+
+static int
+connectToServer(const char *host, const char *port)
+{
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    struct addrinfo *pInfo;
+    int res = getaddrinfo(host, port, &hints, &pInfo);
+    if (res != 0)
+    {
+        fprintf(stderr, "getaddrinfo error %d\n", res);
+        return -1;
+    }
+
+    int s = socket(pInfo->ai_family, pInfo->ai_socktype, pInfo->ai_protocol);
+    if (s < 0)
+    {
+        fprintf(stderr, "socket error %d (%s)\n", errno, strerror(errno));
+        freeaddrinfo(pInfo);
+        return -1;
+    }
+
+    res = connect(s, pInfo->ai_addr, pInfo->ai_addrlen);
+    freeaddrinfo(pInfo);
+    if (res < 0)
+    {
+        fprintf(stderr, "connect error %d (%s)\n", errno, strerror(errno));
+        close(s);
+        return -1;
+    }
+
+    // latency is what is being measured, so do not let
+    // the stack hold back small packets
+    int one = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return s;
+}
+
+static int
+netReadInto(void *hNet, uint8_t *pBuf, uint32_t len)
+{
+    LoadClient_t *pClient = hNet;
+    int res = recv(pClient->sock, pBuf, len, MSG_DONTWAIT);
+    if (res < 0)
+    {
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        {
+            return 0;
+        }
+        fprintf(stderr, "%s: read error %d (%s)\n", pClient->clientId, errno, strerror(errno));
+        networkError = true;
+    }
+    else if (res == 0)
+    {
+        fprintf(stderr, "%s: connection closed\n", pClient->clientId);
+        networkError = true;
+        res = -1;
+    }
+    return res;
+}
+
+static int
+netWritePacket(void *hNet, const uint8_t *pBuf, uint32_t len, bool isMore)
+{
+    LoadClient_t *pClient = hNet;
+    int res = send(pClient->sock, pBuf, len, isMore ? MSG_MORE : 0);
+    if (res < 0)
+    {
+        fprintf(stderr, "%s: write error %d (%s)\n", pClient->clientId, errno, strerror(errno));
+        networkError = true;
+    }
+    return res;
+}
+
+// batch publish can pass more segments than fit iov, so they are
+// written 4 at a time
+static int
+netWritev(void *hNet, const umqtt_IoVec_t *pIov, unsigned int iovCnt)
+{
+    LoadClient_t *pClient = hNet;
+    struct iovec iov[4];
+    int total = 0;
+    while (iovCnt)
+    {
+        unsigned int cnt = (iovCnt > 4) ? 4 : iovCnt;
+        int chunkLen = 0;
+        for (unsigned int idx = 0; idx < cnt; idx++)
+        {
+            iov[idx].iov_base = (void *)pIov[idx].pBuf;
+            iov[idx].iov_len = pIov[idx].len;
+            chunkLen += pIov[idx].len;
+        }
+        int res = writev(pClient->sock, iov, cnt);
+        if (res < 0)
+        {
+            fprintf(stderr, "%s: writev error %d (%s)\n", pClient->clientId, errno, strerror(errno));
+            networkError = true;
+            return total ? total : res;
+        }
+        total += res;
+        if (res < chunkLen)
+        {
+            break;
+        }
+        pIov += cnt;
+        iovCnt -= cnt;
+    }
+    return total;
+}
+
+/*
+ * umqtt callbacks
+ */
+
+static void
+connackCb(umqtt_Handle_t h, void *pUser, bool sessionPresent, uint8_t retCode)
+{
+    (void)h; (void)sessionPresent;
+    LoadClient_t *pClient = pUser;
+    if (retCode != 0)
+    {
+        fprintf(stderr, "%s: connect refused (%u)\n", pClient->clientId, retCode);
+        networkError = true;
+        return;
+    }
+    pClient->connected = true;
+}
+
+// called for PUBACK at QoS 1 and PUBCOMP at QoS 2
+static void
+pubackCb(umqtt_Handle_t h, void *pUser, uint16_t msgId)
+{
+    (void)h;
+    LoadClient_t *pClient = pUser;
+    uint64_t lat = nowNs() - pClient->pSentNs[msgId];
+    if (latencyCount < MAX_SAMPLES)
+    {
+        latencies[latencyCount++] = (lat > UINT32_MAX) ? UINT32_MAX : (uint32_t)lat;
+    }
+    ++pClient->acked;
+    if (pClient->inflight)
+    {
+        --pClient->inflight;
+    }
+}
+
+static umqtt_Callbacks_t callbacks =
+{
+    connackCb, NULL, pubackCb, NULL, NULL, NULL
+};
+
+/*
+ * Load run
+ */
+
+// wait for socket activity on any client, or until timeout
+static void
+waitForClients(LoadClient_t *pClients, struct pollfd *pFds, int timeoutMs)
+{
+    for (unsigned int idx = 0; idx < cfg.clients; idx++)
+    {
+        pFds[idx].fd = pClients[idx].sock;
+        pFds[idx].events = POLLIN;
+        pFds[idx].revents = 0;
+    }
+    poll(pFds, cfg.clients, timeoutMs);
+}
+
+static void
+runClients(LoadClient_t *pClients)
+{
+    uint32_t ticks = nowMs();
+    for (unsigned int idx = 0; idx < cfg.clients; idx++)
+    {
+        umqtt_Error_t err = umqtt_Run(pClients[idx].h, ticks);
+        if ((err != UMQTT_ERR_OK) && (err != UMQTT_ERR_CONNECT_PENDING))
+        {
+            fprintf(stderr, "%s: run error %s\n", pClients[idx].clientId, umqtt_GetErrorString(err));
+            networkError = true;
+        }
+    }
+}
+
+static bool
+openClients(LoadClient_t *pClients, struct pollfd *pFds)
+{
+    for (unsigned int idx = 0; idx < cfg.clients; idx++)
+    {
+        LoadClient_t *pClient = &pClients[idx];
+        snprintf(pClient->clientId, sizeof(pClient->clientId), "umqtt_load_%u", idx);
+        snprintf(pClient->topic, sizeof(pClient->topic), "umqtt/load/%u", idx);
+        pClient->pSentNs = calloc(65536, sizeof(uint64_t));
+        pClient->sock = connectToServer(cfg.host, cfg.port);
+        if ((pClient->sock < 0) || !pClient->pSentNs)
+        {
+            return false;
+        }
+        umqtt_TransportConfig_t transport =
+        {   pClient, malloc, free, NULL, netWritePacket, netReadInto, NULL, RX_BUF_SIZE,
+            NULL, NULL, netWritev, NULL, 0 };
+        pClient->transport = transport;
+        pClient->h = umqtt_New(&pClient->transport, &callbacks, pClient);
+        if (!pClient->h)
+        {
+            fprintf(stderr, "umqtt_New() failed\n");
+            return false;
+        }
+        umqtt_SetInflightWindow(pClient->h, cfg.window);
+        pClient->hTopic = umqtt_NewTopic(pClient->h, pClient->topic);
+        if (!pClient->hTopic)
+        {
+            fprintf(stderr, "umqtt_NewTopic() failed\n");
+            return false;
+        }
+        umqtt_Error_t err = umqtt_Connect(pClient->h, true, false, 0, 60,
+                                          pClient->clientId, NULL, NULL, 0, NULL, NULL);
+        if (err != UMQTT_ERR_OK)
+        {
+            fprintf(stderr, "%s: connect error %s\n", pClient->clientId, umqtt_GetErrorString(err));
+            return false;
+        }
+    }
+
+    // wait for all the CONNACKs
+    uint32_t start = nowMs();
+    unsigned int connected;
+    do
+    {
+        waitForClients(pClients, pFds, 10);
+        runClients(pClients);
+        connected = 0;
+        for (unsigned int idx = 0; idx < cfg.clients; idx++)
+        {
+            connected += pClients[idx].connected ? 1 : 0;
+        }
+    } while (!networkError && (connected < cfg.clients)
+             && ((nowMs() - start) < CONNECT_TIMEOUT_MS));
+
+    if (connected < cfg.clients)
+    {
+        fprintf(stderr, "only %u of %u clients connected\n", connected, cfg.clients);
+        return false;
+    }
+    return true;
+}
+
+static void
+closeClients(LoadClient_t *pClients)
+{
+    for (unsigned int idx = 0; idx < cfg.clients; idx++)
+    {
+        LoadClient_t *pClient = &pClients[idx];
+        if (pClient->h)
+        {
+            if (pClient->connected)
+            {
+                umqtt_Disconnect(pClient->h);
+            }
+            umqtt_DeleteTopic(pClient->h, pClient->hTopic);
+            umqtt_Delete(pClient->h);
+        }
+        if (pClient->sock >= 0)
+        {
+            close(pClient->sock);
+        }
+        free(pClient->pSentNs);
+    }
+}
+
+// publish from any client that is due, returns true if
+// any client will be able to publish again right away
+static bool
+publishDue(LoadClient_t *pClients, const uint8_t *pPayload, uint64_t now)
+{
+    uint64_t interval = cfg.rate ? (1000000000ULL / cfg.rate) : 0;
+    bool ready = false;
+    for (unsigned int idx = 0; idx < cfg.clients; idx++)
+    {
+        LoadClient_t *pClient = &pClients[idx];
+        if (pClient->nextSendNs > now)
+        {
+            continue;
+        }
+        uint16_t msgId = 0;
+        umqtt_Error_t err = umqtt_PublishTopic(pClient->h, pClient->hTopic, pPayload,
+                                               cfg.payloadLen, cfg.qos, false, &msgId);
+        if (err == UMQTT_ERR_WINDOW_FULL)
+        {
+            continue;
+        }
+        else if (err != UMQTT_ERR_OK)
+        {
+            fprintf(stderr, "%s: publish error %s\n", pClient->clientId, umqtt_GetErrorString(err));
+            networkError = true;
+            return false;
+        }
+        if (cfg.qos != 0)
+        {
+            pClient->pSentNs[msgId] = now;
+            ++pClient->inflight;
+        }
+        ++pClient->sent;
+        // stay on schedule, but do not try to catch up after a stall
+        pClient->nextSendNs = (pClient->nextSendNs + interval < now) ? now : pClient->nextSendNs + interval;
+        ready = ready || (pClient->nextSendNs <= now);
+    }
+    return ready;
+}
+
+static int
+compareLatency(const void *pA, const void *pB)
+{
+    uint32_t a = *(const uint32_t *)pA;
+    uint32_t b = *(const uint32_t *)pB;
+    return (a > b) - (a < b);
+}
+
+// percentile in tenths of a percent, in microseconds
+static double
+percentile(unsigned int pmille)
+{
+    if (latencyCount == 0)
+    {
+        return 0.0;
+    }
+    unsigned long idx = ((latencyCount - 1) * pmille) / 1000;
+    return latencies[idx] / 1000.0;
+}
+
+static void
+report(uint64_t sent, uint64_t acked, uint64_t elapsedNs, uint64_t cpuUsedNs)
+{
+    double secs = elapsedNs / 1e9;
+    double msgsPerSec = secs ? (sent / secs) : 0.0;
+    double cpuUsPerMsg = sent ? ((cpuUsedNs / 1000.0) / sent) : 0.0;
+    qsort(latencies, latencyCount, sizeof(latencies[0]), compareLatency);
+    double p50 = percentile(500);
+    double p99 = percentile(990);
+    double p999 = percentile(999);
+
+    if (cfg.json)
+    {
+        printf("{\"clients\": %u, \"qos\": %u, \"payload\": %u, \"rate\": %u, \"window\": %u, "
+               "\"seconds\": %.3f, \"sent\": %llu, \"acked\": %llu, \"msgs_per_sec\": %.1f, "
+               "\"p50_us\": %.1f, \"p99_us\": %.1f, \"p999_us\": %.1f, \"cpu_us_per_msg\": %.3f}\n",
+               cfg.clients, cfg.qos, cfg.payloadLen, cfg.rate, cfg.window, secs,
+               (unsigned long long)sent, (unsigned long long)acked, msgsPerSec,
+               p50, p99, p999, cpuUsPerMsg);
+    }
+    else
+    {
+        printf("clients,qos,payload,rate,window,seconds,sent,acked,msgs_per_sec,"
+               "p50_us,p99_us,p999_us,cpu_us_per_msg\n");
+        printf("%u,%u,%u,%u,%u,%.3f,%llu,%llu,%.1f,%.1f,%.1f,%.1f,%.3f\n",
+               cfg.clients, cfg.qos, cfg.payloadLen, cfg.rate, cfg.window, secs,
+               (unsigned long long)sent, (unsigned long long)acked, msgsPerSec,
+               p50, p99, p999, cpuUsPerMsg);
+    }
+}
+
+static int
+runLoad(void)
+{
+    static uint8_t payload[MAX_PAYLOAD];
+    memset(payload, 'p', cfg.payloadLen);
+
+    LoadClient_t *pClients = calloc(cfg.clients, sizeof(LoadClient_t));
+    struct pollfd *pFds = calloc(cfg.clients, sizeof(struct pollfd));
+    latencies = malloc(MAX_SAMPLES * sizeof(latencies[0]));
+    if (!pClients || !pFds || !latencies)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for (unsigned int idx = 0; idx < cfg.clients; idx++)
+    {
+        pClients[idx].sock = -1;
+    }
+
+    int ret = 1;
+    if (openClients(pClients, pFds))
+    {
+        uint64_t cpu0 = cpuNs();
+        uint64_t t0 = nowNs();
+        uint64_t end = t0 + (cfg.seconds * 1000000000ULL);
+        uint64_t now = t0;
+        for (unsigned int idx = 0; idx < cfg.clients; idx++)
+        {
+            pClients[idx].nextSendNs = t0;
+        }
+
+        // publish for the run time
+        while (!networkError && (now < end))
+        {
+            bool ready = publishDue(pClients, payload, now);
+            waitForClients(pClients, pFds, ready ? 0 : 1);
+            runClients(pClients);
+            now = nowNs();
+        }
+        uint64_t t1 = now;
+
+        // let outstanding PUBACKs arrive, they count for latency
+        // but the run time above is what sets the message rate
+        uint64_t drainEnd = t1 + (DRAIN_TIMEOUT_MS * 1000000ULL);
+        bool pending = true;
+        while (!networkError && pending && (nowNs() < drainEnd))
+        {
+            waitForClients(pClients, pFds, 1);
+            runClients(pClients);
+            pending = false;
+            for (unsigned int idx = 0; idx < cfg.clients; idx++)
+            {
+                pending = pending || (pClients[idx].inflight != 0);
+            }
+        }
+        uint64_t cpu1 = cpuNs();
+
+        uint64_t sent = 0;
+        uint64_t acked = 0;
+        for (unsigned int idx = 0; idx < cfg.clients; idx++)
+        {
+            sent += pClients[idx].sent;
+            acked += pClients[idx].acked;
+        }
+        report(sent, acked, t1 - t0, cpu1 - cpu0);
+        ret = networkError ? 1 : 0;
+    }
+
+    closeClients(pClients);
+    free(pClients);
+    free(pFds);
+    free(latencies);
+    return ret;
+}
+
+static void
+usage(const char *exe)
+{
+    fprintf(stderr,
+            "usage: %s [-H host] [-P port] [-c clients] [-q qos] [-s payload]\n"
+            "          [-r rate] [-w window] [-d seconds] [-f csv|json]\n"
+            "  -c  number of clients (1-%u, default 1)\n"
+            "  -q  publish QoS, 0 to 2 (default 1)\n"
+            "  -s  payload size in bytes (0-%lu, default 64)\n"
+            "  -r  publishes per second per client, 0 for no limit (default 0)\n"
+            "  -w  max QoS 1 or 2 publishes in flight per client (default 16)\n"
+            "  -d  run time in seconds (default 10)\n",
+            exe, MAX_CLIENTS, MAX_PAYLOAD);
+    exit(1);
+}
+
+int
+main(int argc, const char *argv[])
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (((i + 1) >= argc) || (argv[i][0] != '-') || (strlen(argv[i]) != 2))
+        {
+            usage(argv[0]);
+        }
+        const char *arg = argv[++i];
+        unsigned long val = strtoul(arg, NULL, 0);
+        switch (argv[i - 1][1])
+        {
+            case 'H': cfg.host = arg; break;
+            case 'P': cfg.port = arg; break;
+            case 'c': cfg.clients = val; break;
+            case 'q': cfg.qos = val; break;
+            case 's': cfg.payloadLen = val; break;
+            case 'r': cfg.rate = val; break;
+            case 'w': cfg.window = val; break;
+            case 'd': cfg.seconds = val; break;
+            case 'f':
+                if (strcmp(arg, "json") == 0) { cfg.json = true; }
+                else if (strcmp(arg, "csv") == 0) { cfg.json = false; }
+                else { usage(argv[0]); }
+                break;
+            default:
+                usage(argv[0]);
+                break;
+        }
+    }
+    if ((cfg.clients == 0) || (cfg.clients > MAX_CLIENTS) || (cfg.qos > 2)
+     || (cfg.payloadLen > MAX_PAYLOAD) || (cfg.window == 0) || (cfg.seconds == 0))
+    {
+        usage(argv[0]);
+    }
+
+    return runLoad();
+}
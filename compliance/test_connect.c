@@ -18,6 +18,8 @@
 #include <time.h>
 #include <sys/time.h>
 #include <unistd.h>
+#include <sys/uio.h>
+#include <poll.h>
 
 #include "unity_fixture.h"
 #include "umqtt/umqtt.h"
@@ -25,7 +27,8 @@
 // host network functions - must be provided by test suite
 extern int ConnectToServer(void);
 extern int WriteToServer(int socket, const uint8_t *buf, uint32_t len);
-extern int ReadFromServer(int socket, const uint8_t *buf, uint32_t len);
+extern int WritevToServer(int socket, const struct iovec *iov, int iovcnt);
+extern int ReadFromServer(int socket, uint8_t *buf, uint32_t len);
 extern void DisconnectServer(int socket);
 
 // globals used by the test
@@ -147,19 +150,20 @@ testFree(void *ptr)
     free(ptr);
 }
 
+// size of the receive buffer that umqtt allocates once at umqtt_New().
+// umqtt reassembles packets that are split across reads and decodes all
+// the packets found in a read, so reads do not need to line up with MQTT
+// packets.  It only needs to be big enough for the largest packet.
+#define RX_BUF_SIZE 2048
+
 // implementation of umqtt network read function
+// reads directly into the umqtt receive buffer so there is no
+// allocation on the receive path
 static int
-netReadPacket(void *hNet, uint8_t **ppBuf)
+netReadInto(void *hNet, uint8_t *pBuf, uint32_t len)
 {
     int socket = *(int *)hNet;
-    uint8_t *buf = testMalloc(512);
-    int ret = ReadFromServer(socket, buf, 512);
-    if (ret <= 0)
-    {
-        testFree(buf);
-    }
-    *ppBuf = buf;
-    return ret;
+    return ReadFromServer(socket, pBuf, len);
 }
 
 // implementation of umqtt network write function
@@ -172,9 +176,46 @@ netWritePacket(void *hNet, const uint8_t *pBuf, uint32_t len, bool isMore)
     return ret;
 }
 
+// implementation of umqtt network scatter/gather write function
+// publish header, topic and payload go out in one system call.  a
+// batch publish can pass more segments, which are written 4 at a time
+static int
+netWritev(void *hNet, const umqtt_IoVec_t *pIov, unsigned int iovCnt)
+{
+    struct iovec iov[4];
+    int socket = *(int *)hNet;
+    int total = 0;
+    while (iovCnt)
+    {
+        unsigned int cnt = (iovCnt > 4) ? 4 : iovCnt;
+        int chunkLen = 0;
+        for (unsigned int idx = 0; idx < cnt; idx++)
+        {
+            iov[idx].iov_base = (void *)pIov[idx].pBuf;
+            iov[idx].iov_len = pIov[idx].len;
+            chunkLen += pIov[idx].len;
+        }
+        int ret = WritevToServer(socket, iov, cnt);
+        if (ret < 0)
+        {
+            return total ? total : ret;
+        }
+        total += ret;
+        // short write, let umqtt deal with the rest
+        if (ret < chunkLen)
+        {
+            break;
+        }
+        pIov += cnt;
+        iovCnt -= cnt;
+    }
+    return total;
+}
+
 // transport structure needed for umqtt init
 static umqtt_TransportConfig_t transport =
-{   &sock, testMalloc, testFree, netReadPacket, netWritePacket };
+{   &sock, testMalloc, testFree, NULL, netWritePacket, netReadInto, NULL, RX_BUF_SIZE,
+    NULL, NULL, netWritev, NULL, 0 };
 
 // test helper that gets time ticks in milliseconds
 // this is relative not absolute
@@ -191,6 +232,7 @@ getTestTicksMs(void)
 
 // test helper
 // execute umqtt Run loop until pointer is non-null or time expires
+// between runs, wait in poll() instead of spinning
 static void
 RunUntil(void **wait_h, unsigned int seconds)
 {
@@ -204,6 +246,22 @@ RunUntil(void **wait_h, unsigned int seconds)
         {
             break;
         }
+
+        // sleep until umqtt has something to do or the socket has
+        // incoming data, but wake at least once a second to check
+        // the overall time limit
+        int timeout = 1000;
+        uint32_t deadline;
+        if (umqtt_GetNextDeadline(u, &deadline) == UMQTT_ERR_OK)
+        {
+            int32_t wait = (int32_t)(deadline - (uint32_t)getTestTicksMs());
+            if (wait < timeout)
+            {
+                timeout = (wait < 0) ? 0 : wait;
+            }
+        }
+        struct pollfd pfd = { sock, POLLIN, 0 };
+        poll(&pfd, 1, timeout);
     } while ((time(NULL) - time0) < seconds);
 }
 
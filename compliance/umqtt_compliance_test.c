@@ -17,6 +17,7 @@
 #include <stdint.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <netdb.h>
 #include <unistd.h>
@@ -96,6 +97,28 @@ WriteToServer(int socket, const uint8_t *buf, uint32_t len)
     return res;
 }
 
+// write a packet that is split into several buffers to mqtt broker
+// via network, using a single system call
+int
+WritevToServer(int socket, const struct iovec *iov, int iovcnt)
+{
+    ssize_t len = 0;
+    for (int idx = 0; idx < iovcnt; idx++)
+    {
+        len += iov[idx].iov_len;
+    }
+    int res = writev(socket, iov, iovcnt);
+    if (res == -1)
+    {
+        printf("writev error %d (%s)\n", errno, strerror(errno));
+    }
+    else if (res != len)
+    {
+        printf("writev incomplete, attempted %d, wrote %d\n", (int)len, res);
+    }
+    return res;
+}
+
 // read a packet from mqtt broker via network
 // since socket is non-blocking, it can return without
 // reading anything.  In this case it should return 0
@@ -0,0 +1,770 @@
+/******************************************************************************
+ * loopback_broker.c - in-process MQTT broker stand-in for umqtt testing
+ *
+ * Copyright (c) 2017, Joseph Kroesche (tronics.kroesche.io)
+ * All rights reserved.
+ *
+ * This software is released under the FreeBSD license, found in the
+ * accompanying file LICENSE.txt and at the following URL:
+ *      http://www.freebsd.org/copyright/freebsd-license.html
+ *
+ * This software is provided as-is and without warranty.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "umqtt/umqtt.h"
+#include "loopback_broker.h"
+
+/**
+ * This file provides a minimal MQTT 3.1.1 broker that runs inside the test
+ * process.  umqtt reaches it through the transport functions instead of a
+ * socket, so benchmarks and tests can run at full speed with no network
+ * and no external broker.
+ *
+ * It handles CONNECT, PUBLISH at all QoS levels, SUBSCRIBE, UNSUBSCRIBE,
+ * PINGREQ and DISCONNECT, and fans out each publish to every client with
+ * a matching subscription (+ and # wildcards are supported).
+ *
+ * Packets written by a client are processed during the write, and
+ * anything the broker sends back is queued for the client to read on its
+ * next umqtt_Run().  There are no threads, sockets or timers so the
+ * results are deterministic.
+ *
+ * A QoS 2 publish is delivered when it first arrives, and its packet ID
+ * is held until the PUBREL so that a resent copy is not delivered again.
+ *
+ * Not supported: retained messages, will messages and persistent
+ * sessions.  PUBACKs and PUBCOMPs from clients are accepted and ignored,
+ * so the broker never resends.  Any protocol error fails the client
+ * connection and all further reads and writes return an error.
+ */
+
+/**
+ * @internal
+ * Reset a client to the unconnected state.
+ *
+ * @param this client connection
+ */
+static void
+loopback_ResetClient(loopback_Client_t *this)
+{
+    this->connected = false;
+    this->failed = false;
+    this->nextPktId = 1;
+    this->pktLen = 0;
+    this->rd = 0;
+    this->wr = 0;
+    this->dropped = 0;
+    memset(this->qos2Ids, 0, sizeof(this->qos2Ids));
+    memset(this->subs, 0, sizeof(this->subs));
+}
+
+/**
+ * @internal
+ * Encode MQTT remaining length.
+ *
+ * @param pBuf buffer of at least 4 bytes for the encoded length
+ * @param remLen the remaining length value
+ *
+ * @return number of bytes used for the encoded length
+ */
+static uint32_t
+loopback_EncodeLength(uint8_t *pBuf, uint32_t remLen)
+{
+    uint32_t cnt = 0;
+    do
+    {
+        uint8_t b = remLen & 0x7F;
+        remLen >>= 7;
+        pBuf[cnt++] = remLen ? (b | 0x80) : b;
+    } while (remLen && (cnt < 4));
+    return cnt;
+}
+
+/**
+ * @internal
+ * Decode MQTT remaining length from a partial packet.
+ *
+ * @param pBuf packet data starting after the first header byte
+ * @param avail number of bytes available in pBuf
+ * @param pRemLen storage for the decoded remaining length
+ *
+ * @return number of length bytes, 0 if more data is needed,
+ * or -1 if the length is malformed
+ */
+static int
+loopback_DecodeLength(const uint8_t *pBuf, uint32_t avail, uint32_t *pRemLen)
+{
+    uint32_t remLen = 0;
+    for (uint32_t idx = 0; idx < 4; idx++)
+    {
+        if (idx >= avail)
+        {
+            return 0;
+        }
+        remLen |= (uint32_t)(pBuf[idx] & 0x7F) << (7 * idx);
+        if ((pBuf[idx] & 0x80) == 0)
+        {
+            *pRemLen = remLen;
+            return idx + 1;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @internal
+ * Add a packet to the data waiting to be read by a client.
+ *
+ * @param this client connection
+ * @param pIov segments that make up the packet
+ * @param iovCnt number of segments
+ *
+ * The packet is dropped and counted if there is no room for all of it.
+ */
+static void
+loopback_Queue(loopback_Client_t *this, const umqtt_IoVec_t *pIov, unsigned int iovCnt)
+{
+    uint32_t total = 0;
+    for (unsigned int idx = 0; idx < iovCnt; idx++)
+    {
+        total += pIov[idx].len;
+    }
+
+    // move unread data to the front to make room
+    if ((this->wr + total) > LOOPBACK_QUEUE_SIZE)
+    {
+        memmove(this->queue, &this->queue[this->rd], this->wr - this->rd);
+        this->wr -= this->rd;
+        this->rd = 0;
+    }
+    if ((this->wr + total) > LOOPBACK_QUEUE_SIZE)
+    {
+        ++this->dropped;
+        return;
+    }
+
+    for (unsigned int idx = 0; idx < iovCnt; idx++)
+    {
+        memcpy(&this->queue[this->wr], pIov[idx].pBuf, pIov[idx].len);
+        this->wr += pIov[idx].len;
+    }
+}
+
+// queue a packet that has only a packet ID as payload
+static void
+loopback_QueueAck(loopback_Client_t *this, uint8_t type, uint16_t pktId)
+{
+    uint8_t ack[4];
+    ack[0] = (type << 4) | ((type == 6) ? 2 : 0); // PUBREL flags are 2
+    ack[1] = 2;
+    ack[2] = pktId >> 8;
+    ack[3] = pktId & 0xFF;
+    umqtt_IoVec_t iov = { ack, sizeof(ack) };
+    loopback_Queue(this, &iov, 1);
+}
+
+/**
+ * @internal
+ * Check if a topic matches a subscription filter.
+ *
+ * @param pFilter null terminated topic filter, which can have wildcards
+ * @param pTopic topic name from a publish packet (not null terminated)
+ * @param topicLen length of the topic name
+ *
+ * @return true if the topic matches the filter
+ */
+static bool
+loopback_TopicMatch(const char *pFilter, const char *pTopic, uint16_t topicLen)
+{
+    uint16_t idx = 0;
+    while (*pFilter)
+    {
+        if (*pFilter == '#')
+        {
+            return true;
+        }
+        else if (*pFilter == '+')
+        {
+            while ((idx < topicLen) && (pTopic[idx] != '/'))
+            {
+                ++idx;
+            }
+            ++pFilter;
+        }
+        else if ((idx == topicLen) && (pFilter[0] == '/') && (pFilter[1] == '#'))
+        {
+            // "a/#" also matches the parent level "a"
+            return true;
+        }
+        else if ((idx < topicLen) && (*pFilter == pTopic[idx]))
+        {
+            ++pFilter;
+            ++idx;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return idx == topicLen;
+}
+
+/**
+ * @internal
+ * Send a publish to every client that has a matching subscription.
+ *
+ * @param pBroker broker instance
+ * @param qos QoS of the incoming publish
+ * @param pTopic topic name
+ * @param topicLen length of the topic name
+ * @param pPayload message payload
+ * @param payloadLen length of the payload
+ *
+ * Each client gets the message once, at the lower of the publish QoS and
+ * the highest QoS of its matching subscriptions.
+ */
+static void
+loopback_FanOut(loopback_Broker_t *pBroker, uint8_t qos, const uint8_t *pTopic,
+                uint16_t topicLen, const uint8_t *pPayload, uint32_t payloadLen)
+{
+    for (unsigned int cdx = 0; cdx < LOOPBACK_MAX_CLIENTS; cdx++)
+    {
+        loopback_Client_t *pClient = &pBroker->clients[cdx];
+        if (!pClient->inUse || !pClient->connected)
+        {
+            continue;
+        }
+
+        int subQos = -1;
+        for (unsigned int sdx = 0; sdx < LOOPBACK_MAX_SUBS; sdx++)
+        {
+            loopback_Sub_t *pSub = &pClient->subs[sdx];
+            if (pSub->inUse && (pSub->qos > subQos)
+             && loopback_TopicMatch(pSub->filter, (const char *)pTopic, topicLen))
+            {
+                subQos = pSub->qos;
+            }
+        }
+        if (subQos < 0)
+        {
+            continue;
+        }
+
+        uint8_t outQos = (qos < subQos) ? qos : subQos;
+        uint8_t hdr[7];
+        uint32_t remLen = 2 + topicLen + (outQos ? 2 : 0) + payloadLen;
+        hdr[0] = (3 << 4) | (outQos << 1);
+        uint32_t hdrLen = 1 + loopback_EncodeLength(&hdr[1], remLen);
+        hdr[hdrLen++] = topicLen >> 8;
+        hdr[hdrLen++] = topicLen & 0xFF;
+        uint8_t pktIdBuf[2];
+        if (outQos)
+        {
+            uint16_t pktId = pClient->nextPktId++;
+            pClient->nextPktId = pClient->nextPktId ? pClient->nextPktId : 1;
+            pktIdBuf[0] = pktId >> 8;
+            pktIdBuf[1] = pktId & 0xFF;
+        }
+        umqtt_IoVec_t iov[4] =
+        {
+            { hdr, hdrLen },
+            { pTopic, topicLen },
+            { pktIdBuf, outQos ? 2 : 0 },
+            { pPayload, payloadLen },
+        };
+        loopback_Queue(pClient, iov, 4);
+        ++pBroker->deliveries;
+    }
+}
+
+// process a PUBLISH, returns false if it is malformed
+static bool
+loopback_Publish(loopback_Client_t *this, uint8_t flags, const uint8_t *pBody, uint32_t bodyLen)
+{
+    uint8_t qos = (flags >> 1) & 3;
+    if ((qos > 2) || (bodyLen < 2))
+    {
+        return false;
+    }
+    uint16_t topicLen = (pBody[0] << 8) | pBody[1];
+    uint32_t hdrLen = 2 + topicLen + (qos ? 2 : 0);
+    if ((topicLen == 0) || (hdrLen > bodyLen))
+    {
+        return false;
+    }
+
+    ++this->pBroker->publishes;
+    if (qos == 1)
+    {
+        loopback_QueueAck(this, 4, (pBody[2 + topicLen] << 8) | pBody[3 + topicLen]);
+    }
+    else if (qos == 2)
+    {
+        // remember the packet ID until PUBREL, a copy that arrives
+        // before then is only acknowledged again
+        uint16_t pktId = (pBody[2 + topicLen] << 8) | pBody[3 + topicLen];
+        uint16_t *pFree = NULL;
+        // 0 marks a free entry so it can never be a QoS 2 packet ID
+        if (pktId == 0)
+        {
+            return false;
+        }
+        for (unsigned int idx = 0; idx < LOOPBACK_MAX_QOS2; idx++)
+        {
+            if (this->qos2Ids[idx] == pktId)
+            {
+                loopback_QueueAck(this, 5, pktId);
+                return true;
+            }
+            if (!this->qos2Ids[idx] && !pFree)
+            {
+                pFree = &this->qos2Ids[idx];
+            }
+        }
+        if (!pFree)
+        {
+            return false;
+        }
+        *pFree = pktId;
+        loopback_QueueAck(this, 5, pktId);
+    }
+    loopback_FanOut(this->pBroker, qos, &pBody[2], topicLen,
+                    &pBody[hdrLen], bodyLen - hdrLen);
+    return true;
+}
+
+// process a SUBSCRIBE, returns false if it is malformed
+static bool
+loopback_Subscribe(loopback_Client_t *this, const uint8_t *pBody, uint32_t bodyLen)
+{
+    uint8_t retCodes[LOOPBACK_PKT_SIZE / 4];
+    uint32_t count = 0;
+    uint32_t idx = 2;
+    if (bodyLen < 5)
+    {
+        return false;
+    }
+    while (idx < bodyLen)
+    {
+        if ((idx + 2) > bodyLen)
+        {
+            return false;
+        }
+        uint16_t len = (pBody[idx] << 8) | pBody[idx + 1];
+        idx += 2;
+        if ((len == 0) || ((idx + len + 1) > bodyLen))
+        {
+            return false;
+        }
+        const char *pFilter = (const char *)&pBody[idx];
+        uint8_t qos = pBody[idx + len];
+        idx += len + 1;
+
+        // replace an existing subscription to the same filter,
+        // or else use a free entry
+        loopback_Sub_t *pSub = NULL;
+        for (unsigned int sdx = 0; sdx < LOOPBACK_MAX_SUBS; sdx++)
+        {
+            loopback_Sub_t *pEntry = &this->subs[sdx];
+            if (pEntry->inUse && (strlen(pEntry->filter) == len)
+             && (memcmp(pEntry->filter, pFilter, len) == 0))
+            {
+                pSub = pEntry;
+                break;
+            }
+            if (!pEntry->inUse && !pSub)
+            {
+                pSub = pEntry;
+            }
+        }
+        // a # wildcard is only allowed as the last character
+        if (!pSub || (len > LOOPBACK_MAX_FILTER) || (qos > 2)
+         || memchr(pFilter, '#', len - 1))
+        {
+            retCodes[count++] = 0x80;
+            continue;
+        }
+        memcpy(pSub->filter, pFilter, len);
+        pSub->filter[len] = 0;
+        pSub->qos = qos;
+        pSub->inUse = true;
+        retCodes[count++] = pSub->qos;
+    }
+
+    uint8_t hdr[7];
+    hdr[0] = 9 << 4;
+    uint32_t hdrLen = 1 + loopback_EncodeLength(&hdr[1], 2 + count);
+    hdr[hdrLen++] = pBody[0];
+    hdr[hdrLen++] = pBody[1];
+    umqtt_IoVec_t iov[2] = { { hdr, hdrLen }, { retCodes, count } };
+    loopback_Queue(this, iov, 2);
+    return true;
+}
+
+// process a PUBREL, returns false if it is malformed
+static bool
+loopback_Pubrel(loopback_Client_t *this, uint8_t flags, const uint8_t *pBody, uint32_t bodyLen)
+{
+    if ((flags != 2) || (bodyLen != 2))
+    {
+        return false;
+    }
+    uint16_t pktId = (pBody[0] << 8) | pBody[1];
+    for (unsigned int idx = 0; idx < LOOPBACK_MAX_QOS2; idx++)
+    {
+        if (this->qos2Ids[idx] == pktId)
+        {
+            this->qos2Ids[idx] = 0;
+        }
+    }
+    // PUBCOMP is sent even for an unknown ID, it may be a resend
+    loopback_QueueAck(this, 7, pktId);
+    return true;
+}
+
+// process an UNSUBSCRIBE, returns false if it is malformed
+static bool
+loopback_Unsubscribe(loopback_Client_t *this, const uint8_t *pBody, uint32_t bodyLen)
+{
+    uint32_t idx = 2;
+    if (bodyLen < 4)
+    {
+        return false;
+    }
+    while (idx < bodyLen)
+    {
+        if ((idx + 2) > bodyLen)
+        {
+            return false;
+        }
+        uint16_t len = (pBody[idx] << 8) | pBody[idx + 1];
+        idx += 2;
+        if ((idx + len) > bodyLen)
+        {
+            return false;
+        }
+        for (unsigned int sdx = 0; sdx < LOOPBACK_MAX_SUBS; sdx++)
+        {
+            loopback_Sub_t *pSub = &this->subs[sdx];
+            if (pSub->inUse && (strlen(pSub->filter) == len)
+             && (memcmp(pSub->filter, &pBody[idx], len) == 0))
+            {
+                pSub->inUse = false;
+            }
+        }
+        idx += len;
+    }
+    loopback_QueueAck(this, 11, (pBody[0] << 8) | pBody[1]);
+    return true;
+}
+
+/**
+ * @internal
+ * Process one complete packet written by a client.
+ *
+ * @param this client connection
+ * @param hdr first byte of the packet (type and flags)
+ * @param pBody packet data after the fixed header
+ * @param bodyLen length of the packet data after the fixed header
+ *
+ * @return true if the packet was processed, false for a protocol error
+ */
+static bool
+loopback_ProcessPacket(loopback_Client_t *this, uint8_t hdr, const uint8_t *pBody, uint32_t bodyLen)
+{
+    uint8_t type = hdr >> 4;
+    uint8_t flags = hdr & 0x0F;
+    static const uint8_t connack[] = { 2 << 4, 2, 0, 0 };
+    static const uint8_t pingresp[] = { 13 << 4, 0 };
+
+    // first packet must be CONNECT, and only the first
+    if (this->connected == (type == 1))
+    {
+        return false;
+    }
+
+    switch (type)
+    {
+        case 1: // CONNECT
+        {
+            umqtt_IoVec_t iov = { connack, sizeof(connack) };
+            this->connected = true;
+            loopback_Queue(this, &iov, 1);
+            return true;
+        }
+        case 3: // PUBLISH
+            return loopback_Publish(this, flags, pBody, bodyLen);
+        case 4: // PUBACK
+            return bodyLen == 2;
+        case 5: // PUBREC
+            if (bodyLen != 2)
+            {
+                return false;
+            }
+            loopback_QueueAck(this, 6, (pBody[0] << 8) | pBody[1]);
+            return true;
+        case 6: // PUBREL
+            return loopback_Pubrel(this, flags, pBody, bodyLen);
+        case 7: // PUBCOMP
+            return bodyLen == 2;
+        case 8: // SUBSCRIBE
+            return (flags == 2) && loopback_Subscribe(this, pBody, bodyLen);
+        case 10: // UNSUBSCRIBE
+            return (flags == 2) && loopback_Unsubscribe(this, pBody, bodyLen);
+        case 12: // PINGREQ
+        {
+            umqtt_IoVec_t iov = { pingresp, sizeof(pingresp) };
+            if (bodyLen != 0)
+            {
+                return false;
+            }
+            loopback_Queue(this, &iov, 1);
+            return true;
+        }
+        case 14: // DISCONNECT
+            this->connected = false;
+            memset(this->qos2Ids, 0, sizeof(this->qos2Ids));
+            memset(this->subs, 0, sizeof(this->subs));
+            return bodyLen == 0;
+        default:
+            return false;
+    }
+}
+
+/**
+ * @internal
+ * Accept data written by a client.
+ *
+ * @param this client connection
+ * @param pBuf data written by the client
+ * @param len length of the data
+ *
+ * @return true if the data was accepted, false for a protocol error
+ *
+ * Data is assembled into packets, which do not need to line up with
+ * writes.  Each complete packet is processed right away.
+ */
+static bool
+loopback_Write(loopback_Client_t *this, const uint8_t *pBuf, uint32_t len)
+{
+    while (len)
+    {
+        uint32_t chunk = LOOPBACK_PKT_SIZE - this->pktLen;
+        chunk = (len < chunk) ? len : chunk;
+        memcpy(&this->pkt[this->pktLen], pBuf, chunk);
+        this->pktLen += chunk;
+        pBuf += chunk;
+        len -= chunk;
+
+        // process every complete packet in the assembly buffer
+        uint32_t start = 0;
+        while ((this->pktLen - start) >= 2)
+        {
+            uint32_t remLen;
+            int lenBytes = loopback_DecodeLength(&this->pkt[start + 1],
+                                                 this->pktLen - start - 1, &remLen);
+            if (lenBytes < 0)
+            {
+                return false;
+            }
+            uint32_t total = 1 + lenBytes + remLen;
+            if ((lenBytes == 0) || ((this->pktLen - start) < total))
+            {
+                // packet that can never fit in the buffer
+                if ((lenBytes != 0) && (total > LOOPBACK_PKT_SIZE))
+                {
+                    return false;
+                }
+                break;
+            }
+            if (!loopback_ProcessPacket(this, this->pkt[start],
+                                        &this->pkt[start + 1 + lenBytes], remLen))
+            {
+                return false;
+            }
+            start += total;
+        }
+
+        // keep any partial packet at the front
+        memmove(this->pkt, &this->pkt[start], this->pktLen - start);
+        this->pktLen -= start;
+    }
+    return true;
+}
+
+/**
+ * @internal
+ * Transport write function for umqtt.
+ */
+static int
+loopback_NetWritePacket(void *hNet, const uint8_t *pBuf, uint32_t len, bool isMore)
+{
+    (void)isMore;
+    loopback_Client_t *this = hNet;
+    if (!this->inUse || this->failed)
+    {
+        return -1;
+    }
+    if (!loopback_Write(this, pBuf, len))
+    {
+        this->failed = true;
+        return -1;
+    }
+    return len;
+}
+
+/**
+ * @internal
+ * Transport scatter/gather write function for umqtt.
+ */
+static int
+loopback_NetWritev(void *hNet, const umqtt_IoVec_t *pIov, unsigned int iovCnt)
+{
+    int total = 0;
+    for (unsigned int idx = 0; idx < iovCnt; idx++)
+    {
+        int res = loopback_NetWritePacket(hNet, pIov[idx].pBuf, pIov[idx].len, false);
+        if (res < 0)
+        {
+            return res;
+        }
+        total += res;
+    }
+    return total;
+}
+
+/**
+ * @internal
+ * Transport read function for umqtt.  Returns 0 when there is nothing
+ * waiting for the client.
+ */
+static int
+loopback_NetReadInto(void *hNet, uint8_t *pBuf, uint32_t len)
+{
+    loopback_Client_t *this = hNet;
+    if (!this->inUse || this->failed)
+    {
+        return -1;
+    }
+    uint32_t avail = this->wr - this->rd;
+    len = (len < avail) ? len : avail;
+    memcpy(pBuf, &this->queue[this->rd], len);
+    this->rd += len;
+    if (this->rd == this->wr)
+    {
+        this->rd = 0;
+        this->wr = 0;
+    }
+    return len;
+}
+
+/**
+ * Initialize a loopback broker.
+ *
+ * @param pBroker memory for the broker instance
+ *
+ * The broker starts with no clients.
+ */
+void
+loopback_Init(loopback_Broker_t *pBroker)
+{
+    if (pBroker)
+    {
+        memset(pBroker, 0, sizeof(loopback_Broker_t));
+    }
+}
+
+/**
+ * Attach a new client connection to the broker.
+ *
+ * @param pBroker broker instance
+ *
+ * @return a client connection, or NULL if there are no free connections
+ *
+ * This is the equivalent of opening a socket to the broker.  Use
+ * loopback_InitTransport() to connect it to a umqtt instance.
+ */
+loopback_Client_t *
+loopback_NewClient(loopback_Broker_t *pBroker)
+{
+    if (pBroker)
+    {
+        for (unsigned int idx = 0; idx < LOOPBACK_MAX_CLIENTS; idx++)
+        {
+            loopback_Client_t *pClient = &pBroker->clients[idx];
+            if (!pClient->inUse)
+            {
+                loopback_ResetClient(pClient);
+                pClient->pBroker = pBroker;
+                pClient->inUse = true;
+                return pClient;
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Detach a client connection from the broker.
+ *
+ * @param pClient client connection
+ *
+ * This is the equivalent of closing the socket.  Subscriptions are
+ * removed and any data not yet read is discarded.
+ */
+void
+loopback_DeleteClient(loopback_Client_t *pClient)
+{
+    if (pClient)
+    {
+        loopback_ResetClient(pClient);
+        pClient->inUse = false;
+    }
+}
+
+/**
+ * Set up umqtt transport functions for a loopback client connection.
+ *
+ * @param pClient client connection
+ * @param pTransport transport configuration to be passed to umqtt_New()
+ *
+ * This sets the network handle and the read and write functions.  The
+ * memory functions, and pool configuration if any, are left for the
+ * caller.  Reads use the "read into" method, so if the caller has not
+ * set a receive buffer length it is set to LOOPBACK_PKT_SIZE.
+ */
+void
+loopback_InitTransport(loopback_Client_t *pClient, umqtt_TransportConfig_t *pTransport)
+{
+    if (pClient && pTransport)
+    {
+        pTransport->hNet = pClient;
+        pTransport->pfnNetReadPacket = NULL;
+        pTransport->pfnNetWritePacket = loopback_NetWritePacket;
+        pTransport->pfnNetReadInto = loopback_NetReadInto;
+        pTransport->pfnNetReadSegment = NULL;
+        pTransport->pfnNetReleaseSegment = NULL;
+        pTransport->pfnNetWritev = loopback_NetWritev;
+        if (pTransport->rxBufLen == 0)
+        {
+            pTransport->rxBufLen = LOOPBACK_PKT_SIZE;
+        }
+    }
+}
+
+/**
+ * Get number of packets to a client that were dropped.
+ *
+ * @param pClient client connection
+ *
+ * @return number of packets that did not fit in the client read queue
+ */
+uint32_t
+loopback_GetDropped(loopback_Client_t *pClient)
+{
+    return pClient ? pClient->dropped : 0;
+}
@@ -0,0 +1,112 @@
+/******************************************************************************
+ * loopback_broker.h - in-process MQTT broker stand-in for umqtt testing
+ *
+ * Copyright (c) 2017, Joseph Kroesche (tronics.kroesche.io)
+ * All rights reserved.
+ *
+ * This software is released under the FreeBSD license, found in the
+ * accompanying file LICENSE.txt and at the following URL:
+ *      http://www.freebsd.org/copyright/freebsd-license.html
+ *
+ * This software is provided as-is and without warranty.
+ */
+
+#ifndef __LOOPBACK_BROKER_H__
+#define __LOOPBACK_BROKER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "umqtt/umqtt.h"
+
+// max clients attached to one broker
+#ifndef LOOPBACK_MAX_CLIENTS
+#define LOOPBACK_MAX_CLIENTS 8
+#endif
+
+// max subscriptions for each client
+#ifndef LOOPBACK_MAX_SUBS
+#define LOOPBACK_MAX_SUBS 16
+#endif
+
+// max length of a subscription topic filter
+#ifndef LOOPBACK_MAX_FILTER
+#define LOOPBACK_MAX_FILTER 64
+#endif
+
+// size of the buffer for assembling one packet written by a client,
+// this is the largest packet a client can send
+#ifndef LOOPBACK_PKT_SIZE
+#define LOOPBACK_PKT_SIZE 2048
+#endif
+
+// size of the queue of data waiting to be read by a client, packets
+// that do not fit are dropped and counted
+#ifndef LOOPBACK_QUEUE_SIZE
+#define LOOPBACK_QUEUE_SIZE 8192
+#endif
+
+// max QoS 2 publishes from one client that are waiting for PUBREL
+#ifndef LOOPBACK_MAX_QOS2
+#define LOOPBACK_MAX_QOS2 8
+#endif
+
+/**
+ * @internal
+ * Subscription entry - treat as opaque.
+ */
+typedef struct
+{
+    char filter[LOOPBACK_MAX_FILTER + 1];
+    uint8_t qos;
+    bool inUse;
+} loopback_Sub_t;
+
+struct loopback_Broker_s;
+
+/**
+ * Client connection instance - treat as opaque.
+ */
+typedef struct
+{
+    struct loopback_Broker_s *pBroker;
+    bool inUse;
+    bool connected;
+    bool failed;            // protocol error, writes and reads fail
+    uint16_t nextPktId;     // for QoS 1 and 2 publish sent to this client
+    uint16_t qos2Ids[LOOPBACK_MAX_QOS2]; // received QoS 2 waiting for PUBREL, 0 is unused
+    uint32_t pktLen;        // bytes assembled in pkt
+    uint8_t pkt[LOOPBACK_PKT_SIZE];
+    uint32_t rd;            // queue read index
+    uint32_t wr;            // queue write index
+    uint8_t queue[LOOPBACK_QUEUE_SIZE];
+    uint32_t dropped;       // packets that did not fit in the queue
+    loopback_Sub_t subs[LOOPBACK_MAX_SUBS];
+} loopback_Client_t;
+
+/**
+ * Broker instance - treat as opaque.
+ */
+typedef struct loopback_Broker_s
+{
+    loopback_Client_t clients[LOOPBACK_MAX_CLIENTS];
+    uint32_t publishes;     // publish packets received from clients
+    uint32_t deliveries;    // publish packets queued to subscribers
+} loopback_Broker_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern void loopback_Init(loopback_Broker_t *pBroker);
+extern loopback_Client_t *loopback_NewClient(loopback_Broker_t *pBroker);
+extern void loopback_DeleteClient(loopback_Client_t *pClient);
+extern void loopback_InitTransport(loopback_Client_t *pClient,
+                                   umqtt_TransportConfig_t *pTransport);
+extern uint32_t loopback_GetDropped(loopback_Client_t *pClient);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -97,7 +97,8 @@ net_EventCb(NetClient_Event_t event, void *pUser)
  * The following are UMQTT callback functions for memory and transport
  */
 
-// memory allocation for umqtt
+// memory allocation for the app.  umqtt itself runs from a static arena
+// (see below) and does not allocate.
 static void *
 app_malloc(size_t size)
 {
@@ -105,37 +106,27 @@ app_malloc(size_t size)
     return mem_malloc(size);
 }
 
-// memory free for umqtt
+// memory free for the app
 static void
 app_free(void *ptr)
 {
     mem_free(ptr); // lwip allocator
 }
 
-// function to read a packet from the network
+// function to lend a received lwip pbuf to umqtt.  umqtt decodes packets
+// directly out of the pbuf payload so there is no copy on the receive
+// path.  Only a packet that spans pbufs of a chain is copied by umqtt.
 static int
-netReadPacket(void *pNet, uint8_t **ppBuf)
+netReadSegment(void *pNet, const uint8_t **ppData, void **ppSeg)
 {
-    // get the length of the next incoming packet
-    uint16_t len  = net_GetReadLen(pNet);
-    if (len)
-    {
-        // allocate some memory to hold the packet data
-        uint8_t *buf = app_malloc(len);
-        if (buf)
-        {
-            // call net_client read function to get the packet data
-            len = net_ReadPacket(pNet, buf, len);
-            *ppBuf = buf;
-        }
-        else // allocation failure
-        {
-            UARTprintf("netRead malloc fail for %u\n", len);
-        }
-    }
-    // return the number of bytes that were copied into the packet buffer
-    // umqtt will free the packet buffer when it is finished
-    return len;
+    return net_ReadSegment(pNet, ppData, ppSeg);
+}
+
+// umqtt gives back each pbuf when it is done with it
+static void
+netReleaseSegment(void *pNet, void *pSeg)
+{
+    net_ReleaseSegment(pNet, pSeg);
 }
 
 // umqtt function to write a packet to the network
@@ -146,11 +137,56 @@ netWritePacket(void *pNet, const uint8_t *pBuf, uint32_t len, bool isMore)
     return len;
 }
 
+// umqtt function to write a packet that is split into segments.  Each
+// segment is copied straight into lwip send buffers, so umqtt does not
+// need to build the publish packet in a buffer of its own.
+static int
+netWritev(void *pNet, const umqtt_IoVec_t *pIov, unsigned int iovCnt)
+{
+    int total = 0;
+    for (unsigned int idx = 0; idx < iovCnt; idx++)
+    {
+        bool isMore = (idx + 1) < iovCnt;
+        int len = net_WritePacket(pNet, pIov[idx].pBuf, pIov[idx].len, isMore);
+        if (len != (int)pIov[idx].len)
+        {
+            // return what was written so umqtt sees a short write
+            return (len < 0) ? len : total + len;
+        }
+        total += len;
+    }
+    return total;
+}
+
+// umqtt runs entirely out of one static arena so there is no heap use
+// after init, and the worst case memory is known at link time.  The
+// arena holds the umqtt instance, a receive buffer that is used to
+// reassemble a packet that spans pbufs, and the outgoing packet pool.
+// The topics and messages used by this app are short so most packets
+// fit the small pool class.
+#define RX_REASSEMBLY_SIZE 512
+#define POOL_SMALL_SIZE 48
+#define POOL_SMALL_COUNT 8
+#define POOL_LARGE_SIZE 128
+#define POOL_LARGE_COUNT 2
+#define POOL_BYTES (UMQTT_POOL_BYTES(POOL_SMALL_SIZE, POOL_SMALL_COUNT) + \
+                    UMQTT_POOL_BYTES(POOL_LARGE_SIZE, POOL_LARGE_COUNT))
+#define ARENA_SIZE UMQTT_ARENA_SIZE(RX_REASSEMBLY_SIZE, POOL_BYTES)
+static uint32_t umqttArena[(ARENA_SIZE + 3) / 4];
+
+static const umqtt_PoolClass_t poolClasses[] =
+{
+    { POOL_SMALL_SIZE, POOL_SMALL_COUNT },
+    { POOL_LARGE_SIZE, POOL_LARGE_COUNT },
+};
+
 // define the transport callback structure that is used to
 // initialize umqtt
 static umqtt_TransportConfig_t transportConfig =
 {
-    NULL, app_malloc, app_free, netReadPacket, netWritePacket
+    NULL, NULL, NULL, NULL, netWritePacket,
+    NULL, NULL, RX_REASSEMBLY_SIZE, netReadSegment, netReleaseSegment, netWritev,
+    poolClasses, sizeof(poolClasses) / sizeof(poolClasses[0])
     // hNet is populated at run time after network is opened
 };
 
@@ -360,14 +396,23 @@ main(void)
     hNet = net_Init(netInst, net_EventCb, NULL);
     transportConfig.hNet = hNet;
 
-    // Initialize umqtt (MQTT client module)
-    umqtt_Handle_t hu = umqtt_New(&transportConfig, &callbacks, NULL);
+    // Initialize umqtt (MQTT client module) in the static arena
+    umqtt_Handle_t hu = umqtt_NewStatic(umqttArena, sizeof(umqttArena),
+                                        &transportConfig, &callbacks, NULL);
     if (!hu)
     {
-        UARTprintf("umqtt_New() failed\n");
+        UARTprintf("umqtt_NewStatic() failed\n");
         for (;;) {}
     }
 
+    // retry timeout follows the measured round trip time, which on the
+    // local network is much shorter than the default fixed 5 seconds
+    umqtt_SetRetryBounds(hu, 250, 30000);
+
+    // a full lwip send buffer is not an error, umqtt finishes the
+    // packet on a later umqtt_Run()
+    umqtt_SetPartialWrites(hu, true);
+
     // Set an initial uptime report interval of 5 seconds
     SwTimer_SetTimeout(&upTimeReportTimer, 5000);
 
@@ -497,6 +542,25 @@ main(void)
                     runState = STATE_RECOVERY;
                 }
 
+                // go straight to recovery without sleeping if the run
+                // failed or the connection dropped during it
+                if ((runState == STATE_RECOVERY) || netWasDisconnected)
+                {
+                    break;
+                }
+
+                // if umqtt has nothing to do right now then sleep until
+                // the next interrupt.  systick and ethernet receive both
+                // wake the processor, so incoming packets and the umqtt
+                // deadline are still handled on time
+                uint32_t deadline;
+                err = umqtt_GetNextDeadline(hu, &deadline);
+                if ((err == UMQTT_ERR_NO_DEADLINE) ||
+                    ((err == UMQTT_ERR_OK) && ((int32_t)(deadline - msTicks) > 0)))
+                {
+                    SysCtlSleep();
+                }
+
                 // check for uptime report timeout
                 // send topic that indicates our uptime in h:m:s
                 if (SwTimer_IsTimedOut(&upTimeReportTimer))
@@ -506,6 +570,25 @@ main(void)
                     usnprintf(msgBuf, sizeof(msgBuf), "%02u:%02u:%02u",
                               upTime / 3600, (upTime / 60) % 60, upTime % 60);
                     umqtt_Publish(hu, topicBuf, (uint8_t*)msgBuf, strlen(msgBuf), 0, false, NULL);
+#ifdef UMQTT_ENABLE_STATS
+                    // show link health along with uptime
+                    umqtt_Stats_t stats;
+                    if (umqtt_GetStats(hu, &stats) == UMQTT_ERR_OK)
+                    {
+                        UARTprintf("stats: out=%u in=%u retries=%u expired=%u werr=%u\n",
+                                   stats.bytesSent, stats.bytesRcvd, stats.retries,
+                                   stats.expired, stats.writeErrors);
+                    }
+                    umqtt_LatencyHist_t hist;
+                    uint32_t p50, p99;
+                    if ((umqtt_GetAckLatency(hu, UMQTT_ACK_PUBACK, &hist) == UMQTT_ERR_OK)
+                     && (umqtt_GetLatencyPercentile(&hist, 500, &p50) == UMQTT_ERR_OK)
+                     && (umqtt_GetLatencyPercentile(&hist, 990, &p99) == UMQTT_ERR_OK))
+                    {
+                        UARTprintf("puback: n=%u p50<=%ums p99<=%ums max=%ums\n",
+                                   hist.count, p50, p99, hist.maxMs);
+                    }
+#endif
                 }
                 break;
             }
@@ -124,31 +124,72 @@ net_DequeuePbuf(NetClient_Instance_t *this)
  *
  * @param h network instance handle
  *
- * @return length of the next packet that would be returned by net_ReadPacket()
+ * @return length of the data that would be returned by net_ReadPacket()
  *
  * This function provides a way for a client to find out the size of the next
- * packet before attempting to read it.
+ * packet before attempting to read it.  If a packet was only partly read,
+ * then this is the amount of that packet that has not been read yet.
  */
 uint16_t
 net_GetReadLen(NetClient_Handle_t h)
 {
     struct pbuf *pb = NULL;
     uint16_t len = 0;
+    NetClient_Instance_t *this = h;
+
+    // partly read packet is only accessed in app context
+    // so it does not need protection
+    if (this->pRxPbuf)
+    {
+        pb = this->pRxPbuf;
+        return pb->tot_len - this->rxOffset;
+    }
+
     // use lwip critical section to protect the list structure from
     // lwip interrupt
     SYS_ARCH_DECL_PROTECT(crit);
     SYS_ARCH_PROTECT(crit);
-    NetClient_Instance_t *this = h;
     if (this->idx != this->odx)
     {
         uint32_t ndx = (this->odx + 1) % NETCLIENT_QUEUE_SIZE;
         pb = this->queue[ndx];
-        len = pb->len;
+        len = pb->tot_len;
     }
     SYS_ARCH_UNPROTECT(crit);
     return len;
 }
 
+/**
+ * @internal
+ * Drop the pbuf that is held for reading when the connection goes away.
+ *
+ * @param this network instance
+ *
+ * If segments of the pbuf are still lent out by net_ReadSegment() then
+ * the caller may still be using the payload, so the pbuf is left for
+ * net_ReleaseSegment() to free when the last one comes back.
+ */
+static void
+net_DropRxPbuf(NetClient_Instance_t *this)
+{
+    if (this->pRxPbuf)
+    {
+        if (this->rxLent && (this->pRxDead == NULL))
+        {
+            this->pRxDead = this->pRxPbuf;
+            this->rxDeadLent = this->rxLent;
+        }
+        else
+        {
+            pbuf_free(this->pRxPbuf);
+        }
+        this->pRxPbuf = NULL;
+    }
+    this->rxLent = 0;
+    this->rxOffset = 0;
+    this->pRxSeg = NULL;
+}
+
 /**
  * @internal
  * Error handler callback for lwip
@@ -172,6 +213,7 @@ net_ErrorCb(void *arg, err_t err)
     tcp_poll(this->hNet, NULL, 0);
     tcp_abort(this->hNet);
     this->hNet = NULL;
+    net_DropRxPbuf(this);
     this->isConnected = false;
     this->pfnCb(NET_EVENT_DISCONNECTED, this->pUser);
 }
@@ -342,6 +384,12 @@ net_Init(void *pInstMem, void (*pfnEventCb)(NetClient_Event_t, void *),
     {
         this->idx = 0;
         this->odx = 0;
+        this->pRxPbuf = NULL;
+        this->rxOffset = 0;
+        this->pRxSeg = NULL;
+        this->rxLent = 0;
+        this->pRxDead = NULL;
+        this->rxDeadLent = 0;
         this->hNet = NULL;
         this->isConnected = false;
         this->pUser = pUser;
@@ -422,6 +470,7 @@ net_Disconnect(NetClient_Handle_t h)
         tcp_poll(this->hNet, NULL, 0);
         tcp_close(this->hNet);
         this->hNet = NULL;
+        net_DropRxPbuf(this);
         this->isConnected = false;
         this->pfnCb(NET_EVENT_DISCONNECTED, this->pUser);
     }
@@ -439,7 +488,9 @@ net_Disconnect(NetClient_Handle_t h)
  *
  * This function reads a packet of data received from the network, and stores
  * the packet data at the location pointed at by _pBuf_.  It will return
- * the number of bytes that were copied.
+ * the number of bytes that were copied.  If the packet does not fit in
+ * _pBuf_ then the rest of the packet is returned by the next call.  Chained
+ * pbufs are copied in full.
  */
 int
 net_ReadPacket(NetClient_Handle_t h, uint8_t *pBuf, uint16_t len)
@@ -447,24 +498,125 @@ net_ReadPacket(NetClient_Handle_t h, uint8_t *pBuf, uint16_t len)
     RETURN_IF_ERR((h == NULL) || (pBuf == NULL), -1);
     NetClient_Instance_t *this = h;
 
-    struct pbuf *pb = net_DequeuePbuf(this);
-    if (pb)
+    // continue with a partly read pbuf, or get the next one from the queue
+    struct pbuf *pb = this->pRxPbuf;
+    if (pb == NULL)
     {
-        uint8_t *payload = (uint8_t *)pb->payload;
-        uint16_t pktlen = pb->len;
-        len = pktlen > len ? len : pktlen;
-        memcpy(pBuf, payload, len);
-        tcp_recved(this->hNet, pktlen);
-        pbuf_free(pb);
+        pb = net_DequeuePbuf(this);
+        this->pRxPbuf = pb;
+        this->rxOffset = 0;
     }
-    else
+    if (pb == NULL)
     {
-        len = 0;
+        return 0;
+    }
+
+    // copy as much as will fit, walking the pbuf chain if needed
+    len = pbuf_copy_partial(pb, pBuf, len, this->rxOffset);
+    this->rxOffset += len;
+
+    // once all of the pbuf has been read, let lwip know the data was
+    // consumed so it can open the receive window, then free the pbuf
+    if (this->rxOffset >= pb->tot_len)
+    {
+        tcp_recved(this->hNet, pb->tot_len);
+        pbuf_free(pb);
+        this->pRxPbuf = NULL;
+        this->rxOffset = 0;
     }
 
     return len;
 }
 
+/**
+ * Lend the next received pbuf payload to the caller without copying
+ *
+ * @param h network instance handle (from net_Init())
+ * @param ppData location to store pointer to the segment data
+ * @param ppSeg location to store the segment token
+ *
+ * @return count of bytes in the segment or 0 if no packet data is available
+ *
+ * This is an alternative to net_ReadPacket() that does not copy.  The
+ * payload of each pbuf in a received chain is handed out in turn, one per
+ * call.  The data remains owned by lwip until the caller passes the
+ * _ppSeg_ token back to net_ReleaseSegment().  Segments must be released
+ * in the order they were read.  This should not be mixed with
+ * net_ReadPacket() or net_GetReadLen().
+ */
+int
+net_ReadSegment(NetClient_Handle_t h, const uint8_t **ppData, void **ppSeg)
+{
+    RETURN_IF_ERR((h == NULL) || (ppData == NULL) || (ppSeg == NULL), -1);
+    NetClient_Instance_t *this = h;
+
+    // continue walking the current chain, or start on the next one
+    struct pbuf *pb = this->pRxSeg;
+    if (pb == NULL)
+    {
+        // previous chain has not been released yet
+        RETURN_IF_ERR(this->pRxPbuf != NULL, 0);
+        pb = net_DequeuePbuf(this);
+        if (pb == NULL)
+        {
+            return 0;
+        }
+        this->pRxPbuf = pb;
+    }
+
+    // the last pbuf of a chain is the one that holds the rest of the chain
+    this->pRxSeg = (pb->tot_len == pb->len) ? NULL : pb->next;
+    ++this->rxLent;
+    *ppData = pb->payload;
+    *ppSeg = pb;
+    return pb->len;
+}
+
+/**
+ * Return a segment that was lent out by net_ReadSegment()
+ *
+ * @param h network instance handle (from net_Init())
+ * @param pSeg the segment token from net_ReadSegment()
+ *
+ * The pbuf chain is held until its last segment is released.  At that
+ * point lwip is told the data was consumed so it can open the receive
+ * window, and the whole chain is freed.  If the connection was closed
+ * while segments were lent out, the chain is freed once all of them
+ * are released.
+ */
+void
+net_ReleaseSegment(NetClient_Handle_t h, void *pSeg)
+{
+    if (h && pSeg)
+    {
+        NetClient_Instance_t *this = h;
+        struct pbuf *pb = pSeg;
+        struct pbuf *head = this->pRxPbuf;
+
+        // segments come back in the order they were lent, so the ones
+        // of a closed connection are first
+        if (this->pRxDead)
+        {
+            if (--this->rxDeadLent == 0)
+            {
+                pbuf_free(this->pRxDead);
+                this->pRxDead = NULL;
+            }
+            return;
+        }
+        if (this->rxLent)
+        {
+            --this->rxLent;
+        }
+        if (head && (pb->tot_len == pb->len))
+        {
+            tcp_recved(this->hNet, head->tot_len);
+            pbuf_free(head);
+            this->pRxPbuf = NULL;
+        }
+    }
+}
+
 /**
  * Write a packet of data to the network connection
  *
@@ -476,10 +628,12 @@ net_ReadPacket(NetClient_Handle_t h, uint8_t *pBuf, uint16_t len)
  * @return the number of bytes that were sent
  *
  * This function will attempt to write the bytes from _pBuf_ to the active
- * network connection.  The flag _isMore_ can be used to indicate that
- * this data buffer is part of a bigger data set that can be aggregated before
- * transmitting.  This can be used as a hint to the network stack and may
- * allow it to be more efficient and sending data, but is not required.
+ * network connection.  If the send buffer does not have room for all of
+ * it then only the part that fits is written, which can be none.  The flag
+ * _isMore_ can be used to indicate that this data buffer is part of a bigger
+ * data set that can be aggregated before transmitting.  This can be used as
+ * a hint to the network stack and may allow it to be more efficient and
+ * sending data, but is not required.
  */
 int
 net_WritePacket(NetClient_Handle_t h, const uint8_t *pBuf, uint32_t len, bool isMore)
@@ -487,6 +641,15 @@ net_WritePacket(NetClient_Handle_t h, const uint8_t *pBuf, uint32_t len, bool is
     RETURN_IF_ERR((h == NULL) || (pBuf == NULL), -1);
     NetClient_Instance_t *this = h;
 
+    // only write what fits in the send buffer, the caller writes the
+    // rest later
+    uint32_t room = tcp_sndbuf(this->hNet);
+    if (len > room)
+    {
+        len = room;
+        isMore = false;
+    }
+    RETURN_IF_ERR(len == 0, 0);
     err_t err = tcp_write(this->hNet, pBuf, len, TCP_WRITE_FLAG_COPY);
     RETURN_IF_ERR(err != ERR_OK, 0);
     if (!isMore)
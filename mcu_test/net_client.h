@@ -37,6 +37,12 @@ typedef struct
     uint8_t idx;
     uint8_t odx;
     void *queue[NETCLIENT_QUEUE_SIZE];
+    void *pRxPbuf;      // pbuf that has only been partly read or lent out
+    uint16_t rxOffset;  // amount of pRxPbuf that was already read
+    void *pRxSeg;       // next pbuf of pRxPbuf chain to lend out
+    uint8_t rxLent;     // segments of pRxPbuf lent out and not released
+    void *pRxDead;      // pbuf of a closed connection with segments lent out
+    uint8_t rxDeadLent; // segments of pRxDead not released yet
     void *hNet;
     void *pUser;
     void (*pfnCb)(NetClient_Event_t, void *);
@@ -63,6 +69,8 @@ extern NetClient_Handle_t net_Init(void *pInstMem,
 extern int net_Connect(NetClient_Handle_t h, uint8_t addr[], uint16_t port);
 extern void net_Disconnect(NetClient_Handle_t h);
 extern int net_ReadPacket(NetClient_Handle_t h, uint8_t *pBuf, uint16_t len);
+extern int net_ReadSegment(NetClient_Handle_t h, const uint8_t **ppData, void **ppSeg);
+extern void net_ReleaseSegment(NetClient_Handle_t h, void *pSeg);
 extern int net_WritePacket(NetClient_Handle_t h, const uint8_t *pBuf, uint32_t len, bool isMore);
 extern bool net_IsConnected(NetClient_Handle_t h);
 extern uint16_t net_GetReadLen(NetClient_Handle_t h);
@@ -0,0 +1,3862 @@
+/******************************************************************************
+ * umqtt.c - Implementation of umqtt, a minimal MQTT client library
+ *
+ * Copyright (c) 2016, Joseph Kroesche (tronics.kroesche.io)
+ * All rights reserved.
+ *
+ * This software is released under the FreeBSD license, found in the
+ * accompanying file LICENSE.txt and at the following URL:
+ *      http://www.freebsd.org/copyright/freebsd-license.html
+ *
+ * This software is provided as-is and without warranty.
+ *
+ *****************************************************************************/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "umqtt/umqtt.h"
+
+/**
+ * @addtogroup umqtt_client
+ * @{
+ */
+
+// MQTT packet types
+#define CONNECT 1
+#define CONNACK 2
+#define PUBLISH 3
+#define PUBACK 4
+#define PUBREC 5
+#define PUBREL 6
+#define PUBCOMP 7
+#define SUBSCRIBE 8
+#define SUBACK 9
+#define UNSUBSCRIBE 10
+#define UNSUBACK 11
+#define PINGREQ 12
+#define PINGRESP 13
+#define DISCONNECT 14
+
+// number of times a packet is resent before it is given up
+#define RETRY_TTL 10
+
+// retry timeout used until the round trip time is measured, and the
+// default bounds of the adaptive timeout
+#define RTO_INITIAL 5000
+#define RTO_MIN 5000
+#define RTO_MAX 5000
+
+// number of hash buckets of the in-flight packet ID index before it
+// grows, power of 2
+#define ID_BUCKETS 8
+
+// hierarchical timer wheel of WHEEL_LEVELS levels of 2^WHEEL_BITS
+// slots, a level 0 slot is 1 tick and each level above has slots
+// 2^WHEEL_BITS times as long, so the levels cover all 32 bits of ticks
+#define WHEEL_BITS 4
+#define WHEEL_SIZE (1U << WHEEL_BITS)
+#define WHEEL_LEVELS 8
+
+// ticks after which umqtt_Run() should try again to finish a partial
+// write, for hosts that do not wait for the network to be writable
+#define TX_RESUME_TICKS 10
+
+// max number of packet pool classes
+#define POOL_MAX_CLASSES 4
+
+// max number of segments passed to one writev call by a batch publish
+#define BATCH_MAX_IOV 16
+
+// a timer in the timer wheel, it is unlinked when pprev is NULL
+typedef struct Timer
+{
+    struct Timer *next;
+    struct Timer **pprev;   // the link that points to this timer
+    uint32_t expires;
+} Timer_t;
+
+// packet buffer header that is allocated in front of each packet
+typedef struct PktBuf
+{
+    struct PktBuf *next;    // toward older packets
+    struct PktBuf *prev;    // toward newer packets
+    struct PktBuf *idNext;  // next packet in the same ID bucket
+    Timer_t timer;          // retry deadline
+    uint16_t packetId;
+    uint32_t ticks;         // ticks when the packet was last sent
+    unsigned int ttl;       // remaining retries, or length of a queued write
+} PktBuf_t;
+
+// public sizing macros must match the private packet header
+typedef char umqtt_PktBufSizeCheck[(sizeof(PktBuf_t) == UMQTT_PKTBUF_SIZE) ? 1 : -1];
+
+// one class of the packet pool
+typedef struct
+{
+    uint8_t *pFree;         // first free block, blocks link through their first bytes
+    uint32_t stride;        // block size including the packet header
+    uint32_t count;
+} PoolClass_t;
+
+// instance data for one umqtt client
+typedef struct
+{
+    // transport
+    void *hNet;
+    void *(*pfnMalloc)(size_t size);
+    void (*pfnFree)(void *ptr);
+    int (*pfnNetReadPacket)(void *hNet, uint8_t **ppBuf);
+    int (*pfnNetWritePacket)(void *hNet, const uint8_t *pBuf, uint32_t len, bool isMore);
+    int (*pfnNetReadInto)(void *hNet, uint8_t *pBuf, uint32_t len);
+    int (*pfnNetReadSegment)(void *hNet, const uint8_t **ppData, void **ppSeg);
+    void (*pfnNetReleaseSegment)(void *hNet, void *pSeg);
+    int (*pfnNetWritev)(void *hNet, const umqtt_IoVec_t *pIov, unsigned int iovCnt);
+    umqtt_Callbacks_t callbacks;
+    void *pUser;
+
+    // in-flight packets, newest first
+    struct { PktBuf_t *next; } pktList;
+    PktBuf_t *pktTail;
+    PktBuf_t **pIdTable;    // ID index, idMask + 1 buckets
+    uint32_t idMask;
+    uint32_t idCount;       // packets in the ID index
+    bool idTableOwned;
+    PktBuf_t *idTableInit[ID_BUCKETS];
+
+    // timers
+    Timer_t *wheel[WHEEL_LEVELS][WHEEL_SIZE];
+    uint16_t wheelUsed[WHEEL_LEVELS];   // bit for each slot that has timers
+    uint32_t wheelMin[WHEEL_LEVELS - 1][WHEEL_SIZE];    // earliest in slot above level 0
+    Timer_t *wheelDue;      // timers that were already due when started
+    Timer_t pingTimer;
+    uint32_t wheelTicks;    // ticks up to which the wheel was processed
+    uint32_t ticks;         // ticks of the last umqtt_Run()
+
+    // connection
+    bool isConnected;
+    bool connectPending;
+    bool keepAliveOnRx;
+    bool pingOutstanding;
+    uint16_t keepAlive;
+    uint16_t packetId;
+    uint32_t pingSentTicks;
+
+    // adaptive retry timeout
+    bool haveRtt;
+    uint32_t srtt;
+    uint32_t rttVar;
+    uint32_t rto;
+    uint32_t rtoMin;
+    uint32_t rtoMax;
+
+    // in-flight window
+    uint16_t inflightMax;
+    uint16_t inflightCount;
+
+    // partial write in progress
+    bool partialWrites;
+    uint8_t txScratch[4];
+    const uint8_t *pTxRest;
+    uint32_t txRestLen;
+    uint8_t *pTxRestOwned;
+    PktBuf_t *pTxQueue;     // writes waiting for the partial write, oldest first
+    PktBuf_t **ppTxQueueTail;
+
+    // transmit coalescing
+    uint8_t *pTxBuf;
+    uint32_t txBufLen;
+    uint32_t txLen;
+    uint32_t txMaxDelay;
+    uint32_t txFirstTicks;
+
+    // reserved publish
+    uint8_t *pResv;
+    uint32_t resvMaxLen;
+    uint16_t resvTopicLen;
+    uint8_t resvQos;
+
+    // receive
+    uint8_t *pRxBuf;
+    uint32_t rxBufLen;
+    uint32_t rxHeld;        // partial packet bytes at the start of pRxBuf
+    uint8_t *pRxAsm;        // reassembly of a packet split across reads
+    uint32_t rxAsmLen;
+    uint32_t rxAsmTotal;
+    uint8_t rxHold[5];      // partial fixed header split across reads
+    uint8_t rxHoldLen;
+    bool rxBufOwned;
+    bool isStatic;
+
+    // packet pool
+    uint8_t *pPool;
+    uint32_t poolBytes;
+    uint32_t poolFallbacks;
+    unsigned int numPoolClasses;
+    PoolClass_t poolClasses[POOL_MAX_CLASSES];
+
+#ifdef UMQTT_ENABLE_DUP_FILTER
+    // inbound qos 1 duplicate filter
+    bool dupValid;
+    uint16_t dupHighId;
+    uint32_t dupBits[UMQTT_DUP_FILTER_BITS / 32];
+#endif
+
+#ifdef UMQTT_ENABLE_STATS
+    umqtt_Stats_t stats;
+    umqtt_LatencyHist_t latency[UMQTT_ACK_NUM_TYPES];
+#endif
+} umqtt_Instance_t;
+
+// the wheel levels must cover the ticks, the slot bits of a level must
+// fit wheelUsed, and the public instance size counts the wheel slots and
+// their earliest ticks
+typedef char umqtt_WheelCheck[((WHEEL_BITS * WHEEL_LEVELS) >= 32) && (WHEEL_SIZE <= 16)
+                              && (((WHEEL_LEVELS * WHEEL_SIZE * sizeof(Timer_t *))
+                                   + ((WHEEL_LEVELS - 1) * WHEEL_SIZE * sizeof(uint32_t)))
+                                  == UMQTT_TIMER_WHEEL_SIZE)
+                              ? 1 : -1];
+
+// instance must fit the space that is reserved for it in an arena
+typedef char umqtt_InstanceSizeCheck[(sizeof(umqtt_Instance_t) <= UMQTT_INSTANCE_SIZE) ? 1 : -1];
+
+#ifdef UMQTT_ENABLE_STATS
+#define STATS_INC(field) (++this->stats.field)
+#define STATS_ADD(field, val) (this->stats.field += (val))
+#else
+#define STATS_INC(field)
+#define STATS_ADD(field, val)
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Timer wheel
+//
+/////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @internal
+ * Add a timer at the head of a timer list.
+ */
+static void
+timerLink(Timer_t **ppHead, Timer_t *pTimer)
+{
+    pTimer->next = *ppHead;
+    pTimer->pprev = ppHead;
+    if (pTimer->next)
+    {
+        pTimer->next->pprev = &pTimer->next;
+    }
+    *ppHead = pTimer;
+}
+
+/**
+ * @internal
+ * Remove a timer from the timer wheel.  Safe to call for a timer that
+ * is not in the wheel.
+ *
+ * @param this is the umqtt instance
+ * @param pTimer the timer to remove
+ *
+ * The slot of a timer is not stored, but when the timer is the only one
+ * in its slot it is linked from the slot itself, which also tells which
+ * slot bit to clear.
+ */
+static void
+timerStop(umqtt_Instance_t *this, Timer_t *pTimer)
+{
+    if (pTimer->pprev)
+    {
+        *pTimer->pprev = pTimer->next;
+        if (pTimer->next)
+        {
+            pTimer->next->pprev = pTimer->pprev;
+        }
+        else
+        {
+            uintptr_t offset = (uintptr_t)pTimer->pprev - (uintptr_t)&this->wheel[0][0];
+            if (offset < sizeof(this->wheel))
+            {
+                uint32_t slot = offset / sizeof(Timer_t *);
+                if (this->wheel[slot / WHEEL_SIZE][slot % WHEEL_SIZE] == NULL)
+                {
+                    this->wheelUsed[slot / WHEEL_SIZE] &= ~(1U << (slot % WHEEL_SIZE));
+                }
+            }
+        }
+        pTimer->next = NULL;
+        pTimer->pprev = NULL;
+    }
+}
+
+/**
+ * @internal
+ * Add a timer to the timer wheel.
+ *
+ * @param this is the umqtt instance
+ * @param pTimer the timer to add, must not be in the wheel
+ * @param expires ticks when the timer expires
+ *
+ * The timer goes in the lowest level whose slots, counted from the
+ * wheel ticks, reach its expire time, which is the level of the highest
+ * slot digit where the two differ.  A timer that is already due goes on
+ * the due list so it is seen by the next umqtt_Run().  Above level 0 a
+ * slot keeps the earliest expire time of its timers.  It is not raised
+ * when a timer is removed, so it may be early but never late, and the
+ * slot is moved down when that time is reached anyway.  Adding and
+ * removing a timer are O(1).
+ */
+static void
+timerStart(umqtt_Instance_t *this, Timer_t *pTimer, uint32_t expires)
+{
+    pTimer->expires = expires;
+    if ((int32_t)(expires - this->wheelTicks) <= 0)
+    {
+        timerLink(&this->wheelDue, pTimer);
+        return;
+    }
+    uint32_t diff = expires ^ this->wheelTicks;
+    unsigned int level = 0;
+    while ((level < (WHEEL_LEVELS - 1)) && (diff >> (WHEEL_BITS * (level + 1))))
+    {
+        ++level;
+    }
+    uint32_t slot = (expires >> (WHEEL_BITS * level)) & (WHEEL_SIZE - 1);
+    if (level)
+    {
+        uint32_t *pMin = &this->wheelMin[level - 1][slot];
+        if (((this->wheelUsed[level] & (1U << slot)) == 0)
+         || ((int32_t)(expires - *pMin) < 0))
+        {
+            *pMin = expires;
+        }
+    }
+    timerLink(&this->wheel[level][slot], pTimer);
+    this->wheelUsed[level] |= 1U << slot;
+}
+
+/**
+ * @internal
+ * Find the next slot of the timer wheel that has timers.
+ *
+ * @param this is the umqtt instance
+ * @param pLevel storage for the level of the slot
+ * @param pSlot storage for the slot number in its level
+ *
+ * @return ticks from the wheel ticks to the start of the slot, or 0 if
+ * the wheel is empty
+ *
+ * Every timer in a level is due before any slot of the levels above it
+ * starts, so the first level with a slot after the current one has the
+ * next slot.  The top level has no level above it and wraps around.
+ * This looks at the slot bits of each level once, so it is O(1).
+ */
+static uint32_t
+timerNextSlot(umqtt_Instance_t *this, unsigned int *pLevel, uint32_t *pSlot)
+{
+    for (unsigned int level = 0; level < WHEEL_LEVELS; ++level)
+    {
+        unsigned int shift = WHEEL_BITS * level;
+        uint32_t current = (this->wheelTicks >> shift) & (WHEEL_SIZE - 1);
+        uint32_t used = this->wheelUsed[level] & ~((2U << current) - 1);
+        uint32_t base = 0;
+        if (level < (WHEEL_LEVELS - 1))
+        {
+            base = this->wheelTicks & ~((1U << (shift + WHEEL_BITS)) - 1);
+        }
+        else if (used == 0)
+        {
+            used = this->wheelUsed[level];
+        }
+        if (used)
+        {
+            uint32_t slot = 0;
+            while ((used & (1U << slot)) == 0)
+            {
+                ++slot;
+            }
+            *pLevel = level;
+            *pSlot = slot;
+            return (base | (slot << shift)) - this->wheelTicks;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @internal
+ * Find when the earliest timer in the wheel expires.
+ *
+ * @param this is the umqtt instance
+ * @param pExpires storage for the expire ticks
+ *
+ * @return true if there is a timer in the wheel
+ *
+ * Timers on the due list are due at the wheel ticks.  Otherwise the
+ * earliest timer is in the next slot with timers.  A level 0 slot holds
+ * one tick, and a higher slot keeps its earliest time, so this is O(1).
+ */
+static bool
+timerEarliest(umqtt_Instance_t *this, uint32_t *pExpires)
+{
+    unsigned int level;
+    uint32_t slot;
+    if (this->wheelDue)
+    {
+        *pExpires = this->wheelTicks;
+        return true;
+    }
+    uint32_t delta = timerNextSlot(this, &level, &slot);
+    if (delta == 0)
+    {
+        return false;
+    }
+    if (level == 0)
+    {
+        *pExpires = this->wheelTicks + delta;
+    }
+    else
+    {
+        *pExpires = this->wheelMin[level - 1][slot];
+    }
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Packet memory
+//
+/////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @internal
+ * Allocate a new packet buffer.
+ *
+ * @param this is the umqtt instance
+ * @param len is the length of the packet remaining length, without
+ * the fixed header
+ *
+ * @return pointer to the packet buffer or NULL if it could not be
+ * allocated
+ *
+ * Space for the fixed header and the packet header used to keep track
+ * of the packet is added.  The packet comes from the smallest pool
+ * class that fits and has a free block.  If there is none, it is
+ * allocated with malloc unless the instance is static.
+ */
+static uint8_t *
+newPacket(umqtt_Instance_t *this, size_t len)
+{
+    if (this == NULL)
+    {
+        return NULL;
+    }
+    uint8_t *pBlock = NULL;
+    size_t pktLen = len + 5;
+    if (this->numPoolClasses)
+    {
+        for (unsigned int idx = 0; idx < this->numPoolClasses; ++idx)
+        {
+            PoolClass_t *pClass = &this->poolClasses[idx];
+            if (pktLen <= (pClass->stride - sizeof(PktBuf_t)))
+            {
+                pBlock = pClass->pFree;
+                if (pBlock)
+                {
+                    memcpy(&pClass->pFree, pBlock, sizeof(uint8_t *));
+                }
+                break;
+            }
+        }
+        if (pBlock == NULL)
+        {
+            ++this->poolFallbacks;
+        }
+    }
+    if ((pBlock == NULL) && !this->isStatic)
+    {
+        pBlock = this->pfnMalloc(pktLen + sizeof(PktBuf_t));
+    }
+    if (pBlock == NULL)
+    {
+        STATS_INC(allocFails);
+        return NULL;
+    }
+    PktBuf_t *pPkt = (PktBuf_t *)pBlock;
+    memset(pPkt, 0, sizeof(PktBuf_t));
+    return (uint8_t *)&pPkt[1];
+}
+
+/**
+ * @internal
+ * Free a packet buffer that was allocated with newPacket().
+ *
+ * @param this is the umqtt instance
+ * @param pBuf is the packet buffer, can be NULL
+ *
+ * A packet that is inside the pool memory goes back to its class,
+ * anything else was allocated with malloc.
+ */
+static void
+deletePacket(umqtt_Instance_t *this, uint8_t *pBuf)
+{
+    if ((this == NULL) || (pBuf == NULL))
+    {
+        return;
+    }
+    uint8_t *pBlock = pBuf - sizeof(PktBuf_t);
+    if (this->pPool && (pBlock >= this->pPool) && (pBlock < (this->pPool + this->poolBytes)))
+    {
+        // classes are laid out in order in the pool memory
+        uint8_t *pEnd = this->pPool;
+        for (unsigned int idx = 0; idx < this->numPoolClasses; ++idx)
+        {
+            PoolClass_t *pClass = &this->poolClasses[idx];
+            pEnd += pClass->stride * pClass->count;
+            if (pBlock < pEnd)
+            {
+                memcpy(pBlock, &pClass->pFree, sizeof(uint8_t *));
+                pClass->pFree = pBlock;
+                break;
+            }
+        }
+    }
+    else
+    {
+        this->pfnFree(pBlock);
+    }
+}
+
+/**
+ * @internal
+ * Set up the packet pool in memory that holds all of the pool classes.
+ *
+ * @param this is the umqtt instance
+ * @param pPoolClasses the pool classes from the transport
+ * @param pMem memory for the pool, UMQTT_POOL_BYTES() of each class
+ */
+static void
+poolInit(umqtt_Instance_t *this, const umqtt_PoolClass_t *pPoolClasses, uint8_t *pMem)
+{
+    this->pPool = pMem;
+    for (unsigned int idx = 0; idx < this->numPoolClasses; ++idx)
+    {
+        PoolClass_t *pClass = &this->poolClasses[idx];
+        pClass->stride = UMQTT_POOL_BYTES(pPoolClasses[idx].blockSize, 1);
+        pClass->count = pPoolClasses[idx].blockCount;
+        pClass->pFree = NULL;
+        // link blocks so the first one is handed out first
+        for (unsigned int blk = pClass->count; blk > 0; --blk)
+        {
+            uint8_t *pBlock = pMem + ((blk - 1) * pClass->stride);
+            memcpy(pBlock, &pClass->pFree, sizeof(uint8_t *));
+            pClass->pFree = pBlock;
+        }
+        pMem += pClass->stride * pClass->count;
+    }
+}
+
+/**
+ * @internal
+ * Check the pool classes of a transport config.
+ *
+ * @param pTransport the transport config
+ * @param pBytes storage for the memory needed by the pool
+ *
+ * @return true if the pool config is usable
+ */
+static bool
+poolCheck(const umqtt_TransportConfig_t *pTransport, uint32_t *pBytes)
+{
+    uint32_t bytes = 0;
+    if (pTransport->numPoolClasses > POOL_MAX_CLASSES)
+    {
+        return false;
+    }
+    if (pTransport->numPoolClasses && (pTransport->pPoolClasses == NULL))
+    {
+        return false;
+    }
+    for (unsigned int idx = 0; idx < pTransport->numPoolClasses; ++idx)
+    {
+        const umqtt_PoolClass_t *pClass = &pTransport->pPoolClasses[idx];
+        if ((pClass->blockSize == 0) || (pClass->blockCount == 0))
+        {
+            return false;
+        }
+        bytes += UMQTT_POOL_BYTES(pClass->blockSize, pClass->blockCount);
+    }
+    *pBytes = bytes;
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// In-flight packet list
+//
+/////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @internal
+ * Link a packet at the head of the in-flight list, as the newest.
+ */
+static void
+listLink(umqtt_Instance_t *this, PktBuf_t *pPkt)
+{
+    pPkt->prev = NULL;
+    pPkt->next = this->pktList.next;
+    if (pPkt->next)
+    {
+        pPkt->next->prev = pPkt;
+    }
+    else
+    {
+        this->pktTail = pPkt;
+    }
+    this->pktList.next = pPkt;
+}
+
+/**
+ * @internal
+ * Unlink a packet from the in-flight list.
+ */
+static void
+listUnlink(umqtt_Instance_t *this, PktBuf_t *pPkt)
+{
+    if (pPkt->prev)
+    {
+        pPkt->prev->next = pPkt->next;
+    }
+    else
+    {
+        this->pktList.next = pPkt->next;
+    }
+    if (pPkt->next)
+    {
+        pPkt->next->prev = pPkt->prev;
+    }
+    else
+    {
+        this->pktTail = pPkt->prev;
+    }
+    pPkt->next = NULL;
+    pPkt->prev = NULL;
+}
+
+/**
+ * @internal
+ * Move the ID index to a table with more buckets.
+ *
+ * @param this is the umqtt instance
+ * @param buckets the new number of buckets, power of 2
+ *
+ * The new table is allocated with malloc.  If it cannot be allocated
+ * the index keeps its current table, which still works but with longer
+ * buckets.  A static instance has its table in the arena and does not
+ * grow.
+ */
+static void
+idResize(umqtt_Instance_t *this, uint32_t buckets)
+{
+    if (this->isStatic || (buckets <= (this->idMask + 1)))
+    {
+        return;
+    }
+    PktBuf_t **pTable = this->pfnMalloc(buckets * sizeof(PktBuf_t *));
+    if (pTable == NULL)
+    {
+        return;
+    }
+    memset(pTable, 0, buckets * sizeof(PktBuf_t *));
+    for (uint32_t idx = 0; idx <= this->idMask; ++idx)
+    {
+        PktBuf_t *pPkt = this->pIdTable[idx];
+        while (pPkt)
+        {
+            PktBuf_t *pNext = pPkt->idNext;
+            PktBuf_t **ppBucket = &pTable[pPkt->packetId & (buckets - 1)];
+            pPkt->idNext = *ppBucket;
+            *ppBucket = pPkt;
+            pPkt = pNext;
+        }
+    }
+    if (this->idTableOwned)
+    {
+        this->pfnFree(this->pIdTable);
+    }
+    this->pIdTable = pTable;
+    this->idMask = buckets - 1;
+    this->idTableOwned = true;
+}
+
+/**
+ * @internal
+ * Find an in-flight packet by packet ID and type.
+ *
+ * @param this is the umqtt instance
+ * @param packetId the packet ID to find
+ * @param type the MQTT packet type, or 0 for any type
+ *
+ * @return the packet header or NULL if there is no such packet
+ *
+ * Packets with an ID are indexed in hash buckets by the low bits of the
+ * ID.  The number of buckets is doubled whenever there are more packets
+ * in the index than buckets, and umqtt_SetInflightWindow() sizes it for
+ * the window up front.  A client allocates IDs in sequence, so its
+ * packets land in different buckets and the lookup is O(1).
+ */
+static PktBuf_t *
+findPacket(umqtt_Instance_t *this, uint16_t packetId, uint8_t type)
+{
+    PktBuf_t *pPkt = this->pIdTable[packetId & this->idMask];
+    while (pPkt)
+    {
+        if (pPkt->packetId == packetId)
+        {
+            uint8_t *pBuf = (uint8_t *)&pPkt[1];
+            if ((type == 0) || ((pBuf[0] >> 4) == type))
+            {
+                return pPkt;
+            }
+        }
+        pPkt = pPkt->idNext;
+    }
+    return NULL;
+}
+
+/**
+ * @internal
+ * Remove a packet from the in-flight list, the ID index and the timer
+ * wheel.  The packet is not freed.
+ */
+static void
+unlinkPacket(umqtt_Instance_t *this, PktBuf_t *pPkt)
+{
+    listUnlink(this, pPkt);
+    timerStop(this, &pPkt->timer);
+    if (pPkt->packetId)
+    {
+        PktBuf_t **ppLink = &this->pIdTable[pPkt->packetId & this->idMask];
+        while (*ppLink)
+        {
+            if (*ppLink == pPkt)
+            {
+                *ppLink = pPkt->idNext;
+                --this->idCount;
+                break;
+            }
+            ppLink = &(*ppLink)->idNext;
+        }
+        pPkt->idNext = NULL;
+    }
+}
+
+/**
+ * @internal
+ * Add a packet to the in-flight list to wait for its acknowledgement.
+ *
+ * @param this is the umqtt instance
+ * @param pBuf the packet buffer from newPacket()
+ * @param packetId the packet ID, or 0 if the packet has none
+ * @param ticks ticks when the packet was sent
+ *
+ * The retry timer is started with the current retry timeout.
+ */
+static void
+enqueuePacket(umqtt_Instance_t *this, uint8_t *pBuf, uint16_t packetId, uint32_t ticks)
+{
+    if ((this == NULL) || (pBuf == NULL))
+    {
+        return;
+    }
+    PktBuf_t *pPkt = ((PktBuf_t *)pBuf) - 1;
+    pPkt->packetId = packetId;
+    pPkt->ticks = ticks;
+    pPkt->ttl = RETRY_TTL;
+    pPkt->idNext = NULL;
+    listLink(this, pPkt);
+    if (packetId)
+    {
+        if (this->idCount > this->idMask)
+        {
+            idResize(this, 2 * (this->idMask + 1));
+        }
+        PktBuf_t **ppBucket = &this->pIdTable[packetId & this->idMask];
+        pPkt->idNext = *ppBucket;
+        *ppBucket = pPkt;
+        ++this->idCount;
+    }
+    pPkt->timer.pprev = NULL;
+    timerStart(this, &pPkt->timer, ticks + this->rto);
+}
+
+/**
+ * @internal
+ * Remove the in-flight packet with a packet ID and packet type.  A type
+ * of 0 matches any packet type.
+ *
+ * @return the packet or NULL if there is no such packet
+ */
+static PktBuf_t *
+dequeuePacket(umqtt_Instance_t *this, uint16_t packetId, uint8_t type)
+{
+    if ((this == NULL) || (packetId == 0))
+    {
+        return NULL;
+    }
+    PktBuf_t *pPkt = findPacket(this, packetId, type);
+    if (pPkt)
+    {
+        unlinkPacket(this, pPkt);
+    }
+    return pPkt;
+}
+
+/**
+ * @internal
+ * Remove the oldest in-flight packet of a packet type.
+ *
+ * @return the packet buffer or NULL if there is no such packet
+ */
+static uint8_t *
+dequeuePacketByType(umqtt_Instance_t *this, uint8_t type)
+{
+    if (this == NULL)
+    {
+        return NULL;
+    }
+    for (PktBuf_t *pPkt = this->pktTail; pPkt; pPkt = pPkt->prev)
+    {
+        uint8_t *pBuf = (uint8_t *)&pPkt[1];
+        if ((pBuf[0] >> 4) == type)
+        {
+            unlinkPacket(this, pPkt);
+            return pBuf;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @internal
+ * Allocate the next packet ID.
+ *
+ * @param this is the umqtt instance
+ *
+ * @return a packet ID that is not 0 and not used by a packet in flight
+ *
+ * IDs are handed out in sequence from the last one issued, and an ID
+ * that still belongs to a packet in flight is skipped.  Each check is a
+ * lookup in the ID index, which has at least one bucket per packet in
+ * flight and holds consecutive IDs in different buckets, so a check is
+ * O(1) (see findPacket()).  It is a single check unless the sequence
+ * wrapped into a run of IDs that are still in use, and then each ID of
+ * the run is checked once.
+ */
+static uint16_t
+nextPacketId(umqtt_Instance_t *this)
+{
+    uint16_t packetId = this->packetId;
+    while ((packetId == 0) || findPacket(this, packetId, 0))
+    {
+        ++packetId;
+    }
+    this->packetId = packetId + 1;
+    return packetId;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Round trip time, keep alive and statistics
+//
+/////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @internal
+ * Update the retry timeout with a round trip time sample, using the
+ * smoothed RTT and RTT variance of RFC 6298.
+ */
+static void
+rttSample(umqtt_Instance_t *this, uint32_t rtt)
+{
+    if (!this->haveRtt)
+    {
+        this->srtt = rtt;
+        this->rttVar = rtt / 2;
+        this->haveRtt = true;
+    }
+    else
+    {
+        uint32_t delta = (this->srtt > rtt) ? (this->srtt - rtt) : (rtt - this->srtt);
+        this->rttVar = ((3 * this->rttVar) + delta) / 4;
+        this->srtt = ((7 * this->srtt) + rtt) / 8;
+    }
+    uint32_t rto = this->srtt + (4 * this->rttVar);
+    if (rto < this->rtoMin)
+    {
+        rto = this->rtoMin;
+    }
+    if (rto > this->rtoMax)
+    {
+        rto = this->rtoMax;
+    }
+    this->rto = rto;
+}
+
+/**
+ * @internal
+ * Take a round trip time sample from a packet that was acknowledged.
+ * Packets that were resent are not used because it is not known which
+ * copy was acknowledged.
+ */
+static void
+rttAcked(umqtt_Instance_t *this, PktBuf_t *pPkt)
+{
+    int32_t rtt = (int32_t)(this->ticks - pPkt->ticks);
+    if ((pPkt->ttl == RETRY_TTL) && (rtt >= 0))
+    {
+        rttSample(this, (uint32_t)rtt);
+    }
+}
+
+#ifdef UMQTT_ENABLE_STATS
+/**
+ * @internal
+ * Record the latency of an acknowledged packet in a histogram.
+ */
+static void
+latencyRecord(umqtt_Instance_t *this, umqtt_AckType_t type, PktBuf_t *pPkt)
+{
+    umqtt_LatencyHist_t *pHist = &this->latency[type];
+    uint32_t ms = this->ticks - pPkt->ticks;
+    unsigned int bucket = 0;
+    while ((bucket < (UMQTT_LATENCY_BUCKETS - 1)) && (ms >> bucket))
+    {
+        ++bucket;
+    }
+    ++pHist->bucket[bucket];
+    ++pHist->count;
+    if (ms > pHist->maxMs)
+    {
+        pHist->maxMs = ms;
+    }
+}
+#define LATENCY_RECORD(type, pPkt) latencyRecord(this, type, pPkt)
+#else
+#define LATENCY_RECORD(type, pPkt)
+#endif
+
+/**
+ * @internal
+ * Restart the keep alive timer from the current ticks.  A ping is sent
+ * when nothing was sent for half of the keep alive interval.
+ */
+static void
+restartKeepAlive(umqtt_Instance_t *this)
+{
+    timerStop(this, &this->pingTimer);
+    if (this->keepAlive)
+    {
+        timerStart(this, &this->pingTimer, this->ticks + (this->keepAlive * 500U));
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Packet encoding
+//
+/////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @internal
+ * Number of bytes needed to encode a remaining length.
+ */
+static unsigned int
+lengthBytes(uint32_t remLen)
+{
+    unsigned int count = 1;
+    while (remLen > 127)
+    {
+        remLen >>= 7;
+        ++count;
+    }
+    return count;
+}
+
+/**
+ * @internal
+ * Encode a remaining length.
+ *
+ * @return the number of bytes written
+ */
+static unsigned int
+encodeLength(uint8_t *pBuf, uint32_t remLen)
+{
+    unsigned int count = 0;
+    do
+    {
+        uint8_t encoded = remLen & 0x7F;
+        remLen >>= 7;
+        if (remLen)
+        {
+            encoded |= 0x80;
+        }
+        pBuf[count++] = encoded;
+    } while (remLen);
+    return count;
+}
+
+/**
+ * @internal
+ * Parse the fixed header at the start of a buffer.
+ *
+ * @param pBuf the buffer holding the packet
+ * @param len number of bytes in the buffer
+ * @param pRemLen storage for the remaining length
+ *
+ * @return length of the fixed header, 0 if more bytes are needed to
+ * know it, or -1 if the remaining length is malformed
+ */
+static int
+parseFixedHeader(const uint8_t *pBuf, uint32_t len, uint32_t *pRemLen)
+{
+    uint32_t remLen = 0;
+    for (unsigned int idx = 1; idx < 5; ++idx)
+    {
+        if (idx >= len)
+        {
+            return 0;
+        }
+        remLen |= (uint32_t)(pBuf[idx] & 0x7F) << (7 * (idx - 1));
+        if ((pBuf[idx] & 0x80) == 0)
+        {
+            *pRemLen = remLen;
+            return idx + 1;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @internal
+ * Length of a complete packet that was encoded by umqtt.
+ */
+static uint32_t
+packetLength(const uint8_t *pBuf)
+{
+    uint32_t remLen = 0;
+    int hdrLen = parseFixedHeader(pBuf, 5, &remLen);
+    return (uint32_t)hdrLen + remLen;
+}
+
+/**
+ * @internal
+ * Encode a 16 bit value.
+ *
+ * @return pointer to the next byte of the buffer
+ */
+static uint8_t *
+encode16(uint8_t *pBuf, uint16_t val)
+{
+    *pBuf++ = val >> 8;
+    *pBuf++ = val & 0xFF;
+    return pBuf;
+}
+
+/**
+ * @internal
+ * Encode a string with its 16 bit length prefix.
+ *
+ * @return pointer to the next byte of the buffer
+ */
+static uint8_t *
+encodeString(uint8_t *pBuf, const void *pStr, uint16_t len)
+{
+    pBuf = encode16(pBuf, len);
+    memcpy(pBuf, pStr, len);
+    return pBuf + len;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Transmit
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#ifdef UMQTT_ENABLE_STATS
+/**
+ * @internal
+ * Count the packets and bytes of data that was sent.  The data can hold
+ * several packets, and a packet can span segments.
+ */
+static void
+statsSent(umqtt_Instance_t *this, const umqtt_IoVec_t *pIov, unsigned int iovCnt)
+{
+    uint32_t skip = 0;
+    for (unsigned int idx = 0; idx < iovCnt; ++idx)
+    {
+        uint32_t pos = skip;
+        this->stats.bytesSent += pIov[idx].len;
+        while (pos < pIov[idx].len)
+        {
+            const uint8_t *pPkt = &pIov[idx].pBuf[pos];
+            ++this->stats.pktsSent[pPkt[0] >> 4];
+            pos += packetLength(pPkt);
+        }
+        skip = pos - pIov[idx].len;
+    }
+}
+#define STATS_SENT(pIov, iovCnt) statsSent(this, pIov, iovCnt)
+#else
+#define STATS_SENT(pIov, iovCnt)
+#endif
+
+/**
+ * @internal
+ * Write all gathered transmit data in one write.
+ *
+ * @param this is the umqtt instance
+ *
+ * @return UMQTT_ERR_OK or UMQTT_ERR_NETWORK.  The gathered data is
+ * dropped if the write fails.
+ */
+static umqtt_Error_t
+txFlush(umqtt_Instance_t *this)
+{
+    if (this->txLen == 0)
+    {
+        return UMQTT_ERR_OK;
+    }
+    uint32_t len = this->txLen;
+    int written = this->pfnNetWritePacket(this->hNet, this->pTxBuf, len, false);
+    if ((written < 0) || (((uint32_t)written < len) && !this->partialWrites))
+    {
+        STATS_INC(writeErrors);
+        this->txLen = 0;
+        return UMQTT_ERR_NETWORK;
+    }
+    if ((uint32_t)written < len)
+    {
+        // the rest of the buffer is written by umqtt_Run() and the
+        // buffer is not used for gathering until then
+        this->pTxRest = this->pTxBuf + written;
+        this->txRestLen = len - written;
+        this->pTxRestOwned = NULL;
+        return UMQTT_ERR_OK;
+    }
+    this->txLen = 0;
+    restartKeepAlive(this);
+    return UMQTT_ERR_OK;
+}
+
+/**
+ * @internal
+ * Queue data to be written after the partial write that is in progress.
+ *
+ * @param this is the umqtt instance
+ * @param pIov segments of the packet data
+ * @param iovCnt number of segments
+ * @param total length of all segments
+ * @param pOwned packet buffer that is freed once written, or NULL if the
+ * caller keeps the data
+ *
+ * @return UMQTT_ERR_OK, or UMQTT_ERR_BUFSIZE if there is no memory to
+ * hold a copy of the data
+ *
+ * An owned packet buffer is queued as it is, anything else is copied
+ * into a new packet buffer.  txResume() writes the queue in order.
+ */
+static umqtt_Error_t
+txQueue(umqtt_Instance_t *this, const umqtt_IoVec_t *pIov, unsigned int iovCnt,
+        uint32_t total, uint8_t *pOwned)
+{
+    uint8_t *pBuf = pOwned;
+    if ((iovCnt != 1) || (pIov[0].pBuf != pOwned))
+    {
+        pBuf = newPacket(this, total);
+        if (pBuf == NULL)
+        {
+            deletePacket(this, pOwned);
+            return UMQTT_ERR_BUFSIZE;
+        }
+        uint32_t len = 0;
+        for (unsigned int idx = 0; idx < iovCnt; ++idx)
+        {
+            memcpy(&pBuf[len], pIov[idx].pBuf, pIov[idx].len);
+            len += pIov[idx].len;
+        }
+        deletePacket(this, pOwned);
+    }
+    PktBuf_t *pPkt = ((PktBuf_t *)pBuf) - 1;
+    pPkt->ttl = total;
+    pPkt->next = NULL;
+    *this->ppTxQueueTail = pPkt;
+    this->ppTxQueueTail = &pPkt->next;
+    return UMQTT_ERR_OK;
+}
+
+/**
+ * @internal
+ * Free the writes that are waiting for a partial write.
+ */
+static void
+txQueueFree(umqtt_Instance_t *this)
+{
+    while (this->pTxQueue)
+    {
+        PktBuf_t *pPkt = this->pTxQueue;
+        this->pTxQueue = pPkt->next;
+        deletePacket(this, (uint8_t *)&pPkt[1]);
+    }
+    this->ppTxQueueTail = &this->pTxQueue;
+}
+
+/**
+ * @internal
+ * Write one or more complete packets.
+ *
+ * @param this is the umqtt instance
+ * @param pIov segments of the packet data
+ * @param iovCnt number of segments, more than one only if the transport
+ * has pfnNetWritev
+ * @param pOwned packet buffer that is freed once written, or NULL if the
+ * caller keeps the data
+ *
+ * @return UMQTT_ERR_OK if the data was written or accepted for writing
+ * later, UMQTT_ERR_NETWORK if the write failed, or UMQTT_ERR_BUFSIZE if
+ * it had to be queued and there was no memory for it
+ *
+ * With transmit coalescing enabled the data is copied into the coalescing
+ * buffer, except for CONNECT and DISCONNECT which are written along with
+ * anything gathered before them.  With partial writes enabled a short
+ * write keeps the rest to be written by umqtt_Run(), and data that comes
+ * while a partial write is in progress is queued behind it.  That is
+ * also the case for data that does not fit the coalescing buffer when
+ * flushing the buffer is short.
+ */
+static umqtt_Error_t
+txWrite(umqtt_Instance_t *this, const umqtt_IoVec_t *pIov, unsigned int iovCnt,
+        uint8_t *pOwned)
+{
+    umqtt_Error_t err;
+    uint32_t total = 0;
+    for (unsigned int idx = 0; idx < iovCnt; ++idx)
+    {
+        total += pIov[idx].len;
+    }
+    if (this->txRestLen)
+    {
+        return txQueue(this, pIov, iovCnt, total, pOwned);
+    }
+
+    if (this->pTxBuf)
+    {
+        uint8_t type = pIov[0].pBuf[0] >> 4;
+        bool flushNow = (type == CONNECT) || (type == DISCONNECT);
+        if ((this->txLen + total) > this->txBufLen)
+        {
+            err = txFlush(this);
+            if (err != UMQTT_ERR_OK)
+            {
+                deletePacket(this, pOwned);
+                return err;
+            }
+            if (this->txRestLen)
+            {
+                return txQueue(this, pIov, iovCnt, total, pOwned);
+            }
+        }
+        if (total <= this->txBufLen)
+        {
+            if (this->txLen == 0)
+            {
+                this->txFirstTicks = this->ticks;
+            }
+            for (unsigned int idx = 0; idx < iovCnt; ++idx)
+            {
+                memcpy(&this->pTxBuf[this->txLen], pIov[idx].pBuf, pIov[idx].len);
+                this->txLen += pIov[idx].len;
+            }
+            STATS_SENT(pIov, iovCnt);
+            deletePacket(this, pOwned);
+            return flushNow ? txFlush(this) : UMQTT_ERR_OK;
+        }
+        // too big to gather, write it directly
+    }
+
+    int written;
+    if (this->pfnNetWritev)
+    {
+        written = this->pfnNetWritev(this->hNet, pIov, iovCnt);
+    }
+    else
+    {
+        written = this->pfnNetWritePacket(this->hNet, pIov[0].pBuf, pIov[0].len, false);
+    }
+    if ((written < 0) || (((uint32_t)written < total) && !this->partialWrites))
+    {
+        STATS_INC(writeErrors);
+        deletePacket(this, pOwned);
+        return UMQTT_ERR_NETWORK;
+    }
+    STATS_SENT(pIov, iovCnt);
+    if ((uint32_t)written == total)
+    {
+        deletePacket(this, pOwned);
+        restartKeepAlive(this);
+        return UMQTT_ERR_OK;
+    }
+
+    // partial write, keep the rest so it can be written by umqtt_Run()
+    uint32_t restLen = total - written;
+    if (iovCnt > 1)
+    {
+        // copy the rest of the segments so the caller buffers can be reused
+        uint8_t *pRest = newPacket(this, restLen);
+        if (pRest == NULL)
+        {
+            STATS_INC(writeErrors);
+            deletePacket(this, pOwned);
+            return UMQTT_ERR_NETWORK;
+        }
+        uint8_t *pDst = pRest;
+        uint32_t skip = written;
+        for (unsigned int idx = 0; idx < iovCnt; ++idx)
+        {
+            if (skip >= pIov[idx].len)
+            {
+                skip -= pIov[idx].len;
+                continue;
+            }
+            memcpy(pDst, &pIov[idx].pBuf[skip], pIov[idx].len - skip);
+            pDst += pIov[idx].len - skip;
+            skip = 0;
+        }
+        deletePacket(this, pOwned);
+        this->pTxRest = pRest;
+        this->pTxRestOwned = pRest;
+    }
+    else if ((pOwned == NULL) && (restLen <= sizeof(this->txScratch)))
+    {
+        // short packet from the caller stack, keep the rest in the instance
+        memcpy(this->txScratch, &pIov[0].pBuf[written], restLen);
+        this->pTxRest = this->txScratch;
+        this->pTxRestOwned = NULL;
+    }
+    else
+    {
+        this->pTxRest = &pIov[0].pBuf[written];
+        this->pTxRestOwned = pOwned;
+    }
+    this->txRestLen = restLen;
+    return UMQTT_ERR_OK;
+}
+
+/**
+ * @internal
+ * Write one complete packet, see txWrite().
+ */
+static umqtt_Error_t
+txPacket(umqtt_Instance_t *this, const uint8_t *pBuf, uint32_t len, uint8_t *pOwned)
+{
+    umqtt_IoVec_t iov;
+    iov.pBuf = pBuf;
+    iov.len = len;
+    return txWrite(this, &iov, 1, pOwned);
+}
+
+/**
+ * @internal
+ * Write a 4 byte acknowledgement packet.
+ *
+ * While a partial write is in progress the ack is queued behind it (see
+ * txWrite()), so a received packet is never refused because its ack
+ * cannot be written yet.
+ */
+static umqtt_Error_t
+txAck(umqtt_Instance_t *this, uint8_t hdr, uint16_t packetId)
+{
+    uint8_t ack[4];
+    ack[0] = hdr;
+    ack[1] = 2;
+    encode16(&ack[2], packetId);
+    return txPacket(this, ack, sizeof(ack), NULL);
+}
+
+/**
+ * @internal
+ * Continue a partial write.
+ *
+ * @param this is the umqtt instance
+ *
+ * @return UMQTT_ERR_OK or UMQTT_ERR_NETWORK
+ *
+ * Once the rest is written, the data that was queued while it was in
+ * progress is written in order, until one of the writes is short again.
+ */
+static umqtt_Error_t
+txResume(umqtt_Instance_t *this)
+{
+    int written = this->pfnNetWritePacket(this->hNet, this->pTxRest, this->txRestLen, false);
+    bool failed = (written < 0);
+    if (failed)
+    {
+        // the rest is dropped
+        STATS_INC(writeErrors);
+        this->txRestLen = 0;
+    }
+    else
+    {
+        this->pTxRest += written;
+        this->txRestLen -= written;
+    }
+    if (this->txRestLen == 0)
+    {
+        deletePacket(this, this->pTxRestOwned);
+        this->pTxRestOwned = NULL;
+        this->pTxRest = NULL;
+        this->txLen = 0;
+        if (failed)
+        {
+            txQueueFree(this);
+            return UMQTT_ERR_NETWORK;
+        }
+        restartKeepAlive(this);
+    }
+    while (this->pTxQueue && (this->txRestLen == 0))
+    {
+        // the rest of the queue is set aside, so that a write that is
+        // queued again stays in front of it
+        PktBuf_t *pPkt = this->pTxQueue;
+        PktBuf_t *pLater = pPkt->next;
+        PktBuf_t **ppLaterTail = this->ppTxQueueTail;
+        this->pTxQueue = NULL;
+        this->ppTxQueueTail = &this->pTxQueue;
+        uint8_t *pBuf = (uint8_t *)&pPkt[1];
+        umqtt_Error_t err = txPacket(this, pBuf, pPkt->ttl, pBuf);
+        if (pLater)
+        {
+            *this->ppTxQueueTail = pLater;
+            this->ppTxQueueTail = ppLaterTail;
+        }
+        if (err != UMQTT_ERR_OK)
+        {
+            txQueueFree(this);
+            return err;
+        }
+    }
+    return UMQTT_ERR_OK;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Duplicate filter
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#ifdef UMQTT_ENABLE_DUP_FILTER
+/**
+ * @internal
+ * Forget all inbound packet IDs.
+ */
+static void
+dupClear(umqtt_Instance_t *this)
+{
+    this->dupValid = false;
+    this->dupHighId = 0;
+    memset(this->dupBits, 0, sizeof(this->dupBits));
+}
+
+/**
+ * @internal
+ * Check and record an inbound qos 1 packet ID.
+ *
+ * @param this is the umqtt instance
+ * @param packetId the inbound packet ID, not 0
+ *
+ * @return true if the ID was already recorded
+ *
+ * Bit n of the bitmap is the ID n below the highest ID received.  IDs
+ * are compared in sequence space of 1 to 65535, so the window follows
+ * the ID across the wrap.  An ID more than half the sequence space
+ * ahead of the highest is taken as an old one.
+ */
+static bool
+dupCheck(umqtt_Instance_t *this, uint16_t packetId)
+{
+    if (!this->dupValid)
+    {
+        this->dupValid = true;
+        this->dupHighId = packetId;
+        this->dupBits[0] = 1;
+        return false;
+    }
+    uint32_t ahead = ((uint32_t)packetId + 65535 - this->dupHighId) % 65535;
+    if ((ahead != 0) && (ahead < 32768))
+    {
+        // newer ID, move the window up
+        if (ahead >= UMQTT_DUP_FILTER_BITS)
+        {
+            memset(this->dupBits, 0, sizeof(this->dupBits));
+        }
+        else
+        {
+            unsigned int words = ahead / 32;
+            unsigned int bits = ahead % 32;
+            for (int idx = (UMQTT_DUP_FILTER_BITS / 32) - 1; idx >= 0; --idx)
+            {
+                uint32_t val = 0;
+                if (idx >= (int)words)
+                {
+                    val = this->dupBits[idx - words] << bits;
+                    if (bits && (idx > (int)words))
+                    {
+                        val |= this->dupBits[idx - words - 1] >> (32 - bits);
+                    }
+                }
+                this->dupBits[idx] = val;
+            }
+        }
+        this->dupHighId = packetId;
+        this->dupBits[0] |= 1;
+        return false;
+    }
+    uint32_t behind = (ahead == 0) ? 0 : (65535 - ahead);
+    if (behind >= UMQTT_DUP_FILTER_BITS)
+    {
+        // too old to know
+        return false;
+    }
+    uint32_t mask = 1UL << (behind % 32);
+    bool seen = (this->dupBits[behind / 32] & mask) != 0;
+    this->dupBits[behind / 32] |= mask;
+    return seen;
+}
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Receive
+//
+/////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @internal
+ * Decode a received PUBLISH packet.
+ */
+static umqtt_Error_t
+decodePublish(umqtt_Instance_t *this, uint8_t *pBuf, uint32_t hdrLen, uint32_t remLen)
+{
+    umqtt_Error_t err = UMQTT_ERR_OK;
+    uint8_t flags = pBuf[0] & 0x0F;
+    bool dup = (flags & 0x08) != 0;
+    bool retain = (flags & 0x01) != 0;
+    uint8_t qos = (flags >> 1) & 3;
+    if ((qos == 3) || (remLen < 2))
+    {
+        return UMQTT_ERR_PACKET_ERROR;
+    }
+    uint8_t *pVar = &pBuf[hdrLen];
+    uint16_t topicLen = (pVar[0] << 8) | pVar[1];
+    uint32_t varLen = 2 + topicLen + (qos ? 2 : 0);
+    if (varLen > remLen)
+    {
+        return UMQTT_ERR_PACKET_ERROR;
+    }
+    uint16_t packetId = 0;
+    if (qos)
+    {
+        packetId = (pVar[2 + topicLen] << 8) | pVar[3 + topicLen];
+    }
+    uint16_t msgLen = remLen - varLen;
+    const uint8_t *pMsg = msgLen ? &pVar[varLen] : NULL;
+    bool deliver = true;
+
+    if (qos == 1)
+    {
+#ifdef UMQTT_ENABLE_DUP_FILTER
+        if (dupCheck(this, packetId) && dup)
+        {
+            deliver = false;
+        }
+#endif
+    }
+    else if (qos == 2)
+    {
+        if (packetId == 0)
+        {
+            return UMQTT_ERR_PACKET_ERROR;
+        }
+        // a PUBREC is kept until PUBREL so a resent PUBLISH is not
+        // delivered again
+        if (findPacket(this, packetId, PUBREC))
+        {
+            deliver = false;
+        }
+        else
+        {
+            uint8_t *pRec = newPacket(this, 2);
+            if (pRec == NULL)
+            {
+                return UMQTT_ERR_BUFSIZE;
+            }
+            pRec[0] = PUBREC << 4;
+            pRec[1] = 2;
+            encode16(&pRec[2], packetId);
+            enqueuePacket(this, pRec, packetId, this->ticks);
+            // it is sent again when the PUBLISH is, so it is not retried
+            // and does not expire
+            timerStop(this, &(((PktBuf_t *)pRec) - 1)->timer);
+        }
+    }
+
+    if (deliver && this->callbacks.pfnPublishCb)
+    {
+        this->callbacks.pfnPublishCb(this, this->pUser, dup, retain, qos,
+                                     (const char *)&pVar[2], topicLen, pMsg, msgLen);
+    }
+    if (qos == 1)
+    {
+        err = txAck(this, PUBACK << 4, packetId);
+    }
+    else if (qos == 2)
+    {
+        err = txAck(this, PUBREC << 4, packetId);
+    }
+    return err;
+}
+
+/**
+ * @internal
+ * Decode one complete packet.
+ *
+ * @param this is the umqtt instance
+ * @param pBuf the packet
+ * @param len the packet length, must match the fixed header
+ *
+ * @return UMQTT_ERR_OK or an error code
+ */
+static umqtt_Error_t
+decodePacket(umqtt_Instance_t *this, uint8_t *pBuf, uint32_t len)
+{
+    umqtt_Error_t err = UMQTT_ERR_OK;
+    uint32_t remLen = 0;
+    int hdrLen = parseFixedHeader(pBuf, len, &remLen);
+    if ((hdrLen <= 0) || ((hdrLen + remLen) != len))
+    {
+        return UMQTT_ERR_PACKET_ERROR;
+    }
+    uint8_t type = pBuf[0] >> 4;
+    uint8_t *pVar = &pBuf[hdrLen];
+    uint16_t packetId = (remLen >= 2) ? ((pVar[0] << 8) | pVar[1]) : 0;
+    PktBuf_t *pPkt;
+    STATS_INC(pktsRcvd[type]);
+    STATS_ADD(bytesRcvd, len);
+
+    switch (type)
+    {
+        case CONNACK:
+        {
+            if (remLen != 2)
+            {
+                return UMQTT_ERR_PACKET_ERROR;
+            }
+            uint8_t *pConn = dequeuePacketByType(this, CONNECT);
+            if (pConn)
+            {
+                rttAcked(this, ((PktBuf_t *)pConn) - 1);
+                deletePacket(this, pConn);
+            }
+            bool sessionPresent = (pVar[0] & 1) != 0;
+            this->connectPending = false;
+            this->isConnected = (pVar[1] == 0);
+#ifdef UMQTT_ENABLE_DUP_FILTER
+            if (!sessionPresent)
+            {
+                dupClear(this);
+            }
+#endif
+            if (this->callbacks.pfnConnackCb)
+            {
+                this->callbacks.pfnConnackCb(this, this->pUser, sessionPresent, pVar[1]);
+            }
+            break;
+        }
+
+        case PUBLISH:
+            err = decodePublish(this, pBuf, hdrLen, remLen);
+            break;
+
+        case PUBACK:
+            if (remLen != 2)
+            {
+                return UMQTT_ERR_PACKET_ERROR;
+            }
+            pPkt = dequeuePacket(this, packetId, PUBLISH);
+            if (pPkt)
+            {
+                rttAcked(this, pPkt);
+                LATENCY_RECORD(UMQTT_ACK_PUBACK, pPkt);
+                if (this->inflightCount)
+                {
+                    --this->inflightCount;
+                }
+                deletePacket(this, (uint8_t *)&pPkt[1]);
+            }
+            if (this->callbacks.pfnPubackCb)
+            {
+                this->callbacks.pfnPubackCb(this, this->pUser, packetId);
+            }
+            break;
+
+        case PUBREC:
+            if ((remLen != 2) || (pBuf[0] & 0x0F))
+            {
+                return UMQTT_ERR_PACKET_ERROR;
+            }
+            pPkt = findPacket(this, packetId, PUBLISH);
+            if (pPkt == NULL)
+            {
+                // a PUBREC can be resent after the PUBREL was sent
+                pPkt = findPacket(this, packetId, PUBREL);
+            }
+            if (pPkt)
+            {
+                uint8_t *pRel = (uint8_t *)&pPkt[1];
+                if ((pRel[0] >> 4) == PUBLISH)
+                {
+                    rttAcked(this, pPkt);
+                }
+                // the publish buffer is reused for the PUBREL, which is
+                // kept until PUBCOMP
+                pRel[0] = (PUBREL << 4) | 2;
+                pRel[1] = 2;
+                encode16(&pRel[2], packetId);
+                unlinkPacket(this, pPkt);
+                enqueuePacket(this, pRel, packetId, this->ticks);
+                err = txAck(this, pRel[0], packetId);
+            }
+            break;
+
+        case PUBREL:
+            if ((remLen != 2) || ((pBuf[0] & 0x0F) != 2))
+            {
+                return UMQTT_ERR_PACKET_ERROR;
+            }
+            pPkt = dequeuePacket(this, packetId, PUBREC);
+            if (pPkt)
+            {
+                deletePacket(this, (uint8_t *)&pPkt[1]);
+            }
+            err = txAck(this, PUBCOMP << 4, packetId);
+            break;
+
+        case PUBCOMP:
+            if ((remLen != 2) || (pBuf[0] & 0x0F))
+            {
+                return UMQTT_ERR_PACKET_ERROR;
+            }
+            pPkt = dequeuePacket(this, packetId, PUBREL);
+            if (pPkt)
+            {
+                LATENCY_RECORD(UMQTT_ACK_PUBACK, pPkt);
+                if (this->inflightCount)
+                {
+                    --this->inflightCount;
+                }
+                deletePacket(this, (uint8_t *)&pPkt[1]);
+                if (this->callbacks.pfnPubackCb)
+                {
+                    this->callbacks.pfnPubackCb(this, this->pUser, packetId);
+                }
+            }
+            break;
+
+        case SUBACK:
+            if (remLen < 3)
+            {
+                return UMQTT_ERR_PACKET_ERROR;
+            }
+            pPkt = dequeuePacket(this, packetId, SUBSCRIBE);
+            if (pPkt)
+            {
+                rttAcked(this, pPkt);
+                LATENCY_RECORD(UMQTT_ACK_SUBACK, pPkt);
+                deletePacket(this, (uint8_t *)&pPkt[1]);
+            }
+            if (this->callbacks.pfnSubackCb)
+            {
+                this->callbacks.pfnSubackCb(this, this->pUser, &pVar[2], remLen - 2, packetId);
+            }
+            break;
+
+        case UNSUBACK:
+            if (remLen != 2)
+            {
+                return UMQTT_ERR_PACKET_ERROR;
+            }
+            pPkt = dequeuePacket(this, packetId, UNSUBSCRIBE);
+            if (pPkt)
+            {
+                rttAcked(this, pPkt);
+                LATENCY_RECORD(UMQTT_ACK_UNSUBACK, pPkt);
+                deletePacket(this, (uint8_t *)&pPkt[1]);
+            }
+            if (this->callbacks.pfnUnsubackCb)
+            {
+                this->callbacks.pfnUnsubackCb(this, this->pUser, packetId);
+            }
+            break;
+
+        case PINGRESP:
+            if (remLen != 0)
+            {
+                return UMQTT_ERR_PACKET_ERROR;
+            }
+            if (this->pingOutstanding)
+            {
+                int32_t rtt = (int32_t)(this->ticks - this->pingSentTicks);
+                if (rtt >= 0)
+                {
+                    rttSample(this, (uint32_t)rtt);
+                }
+                this->pingOutstanding = false;
+            }
+            if (this->callbacks.pfnPingrespCb)
+            {
+                this->callbacks.pfnPingrespCb(this, this->pUser);
+            }
+            break;
+
+        default:
+            return UMQTT_ERR_PACKET_ERROR;
+    }
+
+    if ((err == UMQTT_ERR_OK) && this->keepAliveOnRx)
+    {
+        restartKeepAlive(this);
+    }
+    return err;
+}
+
+/**
+ * @internal
+ * Decode the complete packets at the start of a buffer.
+ *
+ * @param this is the umqtt instance
+ * @param pBuf received data
+ * @param len number of bytes of data
+ * @param pUsed storage for the number of bytes that were decoded
+ * @param pNeed storage for the total length of the partial packet that
+ * follows, or 0 if its fixed header is not complete
+ *
+ * @return UMQTT_ERR_OK or the error of the packet that failed
+ */
+static umqtt_Error_t
+rxDecode(umqtt_Instance_t *this, uint8_t *pBuf, uint32_t len,
+         uint32_t *pUsed, uint32_t *pNeed)
+{
+    uint32_t used = 0;
+    *pNeed = 0;
+    while (used < len)
+    {
+        uint32_t remLen = 0;
+        int hdrLen = parseFixedHeader(&pBuf[used], len - used, &remLen);
+        if (hdrLen < 0)
+        {
+            return UMQTT_ERR_PACKET_ERROR;
+        }
+        if (hdrLen == 0)
+        {
+            break;
+        }
+        uint32_t pktLen = hdrLen + remLen;
+        if (pktLen > (len - used))
+        {
+            *pNeed = pktLen;
+            break;
+        }
+        umqtt_Error_t err = decodePacket(this, &pBuf[used], pktLen);
+        if (err != UMQTT_ERR_OK)
+        {
+            return err;
+        }
+        used += pktLen;
+    }
+    *pUsed = used;
+    return UMQTT_ERR_OK;
+}
+
+/**
+ * @internal
+ * Free a reassembly buffer.
+ */
+static void
+rxAsmFree(umqtt_Instance_t *this)
+{
+    if (this->pRxAsm && (this->pRxAsm != this->pRxBuf))
+    {
+        this->pfnFree(this->pRxAsm);
+    }
+    this->pRxAsm = NULL;
+    this->rxAsmLen = 0;
+    this->rxAsmTotal = 0;
+}
+
+/**
+ * @internal
+ * Start reassembly of a packet that is split across reads.
+ *
+ * @return UMQTT_ERR_OK or UMQTT_ERR_BUFSIZE
+ *
+ * A static instance reassembles in its receive buffer, otherwise a
+ * buffer of the packet length is allocated.
+ */
+static umqtt_Error_t
+rxAsmStart(umqtt_Instance_t *this, const uint8_t *pData, uint32_t len, uint32_t total)
+{
+    uint8_t *pAsm = NULL;
+    if (this->isStatic)
+    {
+        if (total <= this->rxBufLen)
+        {
+            pAsm = this->pRxBuf;
+        }
+    }
+    else
+    {
+        pAsm = this->pfnMalloc(total);
+    }
+    if (pAsm == NULL)
+    {
+        return UMQTT_ERR_BUFSIZE;
+    }
+    memcpy(pAsm, pData, len);
+    this->pRxAsm = pAsm;
+    this->rxAsmLen = len;
+    this->rxAsmTotal = total;
+    return UMQTT_ERR_OK;
+}
+
+/**
+ * @internal
+ * Process received data that is not kept after the call, from
+ * pfnNetReadPacket or pfnNetReadSegment.
+ *
+ * @param this is the umqtt instance
+ * @param pData received data
+ * @param len number of bytes of data
+ *
+ * @return UMQTT_ERR_OK or an error code
+ *
+ * Data can hold any number of packets and the last one can be partial.
+ * Complete packets are decoded in place.  A partial fixed header is
+ * held in the instance, and a partial packet is copied to a reassembly
+ * buffer, until the rest of it arrives in later reads.
+ */
+static umqtt_Error_t
+rxStream(umqtt_Instance_t *this, uint8_t *pData, uint32_t len)
+{
+    umqtt_Error_t err = UMQTT_ERR_OK;
+    uint32_t used;
+    uint32_t need;
+
+    // finish a fixed header from an earlier read
+    while (this->rxHoldLen && len)
+    {
+        uint32_t remLen = 0;
+        this->rxHold[this->rxHoldLen++] = *pData++;
+        --len;
+        int hdrLen = parseFixedHeader(this->rxHold, this->rxHoldLen, &remLen);
+        if (hdrLen < 0)
+        {
+            this->rxHoldLen = 0;
+            return UMQTT_ERR_PACKET_ERROR;
+        }
+        if (hdrLen == 0)
+        {
+            continue;
+        }
+        uint32_t total = hdrLen + remLen;
+        uint32_t held = this->rxHoldLen;
+        this->rxHoldLen = 0;
+        if (total <= sizeof(this->rxHold))
+        {
+            // small packet, finish it in the hold buffer
+            uint32_t count = total - held;
+            if (count > len)
+            {
+                memcpy(&this->rxHold[held], pData, len);
+                this->rxHoldLen = held + len;
+                return UMQTT_ERR_OK;
+            }
+            memcpy(&this->rxHold[held], pData, count);
+            pData += count;
+            len -= count;
+            err = decodePacket(this, this->rxHold, total);
+            if (err != UMQTT_ERR_OK)
+            {
+                return err;
+            }
+        }
+        else
+        {
+            err = rxAsmStart(this, this->rxHold, held, total);
+            if (err != UMQTT_ERR_OK)
+            {
+                return err;
+            }
+        }
+    }
+
+    // finish a packet from an earlier read
+    if (this->pRxAsm && len)
+    {
+        uint32_t count = this->rxAsmTotal - this->rxAsmLen;
+        if (count > len)
+        {
+            count = len;
+        }
+        memcpy(&this->pRxAsm[this->rxAsmLen], pData, count);
+        this->rxAsmLen += count;
+        pData += count;
+        len -= count;
+        if (this->rxAsmLen < this->rxAsmTotal)
+        {
+            return UMQTT_ERR_OK;
+        }
+        err = decodePacket(this, this->pRxAsm, this->rxAsmTotal);
+        rxAsmFree(this);
+        if (err != UMQTT_ERR_OK)
+        {
+            return err;
+        }
+    }
+
+    err = rxDecode(this, pData, len, &used, &need);
+    if (err != UMQTT_ERR_OK)
+    {
+        return err;
+    }
+    if (used < len)
+    {
+        if (need == 0)
+        {
+            memcpy(this->rxHold, &pData[used], len - used);
+            this->rxHoldLen = len - used;
+        }
+        else
+        {
+            err = rxAsmStart(this, &pData[used], len - used, need);
+        }
+    }
+    return err;
+}
+
+/**
+ * @internal
+ * Read and process incoming data with whichever read method the
+ * transport provides.  At most one read is done per call.
+ *
+ * @param this is the umqtt instance
+ *
+ * @return UMQTT_ERR_OK or an error code
+ */
+static umqtt_Error_t
+rxRun(umqtt_Instance_t *this)
+{
+    umqtt_Error_t err = UMQTT_ERR_OK;
+    if (this->pfnNetReadSegment)
+    {
+        const uint8_t *pData = NULL;
+        void *pSeg = NULL;
+        int len = this->pfnNetReadSegment(this->hNet, &pData, &pSeg);
+        if (len < 0)
+        {
+            return UMQTT_ERR_NETWORK;
+        }
+        if (len > 0)
+        {
+            // decoded in place, the segment is not modified
+            err = rxStream(this, (uint8_t *)pData, len);
+            this->pfnNetReleaseSegment(this->hNet, pSeg);
+        }
+    }
+    else if (this->pfnNetReadInto)
+    {
+        int len = this->pfnNetReadInto(this->hNet, &this->pRxBuf[this->rxHeld],
+                                       this->rxBufLen - this->rxHeld);
+        if (len < 0)
+        {
+            return UMQTT_ERR_NETWORK;
+        }
+        if (len > 0)
+        {
+            uint32_t total = this->rxHeld + len;
+            uint32_t used;
+            uint32_t need;
+            err = rxDecode(this, this->pRxBuf, total, &used, &need);
+            if ((err == UMQTT_ERR_OK) && (need > this->rxBufLen))
+            {
+                err = UMQTT_ERR_BUFSIZE;
+            }
+            if (err != UMQTT_ERR_OK)
+            {
+                this->rxHeld = 0;
+                return err;
+            }
+            // keep a partial packet at the start of the buffer
+            memmove(this->pRxBuf, &this->pRxBuf[used], total - used);
+            this->rxHeld = total - used;
+        }
+    }
+    else
+    {
+        uint8_t *pBuf = NULL;
+        int len = this->pfnNetReadPacket(this->hNet, &pBuf);
+        if (len < 0)
+        {
+            return UMQTT_ERR_NETWORK;
+        }
+        if (len > 0)
+        {
+            err = rxStream(this, pBuf, len);
+            this->pfnFree(pBuf);
+        }
+    }
+    return err;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Instance
+//
+/////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @internal
+ * Initialize the instance memory.
+ */
+static void
+instanceInit(umqtt_Instance_t *this, umqtt_TransportConfig_t *pTransport,
+             umqtt_Callbacks_t *pCallbacks, void *pUser)
+{
+    memset(this, 0, sizeof(umqtt_Instance_t));
+    this->hNet = pTransport->hNet;
+    this->pfnMalloc = pTransport->pfnMalloc;
+    this->pfnFree = pTransport->pfnFree;
+    this->pfnNetReadPacket = pTransport->pfnNetReadPacket;
+    this->pfnNetWritePacket = pTransport->pfnNetWritePacket;
+    this->pfnNetReadInto = pTransport->pfnNetReadInto;
+    this->pfnNetReadSegment = pTransport->pfnNetReadSegment;
+    this->pfnNetReleaseSegment = pTransport->pfnNetReleaseSegment;
+    this->pfnNetWritev = pTransport->pfnNetWritev;
+    this->pRxBuf = pTransport->pRxBuf;
+    this->rxBufLen = pTransport->rxBufLen;
+    this->numPoolClasses = pTransport->numPoolClasses;
+    if (pCallbacks)
+    {
+        this->callbacks = *pCallbacks;
+    }
+    this->pUser = pUser;
+    this->packetId = 1;
+    this->rto = RTO_INITIAL;
+    this->rtoMin = RTO_MIN;
+    this->rtoMax = RTO_MAX;
+    this->pIdTable = this->idTableInit;
+    this->idMask = ID_BUCKETS - 1;
+    this->ppTxQueueTail = &this->pTxQueue;
+}
+
+/**
+ * Create a new umqtt instance.
+ *
+ * @param pTransport the transport configuration
+ * @param pCallbacks callback functions for received packets, can be NULL
+ * @param pUser caller data passed to the callbacks
+ *
+ * @return handle of the instance, or NULL if it could not be created
+ *
+ * The instance, the receive buffer if pfnNetReadInto is used without
+ * pRxBuf, and the packet pool if there are pool classes, are allocated
+ * with pfnMalloc.
+ */
+umqtt_Handle_t
+umqtt_New(umqtt_TransportConfig_t *pTransport, umqtt_Callbacks_t *pCallbacks, void *pUser)
+{
+    uint32_t poolBytes = 0;
+    if (pTransport == NULL)
+    {
+        return NULL;
+    }
+    if (pTransport->pfnNetReadInto)
+    {
+        if ((pTransport->rxBufLen == 0) || pTransport->pfnNetReadSegment)
+        {
+            return NULL;
+        }
+    }
+    if (pTransport->pfnNetReadSegment && (pTransport->pfnNetReleaseSegment == NULL))
+    {
+        return NULL;
+    }
+    if (!poolCheck(pTransport, &poolBytes))
+    {
+        return NULL;
+    }
+
+    umqtt_Instance_t *this = pTransport->pfnMalloc(sizeof(umqtt_Instance_t));
+    if (this == NULL)
+    {
+        return NULL;
+    }
+    instanceInit(this, pTransport, pCallbacks, pUser);
+
+    if (pTransport->pfnNetReadInto && (pTransport->pRxBuf == NULL))
+    {
+        this->pRxBuf = this->pfnMalloc(this->rxBufLen);
+        if (this->pRxBuf == NULL)
+        {
+            this->pfnFree(this);
+            return NULL;
+        }
+        this->rxBufOwned = true;
+    }
+
+    if (this->numPoolClasses)
+    {
+        uint8_t *pPool = this->pfnMalloc(poolBytes);
+        if (pPool == NULL)
+        {
+            if (this->rxBufOwned)
+            {
+                this->pfnFree(this->pRxBuf);
+            }
+            this->pfnFree(this);
+            return NULL;
+        }
+        this->poolBytes = poolBytes;
+        poolInit(this, pTransport->pPoolClasses, pPool);
+    }
+    return this;
+}
+
+/**
+ * Create a new umqtt instance in memory provided by the caller.
+ *
+ * @param pArena memory for the instance, the packet pool and the
+ * receive buffer, aligned for any type
+ * @param arenaSize size of the arena, at least UMQTT_ARENA_SIZE()
+ * @param pTransport the transport configuration
+ * @param pCallbacks callback functions for received packets, can be NULL
+ * @param pUser caller data passed to the callbacks
+ *
+ * @return handle of the instance, or NULL if it could not be created
+ *
+ * A static instance never allocates memory, the packet ID index is in
+ * the arena too.  The transport must use
+ * pfnNetReadInto or pfnNetReadSegment with rxBufLen set and pRxBuf
+ * NULL, and must have pool classes.  Packets that do not fit a free
+ * pool block fail with UMQTT_ERR_BUFSIZE.  In segment mode the receive
+ * buffer is used to reassemble a packet split across segments.
+ */
+umqtt_Handle_t
+umqtt_NewStatic(void *pArena, size_t arenaSize, umqtt_TransportConfig_t *pTransport,
+                umqtt_Callbacks_t *pCallbacks, void *pUser)
+{
+    uint32_t poolBytes = 0;
+    if ((pArena == NULL) || (pTransport == NULL))
+    {
+        return NULL;
+    }
+    if ((pTransport->rxBufLen == 0) || pTransport->pRxBuf)
+    {
+        return NULL;
+    }
+    if ((pTransport->pfnNetReadInto == NULL) == (pTransport->pfnNetReadSegment == NULL))
+    {
+        return NULL;
+    }
+    if (pTransport->pfnNetReadSegment && (pTransport->pfnNetReleaseSegment == NULL))
+    {
+        return NULL;
+    }
+    if ((pTransport->numPoolClasses == 0) || !poolCheck(pTransport, &poolBytes))
+    {
+        return NULL;
+    }
+    if (arenaSize < UMQTT_ARENA_SIZE(pTransport->rxBufLen, poolBytes))
+    {
+        return NULL;
+    }
+
+    umqtt_Instance_t *this = pArena;
+    uint8_t *pMem = (uint8_t *)pArena + UMQTT_INSTANCE_SIZE;
+    instanceInit(this, pTransport, pCallbacks, pUser);
+    this->isStatic = true;
+    this->poolBytes = poolBytes;
+    poolInit(this, pTransport->pPoolClasses, pMem);
+    pMem += poolBytes;
+
+    // every packet comes from the pool, so an ID index with a bucket
+    // per pool block never needs to grow
+    uint32_t blocks = 0;
+    for (unsigned int idx = 0; idx < this->numPoolClasses; ++idx)
+    {
+        blocks += this->poolClasses[idx].count;
+    }
+    uint32_t buckets = ID_BUCKETS;
+    while (buckets < blocks)
+    {
+        buckets *= 2;
+    }
+    if (buckets > ID_BUCKETS)
+    {
+        this->pIdTable = (PktBuf_t **)pMem;
+        this->idMask = buckets - 1;
+        memset(this->pIdTable, 0, buckets * sizeof(PktBuf_t *));
+    }
+    pMem += UMQTT_ID_TABLE_BYTES(poolBytes);
+    this->pRxBuf = pMem;
+    return this;
+}
+
+/**
+ * Free a umqtt instance and everything it holds.
+ *
+ * @param h the umqtt instance handle
+ *
+ * Nothing is freed for an instance from umqtt_NewStatic().
+ */
+void
+umqtt_Delete(umqtt_Handle_t h)
+{
+    umqtt_Instance_t *this = h;
+    if ((this == NULL) || this->isStatic)
+    {
+        return;
+    }
+    while (this->pktList.next)
+    {
+        PktBuf_t *pPkt = this->pktList.next;
+        unlinkPacket(this, pPkt);
+        deletePacket(this, (uint8_t *)&pPkt[1]);
+    }
+    deletePacket(this, this->pTxRestOwned);
+    txQueueFree(this);
+    deletePacket(this, this->pResv);
+    rxAsmFree(this);
+    if (this->rxBufOwned)
+    {
+        this->pfnFree(this->pRxBuf);
+    }
+    if (this->pPool)
+    {
+        this->pfnFree(this->pPool);
+    }
+    if (this->idTableOwned)
+    {
+        this->pfnFree(this->pIdTable);
+    }
+    this->pfnFree(this);
+}
+
+/**
+ * Get a string that describes an error code.
+ */
+const char *
+umqtt_GetErrorString(umqtt_Error_t err)
+{
+    static const char *errStrings[] =
+    {
+        "UMQTT_ERR_OK",
+        "UMQTT_ERR_PACKET_ERROR",
+        "UMQTT_ERR_BUFSIZE",
+        "UMQTT_ERR_PARM",
+        "UMQTT_ERR_NETWORK",
+        "UMQTT_ERR_CONNECT_PENDING",
+        "UMQTT_ERR_CONNECTED",
+        "UMQTT_ERR_DISCONNECTED",
+        "UMQTT_ERR_TIMEOUT",
+        "UMQTT_ERR_NO_DEADLINE",
+        "UMQTT_ERR_WINDOW_FULL",
+        "UMQTT_ERR_TX_BUSY",
+    };
+    if ((unsigned int)err < (sizeof(errStrings) / sizeof(errStrings[0])))
+    {
+        return errStrings[err];
+    }
+    return "UMQTT_ERR_UNKNOWN";
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Connect
+//
+/////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Connect to the MQTT server.
+ *
+ * @param h the umqtt instance handle
+ * @param cleanSession start a new session
+ * @param willRetain retain flag of the will message
+ * @param willQos qos of the will message
+ * @param keepAlive keep alive interval in seconds, 0 for none
+ * @param pClientId client identifier
+ * @param pWillTopic will topic, or NULL for no will
+ * @param pWillMessage will message, required with a will topic
+ * @param willMessageLen length of the will message
+ * @param pUsername user name, or NULL
+ * @param pPassword password, or NULL
+ *
+ * @return UMQTT_ERR_OK if the CONNECT was sent, or an error code
+ *
+ * The connection is complete when the CONNACK arrives.  If it does not
+ * arrive within the retry timeout, umqtt_Run() returns UMQTT_ERR_TIMEOUT.
+ */
+umqtt_Error_t
+umqtt_Connect(umqtt_Handle_t h, bool cleanSession, bool willRetain, uint8_t willQos,
+              uint16_t keepAlive, const char *pClientId, const char *pWillTopic,
+              const uint8_t *pWillMessage, uint32_t willMessageLen,
+              const char *pUsername, const char *pPassword)
+{
+    umqtt_Instance_t *this = h;
+    if ((this == NULL) || (pClientId == NULL))
+    {
+        return UMQTT_ERR_PARM;
+    }
+    if (pWillTopic && (pWillMessage == NULL))
+    {
+        return UMQTT_ERR_PARM;
+    }
+    if (this->isConnected)
+    {
+        return UMQTT_ERR_CONNECTED;
+    }
+    if (this->connectPending)
+    {
+        return UMQTT_ERR_CONNECT_PENDING;
+    }
+    if (this->txRestLen)
+    {
+        return UMQTT_ERR_TX_BUSY;
+    }
+
+    uint8_t flags = cleanSession ? 0x02 : 0;
+    uint16_t clientIdLen = strlen(pClientId);
+    uint32_t remLen = 10 + 2 + clientIdLen;
+    uint16_t willTopicLen = 0;
+    uint16_t usernameLen = 0;
+    uint16_t passwordLen = 0;
+    if (pWillTopic)
+    {
+        willTopicLen = strlen(pWillTopic);
+        remLen += 2 + willTopicLen + 2 + willMessageLen;
+        flags |= 0x04 | ((willQos & 3) << 3) | (willRetain ? 0x20 : 0);
+    }
+    if (pUsername)
+    {
+        usernameLen = strlen(pUsername);
+        remLen += 2 + usernameLen;
+        flags |= 0x80;
+    }
+    if (pPassword)
+    {
+        passwordLen = strlen(pPassword);
+        remLen += 2 + passwordLen;
+        flags |= 0x40;
+    }
+
+    uint8_t *pBuf = newPacket(this, remLen);
+    if (pBuf == NULL)
+    {
+        return UMQTT_ERR_BUFSIZE;
+    }
+    // placeholder that waits for the CONNACK
+    uint8_t *pConn = newPacket(this, 0);
+    if (pConn == NULL)
+    {
+        deletePacket(this, pBuf);
+        return UMQTT_ERR_BUFSIZE;
+    }
+    pConn[0] = CONNECT << 4;
+    pConn[1] = 0;
+
+    uint8_t *pEnc = pBuf;
+    *pEnc++ = CONNECT << 4;
+    pEnc += encodeLength(pEnc, remLen);
+    pEnc = encodeString(pEnc, "MQTT", 4);
+    *pEnc++ = 4;
+    *pEnc++ = flags;
+    pEnc = encode16(pEnc, keepAlive);
+    pEnc = encodeString(pEnc, pClientId, clientIdLen);
+    if (pWillTopic)
+    {
+        pEnc = encodeString(pEnc, pWillTopic, willTopicLen);
+        pEnc = encodeString(pEnc, pWillMessage, willMessageLen);
+    }
+    if (pUsername)
+    {
+        pEnc = encodeString(pEnc, pUsername, usernameLen);
+    }
+    if (pPassword)
+    {
+        pEnc = encodeString(pEnc, pPassword, passwordLen);
+    }
+
+    this->keepAlive = keepAlive;
+    enqueuePacket(this, pConn, 0, this->ticks);
+    umqtt_Error_t err = txPacket(this, pBuf, pEnc - pBuf, pBuf);
+    if (err != UMQTT_ERR_OK)
+    {
+        unlinkPacket(this, ((PktBuf_t *)pConn) - 1);
+        deletePacket(this, pConn);
+        return err;
+    }
+    this->connectPending = true;
+    return UMQTT_ERR_OK;
+}
+
+/**
+ * Disconnect from the MQTT server.
+ *
+ * @param h the umqtt instance handle
+ *
+ * @return UMQTT_ERR_OK if the DISCONNECT was sent, or an error code
+ */
+umqtt_Error_t
+umqtt_Disconnect(umqtt_Handle_t h)
+{
+    umqtt_Instance_t *this = h;
+    static const uint8_t disconnectPacket[2] = { DISCONNECT << 4, 0 };
+    if (this == NULL)
+    {
+        return UMQTT_ERR_PARM;
+    }
+    if (this->txRestLen)
+    {
+        return UMQTT_ERR_TX_BUSY;
+    }
+    this->isConnected = false;
+    this->connectPending = false;
+    return txPacket(this, disconnectPacket, sizeof(disconnectPacket), NULL);
+}
+
+/**
+ * Get the connection status.
+ *
+ * @return UMQTT_ERR_CONNECTED, UMQTT_ERR_CONNECT_PENDING or
+ * UMQTT_ERR_DISCONNECTED
+ */
+umqtt_Error_t
+umqtt_GetConnectedStatus(umqtt_Handle_t h)
+{
+    umqtt_Instance_t *this = h;
+    if (this == NULL)
+    {
+        return UMQTT_ERR_PARM;
+    }
+    if (this->isConnected)
+    {
+        return UMQTT_ERR_CONNECTED;
+    }
+    return this->connectPending ? UMQTT_ERR_CONNECT_PENDING : UMQTT_ERR_DISCONNECTED;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Publish
+//
+/////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @internal
+ * Check whether a qos 1 or 2 publish fits in the in-flight window.
+ */
+static bool
+windowFull(umqtt_Instance_t *this, uint32_t count)
+{
+    return this->inflightMax && ((this->inflightCount + count) > this->inflightMax);
+}
+
+/**
+ * @internal
+ * Encode the fixed header of a PUBLISH.
+ *
+ * @return pointer to where the topic goes
+ */
+static uint8_t *
+encodePublishFixed(uint8_t *pBuf, uint32_t remLen, uint8_t qos, bool shouldRetain)
+{
+    *pBuf++ = (PUBLISH << 4) | (qos << 1) | (shouldRetain ? 1 : 0);
+    return pBuf + encodeLength(pBuf, remLen);
+}
+
+/**
+ * @internal
+ * Encode the fixed and variable header of a PUBLISH.
+ *
+ * @return pointer to where the payload goes
+ */
+static uint8_t *
+encodePublish(uint8_t *pBuf, const char *pTopic, uint16_t topicLen, uint32_t remLen,
+              uint8_t qos, bool shouldRetain, uint16_t packetId)
+{
+    pBuf = encodePublishFixed(pBuf, remLen, qos, shouldRetain);
+    pBuf = encodeString(pBuf, pTopic, topicLen);
+    if (qos)
+    {
+        pBuf = encode16(pBuf, packetId);
+    }
+    return pBuf;
+}
+
+/**
+ * @internal
+ * Queue an encoded qos 1 or 2 publish for its acknowledgement and write
+ * it.  The packet is freed if the write fails.
+ */
+static umqtt_Error_t
+publishQueued(umqtt_Instance_t *this, uint8_t *pBuf, uint32_t len, uint16_t packetId)
+{
+    umqtt_Error_t err = txPacket(this, pBuf, len, NULL);
+    if (err != UMQTT_ERR_OK)
+    {
+        deletePacket(this, pBuf);
+        return err;
+    }
+    enqueuePacket(this, pBuf, packetId, this->ticks);
+    ++this->inflightCount;
+    return UMQTT_ERR_OK;
+}
+
+/**
+ * @internal
+ * Encode and send a PUBLISH.
+ *
+ * A qos 0 publish with a transport that has pfnNetWritev is written as
+ * header, topic and payload segments without a copy.  Anything else is
+ * encoded into one packet buffer, which is kept for the acknowledgement
+ * if the qos is not 0.
+ *
+ * The topic is either a string of topicLen bytes at pTopic, or with
+ * pEncTopic an encoded topic of a topic handle, which is used as it is.
+ */
+static umqtt_Error_t
+publish(umqtt_Instance_t *this, const char *pTopic, const uint8_t *pEncTopic,
+        uint16_t topicLen, const uint8_t *pMsg, uint32_t msgLen, uint8_t qos,
+        bool shouldRetain, uint16_t *pId)
+{
+    if (this->txRestLen)
+    {
+        return UMQTT_ERR_TX_BUSY;
+    }
+    if (qos && windowFull(this, 1))
+    {
+        return UMQTT_ERR_WINDOW_FULL;
+    }
+    uint32_t remLen = 2 + topicLen + (qos ? 2 : 0) + msgLen;
+
+    if ((qos == 0) && this->pfnNetWritev)
+    {
+        uint8_t hdr[7];
+        umqtt_IoVec_t iov[3];
+        uint8_t *pEnd = encodePublishFixed(hdr, remLen, 0, shouldRetain);
+        if (pEncTopic)
+        {
+            iov[1].pBuf = pEncTopic;
+            iov[1].len = 2 + topicLen;
+        }
+        else
+        {
+            pEnd = encode16(pEnd, topicLen);
+            iov[1].pBuf = (const uint8_t *)pTopic;
+            iov[1].len = topicLen;
+        }
+        iov[0].pBuf = hdr;
+        iov[0].len = pEnd - hdr;
+        iov[2].pBuf = pMsg;
+        iov[2].len = msgLen;
+        if (pId)
+        {
+            *pId = 0;
+        }
+        return txWrite(this, iov, msgLen ? 3 : 2, NULL);
+    }
+
+    uint8_t *pBuf = newPacket(this, remLen);
+    if (pBuf == NULL)
+    {
+        return UMQTT_ERR_BUFSIZE;
+    }
+    uint16_t packetId = qos ? nextPacketId(this) : 0;
+    uint8_t *pEnc;
+    if (pEncTopic)
+    {
+        pEnc = encodePublishFixed(pBuf, remLen, qos, shouldRetain);
+        memcpy(pEnc, pEncTopic, 2 + topicLen);
+        pEnc += 2 + topicLen;
+        if (qos)
+        {
+            pEnc = encode16(pEnc, packetId);
+        }
+    }
+    else
+    {
+        pEnc = encodePublish(pBuf, pTopic, topicLen, remLen, qos, shouldRetain, packetId);
+    }
+    if (msgLen)
+    {
+        memcpy(pEnc, pMsg, msgLen);
+    }
+    uint32_t len = (pEnc - pBuf) + msgLen;
+    if (pId)
+    {
+        *pId = packetId;
+    }
+    if (qos == 0)
+    {
+        return txPacket(this, pBuf, len, pBuf);
+    }
+    return publishQueued(this, pBuf, len, packetId);
+}
+
+/**
+ * Publish a message.
+ *
+ * @param h the umqtt instance handle
+ * @param pTopic topic string
+ * @param pMsg message payload, can be NULL if msgLen is 0
+ * @param msgLen length of the payload
+ * @param qos qos level 0-2
+ * @param shouldRetain retain flag of the message
+ * @param pId storage for the packet ID, 0 for qos 0, can be NULL
+ *
+ * @return UMQTT_ERR_OK if the message was sent, or an error code
+ *
+ * For qos 1 and 2 the packet is kept and resent until it is
+ * acknowledged, and UMQTT_ERR_WINDOW_FULL is returned if the in-flight
+ * window is full.
+ */
+umqtt_Error_t
+umqtt_Publish(umqtt_Handle_t h, const char *pTopic, const uint8_t *pMsg, uint32_t msgLen,
+              uint8_t qos, bool shouldRetain, uint16_t *pId)
+{
+    umqtt_Instance_t *this = h;
+    if ((this == NULL) || (pTopic == NULL) || (qos > 2))
+    {
+        return UMQTT_ERR_PARM;
+    }
+    return publish(this, pTopic, NULL, strlen(pTopic), pMsg, msgLen, qos, shouldRetain, pId);
+}
+
+/**
+ * Create a topic handle for repeated publishes to the same topic.
+ *
+ * @param h the umqtt instance handle
+ * @param pTopic topic string, must not be empty
+ *
+ * @return the topic handle, or NULL if it could not be allocated
+ *
+ * The handle holds the topic already encoded with its length prefix.
+ * Free it with umqtt_DeleteTopic().
+ */
+umqtt_TopicHandle_t
+umqtt_NewTopic(umqtt_Handle_t h, const char *pTopic)
+{
+    umqtt_Instance_t *this = h;
+    if ((this == NULL) || (pTopic == NULL) || (pTopic[0] == 0) || this->isStatic)
+    {
+        return NULL;
+    }
+    uint16_t topicLen = strlen(pTopic);
+    uint8_t *pHandle = this->pfnMalloc(2 + topicLen);
+    if (pHandle)
+    {
+        encodeString(pHandle, pTopic, topicLen);
+    }
+    return pHandle;
+}
+
+/**
+ * Free a topic handle from umqtt_NewTopic().
+ */
+void
+umqtt_DeleteTopic(umqtt_Handle_t h, umqtt_TopicHandle_t hTopic)
+{
+    umqtt_Instance_t *this = h;
+    if (this && hTopic)
+    {
+        this->pfnFree(hTopic);
+    }
+}
+
+/**
+ * Publish a message to the topic of a topic handle.
+ *
+ * Same as umqtt_Publish() except the topic comes from a handle made by
+ * umqtt_NewTopic().  The handle holds the topic as it is encoded in the
+ * packet, so it is copied, or written as its own segment, as it is.
+ */
+umqtt_Error_t
+umqtt_PublishTopic(umqtt_Handle_t h, umqtt_TopicHandle_t hTopic, const uint8_t *pMsg,
+                   uint32_t msgLen, uint8_t qos, bool shouldRetain, uint16_t *pId)
+{
+    umqtt_Instance_t *this = h;
+    const uint8_t *pTopic = hTopic;
+    if ((this == NULL) || (pTopic == NULL) || (qos > 2))
+    {
+        return UMQTT_ERR_PARM;
+    }
+    uint16_t topicLen = (pTopic[0] << 8) | pTopic[1];
+    return publish(this, NULL, pTopic, topicLen, pMsg, msgLen, qos, shouldRetain, pId);
+}
+
+/**
+ * Reserve a publish packet so the payload can be written into it.
+ *
+ * @param h the umqtt instance handle
+ * @param pTopic topic string, must not be empty
+ * @param maxLen largest payload that will be committed
+ * @param qos qos level 0-2
+ * @param shouldRetain retain flag of the message
+ * @param ppPayload storage for the pointer to where the payload goes
+ *
+ * @return UMQTT_ERR_OK or an error code
+ *
+ * The payload is written by the caller and the packet sent with
+ * umqtt_PublishCommit(), or dropped with umqtt_PublishCancel().  Only
+ * one publish can be reserved at a time.
+ */
+umqtt_Error_t
+umqtt_PublishReserve(umqtt_Handle_t h, const char *pTopic, uint32_t maxLen, uint8_t qos,
+                     bool shouldRetain, uint8_t **ppPayload)
+{
+    umqtt_Instance_t *this = h;
+    if ((this == NULL) || (pTopic == NULL) || (pTopic[0] == 0) || (qos > 2)
+     || (ppPayload == NULL))
+    {
+        return UMQTT_ERR_PARM;
+    }
+    if (this->pResv)
+    {
+        return UMQTT_ERR_TX_BUSY;
+    }
+    if (!this->isConnected)
+    {
+        return UMQTT_ERR_DISCONNECTED;
+    }
+    if (qos && windowFull(this, 1))
+    {
+        return UMQTT_ERR_WINDOW_FULL;
+    }
+    uint16_t topicLen = strlen(pTopic);
+    uint32_t remLen = 2 + topicLen + (qos ? 2 : 0) + maxLen;
+    uint8_t *pBuf = newPacket(this, remLen);
+    if (pBuf == NULL)
+    {
+        return UMQTT_ERR_BUFSIZE;
+    }
+    // header is encoded for the max length, commit moves it if the
+    // payload needs fewer length bytes
+    *ppPayload = encodePublish(pBuf, pTopic, topicLen, remLen, qos, shouldRetain, 0);
+    this->pResv = pBuf;
+    this->resvMaxLen = maxLen;
+    this->resvTopicLen = topicLen;
+    this->resvQos = qos;
+    return UMQTT_ERR_OK;
+}
+
+/**
+ * Send the publish reserved with umqtt_PublishReserve().
+ *
+ * @param h the umqtt instance handle
+ * @param msgLen length of the payload that was written
+ * @param pId storage for the packet ID, 0 for qos 0, can be NULL
+ *
+ * @return UMQTT_ERR_OK or an error code.  If msgLen is too long, the
+ * transport is busy or the in-flight window is full, the reservation is
+ * kept so the commit can be retried.
+ */
+umqtt_Error_t
+umqtt_PublishCommit(umqtt_Handle_t h, uint32_t msgLen, uint16_t *pId)
+{
+    umqtt_Instance_t *this = h;
+    if ((this == NULL) || (this->pResv == NULL) || (msgLen > this->resvMaxLen))
+    {
+        return UMQTT_ERR_PARM;
+    }
+    if (this->txRestLen)
+    {
+        return UMQTT_ERR_TX_BUSY;
+    }
+    // other publishes may have filled the window since the reserve
+    if (this->resvQos && windowFull(this, 1))
+    {
+        return UMQTT_ERR_WINDOW_FULL;
+    }
+    uint8_t *pBuf = this->pResv;
+    uint8_t qos = this->resvQos;
+    uint32_t varLen = 2 + this->resvTopicLen + (qos ? 2 : 0);
+    unsigned int maxLenBytes = lengthBytes(varLen + this->resvMaxLen);
+    uint32_t remLen = varLen + msgLen;
+    unsigned int shift = maxLenBytes - lengthBytes(remLen);
+    this->pResv = NULL;
+
+    // move the packet type up against the shorter remaining length
+    uint8_t *pPkt = pBuf + shift;
+    pPkt[0] = pBuf[0];
+    encodeLength(&pPkt[1], remLen);
+    uint32_t len = 1 + lengthBytes(remLen) + remLen;
+    uint16_t packetId = 0;
+    if (qos)
+    {
+        packetId = nextPacketId(this);
+        encode16(&pPkt[len - msgLen - 2], packetId);
+        // queued packets start at the buffer so retries find them
+        if (shift)
+        {
+            memmove(pBuf, pPkt, len);
+            pPkt = pBuf;
+        }
+    }
+    if (pId)
+    {
+        *pId = packetId;
+    }
+    if (qos == 0)
+    {
+        return txPacket(this, pPkt, len, pBuf);
+    }
+    return publishQueued(this, pBuf, len, packetId);
+}
+
+/**
+ * Drop the publish reserved with umqtt_PublishReserve().
+ *
+ * @return UMQTT_ERR_OK, or UMQTT_ERR_PARM if nothing is reserved
+ */
+umqtt_Error_t
+umqtt_PublishCancel(umqtt_Handle_t h)
+{
+    umqtt_Instance_t *this = h;
+    if ((this == NULL) || (this->pResv == NULL))
+    {
+        return UMQTT_ERR_PARM;
+    }
+    deletePacket(this, this->pResv);
+    this->pResv = NULL;
+    return UMQTT_ERR_OK;
+}
+
+/**
+ * Publish several messages at once.
+ *
+ * @param h the umqtt instance handle
+ * @param pMsgs the messages
+ * @param count number of messages
+ * @param pIds storage for count packet IDs, 0 for qos 0, can be NULL
+ *
+ * @return UMQTT_ERR_OK or an error code
+ *
+ * All qos 0 messages are encoded into one buffer, and each qos 1 or 2
+ * message into its own packet that is kept for the acknowledgement.  If
+ * the transport has pfnNetWritev, all of them are written with one call
+ * per BATCH_MAX_IOV segments in message order, otherwise with one write
+ * per buffer.  Nothing is written unless every buffer is allocated.
+ *
+ * Writing stops at a short write.  The qos 0 messages that were not
+ * written are queued behind it, and the qos 1 and 2 packets that were
+ * not written go out at their first retry.  If a write fails after part
+ * of the batch was written, the qos 1 and 2 packets are still kept and
+ * the error is returned.
+ */
+umqtt_Error_t
+umqtt_PublishBatch(umqtt_Handle_t h, const umqtt_Msg_t *pMsgs, uint32_t count, uint16_t *pIds)
+{
+    umqtt_Instance_t *this = h;
+    umqtt_Error_t err = UMQTT_ERR_OK;
+    uint32_t qos0Len = 0;
+    uint32_t queuedCount = 0;
+    if ((this == NULL) || (pMsgs == NULL) || (count == 0))
+    {
+        return UMQTT_ERR_PARM;
+    }
+    for (uint32_t idx = 0; idx < count; ++idx)
+    {
+        const umqtt_Msg_t *pMsg = &pMsgs[idx];
+        if ((pMsg->pTopic == NULL) || (pMsg->pTopic[0] == 0) || (pMsg->qos > 2))
+        {
+            return UMQTT_ERR_PARM;
+        }
+        if (pMsg->qos)
+        {
+            ++queuedCount;
+        }
+        else
+        {
+            uint32_t remLen = 2 + strlen(pMsg->pTopic) + pMsg->msgLen;
+            qos0Len += 1 + lengthBytes(remLen) + remLen;
+        }
+    }
+    if (!this->isConnected)
+    {
+        return UMQTT_ERR_DISCONNECTED;
+    }
+    if (this->txRestLen)
+    {
+        return UMQTT_ERR_TX_BUSY;
+    }
+    if (queuedCount && windowFull(this, queuedCount))
+    {
+        return UMQTT_ERR_WINDOW_FULL;
+    }
+
+    // allocate everything before anything is sent
+    uint8_t *pQos0 = NULL;
+    if (qos0Len)
+    {
+        pQos0 = newPacket(this, qos0Len);
+        if (pQos0 == NULL)
+        {
+            return UMQTT_ERR_BUFSIZE;
+        }
+    }
+    // qos 1 and 2 packets are chained through the packet header
+    // until they are queued
+    PktBuf_t *pFirst = NULL;
+    PktBuf_t **ppLast = &pFirst;
+    for (uint32_t idx = 0; idx < count; ++idx)
+    {
+        const umqtt_Msg_t *pMsg = &pMsgs[idx];
+        if (pMsg->qos)
+        {
+            uint32_t remLen = 2 + strlen(pMsg->pTopic) + 2 + pMsg->msgLen;
+            uint8_t *pBuf = newPacket(this, remLen);
+            if (pBuf == NULL)
+            {
+                while (pFirst)
+                {
+                    PktBuf_t *pNext = pFirst->next;
+                    deletePacket(this, (uint8_t *)&pFirst[1]);
+                    pFirst = pNext;
+                }
+                deletePacket(this, pQos0);
+                return UMQTT_ERR_BUFSIZE;
+            }
+            *ppLast = ((PktBuf_t *)pBuf) - 1;
+            ppLast = &(*ppLast)->next;
+        }
+    }
+
+    // encode, building the segment list in message order
+    umqtt_IoVec_t iov[BATCH_MAX_IOV];
+    unsigned int iovCnt = 0;
+    uint8_t *pEnc0 = pQos0;
+    // start of the qos 0 messages that have not been written
+    uint8_t *pUnsent0 = pQos0;
+    bool isSent = false;
+    PktBuf_t *pPkt = pFirst;
+    for (uint32_t idx = 0; idx < count; ++idx)
+    {
+        const umqtt_Msg_t *pMsg = &pMsgs[idx];
+        uint16_t topicLen = strlen(pMsg->pTopic);
+        uint32_t remLen = 2 + topicLen + (pMsg->qos ? 2 : 0) + pMsg->msgLen;
+        uint16_t packetId = 0;
+        uint8_t *pBuf = pEnc0;
+        if (pMsg->qos)
+        {
+            pBuf = (uint8_t *)&pPkt[1];
+            pPkt->packetId = packetId = nextPacketId(this);
+            pPkt = pPkt->next;
+        }
+        uint8_t *pEnc = encodePublish(pBuf, pMsg->pTopic, topicLen, remLen, pMsg->qos,
+                                      pMsg->shouldRetain, packetId);
+        if (pMsg->msgLen)
+        {
+            memcpy(pEnc, pMsg->pMsg, pMsg->msgLen);
+        }
+        uint32_t len = (pEnc - pBuf) + pMsg->msgLen;
+        if (pIds)
+        {
+            pIds[idx] = packetId;
+        }
+        if (pMsg->qos == 0)
+        {
+            pEnc0 += len;
+        }
+        if (this->pfnNetWritev)
+        {
+            // consecutive qos 0 messages are one segment
+            if ((pMsg->qos == 0) && iovCnt && (iov[iovCnt - 1].pBuf + iov[iovCnt - 1].len == pBuf))
+            {
+                iov[iovCnt - 1].len += len;
+                continue;
+            }
+            if (iovCnt == BATCH_MAX_IOV)
+            {
+                // nothing more is written after a short write
+                if ((err == UMQTT_ERR_OK) && !this->txRestLen)
+                {
+                    err = txWrite(this, iov, iovCnt, NULL);
+                    isSent = isSent || (err == UMQTT_ERR_OK);
+                    pUnsent0 = (pMsg->qos == 0) ? pBuf : pEnc0;
+                }
+                iovCnt = 0;
+            }
+            iov[iovCnt].pBuf = pBuf;
+            iov[iovCnt].len = len;
+            ++iovCnt;
+        }
+    }
+
+    // write
+    if (this->pfnNetWritev)
+    {
+        if ((err == UMQTT_ERR_OK) && !this->txRestLen && iovCnt)
+        {
+            err = txWrite(this, iov, iovCnt, NULL);
+            isSent = isSent || (err == UMQTT_ERR_OK);
+            pUnsent0 = pEnc0;
+        }
+    }
+    else
+    {
+        if (pQos0)
+        {
+            err = txPacket(this, pQos0, qos0Len, NULL);
+            isSent = (err == UMQTT_ERR_OK);
+            pUnsent0 = pEnc0;
+        }
+        for (pPkt = pFirst; pPkt && (err == UMQTT_ERR_OK) && !this->txRestLen; pPkt = pPkt->next)
+        {
+            uint8_t *pBuf = (uint8_t *)&pPkt[1];
+            err = txPacket(this, pBuf, packetLength(pBuf), NULL);
+            isSent = isSent || (err == UMQTT_ERR_OK);
+        }
+    }
+
+    // a partial write holds on to the qos 0 buffer until it is done
+    if (pQos0 && this->txRestLen && (this->pTxRestOwned == NULL)
+     && (this->pTxRest >= pQos0) && (this->pTxRest < (pQos0 + qos0Len)))
+    {
+        this->pTxRestOwned = pQos0;
+        pQos0 = NULL;
+    }
+    else if (pQos0 && this->txRestLen && (pUnsent0 < (pQos0 + qos0Len)))
+    {
+        // qos 0 messages that were not written are queued behind the
+        // partial write in their own buffer, which needs no copy
+        umqtt_IoVec_t rest;
+        rest.pBuf = pQos0;
+        rest.len = (pQos0 + qos0Len) - pUnsent0;
+        memmove(pQos0, pUnsent0, rest.len);
+        txQueue(this, &rest, 1, rest.len, pQos0);
+        pQos0 = NULL;
+    }
+    deletePacket(this, pQos0);
+    while (pFirst)
+    {
+        PktBuf_t *pNext = pFirst->next;
+        uint8_t *pBuf = (uint8_t *)&pFirst[1];
+        if ((err == UMQTT_ERR_OK) || isSent)
+        {
+            // packets not written because of a partial write or an
+            // error go out at their first retry, and any that may be
+            // on the wire are kept for their ack
+            enqueuePacket(this, pBuf, pFirst->packetId, this->ticks);
+            ++this->inflightCount;
+        }
+        else
+        {
+            deletePacket(this, pBuf);
+        }
+        pFirst = pNext;
+    }
+    return err;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Subscribe
+//
+/////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Subscribe to topics.
+ *
+ * @param h the umqtt instance handle
+ * @param count number of topics
+ * @param pTopics topic filters
+ * @param pQos requested qos of each topic
+ * @param pId storage for the packet ID, can be NULL
+ *
+ * @return UMQTT_ERR_OK if the SUBSCRIBE was sent, or an error code
+ */
+umqtt_Error_t
+umqtt_Subscribe(umqtt_Handle_t h, uint32_t count, char *pTopics[], uint8_t pQos[],
+                uint16_t *pId)
+{
+    umqtt_Instance_t *this = h;
+    if ((this == NULL) || (count == 0) || (pTopics == NULL) || (pQos == NULL))
+    {
+        return UMQTT_ERR_PARM;
+    }
+    if (this->txRestLen)
+    {
+        return UMQTT_ERR_TX_BUSY;
+    }
+    uint32_t remLen = 2;
+    for (uint32_t idx = 0; idx < count; ++idx)
+    {
+        remLen += 2 + strlen(pTopics[idx]) + 1;
+    }
+    uint8_t *pBuf = newPacket(this, remLen);
+    if (pBuf == NULL)
+    {
+        return UMQTT_ERR_BUFSIZE;
+    }
+    uint16_t packetId = nextPacketId(this);
+    uint8_t *pEnc = pBuf;
+    *pEnc++ = (SUBSCRIBE << 4) | 2;
+    pEnc += encodeLength(pEnc, remLen);
+    pEnc = encode16(pEnc, packetId);
+    for (uint32_t idx = 0; idx < count; ++idx)
+    {
+        pEnc = encodeString(pEnc, pTopics[idx], strlen(pTopics[idx]));
+        *pEnc++ = pQos[idx];
+    }
+    umqtt_Error_t err = txPacket(this, pBuf, pEnc - pBuf, NULL);
+    if (err != UMQTT_ERR_OK)
+    {
+        deletePacket(this, pBuf);
+        return err;
+    }
+    enqueuePacket(this, pBuf, packetId, this->ticks);
+    if (pId)
+    {
+        *pId = packetId;
+    }
+    return UMQTT_ERR_OK;
+}
+
+/**
+ * Unsubscribe from topics.
+ *
+ * @param h the umqtt instance handle
+ * @param count number of topics
+ * @param pTopics topic filters
+ * @param pId storage for the packet ID, can be NULL
+ *
+ * @return UMQTT_ERR_OK if the UNSUBSCRIBE was sent, or an error code
+ */
+umqtt_Error_t
+umqtt_Unsubscribe(umqtt_Handle_t h, uint32_t count, const char *pTopics[], uint16_t *pId)
+{
+    umqtt_Instance_t *this = h;
+    if ((this == NULL) || (count == 0) || (pTopics == NULL))
+    {
+        return UMQTT_ERR_PARM;
+    }
+    if (this->txRestLen)
+    {
+        return UMQTT_ERR_TX_BUSY;
+    }
+    uint32_t remLen = 2;
+    for (uint32_t idx = 0; idx < count; ++idx)
+    {
+        remLen += 2 + strlen(pTopics[idx]);
+    }
+    uint8_t *pBuf = newPacket(this, remLen);
+    if (pBuf == NULL)
+    {
+        return UMQTT_ERR_BUFSIZE;
+    }
+    uint16_t packetId = nextPacketId(this);
+    uint8_t *pEnc = pBuf;
+    *pEnc++ = (UNSUBSCRIBE << 4) | 2;
+    pEnc += encodeLength(pEnc, remLen);
+    pEnc = encode16(pEnc, packetId);
+    for (uint32_t idx = 0; idx < count; ++idx)
+    {
+        pEnc = encodeString(pEnc, pTopics[idx], strlen(pTopics[idx]));
+    }
+    umqtt_Error_t err = txPacket(this, pBuf, pEnc - pBuf, NULL);
+    if (err != UMQTT_ERR_OK)
+    {
+        deletePacket(this, pBuf);
+        return err;
+    }
+    enqueuePacket(this, pBuf, packetId, this->ticks);
+    if (pId)
+    {
+        *pId = packetId;
+    }
+    return UMQTT_ERR_OK;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Run loop
+//
+/////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Decode a complete packet received from the server.
+ *
+ * @param h the umqtt instance handle
+ * @param pIncoming the packet
+ * @param incomingLen length of the packet
+ *
+ * @return UMQTT_ERR_OK or an error code
+ *
+ * Callbacks are called for the packet, and an ack is sent if one is
+ * needed.  umqtt_Run() does this for data it reads from the transport.
+ */
+umqtt_Error_t
+umqtt_DecodePacket(umqtt_Handle_t h, uint8_t *pIncoming, uint32_t incomingLen)
+{
+    umqtt_Instance_t *this = h;
+    if ((this == NULL) || (pIncoming == NULL) || (incomingLen == 0))
+    {
+        return UMQTT_ERR_PARM;
+    }
+    return decodePacket(this, pIncoming, incomingLen);
+}
+
+/**
+ * @internal
+ * Handle an expired packet retry timer.
+ *
+ * @return UMQTT_ERR_OK, UMQTT_ERR_NETWORK if the resend failed, or
+ * UMQTT_ERR_TIMEOUT if the packet was given up
+ */
+static umqtt_Error_t
+retryPacket(umqtt_Instance_t *this, PktBuf_t *pPkt)
+{
+    uint8_t *pBuf = (uint8_t *)&pPkt[1];
+    uint8_t type = pBuf[0] >> 4;
+    if ((type == CONNECT) || (pPkt->ttl == 0))
+    {
+        unlinkPacket(this, pPkt);
+        if (type == CONNECT)
+        {
+            this->connectPending = false;
+            STATS_INC(connackTimeouts);
+        }
+        else
+        {
+            STATS_INC(expired);
+            if (((type == PUBLISH) || (type == PUBREL)) && this->inflightCount)
+            {
+                --this->inflightCount;
+            }
+        }
+        deletePacket(this, pBuf);
+        return UMQTT_ERR_TIMEOUT;
+    }
+
+    // back off, and the resent packet becomes the newest
+    uint32_t interval = 2 * (pPkt->timer.expires - pPkt->ticks);
+    if (interval > this->rtoMax)
+    {
+        interval = this->rtoMax;
+    }
+    --pPkt->ttl;
+    pPkt->ticks = this->ticks;
+    listUnlink(this, pPkt);
+    listLink(this, pPkt);
+    timerStart(this, &pPkt->timer, this->ticks + interval);
+    STATS_INC(retries);
+    return txPacket(this, pBuf, packetLength(pBuf), NULL);
+}
+
+/**
+ * @internal
+ * Handle the keep alive timer.
+ */
+static umqtt_Error_t
+keepAliveExpired(umqtt_Instance_t *this)
+{
+    static const uint8_t pingreqPacket[2] = { PINGREQ << 4, 0 };
+    if (!this->isConnected)
+    {
+        return UMQTT_ERR_OK;
+    }
+    umqtt_Error_t err = txPacket(this, pingreqPacket, sizeof(pingreqPacket), NULL);
+    if (err == UMQTT_ERR_OK)
+    {
+        this->pingOutstanding = true;
+        this->pingSentTicks = this->ticks;
+        // a coalesced ping restarts keep alive when it is flushed
+        if (this->pingTimer.pprev == NULL)
+        {
+            restartKeepAlive(this);
+        }
+    }
+    else
+    {
+        // try again on the next run
+        timerStart(this, &this->pingTimer, this->ticks);
+    }
+    return err;
+}
+
+/**
+ * @internal
+ * Process the timer wheel up to the current ticks.
+ *
+ * @return UMQTT_ERR_OK or the first error of an expired timer
+ *
+ * The wheel moves from slot to slot with timers, not tick by tick.  A
+ * level 0 slot holds timers of a single tick, which are expired when
+ * the wheel reaches it.  The timers of a higher level slot are moved to
+ * the levels below when the wheel reaches the start of the slot, which
+ * happens at most WHEEL_LEVELS - 1 times for a timer.  A run with
+ * nothing due is therefore O(1), and each expired timer adds O(1).
+ *
+ * Expired timers are moved to a local list before they are handled so
+ * that a timer that is restarted by its handler is not seen again in
+ * the same run.  After an error, or once a resend is left partly
+ * written, the rest of them wait for the next run.  Ticks that went
+ * back do not move the wheel.
+ */
+static umqtt_Error_t
+timerRun(umqtt_Instance_t *this)
+{
+    umqtt_Error_t err = UMQTT_ERR_OK;
+    Timer_t *pExpired = NULL;
+    Timer_t **ppTail = &pExpired;
+
+    // timers that were due when started, the due list is newest first
+    Timer_t *pDue = this->wheelDue;
+    this->wheelDue = NULL;
+    while (pDue)
+    {
+        Timer_t *pNext = pDue->next;
+        timerLink(&pExpired, pDue);
+        if (ppTail == &pExpired)
+        {
+            ppTail = &pDue->next;
+        }
+        pDue = pNext;
+    }
+
+    uint32_t elapsed = 0;
+    if ((int32_t)(this->ticks - this->wheelTicks) > 0)
+    {
+        elapsed = this->ticks - this->wheelTicks;
+    }
+    while (elapsed)
+    {
+        unsigned int level;
+        uint32_t slot;
+        uint32_t delta = timerNextSlot(this, &level, &slot);
+        if ((delta == 0) || (delta > elapsed))
+        {
+            break;
+        }
+        this->wheelTicks += delta;
+        elapsed -= delta;
+        Timer_t *pTimer = this->wheel[level][slot];
+        this->wheel[level][slot] = NULL;
+        this->wheelUsed[level] &= ~(1U << slot);
+        while (pTimer)
+        {
+            Timer_t *pNext = pTimer->next;
+            if (pTimer->expires == this->wheelTicks)
+            {
+                timerLink(ppTail, pTimer);
+                ppTail = &pTimer->next;
+            }
+            else
+            {
+                timerStart(this, pTimer, pTimer->expires);
+            }
+            pTimer = pNext;
+        }
+    }
+    this->wheelTicks += elapsed;
+
+    while (pExpired)
+    {
+        Timer_t *pTimer = pExpired;
+        timerStop(this, pTimer);
+        if ((err != UMQTT_ERR_OK) || this->txRestLen)
+        {
+            // handled on the next run
+            timerStart(this, pTimer, pTimer->expires);
+        }
+        else if (pTimer == &this->pingTimer)
+        {
+            err = keepAliveExpired(this);
+        }
+        else
+        {
+            PktBuf_t *pPkt = (PktBuf_t *)((uint8_t *)pTimer - offsetof(PktBuf_t, timer));
+            err = retryPacket(this, pPkt);
+        }
+    }
+    return err;
+}
+
+/**
+ * Run the umqtt client.  Call it periodically, or at the deadline from
+ * umqtt_GetNextDeadline().
+ *
+ * @param h the umqtt instance handle
+ * @param ticks current time in milliseconds
+ *
+ * @return UMQTT_ERR_OK or an error code
+ *
+ * A partial write is continued first, and nothing else is done until
+ * it is complete.  Then one read is done and all complete packets are
+ * decoded, expired retry and keep alive timers are handled, and
+ * coalesced transmit data is written when its delay is over.
+ */
+umqtt_Error_t
+umqtt_Run(umqtt_Handle_t h, uint32_t ticks)
+{
+    umqtt_Instance_t *this = h;
+    umqtt_Error_t err;
+    if (this == NULL)
+    {
+        return UMQTT_ERR_PARM;
+    }
+    this->ticks = ticks;
+
+    if (this->txRestLen)
+    {
+        err = txResume(this);
+        if ((err != UMQTT_ERR_OK) || this->txRestLen)
+        {
+            return err;
+        }
+    }
+
+    err = rxRun(this);
+    if (err != UMQTT_ERR_OK)
+    {
+        return err;
+    }
+
+    err = timerRun(this);
+
+    if (this->txLen && !this->txRestLen
+     && ((int32_t)(ticks - (this->txFirstTicks + this->txMaxDelay)) >= 0))
+    {
+        umqtt_Error_t flushErr = txFlush(this);
+        if (err == UMQTT_ERR_OK)
+        {
+            err = flushErr;
+        }
+    }
+    return err;
+}
+
+/**
+ * Get the ticks when umqtt_Run() next has something to do.
+ *
+ * @param h the umqtt instance handle
+ * @param pTicks storage for the deadline ticks
+ *
+ * @return UMQTT_ERR_OK, or UMQTT_ERR_NO_DEADLINE if nothing is scheduled
+ * and pTicks is not changed
+ *
+ * Incoming data is not known, so the host must also call umqtt_Run()
+ * when data arrives.  While a partial write is in progress nothing else
+ * is done, and the deadline is a short retry time after the last
+ * umqtt_Run().  A host that can wait for the network to be writable
+ * should also call umqtt_Run() when it is.
+ */
+umqtt_Error_t
+umqtt_GetNextDeadline(umqtt_Handle_t h, uint32_t *pTicks)
+{
+    umqtt_Instance_t *this = h;
+    uint32_t deadline;
+    if ((this == NULL) || (pTicks == NULL))
+    {
+        return UMQTT_ERR_PARM;
+    }
+    if (this->txRestLen)
+    {
+        *pTicks = this->ticks + TX_RESUME_TICKS;
+        return UMQTT_ERR_OK;
+    }
+    bool found = timerEarliest(this, &deadline);
+    if (this->txLen)
+    {
+        uint32_t flushTicks = this->txFirstTicks + this->txMaxDelay;
+        if (!found || ((int32_t)(flushTicks - deadline) < 0))
+        {
+            deadline = flushTicks;
+            found = true;
+        }
+    }
+    if (!found)
+    {
+        return UMQTT_ERR_NO_DEADLINE;
+    }
+    *pTicks = deadline;
+    return UMQTT_ERR_OK;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Options and status
+//
+/////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Get the number of packet allocations that did not fit the pool.
+ */
+umqtt_Error_t
+umqtt_GetPoolFallbacks(umqtt_Handle_t h, uint32_t *pCount)
+{
+    umqtt_Instance_t *this = h;
+    if ((this == NULL) || (pCount == NULL))
+    {
+        return UMQTT_ERR_PARM;
+    }
+    *pCount = this->poolFallbacks;
+    return UMQTT_ERR_OK;
+}
+
+/**
+ * Set whether received packets restart the keep alive timer.  By
+ * default only sent packets do.
+ */
+umqtt_Error_t
+umqtt_SetKeepAliveOnReceive(umqtt_Handle_t h, bool enable)
+{
+    umqtt_Instance_t *this = h;
+    if (this == NULL)
+    {
+        return UMQTT_ERR_PARM;
+    }
+    this->keepAliveOnRx = enable;
+    return UMQTT_ERR_OK;
+}
+
+/**
+ * Set the bounds of the adaptive retry timeout, in milliseconds.  The
+ * timeout and its exponential backoff stay within the bounds.
+ */
+umqtt_Error_t
+umqtt_SetRetryBounds(umqtt_Handle_t h, uint32_t minMs, uint32_t maxMs)
+{
+    umqtt_Instance_t *this = h;
+    if ((this == NULL) || (minMs == 0) || (minMs > maxMs))
+    {
+        return UMQTT_ERR_PARM;
+    }
+    this->rtoMin = minMs;
+    this->rtoMax = maxMs;
+    if (this->rto < minMs)
+    {
+        this->rto = minMs;
+    }
+    if (this->rto > maxMs)
+    {
+        this->rto = maxMs;
+    }
+    return UMQTT_ERR_OK;
+}
+
+/**
+ * Get the smoothed round trip time, its variance and the current retry
+ * timeout, in milliseconds.  Any of the outputs can be NULL.
+ */
+umqtt_Error_t
+umqtt_GetRtt(umqtt_Handle_t h, uint32_t *pSrtt, uint32_t *pRttVar, uint32_t *pRto)
+{
+    umqtt_Instance_t *this = h;
+    if (this == NULL)
+    {
+        return UMQTT_ERR_PARM;
+    }
+    if (pSrtt)
+    {
+        *pSrtt = this->srtt;
+    }
+    if (pRttVar)
+    {
+        *pRttVar = this->rttVar;
+    }
+    if (pRto)
+    {
+        *pRto = this->rto;
+    }
+    return UMQTT_ERR_OK;
+}
+
+/**
+ * Set the max number of qos 1 and 2 publishes in flight, 0 for no
+ * limit.  A publish that does not fit returns UMQTT_ERR_WINDOW_FULL.
+ * The packet ID index is grown to a bucket per publish in the window,
+ * so it does not have to grow while publishing.
+ */
+umqtt_Error_t
+umqtt_SetInflightWindow(umqtt_Handle_t h, unsigned int maxInflight)
+{
+    umqtt_Instance_t *this = h;
+    if ((this == NULL) || (maxInflight > 0xFFFF))
+    {
+        return UMQTT_ERR_PARM;
+    }
+    this->inflightMax = maxInflight;
+    // one ID index bucket per publish in the window
+    uint32_t buckets = ID_BUCKETS;
+    while (buckets < maxInflight)
+    {
+        buckets *= 2;
+    }
+    idResize(this, buckets);
+    return UMQTT_ERR_OK;
+}
+
+/**
+ * Get the number of qos 1 and 2 publishes in flight.
+ */
+umqtt_Error_t
+umqtt_GetInflightCount(umqtt_Handle_t h, unsigned int *pCount)
+{
+    umqtt_Instance_t *this = h;
+    if ((this == NULL) || (pCount == NULL))
+    {
+        return UMQTT_ERR_PARM;
+    }
+    *pCount = this->inflightCount;
+    return UMQTT_ERR_OK;
+}
+
+/**
+ * Set whether a short write is continued by umqtt_Run() instead of
+ * failing.  While a write is in progress, functions that send return
+ * UMQTT_ERR_TX_BUSY.
+ */
+umqtt_Error_t
+umqtt_SetPartialWrites(umqtt_Handle_t h, bool enable)
+{
+    umqtt_Instance_t *this = h;
+    if (this == NULL)
+    {
+        return UMQTT_ERR_PARM;
+    }
+    this->partialWrites = enable;
+    return UMQTT_ERR_OK;
+}
+
+/**
+ * Set a buffer that gathers sent packets into fewer writes.
+ *
+ * @param h the umqtt instance handle
+ * @param pBuf the coalescing buffer, or NULL to turn it off
+ * @param bufLen length of the buffer
+ * @param maxDelay max ticks data is held before umqtt_Run() writes it,
+ * 0 to write at the end of every umqtt_Run()
+ *
+ * @return UMQTT_ERR_OK or an error code
+ *
+ * Anything already gathered is written first.
+ */
+umqtt_Error_t
+umqtt_SetTxCoalescing(umqtt_Handle_t h, uint8_t *pBuf, uint32_t bufLen, uint32_t maxDelay)
+{
+    umqtt_Instance_t *this = h;
+    if ((this == NULL) || (pBuf && (bufLen == 0)))
+    {
+        return UMQTT_ERR_PARM;
+    }
+    if (this->txRestLen)
+    {
+        return UMQTT_ERR_TX_BUSY;
+    }
+    umqtt_Error_t err = txFlush(this);
+    this->pTxBuf = pBuf;
+    this->txBufLen = pBuf ? bufLen : 0;
+    this->txMaxDelay = maxDelay;
+    return err;
+}
+
+#ifdef UMQTT_ENABLE_STATS
+/**
+ * Get a snapshot of the statistics counters.
+ */
+umqtt_Error_t
+umqtt_GetStats(umqtt_Handle_t h, umqtt_Stats_t *pStats)
+{
+    umqtt_Instance_t *this = h;
+    if ((this == NULL) || (pStats == NULL))
+    {
+        return UMQTT_ERR_PARM;
+    }
+    *pStats = this->stats;
+    return UMQTT_ERR_OK;
+}
+
+/**
+ * Get a snapshot of the latency histogram of an acknowledgement type.
+ */
+umqtt_Error_t
+umqtt_GetAckLatency(umqtt_Handle_t h, umqtt_AckType_t type, umqtt_LatencyHist_t *pHist)
+{
+    umqtt_Instance_t *this = h;
+    if ((this == NULL) || ((unsigned int)type >= UMQTT_ACK_NUM_TYPES) || (pHist == NULL))
+    {
+        return UMQTT_ERR_PARM;
+    }
+    *pHist = this->latency[type];
+    return UMQTT_ERR_OK;
+}
+
+/**
+ * Get a latency percentile from a histogram.
+ *
+ * @param pHist the histogram
+ * @param perMille the percentile in tenths of a percent, 0-1000
+ * @param pMs storage for the latency
+ *
+ * @return UMQTT_ERR_OK or UMQTT_ERR_PARM
+ *
+ * The latency is the upper bound of the bucket the percentile falls
+ * in, but not more than the longest latency seen.  It is 0 for an
+ * empty histogram.
+ */
+umqtt_Error_t
+umqtt_GetLatencyPercentile(const umqtt_LatencyHist_t *pHist, unsigned int perMille,
+                           uint32_t *pMs)
+{
+    if ((pHist == NULL) || (perMille > 1000) || (pMs == NULL))
+    {
+        return UMQTT_ERR_PARM;
+    }
+    *pMs = 0;
+    if (pHist->count == 0)
+    {
+        return UMQTT_ERR_OK;
+    }
+    uint64_t target = (((uint64_t)pHist->count * perMille) + 999) / 1000;
+    uint64_t sum = 0;
+    for (unsigned int bucket = 0; bucket < UMQTT_LATENCY_BUCKETS; ++bucket)
+    {
+        sum += pHist->bucket[bucket];
+        if ((sum >= target) && pHist->bucket[bucket])
+        {
+            uint32_t upper = (1UL << bucket) - 1;
+            if ((bucket == (UMQTT_LATENCY_BUCKETS - 1)) || (upper > pHist->maxMs))
+            {
+                upper = pHist->maxMs;
+            }
+            *pMs = upper;
+            break;
+        }
+    }
+    return UMQTT_ERR_OK;
+}
+#endif
+
+/** @} */
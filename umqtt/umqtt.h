@@ -0,0 +1,336 @@
+/******************************************************************************
+ * umqtt.h - Public interface of umqtt, a minimal MQTT client library
+ *
+ * Copyright (c) 2016, Joseph Kroesche (tronics.kroesche.io)
+ * All rights reserved.
+ *
+ * This software is released under the FreeBSD license, found in the
+ * accompanying file LICENSE.txt and at the following URL:
+ *      http://www.freebsd.org/copyright/freebsd-license.html
+ *
+ * This software is provided as-is and without warranty.
+ *
+ *****************************************************************************/
+
+#ifndef __UMQTT_H__
+#define __UMQTT_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @addtogroup umqtt_client
+ * @{
+ */
+
+/**
+ * Error codes returned by umqtt functions.
+ */
+typedef enum
+{
+    UMQTT_ERR_OK,           ///< no error
+    UMQTT_ERR_PACKET_ERROR, ///< malformed packet
+    UMQTT_ERR_BUFSIZE,      ///< packet buffer could not be allocated
+    UMQTT_ERR_PARM,         ///< bad function parameter
+    UMQTT_ERR_NETWORK,      ///< network read or write failed
+    UMQTT_ERR_CONNECT_PENDING, ///< connect sent, waiting for CONNACK
+    UMQTT_ERR_CONNECTED,    ///< client is connected
+    UMQTT_ERR_DISCONNECTED, ///< client is not connected
+    UMQTT_ERR_TIMEOUT,      ///< packet was not acknowledged in time
+    UMQTT_ERR_NO_DEADLINE,  ///< nothing is scheduled
+    UMQTT_ERR_WINDOW_FULL,  ///< in-flight window is full
+    UMQTT_ERR_TX_BUSY,      ///< a partial write is still in progress
+} umqtt_Error_t;
+
+/**
+ * Handle of a umqtt instance, returned by umqtt_New().
+ */
+typedef void * umqtt_Handle_t;
+
+/**
+ * Handle of a pre-encoded topic, returned by umqtt_NewTopic().
+ */
+typedef void * umqtt_TopicHandle_t;
+
+/**
+ * One message of a batch publish, see umqtt_PublishBatch().
+ */
+typedef struct
+{
+    const char *pTopic;     ///< topic string, must not be empty
+    const uint8_t *pMsg;    ///< message payload, can be NULL if msgLen is 0
+    uint32_t msgLen;        ///< length of the payload
+    uint8_t qos;            ///< qos level 0-2
+    bool shouldRetain;      ///< retain flag for the message
+} umqtt_Msg_t;
+
+/**
+ * One segment of a scatter/gather write, see pfnNetWritev.
+ */
+typedef struct
+{
+    const uint8_t *pBuf;    ///< segment data
+    uint32_t len;           ///< segment length
+} umqtt_IoVec_t;
+
+/**
+ * One class of fixed size blocks of the packet pool.  The block size
+ * is the largest packet that fits the block, including the MQTT fixed
+ * header.
+ */
+typedef struct
+{
+    uint16_t blockSize;     ///< largest packet held by a block
+    uint16_t blockCount;    ///< number of blocks of this class
+} umqtt_PoolClass_t;
+
+/**
+ * Transport configuration, supplies memory management and network
+ * functions to the umqtt instance.
+ *
+ * Incoming data is taken with one of three methods.  pfnNetReadPacket
+ * returns a buffer that umqtt frees with pfnFree.  pfnNetReadInto reads
+ * into a receive buffer of rxBufLen bytes that is either pRxBuf or is
+ * allocated by umqtt.  pfnNetReadSegment returns data that stays owned
+ * by the transport until it is handed back to pfnNetReleaseSegment.
+ * If pfnNetReadSegment is set it is used, otherwise pfnNetReadInto if
+ * set, otherwise pfnNetReadPacket.  Each read can return any number of
+ * bytes, umqtt finds the packet boundaries.
+ *
+ * If pfnNetWritev is set, packets are written with it so that a
+ * publish payload can be sent from the caller buffer without a copy.
+ *
+ * If numPoolClasses is not 0, packet buffers are taken from fixed
+ * size blocks allocated once when the instance is created, and
+ * pfnMalloc is only used when no block fits or the class is empty.
+ */
+typedef struct
+{
+    void *hNet;             ///< network handle passed to the net functions
+    void *(*pfnMalloc)(size_t size); ///< allocate memory
+    void (*pfnFree)(void *ptr);      ///< free memory
+    /// read incoming data into a buffer allocated by the transport,
+    /// returns the number of bytes, 0 if none, negative on error
+    int (*pfnNetReadPacket)(void *hNet, uint8_t **ppBuf);
+    /// write data, returns the number of bytes written, negative on error
+    int (*pfnNetWritePacket)(void *hNet, const uint8_t *pBuf, uint32_t len, bool isMore);
+    /// read up to len bytes of incoming data into pBuf (optional)
+    int (*pfnNetReadInto)(void *hNet, uint8_t *pBuf, uint32_t len);
+    uint8_t *pRxBuf;        ///< receive buffer for pfnNetReadInto, or NULL
+    uint32_t rxBufLen;      ///< length of the receive buffer
+    /// return incoming data that is owned by the transport (optional)
+    int (*pfnNetReadSegment)(void *hNet, const uint8_t **ppData, void **ppSeg);
+    /// give a segment from pfnNetReadSegment back to the transport
+    void (*pfnNetReleaseSegment)(void *hNet, void *pSeg);
+    /// write the segments as one, returns total written (optional)
+    int (*pfnNetWritev)(void *hNet, const umqtt_IoVec_t *pIov, unsigned int iovCnt);
+    const umqtt_PoolClass_t *pPoolClasses; ///< packet pool classes, smallest first
+    unsigned int numPoolClasses;    ///< number of pool classes, 0 for no pool
+} umqtt_TransportConfig_t;
+
+/**
+ * Callback functions for packets received from the server.  Any of
+ * them can be NULL.
+ */
+typedef struct
+{
+    /// CONNACK was received
+    void (*pfnConnackCb)(umqtt_Handle_t h, void *pUser, bool sessionPresent,
+                         uint8_t returnCode);
+    /// PUBLISH was received
+    void (*pfnPublishCb)(umqtt_Handle_t h, void *pUser, bool dup, bool retain,
+                         uint8_t qos, const char *pTopic, uint16_t topicLen,
+                         const uint8_t *pMsg, uint16_t msgLen);
+    /// PUBACK, or PUBCOMP of a qos 2 publish, was received
+    void (*pfnPubackCb)(umqtt_Handle_t h, void *pUser, uint16_t msgId);
+    /// SUBACK was received
+    void (*pfnSubackCb)(umqtt_Handle_t h, void *pUser, const uint8_t *retCodes,
+                        uint16_t retCount, uint16_t msgId);
+    /// UNSUBACK was received
+    void (*pfnUnsubackCb)(umqtt_Handle_t h, void *pUser, uint16_t msgId);
+    /// PINGRESP was received
+    void (*pfnPingrespCb)(umqtt_Handle_t h, void *pUser);
+} umqtt_Callbacks_t;
+
+#ifdef UMQTT_ENABLE_DUP_FILTER
+/**
+ * Number of inbound qos 1 packet IDs remembered by the duplicate filter,
+ * must be a multiple of 32.  Each one takes one bit of the instance.
+ */
+#ifndef UMQTT_DUP_FILTER_BITS
+#define UMQTT_DUP_FILTER_BITS 2048
+#endif
+#if (UMQTT_DUP_FILTER_BITS % 32) != 0
+#error "UMQTT_DUP_FILTER_BITS must be a multiple of 32"
+#endif
+#endif
+
+/**
+ * Size of the packet overhead that umqtt keeps in front of each packet
+ * buffer.  Used to size the packet pool.
+ */
+#define UMQTT_PKTBUF_SIZE (sizeof(umqtt_PktBufLayout_t))
+
+/**
+ * Memory needed by one packet pool class.
+ */
+#define UMQTT_POOL_BYTES(blockSize, blockCount) \
+    (((((blockSize) + 7) & ~7) + UMQTT_PKTBUF_SIZE) * (blockCount))
+
+/**
+ * Memory reserved for the instance at the start of a static arena.
+ */
+#define UMQTT_INSTANCE_SIZE (1088 + UMQTT_TIMER_WHEEL_SIZE + UMQTT_INSTANCE_EXTRA)
+
+/**
+ * Memory used in a static arena for the packet ID index of a packet
+ * pool of poolBytes.  It has room for a bucket per pool block rounded
+ * up to a power of 2.
+ */
+#define UMQTT_ID_TABLE_BYTES(poolBytes) \
+    (((poolBytes) / (UMQTT_PKTBUF_SIZE + 8)) * 2 * sizeof(void *))
+
+/**
+ * Size of the arena needed by umqtt_NewStatic() for a receive buffer of
+ * rxBufLen bytes and a packet pool of poolBytes, which is the sum of
+ * UMQTT_POOL_BYTES() for every pool class.
+ */
+#define UMQTT_ARENA_SIZE(rxBufLen, poolBytes) \
+    (UMQTT_INSTANCE_SIZE + (poolBytes) + UMQTT_ID_TABLE_BYTES(poolBytes) + (rxBufLen))
+
+/** @} */
+
+// layout of the private packet header, only used for the size macros
+typedef struct
+{
+    void *pNext;
+    void *ppPrev;
+    uint32_t expires;
+} umqtt_TimerLayout_t;
+
+typedef struct
+{
+    void *pNext;
+    void *pPrev;
+    void *pIdNext;
+    umqtt_TimerLayout_t timer;
+    uint16_t packetId;
+    uint32_t ticks;
+    unsigned int ttl;
+} umqtt_PktBufLayout_t;
+
+// the 128 slots of the timer wheel, and the earliest ticks of the 112
+// slots above level 0, are not in the base instance size
+#define UMQTT_TIMER_WHEEL_SIZE ((128 * sizeof(void *)) + (112 * sizeof(uint32_t)))
+
+// the duplicate filter bitmap does not fit the base instance size
+#if defined(UMQTT_ENABLE_DUP_FILTER) && (UMQTT_DUP_FILTER_BITS > 512)
+#define UMQTT_INSTANCE_EXTRA ((UMQTT_DUP_FILTER_BITS - 512) / 8)
+#else
+#define UMQTT_INSTANCE_EXTRA 0
+#endif
+
+#ifdef UMQTT_ENABLE_STATS
+/**
+ * Statistics counters of an instance, see umqtt_GetStats().  Packet
+ * counters are indexed by MQTT packet type.
+ */
+typedef struct
+{
+    uint32_t pktsSent[16];      ///< packets written, by type
+    uint32_t pktsRcvd[16];      ///< packets received, by type
+    uint32_t bytesSent;         ///< bytes written
+    uint32_t bytesRcvd;         ///< bytes received
+    uint32_t retries;           ///< packets resent
+    uint32_t expired;           ///< packets given up after all retries
+    uint32_t connackTimeouts;   ///< connect attempts without CONNACK
+    uint32_t writeErrors;       ///< failed or short writes
+    uint32_t allocFails;        ///< packet allocations that failed
+} umqtt_Stats_t;
+
+/**
+ * Number of buckets of an ack latency histogram.  Bucket 0 counts 0 ms,
+ * bucket n counts 2^(n-1) to 2^n - 1 ms, and the last bucket counts
+ * everything longer.
+ */
+#define UMQTT_LATENCY_BUCKETS 16
+
+/**
+ * Acknowledgement types with a latency histogram.
+ */
+typedef enum
+{
+    UMQTT_ACK_PUBACK,       ///< PUBACK, or PUBCOMP for qos 2
+    UMQTT_ACK_SUBACK,       ///< SUBACK
+    UMQTT_ACK_UNSUBACK,     ///< UNSUBACK
+    UMQTT_ACK_NUM_TYPES
+} umqtt_AckType_t;
+
+/**
+ * Ack latency histogram, see umqtt_GetAckLatency().
+ */
+typedef struct
+{
+    uint32_t bucket[UMQTT_LATENCY_BUCKETS]; ///< count per log2 bucket
+    uint32_t count;         ///< number of samples
+    uint32_t maxMs;         ///< longest latency seen
+} umqtt_LatencyHist_t;
+#endif
+
+extern umqtt_Handle_t umqtt_New(umqtt_TransportConfig_t *pTransport,
+                                umqtt_Callbacks_t *pCallbacks, void *pUser);
+extern umqtt_Handle_t umqtt_NewStatic(void *pArena, size_t arenaSize,
+                                      umqtt_TransportConfig_t *pTransport,
+                                      umqtt_Callbacks_t *pCallbacks, void *pUser);
+extern void umqtt_Delete(umqtt_Handle_t h);
+extern const char *umqtt_GetErrorString(umqtt_Error_t err);
+extern umqtt_Error_t umqtt_Connect(umqtt_Handle_t h, bool cleanSession, bool willRetain,
+                                   uint8_t willQos, uint16_t keepAlive,
+                                   const char *pClientId, const char *pWillTopic,
+                                   const uint8_t *pWillMessage, uint32_t willMessageLen,
+                                   const char *pUsername, const char *pPassword);
+extern umqtt_Error_t umqtt_Disconnect(umqtt_Handle_t h);
+extern umqtt_Error_t umqtt_Publish(umqtt_Handle_t h, const char *pTopic,
+                                   const uint8_t *pMsg, uint32_t msgLen,
+                                   uint8_t qos, bool shouldRetain, uint16_t *pId);
+extern umqtt_TopicHandle_t umqtt_NewTopic(umqtt_Handle_t h, const char *pTopic);
+extern void umqtt_DeleteTopic(umqtt_Handle_t h, umqtt_TopicHandle_t hTopic);
+extern umqtt_Error_t umqtt_PublishTopic(umqtt_Handle_t h, umqtt_TopicHandle_t hTopic,
+                                        const uint8_t *pMsg, uint32_t msgLen,
+                                        uint8_t qos, bool shouldRetain, uint16_t *pId);
+extern umqtt_Error_t umqtt_PublishReserve(umqtt_Handle_t h, const char *pTopic,
+                                          uint32_t maxLen, uint8_t qos,
+                                          bool shouldRetain, uint8_t **ppPayload);
+extern umqtt_Error_t umqtt_PublishCommit(umqtt_Handle_t h, uint32_t msgLen, uint16_t *pId);
+extern umqtt_Error_t umqtt_PublishCancel(umqtt_Handle_t h);
+extern umqtt_Error_t umqtt_PublishBatch(umqtt_Handle_t h, const umqtt_Msg_t *pMsgs,
+                                        uint32_t count, uint16_t *pIds);
+extern umqtt_Error_t umqtt_Subscribe(umqtt_Handle_t h, uint32_t count, char *pTopics[],
+                                     uint8_t pQos[], uint16_t *pId);
+extern umqtt_Error_t umqtt_Unsubscribe(umqtt_Handle_t h, uint32_t count,
+                                       const char *pTopics[], uint16_t *pId);
+extern umqtt_Error_t umqtt_DecodePacket(umqtt_Handle_t h, uint8_t *pIncoming,
+                                        uint32_t incomingLen);
+extern umqtt_Error_t umqtt_Run(umqtt_Handle_t h, uint32_t ticks);
+extern umqtt_Error_t umqtt_GetConnectedStatus(umqtt_Handle_t h);
+extern umqtt_Error_t umqtt_GetNextDeadline(umqtt_Handle_t h, uint32_t *pTicks);
+extern umqtt_Error_t umqtt_GetPoolFallbacks(umqtt_Handle_t h, uint32_t *pCount);
+extern umqtt_Error_t umqtt_SetKeepAliveOnReceive(umqtt_Handle_t h, bool enable);
+extern umqtt_Error_t umqtt_SetRetryBounds(umqtt_Handle_t h, uint32_t minMs, uint32_t maxMs);
+extern umqtt_Error_t umqtt_GetRtt(umqtt_Handle_t h, uint32_t *pSrtt,
+                                  uint32_t *pRttVar, uint32_t *pRto);
+extern umqtt_Error_t umqtt_SetInflightWindow(umqtt_Handle_t h, unsigned int maxInflight);
+extern umqtt_Error_t umqtt_GetInflightCount(umqtt_Handle_t h, unsigned int *pCount);
+extern umqtt_Error_t umqtt_SetPartialWrites(umqtt_Handle_t h, bool enable);
+extern umqtt_Error_t umqtt_SetTxCoalescing(umqtt_Handle_t h, uint8_t *pBuf,
+                                           uint32_t bufLen, uint32_t maxDelay);
+#ifdef UMQTT_ENABLE_STATS
+extern umqtt_Error_t umqtt_GetStats(umqtt_Handle_t h, umqtt_Stats_t *pStats);
+extern umqtt_Error_t umqtt_GetAckLatency(umqtt_Handle_t h, umqtt_AckType_t type,
+                                         umqtt_LatencyHist_t *pHist);
+extern umqtt_Error_t umqtt_GetLatencyPercentile(const umqtt_LatencyHist_t *pHist,
+                                                unsigned int perMille, uint32_t *pMs);
+#endif
+
+#endif
@@ -0,0 +1,437 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "unity_fixture.h"
+#include "umqtt/umqtt.h"
+#include "umqtt_mocks.h"
+#include "umqtt_wrapper.h"
+
+/*
+batch publish test cases
+
+umqtt_PublishBatch() sizes all of the messages first, then encodes the
+qos 0 messages back to back into one allocated buffer.  Each qos 1 or 2
+message still needs its own packet buffer because it is queued until it
+is acked.  With a writev transport all of the packets go out in one
+writev call, in message order.  Otherwise each buffer is one write.
+The qos 0 buffer is allocated first.  Nothing is written unless every
+buffer can be allocated.  A short write stops the batch, the qos 0
+messages after it are queued and the qos 1 packets after it are kept
+for their first retry.
+
+-null and bad parameters
+-not connected
+-qos 0 messages are one allocation and one write
+-qos 1 messages get packet IDs and are queued
+-mixed batch is one writev in message order
+-more segments than the transport takes in one system call
+-window too small for the batch
+-allocation fails
+-network error
+-short write of a middle writev call
+ */
+
+TEST_GROUP(Batch);
+
+static umqtt_Handle_t h = NULL;
+static void *instBuf = NULL;
+#define SIZE_INSTBUF UMQTT_INSTANCE_SIZE
+static uint8_t *pktBuf = NULL;
+#define SIZE_PKTBUF 1024
+static uint8_t txCopy[128];
+
+// length of qos 0 and qos 1 publish of "message" to "topic"
+#define PUBLISH_LEN 16
+#define PUBLISH_LEN1 18
+
+static const uint8_t publishPacket0[] =
+{
+    0x30, 14, // fixed header
+    0, 5, 't','o','p','i','c',
+    'm','e','s','s','a','g','e',
+};
+
+static const umqtt_Msg_t msg0 = { "topic", (const uint8_t *)"message", 7, 0, false };
+static const umqtt_Msg_t msg1 = { "topic", (const uint8_t *)"message", 7, 1, false };
+
+static umqtt_Callbacks_t callbacks =
+{
+    NULL, NULL, NULL, NULL, NULL, NULL
+};
+
+TEST_SETUP(Batch)
+{
+    // allocate memory for the instance that will be created
+    // init the instance so it will be ready for all tests
+    mock_malloc_Reset();
+    instBuf = malloc(SIZE_INSTBUF);
+    mock_hNet = &mock_hNet;
+    transportConfig.hNet = mock_hNet;
+    mock_malloc_shouldReturn[0] = instBuf;
+    h = umqtt_New(&transportConfig, &callbacks, NULL);
+    TEST_ASSERT_NOT_NULL(h);
+    // clear all mocks
+    mock_malloc_Reset();
+    mock_free_Reset();
+    mock_NetRead_Reset();
+    mock_NetWrite_Reset();
+    mock_NetWritev_Reset();
+    // ready a buffer that can be used for packet allocation
+    pktBuf = malloc(SIZE_PKTBUF);
+    TEST_ASSERT_NOT_NULL(pktBuf);
+    memset(txCopy, 0, sizeof(txCopy));
+    mock_NetWrite_pCopy = txCopy;
+    // fake an existing connection, and long keep alive so that
+    // ping packets do not interfere
+    wrap_setConnected(h, true);
+    wrap_setKeepAlive(h, 1000);
+}
+
+TEST_TEAR_DOWN(Batch)
+{
+    if (instBuf) { free(instBuf); instBuf = NULL; }
+    if (pktBuf) { free(pktBuf); pktBuf = NULL; }
+    h = NULL;
+}
+
+TEST(Batch, NullParms)
+{
+    umqtt_Error_t err;
+    umqtt_Msg_t msgs[2] = { msg0, msg0 };
+    uint16_t ids[2];
+    err = umqtt_PublishBatch(NULL, msgs, 2, ids);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+    err = umqtt_PublishBatch(h, NULL, 2, ids);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+    err = umqtt_PublishBatch(h, msgs, 0, ids);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+    // any bad message fails the whole batch
+    msgs[1].pTopic = NULL;
+    err = umqtt_PublishBatch(h, msgs, 2, ids);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+    msgs[1].pTopic = "";
+    err = umqtt_PublishBatch(h, msgs, 2, ids);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+    msgs[1] = msg0;
+    msgs[1].qos = 3;
+    err = umqtt_PublishBatch(h, msgs, 2, ids);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+}
+
+TEST(Batch, NotConnected)
+{
+    umqtt_Error_t err;
+    wrap_setConnected(h, false);
+    err = umqtt_PublishBatch(h, &msg0, 1, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_DISCONNECTED, err);
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+}
+
+TEST(Batch, Qos0)
+{
+    umqtt_Error_t err;
+    const umqtt_Msg_t msgs[3] = { msg0, msg0, msg0 };
+    uint16_t ids[3] = { 1, 1, 1 };
+    mock_malloc_shouldReturn[0] = pktBuf;
+    mock_NetWrite_shouldReturn = 3 * PUBLISH_LEN;
+    mock_NetWrite_copyLen = 3 * PUBLISH_LEN;
+    err = umqtt_PublishBatch(h, msgs, 3, ids);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1, mock_malloc_count);
+    TEST_ASSERT_EQUAL(1, mock_NetWrite_count);
+    TEST_ASSERT_EQUAL(3 * PUBLISH_LEN, mock_NetWrite_in_len);
+    TEST_ASSERT_FALSE(mock_NetWrite_in_isMore);
+    for (unsigned int idx = 0; idx < 3; idx++)
+    {
+        TEST_ASSERT_EQUAL_MEMORY(publishPacket0, &txCopy[idx * PUBLISH_LEN], PUBLISH_LEN);
+        TEST_ASSERT_EQUAL(0, ids[idx]);
+    }
+    // buffer is not kept
+    TEST_ASSERT_EQUAL(1, mock_free_count);
+    TEST_ASSERT_EQUAL_PTR(pktBuf, mock_free_in_ptr);
+}
+
+TEST(Batch, Qos1)
+{
+    umqtt_Error_t err;
+    const umqtt_Msg_t msgs[2] = { msg1, msg1 };
+    uint16_t ids[2] = { 0, 0 };
+    mock_malloc_shouldReturn[0] = pktBuf;
+    mock_malloc_shouldReturn[1] = &pktBuf[200];
+    mock_NetWrite_shouldReturn = PUBLISH_LEN1;
+    mock_NetWrite_copyLen = PUBLISH_LEN1;
+    err = umqtt_PublishBatch(h, msgs, 2, ids);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    // each one is kept for its puback
+    TEST_ASSERT_EQUAL(2, mock_malloc_count);
+    TEST_ASSERT_FALSE(mock_free_wasCalled);
+    TEST_ASSERT_EQUAL(2, mock_NetWrite_count);
+    TEST_ASSERT_FALSE(mock_NetWrite_in_isMore);
+    TEST_ASSERT_NOT_EQUAL(0, ids[0]);
+    TEST_ASSERT_EQUAL(ids[0] + 1, ids[1]);
+    // last write is the second message
+    TEST_ASSERT_EQUAL(0x32, txCopy[0]);
+    TEST_ASSERT_EQUAL(ids[1] >> 8, txCopy[9]);
+    TEST_ASSERT_EQUAL(ids[1] & 0xFF, txCopy[10]);
+    TEST_ASSERT_EQUAL_PTR(&pktBuf[200], wrap_getNextPktBuf(h));
+}
+
+TEST(Batch, MixedWritev)
+{
+    umqtt_Error_t err;
+    static umqtt_TransportConfig_t iovTransport;
+    uint8_t *iovInstBuf = malloc(SIZE_INSTBUF);
+    TEST_ASSERT_NOT_NULL(iovInstBuf);
+    iovTransport = transportConfig;
+    iovTransport.pfnNetWritev = mock_NetWritev;
+    mock_malloc_Reset();
+    mock_malloc_shouldReturn[0] = iovInstBuf;
+    umqtt_Handle_t hv = umqtt_New(&iovTransport, NULL, NULL);
+    TEST_ASSERT_NOT_NULL(hv);
+    wrap_setConnected(hv, true);
+    wrap_setKeepAlive(hv, 1000);
+
+    const umqtt_Msg_t msgs[3] = { msg0, msg1, msg0 };
+    uint16_t ids[3] = { 1, 0, 1 };
+    mock_malloc_Reset();
+    mock_malloc_shouldReturn[0] = pktBuf;
+    mock_malloc_shouldReturn[1] = &pktBuf[200];
+    mock_NetWritev_shouldReturn = (2 * PUBLISH_LEN) + PUBLISH_LEN1;
+    err = umqtt_PublishBatch(hv, msgs, 3, ids);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(2, mock_malloc_count);
+    TEST_ASSERT_EQUAL(0, ids[0]);
+    TEST_ASSERT_NOT_EQUAL(0, ids[1]);
+    TEST_ASSERT_EQUAL(0, ids[2]);
+
+    // one writev, segments in message order
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+    TEST_ASSERT_TRUE(mock_NetWritev_wasCalled);
+    TEST_ASSERT_EQUAL(3, mock_NetWritev_in_iovCnt);
+    TEST_ASSERT_EQUAL((2 * PUBLISH_LEN) + PUBLISH_LEN1, mock_NetWritev_dataLen);
+    TEST_ASSERT_EQUAL_MEMORY(publishPacket0, mock_NetWritev_data, PUBLISH_LEN);
+    TEST_ASSERT_EQUAL(0x32, mock_NetWritev_data[PUBLISH_LEN]);
+    TEST_ASSERT_EQUAL(ids[1] >> 8, mock_NetWritev_data[PUBLISH_LEN + 9]);
+    TEST_ASSERT_EQUAL(ids[1] & 0xFF, mock_NetWritev_data[PUBLISH_LEN + 10]);
+    TEST_ASSERT_EQUAL_MEMORY(publishPacket0, &mock_NetWritev_data[PUBLISH_LEN + PUBLISH_LEN1],
+                             PUBLISH_LEN);
+    // qos 0 buffer freed, qos 1 packet kept
+    TEST_ASSERT_EQUAL(1, mock_free_count);
+    TEST_ASSERT_EQUAL_PTR(pktBuf, mock_free_in_ptr);
+    TEST_ASSERT_EQUAL_PTR(&pktBuf[200], wrap_getNextPktBuf(hv));
+    free(iovInstBuf);
+}
+
+// more segments than a writev transport may take in one system call,
+// all are passed in one writev and the transport splits them
+TEST(Batch, ManySegments)
+{
+    umqtt_Error_t err;
+    static umqtt_TransportConfig_t iovTransport;
+    uint8_t *iovInstBuf = malloc(SIZE_INSTBUF);
+    TEST_ASSERT_NOT_NULL(iovInstBuf);
+    iovTransport = transportConfig;
+    iovTransport.pfnNetWritev = mock_NetWritev;
+    mock_malloc_Reset();
+    mock_malloc_shouldReturn[0] = iovInstBuf;
+    umqtt_Handle_t hv = umqtt_New(&iovTransport, NULL, NULL);
+    TEST_ASSERT_NOT_NULL(hv);
+    wrap_setConnected(hv, true);
+    wrap_setKeepAlive(hv, 1000);
+
+    // qos 0 messages between qos 1 messages are separate segments
+    const umqtt_Msg_t msgs[5] = { msg0, msg1, msg0, msg1, msg0 };
+    uint16_t ids[5];
+    uint32_t total = (3 * PUBLISH_LEN) + (2 * PUBLISH_LEN1);
+    mock_malloc_Reset();
+    mock_malloc_shouldReturn[0] = pktBuf;
+    mock_malloc_shouldReturn[1] = &pktBuf[200];
+    mock_malloc_shouldReturn[2] = &pktBuf[400];
+    mock_NetWritev_shouldReturn = total;
+    err = umqtt_PublishBatch(hv, msgs, 5, ids);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(3, mock_malloc_count);
+    TEST_ASSERT_NOT_EQUAL(0, ids[1]);
+    TEST_ASSERT_NOT_EQUAL(0, ids[3]);
+    TEST_ASSERT_NOT_EQUAL(ids[1], ids[3]);
+
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+    TEST_ASSERT_TRUE(mock_NetWritev_wasCalled);
+    TEST_ASSERT_EQUAL(5, mock_NetWritev_in_iovCnt);
+    TEST_ASSERT_TRUE(mock_NetWritev_in_iovCnt > MOCK_NETWRITEV_MAX_IOV);
+    // recorded segments alternate between the qos 0 buffer and the
+    // qos 1 packets
+    uint8_t *qos0Buf = pktBuf + UMQTT_PKTBUF_SIZE;
+    TEST_ASSERT_EQUAL_PTR(qos0Buf, mock_NetWritev_in_iov[0].pBuf);
+    TEST_ASSERT_EQUAL(PUBLISH_LEN, mock_NetWritev_in_iov[0].len);
+    TEST_ASSERT_EQUAL_PTR(&pktBuf[200] + UMQTT_PKTBUF_SIZE, mock_NetWritev_in_iov[1].pBuf);
+    TEST_ASSERT_EQUAL(PUBLISH_LEN1, mock_NetWritev_in_iov[1].len);
+    TEST_ASSERT_EQUAL_PTR(qos0Buf + PUBLISH_LEN, mock_NetWritev_in_iov[2].pBuf);
+    TEST_ASSERT_EQUAL(PUBLISH_LEN, mock_NetWritev_in_iov[2].len);
+    TEST_ASSERT_EQUAL_PTR(&pktBuf[400] + UMQTT_PKTBUF_SIZE, mock_NetWritev_in_iov[3].pBuf);
+    TEST_ASSERT_EQUAL(PUBLISH_LEN1, mock_NetWritev_in_iov[3].len);
+
+    // gathered data holds every packet in message order
+    uint32_t offset = 0;
+    TEST_ASSERT_EQUAL(total, mock_NetWritev_dataLen);
+    for (unsigned int idx = 0; idx < 5; idx++)
+    {
+        if (msgs[idx].qos == 0)
+        {
+            TEST_ASSERT_EQUAL_MEMORY(publishPacket0, &mock_NetWritev_data[offset], PUBLISH_LEN);
+            offset += PUBLISH_LEN;
+        }
+        else
+        {
+            TEST_ASSERT_EQUAL(0x32, mock_NetWritev_data[offset]);
+            TEST_ASSERT_EQUAL(ids[idx] >> 8, mock_NetWritev_data[offset + 9]);
+            TEST_ASSERT_EQUAL(ids[idx] & 0xFF, mock_NetWritev_data[offset + 10]);
+            TEST_ASSERT_EQUAL_MEMORY("message", &mock_NetWritev_data[offset + 11], 7);
+            offset += PUBLISH_LEN1;
+        }
+    }
+    // qos 0 buffer freed, both qos 1 packets kept
+    TEST_ASSERT_EQUAL(1, mock_free_count);
+    TEST_ASSERT_EQUAL_PTR(pktBuf, mock_free_in_ptr);
+    free(iovInstBuf);
+}
+
+TEST(Batch, Window)
+{
+    umqtt_Error_t err;
+    const umqtt_Msg_t msgs[3] = { msg1, msg0, msg1 };
+    uint16_t ids[3];
+    umqtt_SetInflightWindow(h, 1);
+    err = umqtt_PublishBatch(h, msgs, 3, ids);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_WINDOW_FULL, err);
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+
+    // batch that fits
+    const umqtt_Msg_t fits[2] = { msg1, msg1 };
+    umqtt_SetInflightWindow(h, 2);
+    mock_malloc_shouldReturn[0] = pktBuf;
+    mock_malloc_shouldReturn[1] = &pktBuf[200];
+    mock_NetWrite_shouldReturn = PUBLISH_LEN1;
+    err = umqtt_PublishBatch(h, fits, 2, ids);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+}
+
+// nothing is sent or queued if any buffer can not be allocated
+TEST(Batch, AllocFail)
+{
+    umqtt_Error_t err;
+    const umqtt_Msg_t msgs[2] = { msg0, msg1 };
+    uint16_t ids[2];
+    mock_malloc_shouldReturn[0] = pktBuf;
+    mock_malloc_shouldReturn[1] = NULL;
+    err = umqtt_PublishBatch(h, msgs, 2, ids);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_BUFSIZE, err);
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+    TEST_ASSERT_EQUAL(1, mock_free_count);
+    TEST_ASSERT_EQUAL_PTR(pktBuf, mock_free_in_ptr);
+    TEST_ASSERT_NULL(wrap_getNextPktBuf(h));
+}
+
+TEST(Batch, NetError)
+{
+    umqtt_Error_t err;
+    const umqtt_Msg_t msgs[2] = { msg0, msg0 };
+    mock_malloc_shouldReturn[0] = pktBuf;
+    mock_NetWrite_shouldReturn = -1;
+    err = umqtt_PublishBatch(h, msgs, 2, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_NETWORK, err);
+    TEST_ASSERT_EQUAL(1, mock_free_count);
+    TEST_ASSERT_EQUAL_PTR(pktBuf, mock_free_in_ptr);
+}
+
+// 16 qos 1 messages are one writev call, the next 16 with a longer
+// payload are written short, and the 2 qos 0 messages are not written.
+// The pool has a block for each buffer of the batch, so the qos 0
+// messages must be queued without a copy.
+TEST(Batch, ShortChunk)
+{
+    umqtt_Error_t err;
+    static umqtt_TransportConfig_t iovTransport;
+    static const umqtt_PoolClass_t poolClass = { 40, 33 };
+    static uint64_t poolMem[UMQTT_POOL_BYTES(40, 33) / 8];
+    uint8_t *iovInstBuf = malloc(SIZE_INSTBUF);
+    TEST_ASSERT_NOT_NULL(iovInstBuf);
+    iovTransport = transportConfig;
+    iovTransport.pfnNetWritev = mock_NetWritev;
+    iovTransport.pPoolClasses = &poolClass;
+    iovTransport.numPoolClasses = 1;
+    mock_malloc_Reset();
+    mock_malloc_shouldReturn[0] = iovInstBuf;
+    mock_malloc_shouldReturn[1] = poolMem;
+    umqtt_Handle_t hv = umqtt_New(&iovTransport, NULL, NULL);
+    TEST_ASSERT_NOT_NULL(hv);
+    wrap_setConnected(hv, true);
+    wrap_setKeepAlive(hv, 1000);
+    err = umqtt_SetPartialWrites(hv, true);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+
+    // qos 1 publish with a 14 byte payload
+    const umqtt_Msg_t msgLong = { "topic", (const uint8_t *)"messagemessage", 14, 1, false };
+    umqtt_Msg_t msgs[34];
+    uint16_t ids[34];
+    for (unsigned int idx = 0; idx < 34; idx++)
+    {
+        msgs[idx] = (idx < 16) ? msg1 : (idx < 32) ? msgLong : msg0;
+    }
+    // the first call is written, the second one short and its rest
+    // is copied
+    mock_malloc_Reset();
+    mock_malloc_shouldReturn[0] = pktBuf;
+    mock_NetWritev_shouldReturn = 16 * PUBLISH_LEN1;
+    err = umqtt_PublishBatch(hv, msgs, 34, ids);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    // last writev is the second call, the qos 0 messages are not written
+    TEST_ASSERT_EQUAL(16, mock_NetWritev_in_iovCnt);
+    TEST_ASSERT_EQUAL(PUBLISH_LEN1 + 7, mock_NetWritev_in_iov[0].len);
+    TEST_ASSERT_EQUAL(PUBLISH_LEN1 + 7, mock_NetWritev_in_iov[3].len);
+    TEST_ASSERT_FALSE(mock_free_wasCalled);
+    // every qos 1 packet is kept, including the ones on the wire
+    unsigned int inflight = 0;
+    umqtt_GetInflightCount(hv, &inflight);
+    TEST_ASSERT_EQUAL(32, inflight);
+    TEST_ASSERT_NOT_EQUAL(0, ids[31]);
+    TEST_ASSERT_EQUAL(0, ids[32]);
+
+    // busy until the rest and the queued qos 0 messages are written
+    err = umqtt_Publish(hv, "topic", (const uint8_t *)"message", 7, 0, false, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_TX_BUSY, err);
+    mock_NetWrite_Reset();
+    mock_NetWritev_Reset();
+    mock_NetWrite_shouldReturn = 16 * 7;
+    mock_NetWritev_shouldReturn = 2 * PUBLISH_LEN;
+    err = umqtt_Run(hv, 1);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1, mock_NetWrite_count);
+    TEST_ASSERT_EQUAL(16 * 7, mock_NetWrite_in_len);
+    TEST_ASSERT_EQUAL(2 * PUBLISH_LEN, mock_NetWritev_dataLen);
+    TEST_ASSERT_EQUAL_MEMORY(publishPacket0, mock_NetWritev_data, PUBLISH_LEN);
+    TEST_ASSERT_EQUAL_MEMORY(publishPacket0, &mock_NetWritev_data[PUBLISH_LEN], PUBLISH_LEN);
+    TEST_ASSERT_TRUE(mock_free_wasCalled);
+    TEST_ASSERT_EQUAL_PTR(pktBuf, mock_free_in_ptr);
+    free(iovInstBuf);
+}
+
+TEST_GROUP_RUNNER(Batch)
+{
+    RUN_TEST_CASE(Batch, NullParms);
+    RUN_TEST_CASE(Batch, NotConnected);
+    RUN_TEST_CASE(Batch, Qos0);
+    RUN_TEST_CASE(Batch, Qos1);
+    RUN_TEST_CASE(Batch, MixedWritev);
+    RUN_TEST_CASE(Batch, ManySegments);
+    RUN_TEST_CASE(Batch, Window);
+    RUN_TEST_CASE(Batch, AllocFail);
+    RUN_TEST_CASE(Batch, NetError);
+    RUN_TEST_CASE(Batch, ShortChunk);
+}
@@ -0,0 +1,380 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "unity_fixture.h"
+#include "umqtt/umqtt.h"
+#include "umqtt_mocks.h"
+#include "umqtt_wrapper.h"
+
+/*
+transmit coalescing test cases
+
+With a transmit buffer set, outgoing packets are copied into it instead
+of being written one at a time.  umqtt_Run() writes everything that is
+gathered in one transport write once the oldest packet has waited the
+max delay, and a packet that does not fit makes room by writing what
+is already gathered.  CONNECT and DISCONNECT are written right away
+along with anything gathered before them.
+
+-null and bad parameters
+-not enabled by default
+-packets between runs are written together
+-qos 1 publish is gathered and still kept for retry
+-acks and pings made by run go out in the same write
+-full buffer is written to make room
+-short write of a full buffer queues the packet that did not fit
+-packet bigger than the buffer is written on its own
+-max delay holds packets across runs, and sets the deadline
+-network error drops what was gathered
+-disconnect writes everything
+ */
+
+TEST_GROUP(Coalesce);
+
+static umqtt_Handle_t h = NULL;
+static void *instBuf = NULL;
+#define SIZE_INSTBUF UMQTT_INSTANCE_SIZE
+static uint8_t *pktBuf = NULL;
+#define SIZE_PKTBUF 1024
+static uint8_t txBuf[64];
+static uint8_t rxBuf[32];
+static uint8_t txCopy[256];
+
+// length of qos 0 publish of "message" to "topic"
+#define PUBLISH_LEN 16
+
+static const uint8_t publishPacket0[] =
+{
+    0x30, 14, // fixed header
+    0, 5, 't','o','p','i','c',
+    'm','e','s','s','a','g','e',
+};
+
+static umqtt_Callbacks_t callbacks =
+{
+    NULL, NULL, NULL, NULL, NULL, NULL
+};
+
+TEST_SETUP(Coalesce)
+{
+    // allocate memory for the instance that will be created
+    // init the instance so it will be ready for all tests
+    mock_malloc_Reset();
+    instBuf = malloc(SIZE_INSTBUF);
+    mock_hNet = &mock_hNet;
+    transportConfig.hNet = mock_hNet;
+    mock_malloc_shouldReturn[0] = instBuf;
+    h = umqtt_New(&transportConfig, &callbacks, NULL);
+    TEST_ASSERT_NOT_NULL(h);
+    // clear all mocks
+    mock_malloc_Reset();
+    mock_free_Reset();
+    mock_NetRead_Reset();
+    mock_NetWrite_Reset();
+    // ready a buffer that can be used for packet allocation
+    pktBuf = malloc(SIZE_PKTBUF);
+    TEST_ASSERT_NOT_NULL(pktBuf);
+    // fake an existing connection, and long keep alive so that
+    // ping packets do not interfere
+    wrap_setConnected(h, true);
+    wrap_setKeepAlive(h, 1000);
+}
+
+TEST_TEAR_DOWN(Coalesce)
+{
+    if (instBuf) { free(instBuf); instBuf = NULL; }
+    if (pktBuf) { free(pktBuf); pktBuf = NULL; }
+    h = NULL;
+}
+
+static void
+Enable(uint32_t bufLen, uint32_t maxDelay)
+{
+    umqtt_Error_t err = umqtt_SetTxCoalescing(h, txBuf, bufLen, maxDelay);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+}
+
+// set up the write mock to take everything and copy it
+static void
+ResetWrite(int writeReturn)
+{
+    mock_NetWrite_Reset();
+    memset(txCopy, 0, sizeof(txCopy));
+    mock_NetWrite_shouldReturn = writeReturn;
+    mock_NetWrite_pCopy = txCopy;
+    mock_NetWrite_copyLen = (writeReturn > 0) ? writeReturn : 0;
+}
+
+// qos 0 publish of "message" to "topic" from pktBuf, with each
+// write taking writeReturn bytes
+static umqtt_Error_t
+Publish(int writeReturn)
+{
+    mock_malloc_Reset();
+    mock_free_Reset();
+    ResetWrite(writeReturn);
+    mock_malloc_shouldReturn[0] = pktBuf;
+    return umqtt_Publish(h, "topic", (const uint8_t *)"message", 7, 0, false, NULL);
+}
+
+static umqtt_Error_t
+Run(uint32_t ticks, int writeReturn)
+{
+    mock_NetRead_Reset();
+    ResetWrite(writeReturn);
+    return umqtt_Run(h, ticks);
+}
+
+TEST(Coalesce, NullParms)
+{
+    umqtt_Error_t err;
+    err = umqtt_SetTxCoalescing(NULL, txBuf, sizeof(txBuf), 0);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+    err = umqtt_SetTxCoalescing(h, txBuf, 0, 0);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+    // no buffer turns it off
+    err = umqtt_SetTxCoalescing(h, NULL, 0, 0);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    err = Publish(PUBLISH_LEN);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_TRUE(mock_NetWrite_wasCalled);
+}
+
+TEST(Coalesce, Disabled)
+{
+    umqtt_Error_t err = Publish(PUBLISH_LEN);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1, mock_NetWrite_count);
+    TEST_ASSERT_EQUAL(PUBLISH_LEN, mock_NetWrite_in_len);
+}
+
+TEST(Coalesce, Gather)
+{
+    umqtt_Error_t err;
+    Enable(sizeof(txBuf), 0);
+    for (unsigned int idx = 0; idx < 3; idx++)
+    {
+        err = Publish(PUBLISH_LEN);
+        TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+        TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+        // qos 0 packet is copied so it is not needed any more
+        TEST_ASSERT_TRUE(mock_free_wasCalled);
+    }
+
+    err = Run(1000, 3 * PUBLISH_LEN);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1, mock_NetWrite_count);
+    TEST_ASSERT_EQUAL(3 * PUBLISH_LEN, mock_NetWrite_in_len);
+    TEST_ASSERT_FALSE(mock_NetWrite_in_isMore);
+    for (unsigned int idx = 0; idx < 3; idx++)
+    {
+        TEST_ASSERT_EQUAL_MEMORY(publishPacket0, &txCopy[idx * PUBLISH_LEN], PUBLISH_LEN);
+    }
+
+    // nothing left
+    err = Run(1010, 0);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+}
+
+TEST(Coalesce, Qos1)
+{
+    umqtt_Error_t err;
+    uint16_t msgId;
+    Enable(sizeof(txBuf), 0);
+    mock_malloc_shouldReturn[0] = pktBuf;
+    err = umqtt_Publish(h, "topic", (const uint8_t *)"message", 7, 1, false, &msgId);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+    TEST_ASSERT_FALSE(mock_free_wasCalled);
+    TEST_ASSERT_EQUAL_PTR(pktBuf, wrap_getNextPktBuf(h));
+
+    err = Run(1000, 18);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(18, mock_NetWrite_in_len);
+    TEST_ASSERT_EQUAL(0x32, txCopy[0]);
+    TEST_ASSERT_EQUAL_PTR(pktBuf, wrap_getNextPktBuf(h));
+}
+
+// puback for a received publish and a ping are both made during
+// the same run, and written together
+TEST(Coalesce, RunGathers)
+{
+    static const uint8_t pubPkt[] =
+    {
+        0x32, 10, // qos 1
+        0, 5, 't', 'o', 'p', 'i', 'c',
+        0x12, 0x34, // packet ID
+        'x'
+    };
+    static const uint8_t expected[] =
+    {
+        0x40, 2, 0x12, 0x34, // puback
+        0xC0, 0 // pingreq
+    };
+    umqtt_Error_t err;
+    Enable(sizeof(txBuf), 0);
+    wrap_setKeepAlive(h, 30);
+    memcpy(rxBuf, pubPkt, sizeof(pubPkt));
+    mock_NetRead_AddChunk(rxBuf, sizeof(pubPkt));
+    ResetWrite(sizeof(expected));
+    err = umqtt_Run(h, 15000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1, mock_NetWrite_count);
+    TEST_ASSERT_EQUAL(sizeof(expected), mock_NetWrite_in_len);
+    TEST_ASSERT_EQUAL_MEMORY(expected, txCopy, sizeof(expected));
+}
+
+TEST(Coalesce, Full)
+{
+    umqtt_Error_t err;
+    Enable(40, 0);
+    err = Publish(2 * PUBLISH_LEN);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    err = Publish(2 * PUBLISH_LEN);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+
+    // third does not fit, so the first two are written
+    err = Publish(2 * PUBLISH_LEN);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1, mock_NetWrite_count);
+    TEST_ASSERT_EQUAL(2 * PUBLISH_LEN, mock_NetWrite_in_len);
+
+    err = Run(1000, PUBLISH_LEN);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1, mock_NetWrite_count);
+    TEST_ASSERT_EQUAL(PUBLISH_LEN, mock_NetWrite_in_len);
+}
+
+// with partial writes, the packet that needed the room waits behind
+// the rest of the buffer instead of being dropped
+TEST(Coalesce, FullShort)
+{
+    umqtt_Error_t err;
+    Enable(40, 0);
+    err = umqtt_SetPartialWrites(h, true);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    err = Publish(2 * PUBLISH_LEN);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    err = Publish(2 * PUBLISH_LEN);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+
+    err = Publish(20);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1, mock_NetWrite_count);
+    TEST_ASSERT_EQUAL(2 * PUBLISH_LEN, mock_NetWrite_in_len);
+    TEST_ASSERT_FALSE(mock_free_wasCalled);
+
+    // rest of the buffer, then the queued packet
+    mock_free_Reset();
+    err = Run(1000, 2 * PUBLISH_LEN);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(2, mock_NetWrite_count);
+    TEST_ASSERT_EQUAL(PUBLISH_LEN, mock_NetWrite_in_len);
+    TEST_ASSERT_EQUAL_MEMORY(publishPacket0, txCopy, PUBLISH_LEN);
+    TEST_ASSERT_TRUE(mock_free_wasCalled);
+    TEST_ASSERT_EQUAL_PTR(pktBuf, mock_free_in_ptr);
+}
+
+TEST(Coalesce, TooBig)
+{
+    umqtt_Error_t err;
+    static uint8_t msg[32];
+    Enable(20, 0);
+
+    // 41 byte packet is written directly
+    mock_malloc_shouldReturn[0] = pktBuf;
+    ResetWrite(9 + sizeof(msg));
+    err = umqtt_Publish(h, "topic", msg, sizeof(msg), 0, false, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1, mock_NetWrite_count);
+    TEST_ASSERT_EQUAL(9 + sizeof(msg), mock_NetWrite_in_len);
+    TEST_ASSERT_EQUAL(0x30, txCopy[0]);
+    TEST_ASSERT_TRUE(mock_free_wasCalled);
+
+    // smaller one is still gathered
+    err = Publish(PUBLISH_LEN);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+}
+
+TEST(Coalesce, MaxDelay)
+{
+    umqtt_Error_t err;
+    uint32_t ticks;
+    Enable(sizeof(txBuf), 50);
+    err = Run(1000, 0);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    err = Publish(PUBLISH_LEN);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    err = umqtt_GetNextDeadline(h, &ticks);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1050, ticks);
+
+    err = Run(1020, 2 * PUBLISH_LEN);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+    // later packets do not move the deadline
+    err = Publish(2 * PUBLISH_LEN);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    err = umqtt_GetNextDeadline(h, &ticks);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1050, ticks);
+
+    err = Run(1049, 2 * PUBLISH_LEN);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+    err = Run(1050, 2 * PUBLISH_LEN);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1, mock_NetWrite_count);
+    TEST_ASSERT_EQUAL(2 * PUBLISH_LEN, mock_NetWrite_in_len);
+}
+
+TEST(Coalesce, NetError)
+{
+    umqtt_Error_t err;
+    Enable(sizeof(txBuf), 0);
+    err = Publish(PUBLISH_LEN);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    err = Run(1000, -1);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_NETWORK, err);
+    TEST_ASSERT_TRUE(mock_NetWrite_wasCalled);
+    err = Run(1010, PUBLISH_LEN);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+}
+
+TEST(Coalesce, Disconnect)
+{
+    umqtt_Error_t err;
+    Enable(sizeof(txBuf), 100);
+    err = Publish(PUBLISH_LEN + 2);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    ResetWrite(PUBLISH_LEN + 2);
+    err = umqtt_Disconnect(h);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1, mock_NetWrite_count);
+    TEST_ASSERT_EQUAL(PUBLISH_LEN + 2, mock_NetWrite_in_len);
+    TEST_ASSERT_EQUAL_MEMORY(publishPacket0, txCopy, PUBLISH_LEN);
+    TEST_ASSERT_EQUAL(14 << 4, txCopy[PUBLISH_LEN]);
+    TEST_ASSERT_EQUAL(0, txCopy[PUBLISH_LEN + 1]);
+}
+
+TEST_GROUP_RUNNER(Coalesce)
+{
+    RUN_TEST_CASE(Coalesce, NullParms);
+    RUN_TEST_CASE(Coalesce, Disabled);
+    RUN_TEST_CASE(Coalesce, Gather);
+    RUN_TEST_CASE(Coalesce, Qos1);
+    RUN_TEST_CASE(Coalesce, RunGathers);
+    RUN_TEST_CASE(Coalesce, Full);
+    RUN_TEST_CASE(Coalesce, FullShort);
+    RUN_TEST_CASE(Coalesce, TooBig);
+    RUN_TEST_CASE(Coalesce, MaxDelay);
+    RUN_TEST_CASE(Coalesce, NetError);
+    RUN_TEST_CASE(Coalesce, Disconnect);
+}
@@ -17,7 +17,7 @@ TEST_GROUP(Connect);
 static umqtt_Handle_t h = NULL;
 
 static void *instBuf = NULL;
-#define SIZE_INSTBUF 200
+#define SIZE_INSTBUF UMQTT_INSTANCE_SIZE
 static uint8_t *pktBuf = NULL;
 #define SIZE_PKTBUF 1024
 static char *clientBuf = NULL;
@@ -0,0 +1,270 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "unity_fixture.h"
+#include "umqtt/umqtt.h"
+#include "umqtt_mocks.h"
+#include "umqtt_wrapper.h"
+
+/*
+next deadline test cases
+
+-null parameters
+-nothing pending
+-connack timeout
+-keep alive ping
+-publish retry earlier than ping
+-deadline moves after ping is sent
+-removing the earliest timer of a slot leaves an early deadline
+ */
+
+TEST_GROUP(Deadline);
+
+static umqtt_Handle_t h = NULL;
+static void *instBuf = NULL;
+#define SIZE_INSTBUF UMQTT_INSTANCE_SIZE
+static uint8_t *pktBuf = NULL;
+#define SIZE_PKTBUF 1024
+
+static umqtt_Callbacks_t callbacks =
+{
+    NULL, NULL, NULL, NULL, NULL, NULL
+};
+
+TEST_SETUP(Deadline)
+{
+    // allocate memory for the instance that will be created
+    // init the instance so it will be ready for all tests
+    mock_malloc_Reset();
+    instBuf = malloc(SIZE_INSTBUF);
+    mock_hNet = &mock_hNet;
+    transportConfig.hNet = mock_hNet;
+    mock_malloc_shouldReturn[0] = instBuf;
+    h = umqtt_New(&transportConfig, &callbacks, NULL);
+    TEST_ASSERT_NOT_NULL(h);
+    // clear all mocks
+    mock_malloc_Reset();
+    mock_free_Reset();
+    mock_NetRead_Reset();
+    mock_NetWrite_Reset();
+    // ready a buffer that can be used for packet allocation
+    pktBuf = malloc(SIZE_PKTBUF);
+    TEST_ASSERT_NOT_NULL(pktBuf);
+}
+
+TEST_TEAR_DOWN(Deadline)
+{
+    if (instBuf) { free(instBuf); instBuf = NULL; }
+    if (pktBuf) { free(pktBuf); pktBuf = NULL; }
+    h = NULL;
+}
+
+// start a connection at the specified ticks, with 30 second keep alive
+static void
+startConnect(uint32_t ticks)
+{
+    umqtt_Error_t err;
+    err = umqtt_Run(h, ticks);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    // lazy way to get required packet length
+    mock_malloc_shouldReturn[0] = pktBuf;
+    mock_malloc_shouldReturn[1] = &pktBuf[600];
+    err = umqtt_Connect(h, false, false, 0, 30, "testClient", NULL, NULL, 0, NULL, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_NETWORK, err);
+    mock_NetWrite_shouldReturn = mock_NetWrite_in_len;
+    mock_malloc_Reset();
+    mock_malloc_shouldReturn[0] = pktBuf;
+    mock_malloc_shouldReturn[1] = &pktBuf[600];
+    err = umqtt_Connect(h, false, false, 0, 30, "testClient", NULL, NULL, 0, NULL, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    mock_malloc_Reset();
+    mock_NetWrite_Reset();
+}
+
+// connack received
+static void
+finishConnect(void)
+{
+    pktBuf[900] = 2 << 4; // connack
+    pktBuf[901] = 2;
+    pktBuf[902] = 0;
+    pktBuf[903] = 0;
+    umqtt_Error_t err = umqtt_DecodePacket(h, &pktBuf[900], 4);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    err = umqtt_GetConnectedStatus(h);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_CONNECTED, err);
+    mock_free_Reset();
+}
+
+TEST(Deadline, NullParms)
+{
+    umqtt_Error_t err;
+    uint32_t ticks;
+    err = umqtt_GetNextDeadline(NULL, &ticks);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+    err = umqtt_GetNextDeadline(h, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+}
+
+// no connection and nothing in flight
+TEST(Deadline, NothingPending)
+{
+    umqtt_Error_t err;
+    uint32_t ticks = 1234;
+    err = umqtt_Run(h, 1000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    err = umqtt_GetNextDeadline(h, &ticks);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_NO_DEADLINE, err);
+    TEST_ASSERT_EQUAL(1234, ticks);
+}
+
+// waiting for connack
+TEST(Deadline, ConnackTimeout)
+{
+    umqtt_Error_t err;
+    uint32_t ticks;
+    startConnect(1000);
+    err = umqtt_GetNextDeadline(h, &ticks);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(6000, ticks);
+}
+
+// connected and idle, next thing is ping at half keep alive
+TEST(Deadline, KeepAlive)
+{
+    umqtt_Error_t err;
+    uint32_t ticks;
+    startConnect(1000);
+    finishConnect();
+    err = umqtt_GetNextDeadline(h, &ticks);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(16000, ticks);
+
+    // running before the deadline does nothing and does not change it
+    err = umqtt_Run(h, 15999);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+    err = umqtt_GetNextDeadline(h, &ticks);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(16000, ticks);
+}
+
+// publish retry comes before ping, and after it is acked the
+// ping is next again
+TEST(Deadline, EarliestEvent)
+{
+    umqtt_Error_t err;
+    uint32_t ticks;
+    uint16_t msgId;
+    startConnect(1000);
+    finishConnect();
+
+    // lazy way to get required packet length
+    err = umqtt_Run(h, 3000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    mock_malloc_shouldReturn[0] = pktBuf;
+    err = umqtt_Publish(h, "topic", (uint8_t *)"message", 7, 1, false, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_NETWORK, err);
+    mock_NetWrite_shouldReturn = mock_NetWrite_in_len;
+    mock_malloc_Reset();
+    mock_malloc_shouldReturn[0] = pktBuf;
+    err = umqtt_Publish(h, "topic", (uint8_t *)"message", 7, 1, false, &msgId);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+
+    // retry is 5 seconds after publish, which is before the ping
+    err = umqtt_GetNextDeadline(h, &ticks);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(8000, ticks);
+
+    // puback removes the retry
+    pktBuf[900] = 4 << 4;
+    pktBuf[901] = 2;
+    pktBuf[902] = msgId >> 8;
+    pktBuf[903] = msgId & 0xFF;
+    err = umqtt_DecodePacket(h, &pktBuf[900], 4);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    // the publish sent at 3000 restarted the keep alive
+    err = umqtt_GetNextDeadline(h, &ticks);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(18000, ticks);
+}
+
+// deadline is the first tick at which run has something to do.
+// once ping is sent the deadline moves out
+TEST(Deadline, AfterPing)
+{
+    umqtt_Error_t err;
+    uint32_t ticks;
+    startConnect(1000);
+    finishConnect();
+
+    mock_NetWrite_shouldReturn = 2;
+    err = umqtt_Run(h, 16000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_TRUE(mock_NetWrite_wasCalled);
+    err = umqtt_GetNextDeadline(h, &ticks);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(31000, ticks);
+}
+
+// the deadline of a slot is not moved out when its earliest timer is
+// removed, running at the early deadline finds the next timer
+TEST(Deadline, RemovedEarliest)
+{
+    umqtt_Error_t err;
+    uint32_t ticks;
+    uint16_t msgId;
+    startConnect(1000);
+    finishConnect();
+
+    // lazy way to get required packet length
+    err = umqtt_Run(h, 3000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    mock_malloc_shouldReturn[0] = pktBuf;
+    err = umqtt_Publish(h, "topic", (uint8_t *)"message", 7, 1, false, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_NETWORK, err);
+    mock_NetWrite_shouldReturn = mock_NetWrite_in_len;
+    mock_malloc_Reset();
+    mock_malloc_shouldReturn[0] = pktBuf;
+    err = umqtt_Publish(h, "topic", (uint8_t *)"message", 7, 1, false, &msgId);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    err = umqtt_Run(h, 3100);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    mock_malloc_Reset();
+    mock_malloc_shouldReturn[0] = &pktBuf[300];
+    err = umqtt_Publish(h, "topic", (uint8_t *)"message", 7, 1, false, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+
+    // both retries are in the same slot, the first is acked
+    pktBuf[900] = 4 << 4;
+    pktBuf[901] = 2;
+    pktBuf[902] = msgId >> 8;
+    pktBuf[903] = msgId & 0xFF;
+    err = umqtt_DecodePacket(h, &pktBuf[900], 4);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    err = umqtt_GetNextDeadline(h, &ticks);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(8000, ticks);
+
+    mock_NetWrite_Reset();
+    err = umqtt_Run(h, 8000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+    err = umqtt_GetNextDeadline(h, &ticks);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(8100, ticks);
+}
+
+TEST_GROUP_RUNNER(Deadline)
+{
+    RUN_TEST_CASE(Deadline, NullParms);
+    RUN_TEST_CASE(Deadline, NothingPending);
+    RUN_TEST_CASE(Deadline, ConnackTimeout);
+    RUN_TEST_CASE(Deadline, KeepAlive);
+    RUN_TEST_CASE(Deadline, EarliestEvent);
+    RUN_TEST_CASE(Deadline, AfterPing);
+    RUN_TEST_CASE(Deadline, RemovedEarliest);
+}
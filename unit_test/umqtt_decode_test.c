@@ -13,7 +13,7 @@ TEST_GROUP(Decode);
 
 static umqtt_Handle_t h = NULL;
 static void *instBuf = NULL;
-#define SIZE_INSTBUF 200
+#define SIZE_INSTBUF UMQTT_INSTANCE_SIZE
 static uint8_t *pktBuf = NULL;
 #define SIZE_PKTBUF 1024
 static uint8_t *pktBuf2 = NULL;
@@ -151,7 +151,7 @@ TEST(Decode, LengthMismatch)
 TEST(Decode, BadType)
 {
     umqtt_Error_t err;
-    pktBuf[0] = 5 << 4; // bogus packet type
+    pktBuf[0] = 15 << 4; // bogus packet type
     pktBuf[1] = 2; // rem len
     pktBuf[2] = 1; // fake pkt id
     pktBuf[3] = 2;
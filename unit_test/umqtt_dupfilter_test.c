@@ -0,0 +1,217 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "unity_fixture.h"
+#include "umqtt/umqtt.h"
+#include "umqtt_mocks.h"
+#include "umqtt_wrapper.h"
+
+/*
+inbound qos 1 duplicate filter test cases
+
+The filter only exists when umqtt is built with UMQTT_ENABLE_DUP_FILTER,
+which the unit test Makefile defines along with a smaller than default
+UMQTT_DUP_FILTER_BITS so the instance fits in the test buffers.  It
+remembers the packet IDs of the last UMQTT_DUP_FILTER_BITS IDs below the
+highest one received, one bit each.  A qos 1 PUBLISH with DUP set and a
+remembered ID is acked but not delivered.  Without DUP the ID may have
+been reused after the PUBACK, so the message is always delivered.
+
+-publish with dup set that was not seen is delivered
+-duplicate is acked but not delivered
+-same ID without dup is delivered
+-IDs older than the window are forgotten
+-window follows packet ID wrap
+-out of order IDs within the window are remembered
+-new session clears the filter, resumed session keeps it
+ */
+
+#ifdef UMQTT_ENABLE_DUP_FILTER
+
+TEST_GROUP(DupFilter);
+
+static umqtt_Handle_t h = NULL;
+static void *instBuf = NULL;
+#define SIZE_INSTBUF UMQTT_INSTANCE_SIZE
+static uint8_t rxBuf[32];
+static uint8_t txCopy[32];
+
+static unsigned int Publish_count;
+static void
+PublishCb(umqtt_Handle_t h, void *pUser, bool dup, bool retain, uint8_t qos,
+          const char *pTopic, uint16_t topicLen, const uint8_t *pMsg, uint16_t msgLen)
+{   (void)h; (void)pUser; (void)dup; (void)retain; (void)qos; (void)pTopic;
+    (void)topicLen; (void)pMsg; (void)msgLen; ++Publish_count; }
+
+static umqtt_Callbacks_t callbacks =
+{
+    NULL, PublishCb, NULL, NULL, NULL, NULL
+};
+
+TEST_SETUP(DupFilter)
+{
+    // allocate memory for the instance that will be created
+    // init the instance so it will be ready for all tests
+    mock_malloc_Reset();
+    instBuf = malloc(SIZE_INSTBUF);
+    memset(instBuf, 0xA5, SIZE_INSTBUF); // make sure filter is cleared
+    mock_hNet = &mock_hNet;
+    transportConfig.hNet = mock_hNet;
+    mock_malloc_shouldReturn[0] = instBuf;
+    h = umqtt_New(&transportConfig, &callbacks, NULL);
+    TEST_ASSERT_NOT_NULL(h);
+    // clear all mocks
+    mock_malloc_Reset();
+    mock_free_Reset();
+    mock_NetRead_Reset();
+    mock_NetWrite_Reset();
+    Publish_count = 0;
+    wrap_setConnected(h, true);
+    wrap_setKeepAlive(h, 1000);
+}
+
+TEST_TEAR_DOWN(DupFilter)
+{
+    if (instBuf) { free(instBuf); instBuf = NULL; }
+    h = NULL;
+}
+
+// decode a qos 1 publish, and check that it was acked
+static void
+DecodePublish(uint16_t pktId, bool dup)
+{
+    static const uint8_t pubPkt[] =
+    {
+        0x32, 10, // qos 1
+        0, 5, 't', 'o', 'p', 'i', 'c',
+        0, 0, // packet ID
+        'x'
+    };
+    uint8_t puback[4] = { 0x40, 2, pktId >> 8, pktId & 0xFF };
+    memcpy(rxBuf, pubPkt, sizeof(pubPkt));
+    rxBuf[0] |= dup ? 0x08 : 0;
+    rxBuf[9] = pktId >> 8;
+    rxBuf[10] = pktId & 0xFF;
+    mock_NetWrite_Reset();
+    memset(txCopy, 0, sizeof(txCopy));
+    mock_NetWrite_shouldReturn = 4;
+    mock_NetWrite_pCopy = txCopy;
+    mock_NetWrite_copyLen = 4;
+    umqtt_Error_t err = umqtt_DecodePacket(h, rxBuf, sizeof(pubPkt));
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1, mock_NetWrite_count);
+    TEST_ASSERT_EQUAL_MEMORY(puback, txCopy, 4);
+}
+
+static void
+DecodeConnack(bool sessionPresent)
+{
+    rxBuf[0] = 2 << 4;
+    rxBuf[1] = 2;
+    rxBuf[2] = sessionPresent ? 1 : 0;
+    rxBuf[3] = 0;
+    umqtt_Error_t err = umqtt_DecodePacket(h, rxBuf, 4);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+}
+
+TEST(DupFilter, NotSeen)
+{
+    DecodePublish(100, true);
+    TEST_ASSERT_EQUAL(1, Publish_count);
+}
+
+TEST(DupFilter, Duplicate)
+{
+    DecodePublish(100, false);
+    TEST_ASSERT_EQUAL(1, Publish_count);
+    DecodePublish(100, true);
+    TEST_ASSERT_EQUAL(1, Publish_count);
+    DecodePublish(100, true);
+    TEST_ASSERT_EQUAL(1, Publish_count);
+    // other IDs are not affected
+    DecodePublish(99, true);
+    TEST_ASSERT_EQUAL(2, Publish_count);
+}
+
+// ID can be reused by the server once it has our puback
+TEST(DupFilter, NoDupFlag)
+{
+    DecodePublish(100, false);
+    DecodePublish(100, false);
+    TEST_ASSERT_EQUAL(2, Publish_count);
+}
+
+TEST(DupFilter, WindowSlides)
+{
+    DecodePublish(100, false);
+    DecodePublish(100 + UMQTT_DUP_FILTER_BITS - 1, false);
+    DecodePublish(100, true);
+    TEST_ASSERT_EQUAL(2, Publish_count);
+
+    // 100 has fallen out of the window, so it is not known
+    DecodePublish(100 + UMQTT_DUP_FILTER_BITS, false);
+    DecodePublish(100, true);
+    TEST_ASSERT_EQUAL(4, Publish_count);
+    // but the newer ones still are
+    DecodePublish(100 + UMQTT_DUP_FILTER_BITS - 1, true);
+    DecodePublish(100 + UMQTT_DUP_FILTER_BITS, true);
+    TEST_ASSERT_EQUAL(4, Publish_count);
+}
+
+// packet ID 0 is not used, so 65535 is followed by 1
+TEST(DupFilter, Wrap)
+{
+    DecodePublish(65534, false);
+    DecodePublish(65535, false);
+    DecodePublish(1, false);
+    DecodePublish(2, false);
+    TEST_ASSERT_EQUAL(4, Publish_count);
+    DecodePublish(65534, true);
+    DecodePublish(65535, true);
+    DecodePublish(1, true);
+    TEST_ASSERT_EQUAL(4, Publish_count);
+    DecodePublish(3, true);
+    TEST_ASSERT_EQUAL(5, Publish_count);
+}
+
+TEST(DupFilter, OutOfOrder)
+{
+    DecodePublish(10, false);
+    DecodePublish(8, false);
+    DecodePublish(12, false);
+    DecodePublish(9, true);
+    TEST_ASSERT_EQUAL(4, Publish_count);
+    DecodePublish(8, true);
+    DecodePublish(10, true);
+    DecodePublish(12, true);
+    TEST_ASSERT_EQUAL(4, Publish_count);
+}
+
+// with a new session the server starts over and will not resend
+// anything, so old IDs must not be held against new messages
+TEST(DupFilter, Session)
+{
+    DecodePublish(100, false);
+    DecodeConnack(true);
+    DecodePublish(100, true);
+    TEST_ASSERT_EQUAL(1, Publish_count);
+    DecodeConnack(false);
+    DecodePublish(100, true);
+    TEST_ASSERT_EQUAL(2, Publish_count);
+}
+
+TEST_GROUP_RUNNER(DupFilter)
+{
+    RUN_TEST_CASE(DupFilter, NotSeen);
+    RUN_TEST_CASE(DupFilter, Duplicate);
+    RUN_TEST_CASE(DupFilter, NoDupFlag);
+    RUN_TEST_CASE(DupFilter, WindowSlides);
+    RUN_TEST_CASE(DupFilter, Wrap);
+    RUN_TEST_CASE(DupFilter, OutOfOrder);
+    RUN_TEST_CASE(DupFilter, Session);
+}
+
+#endif
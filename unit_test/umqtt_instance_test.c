@@ -11,17 +11,20 @@
 TEST_GROUP(Instance);
 
 static void *allocBuf;
+// other test groups use this same size for the instance memory
+#define SIZE_INSTBUF UMQTT_INSTANCE_SIZE
 
 TEST_SETUP(Instance)
 {
     mock_malloc_Reset();
     mock_free_Reset();
     mock_NetRead_Reset();
+    mock_NetReadInto_Reset();
     mock_NetWrite_Reset();
     // the hNet field needs to be set up at run time
     mock_hNet = &mock_hNet;
     transportConfig.hNet = mock_hNet;
-    allocBuf = malloc(256);
+    allocBuf = malloc(SIZE_INSTBUF);
 }
 
 TEST_TEAR_DOWN(Instance)
@@ -52,10 +55,100 @@ TEST(Instance, InitNominal)
     TEST_ASSERT_EQUAL(1, mock_malloc_count);
     TEST_ASSERT_EQUAL_PTR(allocBuf, h);
     TEST_ASSERT_NOT_EQUAL(0, mock_malloc_in_size);
+    // instance includes the in-flight packet index and timer wheel,
+    // make sure it still fits the memory the tests provide
+    TEST_ASSERT_TRUE(mock_malloc_in_size <= SIZE_INSTBUF);
     umqtt_Error_t err = umqtt_GetConnectedStatus(h);
     TEST_ASSERT_EQUAL(UMQTT_ERR_DISCONNECTED, err);
 }
 
+// transport reads into a buffer that umqtt allocates once
+TEST(Instance, InitRxBufAlloc)
+{
+    uint8_t rxBuf[128];
+    umqtt_TransportConfig_t rxTransport = transportConfig;
+    rxTransport.pfnNetReadInto = mock_NetReadInto;
+    rxTransport.pRxBuf = NULL;
+    rxTransport.rxBufLen = sizeof(rxBuf);
+    mock_malloc_shouldReturn[0] = allocBuf;
+    mock_malloc_shouldReturn[1] = rxBuf;
+    umqtt_Handle_t h = umqtt_New(&rxTransport, NULL, NULL);
+    TEST_ASSERT_EQUAL_PTR(allocBuf, h);
+    TEST_ASSERT_EQUAL(2, mock_malloc_count);
+    TEST_ASSERT_EQUAL(sizeof(rxBuf), mock_malloc_in_size);
+}
+
+// receive buffer allocation fails, instance should be released
+TEST(Instance, InitRxBufAllocFail)
+{
+    umqtt_TransportConfig_t rxTransport = transportConfig;
+    rxTransport.pfnNetReadInto = mock_NetReadInto;
+    rxTransport.pRxBuf = NULL;
+    rxTransport.rxBufLen = 128;
+    mock_malloc_shouldReturn[0] = allocBuf;
+    mock_malloc_shouldReturn[1] = NULL;
+    umqtt_Handle_t h = umqtt_New(&rxTransport, NULL, NULL);
+    TEST_ASSERT_NULL(h);
+    TEST_ASSERT_EQUAL(2, mock_malloc_count);
+    TEST_ASSERT_TRUE(mock_free_wasCalled);
+    TEST_ASSERT_EQUAL_PTR(allocBuf, mock_free_in_ptr);
+}
+
+// receive buffer provided by caller, no extra allocation
+TEST(Instance, InitRxBufProvided)
+{
+    uint8_t rxBuf[128];
+    umqtt_TransportConfig_t rxTransport = transportConfig;
+    rxTransport.pfnNetReadInto = mock_NetReadInto;
+    rxTransport.pRxBuf = rxBuf;
+    rxTransport.rxBufLen = sizeof(rxBuf);
+    mock_malloc_shouldReturn[0] = allocBuf;
+    umqtt_Handle_t h = umqtt_New(&rxTransport, NULL, NULL);
+    TEST_ASSERT_EQUAL_PTR(allocBuf, h);
+    TEST_ASSERT_EQUAL(1, mock_malloc_count);
+}
+
+// read into function without a buffer length is a parameter error
+TEST(Instance, InitRxBufNoLen)
+{
+    umqtt_TransportConfig_t rxTransport = transportConfig;
+    rxTransport.pfnNetReadInto = mock_NetReadInto;
+    rxTransport.pRxBuf = NULL;
+    rxTransport.rxBufLen = 0;
+    mock_malloc_shouldReturn[0] = allocBuf;
+    umqtt_Handle_t h = umqtt_New(&rxTransport, NULL, NULL);
+    TEST_ASSERT_NULL(h);
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+}
+
+// read into and read segment methods cannot both be used
+TEST(Instance, InitTwoReadModes)
+{
+    uint8_t rxBuf[128];
+    umqtt_TransportConfig_t rxTransport = transportConfig;
+    rxTransport.pfnNetReadInto = mock_NetReadInto;
+    rxTransport.pRxBuf = rxBuf;
+    rxTransport.rxBufLen = sizeof(rxBuf);
+    rxTransport.pfnNetReadSegment = mock_NetReadSegment;
+    rxTransport.pfnNetReleaseSegment = mock_NetReleaseSegment;
+    mock_malloc_shouldReturn[0] = allocBuf;
+    umqtt_Handle_t h = umqtt_New(&rxTransport, NULL, NULL);
+    TEST_ASSERT_NULL(h);
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+}
+
+// read segment function requires a release function
+TEST(Instance, InitSegmentNoRelease)
+{
+    umqtt_TransportConfig_t rxTransport = transportConfig;
+    rxTransport.pfnNetReadSegment = mock_NetReadSegment;
+    rxTransport.pfnNetReleaseSegment = NULL;
+    mock_malloc_shouldReturn[0] = allocBuf;
+    umqtt_Handle_t h = umqtt_New(&rxTransport, NULL, NULL);
+    TEST_ASSERT_NULL(h);
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+}
+
 TEST(Instance, Delete)
 {
     TEST_IGNORE();
@@ -66,5 +159,11 @@ TEST_GROUP_RUNNER(Instance)
     RUN_TEST_CASE(Instance, InitNullInstance);
     RUN_TEST_CASE(Instance, InitMallocFail);
     RUN_TEST_CASE(Instance, InitNominal);
+    RUN_TEST_CASE(Instance, InitRxBufAlloc);
+    RUN_TEST_CASE(Instance, InitRxBufAllocFail);
+    RUN_TEST_CASE(Instance, InitRxBufProvided);
+    RUN_TEST_CASE(Instance, InitRxBufNoLen);
+    RUN_TEST_CASE(Instance, InitTwoReadModes);
+    RUN_TEST_CASE(Instance, InitSegmentNoRelease);
     RUN_TEST_CASE(Instance, Delete);
 }
@@ -0,0 +1,242 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "unity_fixture.h"
+#include "umqtt/umqtt.h"
+#include "umqtt_mocks.h"
+#include "umqtt_wrapper.h"
+
+/*
+ack latency histogram test cases
+
+Only exists when umqtt is built with UMQTT_ENABLE_STATS.  Latency is the
+ticks of the umqtt_Run() that decodes the ack minus the ticks when the
+packet was enqueued.  Bucket 0 is 0 ms, bucket n is 2^(n-1) to 2^n - 1 ms,
+and the last bucket holds everything longer.
+
+-null parameters
+-all zero after init
+-puback latency lands in log2 buckets, count and max
+-suback and unsuback have their own histograms
+-ack that does not match a packet is not recorded
+-percentile from a histogram
+ */
+
+#ifdef UMQTT_ENABLE_STATS
+
+TEST_GROUP(Latency);
+
+static umqtt_Handle_t h = NULL;
+static void *instBuf = NULL;
+#define SIZE_INSTBUF UMQTT_INSTANCE_SIZE
+static uint8_t *pktBuf = NULL;
+#define SIZE_PKTBUF 1024
+static uint8_t rxBuf[8];
+static umqtt_LatencyHist_t hist;
+
+static umqtt_Callbacks_t callbacks =
+{
+    NULL, NULL, NULL, NULL, NULL, NULL
+};
+
+TEST_SETUP(Latency)
+{
+    // allocate memory for the instance that will be created
+    // init the instance so it will be ready for all tests
+    mock_malloc_Reset();
+    instBuf = malloc(SIZE_INSTBUF);
+    memset(instBuf, 0xA5, SIZE_INSTBUF); // make sure histograms are cleared
+    mock_hNet = &mock_hNet;
+    transportConfig.hNet = mock_hNet;
+    mock_malloc_shouldReturn[0] = instBuf;
+    h = umqtt_New(&transportConfig, &callbacks, NULL);
+    TEST_ASSERT_NOT_NULL(h);
+    // clear all mocks
+    mock_malloc_Reset();
+    mock_free_Reset();
+    mock_NetRead_Reset();
+    mock_NetWrite_Reset();
+    // ready a buffer that can be used for packet allocation
+    pktBuf = malloc(SIZE_PKTBUF);
+    TEST_ASSERT_NOT_NULL(pktBuf);
+    memset(&hist, 0xA5, sizeof(hist));
+    // fake an existing connection, and long keep alive so that
+    // ping packets do not interfere
+    wrap_setConnected(h, true);
+    wrap_setKeepAlive(h, 1000);
+}
+
+TEST_TEAR_DOWN(Latency)
+{
+    if (instBuf) { free(instBuf); instBuf = NULL; }
+    if (pktBuf) { free(pktBuf); pktBuf = NULL; }
+    h = NULL;
+}
+
+// enqueue a packet of a type at sentTicks, then have the matching
+// ack arrive in the run at ackTicks
+static void
+AckAfter(uint8_t pktType, uint8_t ackType, uint16_t pktId,
+         uint32_t sentTicks, uint32_t ackTicks)
+{
+    mock_malloc_Reset();
+    mock_NetRead_Reset();
+    mock_malloc_shouldReturn[0] = pktBuf;
+    uint8_t *buf = wrap_newPacket(h, 30);
+    TEST_ASSERT_NOT_NULL(buf);
+    buf[0] = pktType << 4;
+    wrap_enqueuePacket(h, buf, pktId, sentTicks);
+
+    rxBuf[0] = ackType << 4;
+    rxBuf[1] = (ackType == 9) ? 3 : 2;
+    rxBuf[2] = pktId >> 8;
+    rxBuf[3] = pktId & 0xFF;
+    rxBuf[4] = 0; // suback return code
+    mock_NetRead_AddChunk(rxBuf, rxBuf[1] + 2);
+    umqtt_Error_t err = umqtt_Run(h, ackTicks);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_NULL(wrap_getNextPktBuf(h));
+}
+
+static void
+GetHist(umqtt_AckType_t type)
+{
+    umqtt_Error_t err = umqtt_GetAckLatency(h, type, &hist);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+}
+
+TEST(Latency, NullParms)
+{
+    umqtt_Error_t err;
+    uint32_t ms;
+    err = umqtt_GetAckLatency(NULL, UMQTT_ACK_PUBACK, &hist);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+    err = umqtt_GetAckLatency(h, UMQTT_ACK_NUM_TYPES, &hist);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+    err = umqtt_GetAckLatency(h, UMQTT_ACK_PUBACK, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+
+    GetHist(UMQTT_ACK_PUBACK);
+    err = umqtt_GetLatencyPercentile(NULL, 500, &ms);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+    err = umqtt_GetLatencyPercentile(&hist, 1001, &ms);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+    err = umqtt_GetLatencyPercentile(&hist, 500, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+}
+
+TEST(Latency, Init)
+{
+    umqtt_LatencyHist_t zero;
+    memset(&zero, 0, sizeof(zero));
+    GetHist(UMQTT_ACK_PUBACK);
+    TEST_ASSERT_EQUAL_MEMORY(&zero, &hist, sizeof(hist));
+    GetHist(UMQTT_ACK_SUBACK);
+    TEST_ASSERT_EQUAL_MEMORY(&zero, &hist, sizeof(hist));
+    GetHist(UMQTT_ACK_UNSUBACK);
+    TEST_ASSERT_EQUAL_MEMORY(&zero, &hist, sizeof(hist));
+
+    // percentile of empty histogram is 0
+    uint32_t ms = 5555;
+    umqtt_Error_t err = umqtt_GetLatencyPercentile(&hist, 500, &ms);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(0, ms);
+}
+
+TEST(Latency, Puback)
+{
+    AckAfter(3, 4, 1, 1000, 1000);  // 0 ms, bucket 0
+    AckAfter(3, 4, 2, 2000, 2001);  // 1 ms, bucket 1
+    AckAfter(3, 4, 3, 3000, 3003);  // 3 ms, bucket 2
+    AckAfter(3, 4, 4, 4000, 4100);  // 100 ms, bucket 7
+    AckAfter(3, 4, 5, 5000, 9000);  // 4000 ms, bucket 12
+    GetHist(UMQTT_ACK_PUBACK);
+    TEST_ASSERT_EQUAL(5, hist.count);
+    TEST_ASSERT_EQUAL(4000, hist.maxMs);
+    TEST_ASSERT_EQUAL(1, hist.bucket[0]);
+    TEST_ASSERT_EQUAL(1, hist.bucket[1]);
+    TEST_ASSERT_EQUAL(1, hist.bucket[2]);
+    TEST_ASSERT_EQUAL(1, hist.bucket[7]);
+    TEST_ASSERT_EQUAL(1, hist.bucket[12]);
+
+    // other acks not affected
+    GetHist(UMQTT_ACK_SUBACK);
+    TEST_ASSERT_EQUAL(0, hist.count);
+}
+
+TEST(Latency, AckTypes)
+{
+    AckAfter(8, 9, 0x1234, 1000, 1010);     // suback 10 ms, bucket 4
+    AckAfter(10, 11, 0x2345, 2000, 2020);   // unsuback 20 ms, bucket 5
+    GetHist(UMQTT_ACK_SUBACK);
+    TEST_ASSERT_EQUAL(1, hist.count);
+    TEST_ASSERT_EQUAL(10, hist.maxMs);
+    TEST_ASSERT_EQUAL(1, hist.bucket[4]);
+    GetHist(UMQTT_ACK_UNSUBACK);
+    TEST_ASSERT_EQUAL(1, hist.count);
+    TEST_ASSERT_EQUAL(20, hist.maxMs);
+    TEST_ASSERT_EQUAL(1, hist.bucket[5]);
+    GetHist(UMQTT_ACK_PUBACK);
+    TEST_ASSERT_EQUAL(0, hist.count);
+}
+
+// puback for a packet that is not in flight
+TEST(Latency, Unmatched)
+{
+    rxBuf[0] = 4 << 4;
+    rxBuf[1] = 2;
+    rxBuf[2] = 0x12;
+    rxBuf[3] = 0x34;
+    mock_NetRead_AddChunk(rxBuf, 4);
+    umqtt_Error_t err = umqtt_Run(h, 1000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    GetHist(UMQTT_ACK_PUBACK);
+    TEST_ASSERT_EQUAL(0, hist.count);
+}
+
+// percentile is the upper bound of the bucket it falls in
+TEST(Latency, Percentile)
+{
+    umqtt_Error_t err;
+    uint32_t ms;
+    memset(&hist, 0, sizeof(hist));
+    hist.bucket[0] = 50;
+    hist.bucket[4] = 49;
+    hist.bucket[10] = 1;
+    hist.count = 100;
+    hist.maxMs = 600;
+
+    err = umqtt_GetLatencyPercentile(&hist, 500, &ms);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(0, ms);
+    err = umqtt_GetLatencyPercentile(&hist, 990, &ms);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(15, ms);
+    // never more than the max seen
+    err = umqtt_GetLatencyPercentile(&hist, 999, &ms);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(600, ms);
+
+    // last bucket has no upper bound, so max is used
+    hist.bucket[UMQTT_LATENCY_BUCKETS - 1] = 100;
+    hist.count = 200;
+    hist.maxMs = 70000;
+    err = umqtt_GetLatencyPercentile(&hist, 1000, &ms);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(70000, ms);
+}
+
+TEST_GROUP_RUNNER(Latency)
+{
+    RUN_TEST_CASE(Latency, NullParms);
+    RUN_TEST_CASE(Latency, Init);
+    RUN_TEST_CASE(Latency, Puback);
+    RUN_TEST_CASE(Latency, AckTypes);
+    RUN_TEST_CASE(Latency, Unmatched);
+    RUN_TEST_CASE(Latency, Percentile);
+}
+
+#endif
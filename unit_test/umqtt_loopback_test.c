@@ -0,0 +1,366 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "unity_fixture.h"
+#include "umqtt/umqtt.h"
+#include "umqtt_mocks.h"
+#include "umqtt_wrapper.h"
+#include "loopback/loopback_broker.h"
+
+/*
+loopback broker test cases
+
+These run complete exchanges between umqtt instances and the in-process
+loopback broker instead of feeding canned packets to a single instance.
+
+-connect and connack
+-qos 0 publish fans out to matching subscribers only
+-qos 1 publish is acknowledged, delivered at subscription qos
+-qos 2 publish completes and is delivered once at qos 2
+-qos 2 publish with packet ID 0 fails the connection
+-unsubscribe stops delivery
+-subscribe filter with # before the end is rejected
+-ping and pingresp, ping with a body fails the connection
+-protocol error fails the connection
+ */
+
+TEST_GROUP(Loopback);
+
+#define NUM_CLIENTS 3
+static loopback_Broker_t broker;
+static umqtt_TransportConfig_t lbTransport[NUM_CLIENTS];
+static umqtt_Handle_t hc[NUM_CLIENTS];
+static uint32_t ticks;
+
+// per client record of callbacks, pUser points to the record
+typedef struct
+{
+    unsigned int connackCount;
+    uint8_t connackRetCode;
+    unsigned int publishCount;
+    uint8_t publishQos;
+    char topic[32];
+    char msg[32];
+    unsigned int pubackCount;
+    uint16_t pubackMsgId;
+    unsigned int subackCount;
+    uint8_t subackRetCode;
+    unsigned int unsubackCount;
+    unsigned int pingrespCount;
+} LbRecord_t;
+static LbRecord_t rec[NUM_CLIENTS];
+
+static void
+ConnackCb(umqtt_Handle_t h, void *pUser, bool sessionPresent, uint8_t returnCode)
+{   (void)h; (void)sessionPresent; LbRecord_t *p = pUser;
+    ++p->connackCount; p->connackRetCode = returnCode; }
+
+static void
+PublishCb(umqtt_Handle_t h, void *pUser, bool dup, bool retain, uint8_t qos,
+          const char *pTopic, uint16_t topicLen, const uint8_t *pMsg, uint16_t msgLen)
+{   (void)h; (void)dup; (void)retain; LbRecord_t *p = pUser;
+    ++p->publishCount; p->publishQos = qos;
+    memcpy(p->topic, pTopic, topicLen); p->topic[topicLen] = 0;
+    memcpy(p->msg, pMsg, msgLen); p->msg[msgLen] = 0; }
+
+static void
+PubackCb(umqtt_Handle_t h, void *pUser, uint16_t msgId)
+{   (void)h; LbRecord_t *p = pUser; ++p->pubackCount; p->pubackMsgId = msgId; }
+
+static void
+SubackCb(umqtt_Handle_t h, void *pUser, const uint8_t *pRetCodes, uint16_t retCount, uint16_t msgId)
+{   (void)h; (void)retCount; (void)msgId; LbRecord_t *p = pUser;
+    ++p->subackCount; p->subackRetCode = pRetCodes[0]; }
+
+static void
+UnsubackCb(umqtt_Handle_t h, void *pUser, uint16_t msgId)
+{   (void)h; (void)msgId; LbRecord_t *p = pUser; ++p->unsubackCount; }
+
+static void
+PingrespCb(umqtt_Handle_t h, void *pUser)
+{   (void)h; LbRecord_t *p = pUser; ++p->pingrespCount; }
+
+static umqtt_Callbacks_t callbacks =
+{
+    ConnackCb, PublishCb, PubackCb, SubackCb, UnsubackCb, PingrespCb
+};
+
+// run all clients once, a little later than last time
+static void
+RunAll(void)
+{
+    ticks += 10;
+    for (unsigned int idx = 0; idx < NUM_CLIENTS; idx++)
+    {
+        umqtt_Error_t err = umqtt_Run(hc[idx], ticks);
+        TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    }
+}
+
+static void
+Subscribe(unsigned int idx, const char *topic, uint8_t qos)
+{
+    char *topics[1] = { (char *)topic };
+    uint8_t qoss[1] = { qos };
+    umqtt_Error_t err = umqtt_Subscribe(hc[idx], 1, topics, qoss, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    RunAll();
+    TEST_ASSERT_EQUAL(1, rec[idx].subackCount);
+    TEST_ASSERT_EQUAL(qos, rec[idx].subackRetCode);
+}
+
+TEST_SETUP(Loopback)
+{
+    loopback_Init(&broker);
+    memset(rec, 0, sizeof(rec));
+    ticks = 1000;
+    // each client has its own broker connection, and uses the
+    // normal allocator since nothing here is checking memory use
+    for (unsigned int idx = 0; idx < NUM_CLIENTS; idx++)
+    {
+        lbTransport[idx] = transportConfig;
+        lbTransport[idx].pfnMalloc = malloc;
+        lbTransport[idx].pfnFree = free;
+        lbTransport[idx].pRxBuf = NULL;
+        lbTransport[idx].rxBufLen = 0;
+        loopback_Client_t *pClient = loopback_NewClient(&broker);
+        TEST_ASSERT_NOT_NULL(pClient);
+        loopback_InitTransport(pClient, &lbTransport[idx]);
+        TEST_ASSERT_EQUAL(LOOPBACK_PKT_SIZE, lbTransport[idx].rxBufLen);
+        hc[idx] = umqtt_New(&lbTransport[idx], &callbacks, &rec[idx]);
+        TEST_ASSERT_NOT_NULL(hc[idx]);
+    }
+}
+
+TEST_TEAR_DOWN(Loopback)
+{
+    for (unsigned int idx = 0; idx < NUM_CLIENTS; idx++)
+    {
+        umqtt_Delete(hc[idx]);
+        hc[idx] = NULL;
+    }
+}
+
+// connect all the clients, used by most tests
+static void
+ConnectAll(void)
+{
+    for (unsigned int idx = 0; idx < NUM_CLIENTS; idx++)
+    {
+        umqtt_Error_t err = umqtt_Connect(hc[idx], true, false, 0, 10, "loopback",
+                                          NULL, NULL, 0, NULL, NULL);
+        TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    }
+    RunAll();
+    for (unsigned int idx = 0; idx < NUM_CLIENTS; idx++)
+    {
+        TEST_ASSERT_EQUAL(1, rec[idx].connackCount);
+        TEST_ASSERT_EQUAL(0, rec[idx].connackRetCode);
+        TEST_ASSERT_EQUAL(UMQTT_ERR_CONNECTED, umqtt_GetConnectedStatus(hc[idx]));
+    }
+}
+
+TEST(Loopback, Connect)
+{
+    umqtt_Error_t err;
+    err = umqtt_Connect(hc[0], true, false, 0, 10, "loopback", NULL, NULL, 0, NULL, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_CONNECT_PENDING, umqtt_GetConnectedStatus(hc[0]));
+
+    // connack is waiting to be read
+    err = umqtt_Run(hc[0], ticks);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1, rec[0].connackCount);
+    TEST_ASSERT_EQUAL(0, rec[0].connackRetCode);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_CONNECTED, umqtt_GetConnectedStatus(hc[0]));
+    // other clients not affected
+    TEST_ASSERT_EQUAL(0, rec[1].connackCount);
+}
+
+TEST(Loopback, FanOutQos0)
+{
+    ConnectAll();
+    Subscribe(0, "sensor/+", 0);
+    Subscribe(1, "sensor/temp", 0);
+
+    umqtt_Error_t err;
+    err = umqtt_Publish(hc[2], "sensor/temp", (const uint8_t *)"21", 2, 0, false, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    RunAll();
+    TEST_ASSERT_EQUAL(1, rec[0].publishCount);
+    TEST_ASSERT_EQUAL_STRING("sensor/temp", rec[0].topic);
+    TEST_ASSERT_EQUAL_STRING("21", rec[0].msg);
+    TEST_ASSERT_EQUAL(1, rec[1].publishCount);
+    TEST_ASSERT_EQUAL_STRING("21", rec[1].msg);
+    TEST_ASSERT_EQUAL(0, rec[2].publishCount);
+
+    // only the wildcard matches
+    err = umqtt_Publish(hc[2], "sensor/humidity", (const uint8_t *)"40", 2, 0, false, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    RunAll();
+    TEST_ASSERT_EQUAL(2, rec[0].publishCount);
+    TEST_ASSERT_EQUAL_STRING("sensor/humidity", rec[0].topic);
+    TEST_ASSERT_EQUAL(1, rec[1].publishCount);
+    TEST_ASSERT_EQUAL(2, broker.publishes);
+    TEST_ASSERT_EQUAL(3, broker.deliveries);
+}
+
+TEST(Loopback, Qos1)
+{
+    ConnectAll();
+    Subscribe(0, "cmd/#", 1);
+    Subscribe(1, "cmd/#", 0);
+
+    umqtt_Error_t err;
+    uint16_t msgId = 0;
+    err = umqtt_Publish(hc[2], "cmd/reset", (const uint8_t *)"now", 3, 1, false, &msgId);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_NOT_EQUAL(0, msgId);
+    RunAll();
+
+    // publisher gets its puback
+    TEST_ASSERT_EQUAL(1, rec[2].pubackCount);
+    TEST_ASSERT_EQUAL(msgId, rec[2].pubackMsgId);
+    // delivered at the lower of publish and subscription qos
+    TEST_ASSERT_EQUAL(1, rec[0].publishCount);
+    TEST_ASSERT_EQUAL(1, rec[0].publishQos);
+    TEST_ASSERT_EQUAL_STRING("now", rec[0].msg);
+    TEST_ASSERT_EQUAL(1, rec[1].publishCount);
+    TEST_ASSERT_EQUAL(0, rec[1].publishQos);
+    // subscriber puback was accepted by the broker
+    RunAll();
+    TEST_ASSERT_EQUAL(0, loopback_GetDropped(&broker.clients[0]));
+    TEST_ASSERT_FALSE(broker.clients[0].failed);
+}
+
+TEST(Loopback, Qos2)
+{
+    ConnectAll();
+    Subscribe(0, "cmd/#", 2);
+    Subscribe(1, "cmd/#", 1);
+
+    umqtt_Error_t err;
+    uint16_t msgId = 0;
+    err = umqtt_Publish(hc[2], "cmd/reset", (const uint8_t *)"now", 3, 2, false, &msgId);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_NOT_EQUAL(0, msgId);
+    // pubrec, then pubcomp
+    RunAll();
+    RunAll();
+    TEST_ASSERT_EQUAL(1, rec[2].pubackCount);
+    TEST_ASSERT_EQUAL(msgId, rec[2].pubackMsgId);
+    TEST_ASSERT_EQUAL(1, rec[0].publishCount);
+    TEST_ASSERT_EQUAL(2, rec[0].publishQos);
+    TEST_ASSERT_EQUAL_STRING("now", rec[0].msg);
+    TEST_ASSERT_EQUAL(1, rec[1].publishCount);
+    TEST_ASSERT_EQUAL(1, rec[1].publishQos);
+
+    // all exchanges finish and nothing is left waiting
+    RunAll();
+    for (unsigned int idx = 0; idx < NUM_CLIENTS; idx++)
+    {
+        unsigned int count = 5555;
+        err = umqtt_GetInflightCount(hc[idx], &count);
+        TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+        TEST_ASSERT_EQUAL(0, count);
+        TEST_ASSERT_FALSE(broker.clients[idx].failed);
+        TEST_ASSERT_EQUAL(0, broker.clients[idx].qos2Ids[0]);
+    }
+    TEST_ASSERT_EQUAL(1, rec[0].publishCount);
+}
+
+TEST(Loopback, Qos2ZeroId)
+{
+    ConnectAll();
+    // qos 2 publish to "t" with packet ID 0
+    uint8_t publish[] = { (3 << 4) | 4, 6, 0, 1, 't', 0, 0, 'x' };
+    int res = lbTransport[0].pfnNetWritePacket(lbTransport[0].hNet, publish, 8, false);
+    TEST_ASSERT_EQUAL(-1, res);
+    TEST_ASSERT_TRUE(broker.clients[0].failed);
+    TEST_ASSERT_EQUAL(0, broker.clients[0].qos2Ids[0]);
+    TEST_ASSERT_EQUAL(broker.clients[0].rd, broker.clients[0].wr);
+}
+
+TEST(Loopback, Unsubscribe)
+{
+    ConnectAll();
+    Subscribe(0, "a/b", 0);
+
+    umqtt_Error_t err;
+    const char *topics[1] = { "a/b" };
+    err = umqtt_Unsubscribe(hc[0], 1, topics, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    RunAll();
+    TEST_ASSERT_EQUAL(1, rec[0].unsubackCount);
+
+    err = umqtt_Publish(hc[1], "a/b", (const uint8_t *)"x", 1, 0, false, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    RunAll();
+    TEST_ASSERT_EQUAL(0, rec[0].publishCount);
+    TEST_ASSERT_EQUAL(0, broker.deliveries);
+}
+
+TEST(Loopback, BadFilter)
+{
+    ConnectAll();
+    char *topics[1] = { "a/#/b" };
+    uint8_t qoss[1] = { 0 };
+    umqtt_Error_t err = umqtt_Subscribe(hc[0], 1, topics, qoss, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    RunAll();
+    TEST_ASSERT_EQUAL(1, rec[0].subackCount);
+    TEST_ASSERT_EQUAL(0x80, rec[0].subackRetCode);
+    TEST_ASSERT_FALSE(broker.clients[0].failed);
+}
+
+TEST(Loopback, Ping)
+{
+    ConnectAll();
+    // keep alive of 10 seconds, ping is sent halfway
+    ticks += 6000;
+    RunAll();
+    RunAll();
+    for (unsigned int idx = 0; idx < NUM_CLIENTS; idx++)
+    {
+        TEST_ASSERT_EQUAL(1, rec[idx].pingrespCount);
+        TEST_ASSERT_EQUAL(UMQTT_ERR_CONNECTED, umqtt_GetConnectedStatus(hc[idx]));
+    }
+
+    // a pingreq must not have a body, and is not answered
+    uint8_t pingreq[] = { 12 << 4, 1, 0 };
+    int res = lbTransport[0].pfnNetWritePacket(lbTransport[0].hNet, pingreq, 3, false);
+    TEST_ASSERT_EQUAL(-1, res);
+    TEST_ASSERT_TRUE(broker.clients[0].failed);
+    TEST_ASSERT_EQUAL(broker.clients[0].rd, broker.clients[0].wr);
+}
+
+TEST(Loopback, ProtocolError)
+{
+    // anything other than connect as first packet
+    uint8_t pingreq[] = { 12 << 4, 0 };
+    int res = lbTransport[0].pfnNetWritePacket(lbTransport[0].hNet, pingreq, 2, false);
+    TEST_ASSERT_EQUAL(-1, res);
+    TEST_ASSERT_TRUE(broker.clients[0].failed);
+
+    // connection stays failed
+    umqtt_Error_t err;
+    err = umqtt_Connect(hc[0], true, false, 0, 10, "loopback", NULL, NULL, 0, NULL, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_NETWORK, err);
+}
+
+TEST_GROUP_RUNNER(Loopback)
+{
+    RUN_TEST_CASE(Loopback, Connect);
+    RUN_TEST_CASE(Loopback, FanOutQos0);
+    RUN_TEST_CASE(Loopback, Qos1);
+    RUN_TEST_CASE(Loopback, Qos2);
+    RUN_TEST_CASE(Loopback, Qos2ZeroId);
+    RUN_TEST_CASE(Loopback, Unsubscribe);
+    RUN_TEST_CASE(Loopback, BadFilter);
+    RUN_TEST_CASE(Loopback, Ping);
+    RUN_TEST_CASE(Loopback, ProtocolError);
+}
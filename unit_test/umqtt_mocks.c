@@ -15,7 +15,15 @@ umqtt_TransportConfig_t transportConfig =
     mock_malloc,
     mock_free,
     mock_NetRead,
-    mock_NetWrite
+    mock_NetWrite,
+    NULL, // pfnNetReadInto
+    NULL, // pRxBuf
+    0, // rxBufLen
+    NULL, // pfnNetReadSegment
+    NULL, // pfnNetReleaseSegment
+    NULL, // pfnNetWritev
+    NULL, // pPoolClasses
+    0 // numPoolClasses
 };
 
 void *mock_malloc_shouldReturn[3];
@@ -25,7 +33,12 @@ void *
 mock_malloc(size_t size)
 {
     mock_malloc_in_size = size;
-    void *ret = mock_malloc_shouldReturn[mock_malloc_count];
+    // calls past the scripted ones fail
+    void *ret = NULL;
+    if (mock_malloc_count < (sizeof(mock_malloc_shouldReturn) / sizeof(void *)))
+    {
+        ret = mock_malloc_shouldReturn[mock_malloc_count];
+    }
     ++mock_malloc_count;
     return ret;
 }
@@ -40,17 +53,20 @@ mock_malloc_Reset(void)
 }
 
 bool mock_free_wasCalled;
+unsigned int mock_free_count;
 void *mock_free_in_ptr;
 void
 mock_free(void *ptr)
 {
     mock_free_wasCalled = true;
+    ++mock_free_count;
     mock_free_in_ptr = ptr;
 }
 void
 mock_free_Reset(void)
 {
     mock_free_wasCalled = false;
+    mock_free_count = 0;
     mock_free_in_ptr = NULL;
 }
 
@@ -58,24 +74,139 @@ bool mock_NetRead_wasCalled;
 void *mock_NetRead_in_hNet;
 uint8_t *mock_NetRead_shouldReturn_pBuf;
 int mock_NetRead_shouldReturn;
+unsigned int mock_NetRead_chunkCount;
+unsigned int mock_NetRead_callCount;
+uint8_t *mock_NetRead_chunk_pBuf[MOCK_NETREAD_MAX_CHUNKS];
+int mock_NetRead_chunk_len[MOCK_NETREAD_MAX_CHUNKS];
 int
 mock_NetRead(void *hNet, uint8_t **ppBuf)
 {
     mock_NetRead_wasCalled = true;
     mock_NetRead_in_hNet = hNet;
+    // if a chunk sequence was set up, then return the next chunk
+    if (mock_NetRead_chunkCount)
+    {
+        unsigned int idx = mock_NetRead_callCount++;
+        if (idx < mock_NetRead_chunkCount)
+        {
+            *ppBuf = mock_NetRead_chunk_pBuf[idx];
+            return mock_NetRead_chunk_len[idx];
+        }
+        *ppBuf = NULL;
+        return 0;
+    }
+    ++mock_NetRead_callCount;
     *ppBuf = mock_NetRead_shouldReturn_pBuf;
     return mock_NetRead_shouldReturn;
 }
 void
+mock_NetRead_AddChunk(uint8_t *pBuf, int len)
+{
+    if (mock_NetRead_chunkCount < MOCK_NETREAD_MAX_CHUNKS)
+    {
+        mock_NetRead_chunk_pBuf[mock_NetRead_chunkCount] = pBuf;
+        mock_NetRead_chunk_len[mock_NetRead_chunkCount] = len;
+        ++mock_NetRead_chunkCount;
+    }
+}
+void
 mock_NetRead_Reset(void)
 {
     mock_NetRead_wasCalled = false;
     mock_NetRead_in_hNet = NULL;
     mock_NetRead_shouldReturn_pBuf = NULL;
     mock_NetRead_shouldReturn = 0;
+    mock_NetRead_chunkCount = 0;
+    mock_NetRead_callCount = 0;
+}
+
+bool mock_NetReadInto_wasCalled;
+void *mock_NetReadInto_in_hNet;
+uint8_t *mock_NetReadInto_in_pBuf;
+uint32_t mock_NetReadInto_in_len;
+static int mock_NetReadInto_offset; // amount of current chunk already read
+int
+mock_NetReadInto(void *hNet, uint8_t *pBuf, uint32_t len)
+{
+    mock_NetReadInto_wasCalled = true;
+    mock_NetReadInto_in_hNet = hNet;
+    mock_NetReadInto_in_pBuf = pBuf;
+    mock_NetReadInto_in_len = len;
+    // uses the same chunk sequence as NetRead, but copies the chunk
+    // into the caller buffer.  If the chunk does not fit then the
+    // rest of it is returned on the next call
+    unsigned int idx = mock_NetRead_callCount;
+    if (idx >= mock_NetRead_chunkCount)
+    {
+        return 0;
+    }
+    int remaining = mock_NetRead_chunk_len[idx] - mock_NetReadInto_offset;
+    int count = ((uint32_t)remaining > len) ? (int)len : remaining;
+    memcpy(pBuf, &mock_NetRead_chunk_pBuf[idx][mock_NetReadInto_offset], count);
+    mock_NetReadInto_offset += count;
+    if (mock_NetReadInto_offset == mock_NetRead_chunk_len[idx])
+    {
+        mock_NetReadInto_offset = 0;
+        ++mock_NetRead_callCount;
+    }
+    return count;
+}
+void
+mock_NetReadInto_Reset(void)
+{
+    mock_NetReadInto_wasCalled = false;
+    mock_NetReadInto_in_hNet = NULL;
+    mock_NetReadInto_in_pBuf = NULL;
+    mock_NetReadInto_in_len = 0;
+    mock_NetReadInto_offset = 0;
+}
+
+bool mock_NetReadSegment_wasCalled;
+void *mock_NetReadSegment_in_hNet;
+int
+mock_NetReadSegment(void *hNet, const uint8_t **ppData, void **ppSeg)
+{
+    mock_NetReadSegment_wasCalled = true;
+    mock_NetReadSegment_in_hNet = hNet;
+    // each chunk in the NetRead chunk sequence is one segment
+    // the segment handle is just the chunk pointer
+    unsigned int idx = mock_NetRead_callCount;
+    if (idx >= mock_NetRead_chunkCount)
+    {
+        return 0;
+    }
+    ++mock_NetRead_callCount;
+    *ppData = mock_NetRead_chunk_pBuf[idx];
+    *ppSeg = mock_NetRead_chunk_pBuf[idx];
+    return mock_NetRead_chunk_len[idx];
+}
+void
+mock_NetReadSegment_Reset(void)
+{
+    mock_NetReadSegment_wasCalled = false;
+    mock_NetReadSegment_in_hNet = NULL;
+}
+
+unsigned int mock_NetReleaseSegment_count;
+void *mock_NetReleaseSegment_in_hNet;
+void *mock_NetReleaseSegment_in_pSeg;
+void
+mock_NetReleaseSegment(void *hNet, void *pSeg)
+{
+    ++mock_NetReleaseSegment_count;
+    mock_NetReleaseSegment_in_hNet = hNet;
+    mock_NetReleaseSegment_in_pSeg = pSeg;
+}
+void
+mock_NetReleaseSegment_Reset(void)
+{
+    mock_NetReleaseSegment_count = 0;
+    mock_NetReleaseSegment_in_hNet = NULL;
+    mock_NetReleaseSegment_in_pSeg = NULL;
 }
 
 bool mock_NetWrite_wasCalled;
+unsigned int mock_NetWrite_count;
 void *mock_NetWrite_in_hNet;
 const uint8_t *mock_NetWrite_in_pBuf;
 uint16_t mock_NetWrite_in_len;
@@ -87,13 +218,21 @@ int
 mock_NetWrite(void *hNet, const uint8_t *pBuf, uint32_t len, bool isMore)
 {
     mock_NetWrite_wasCalled = true;
+    ++mock_NetWrite_count;
     mock_NetWrite_in_hNet = hNet;
     mock_NetWrite_in_pBuf = pBuf;
     mock_NetWrite_in_len = len;
     mock_NetWrite_in_isMore = isMore;
     if (mock_NetWrite_pCopy)
     {
-        memcpy(mock_NetWrite_pCopy, pBuf, mock_NetWrite_copyLen);
+        // only what was passed in is copied
+        memcpy(mock_NetWrite_pCopy, pBuf,
+               (len < mock_NetWrite_copyLen) ? len : mock_NetWrite_copyLen);
+    }
+    // the transport takes at most what it is given
+    if ((mock_NetWrite_shouldReturn > 0) && ((uint32_t)mock_NetWrite_shouldReturn > len))
+    {
+        return len;
     }
     return mock_NetWrite_shouldReturn;
 }
@@ -101,6 +240,7 @@ void
 mock_NetWrite_Reset(void)
 {
     mock_NetWrite_wasCalled = false;
+    mock_NetWrite_count = 0;
     mock_NetWrite_in_hNet = NULL;
     mock_NetWrite_in_pBuf = NULL;
     mock_NetWrite_in_len = 0;
@@ -110,3 +250,53 @@ mock_NetWrite_Reset(void)
     mock_NetWrite_copyLen = 0;
 }
 
+
+bool mock_NetWritev_wasCalled;
+void *mock_NetWritev_in_hNet;
+unsigned int mock_NetWritev_in_iovCnt;
+umqtt_IoVec_t mock_NetWritev_in_iov[MOCK_NETWRITEV_MAX_IOV];
+uint8_t mock_NetWritev_data[MOCK_NETWRITEV_MAX_DATA];
+uint32_t mock_NetWritev_dataLen;
+int mock_NetWritev_shouldReturn;
+int
+mock_NetWritev(void *hNet, const umqtt_IoVec_t *pIov, unsigned int iovCnt)
+{
+    mock_NetWritev_wasCalled = true;
+    mock_NetWritev_in_hNet = hNet;
+    mock_NetWritev_in_iovCnt = iovCnt;
+    mock_NetWritev_dataLen = 0;
+    uint32_t total = 0;
+    // record the segments and gather them into one buffer so the
+    // test can check the whole packet
+    for (unsigned int idx = 0; idx < iovCnt; idx++)
+    {
+        if (idx < MOCK_NETWRITEV_MAX_IOV)
+        {
+            mock_NetWritev_in_iov[idx] = pIov[idx];
+        }
+        uint32_t len = pIov[idx].len;
+        if ((mock_NetWritev_dataLen + len) > MOCK_NETWRITEV_MAX_DATA)
+        {
+            len = MOCK_NETWRITEV_MAX_DATA - mock_NetWritev_dataLen;
+        }
+        memcpy(&mock_NetWritev_data[mock_NetWritev_dataLen], pIov[idx].pBuf, len);
+        mock_NetWritev_dataLen += len;
+        total += pIov[idx].len;
+    }
+    // the transport takes at most what it is given
+    if ((mock_NetWritev_shouldReturn > 0) && ((uint32_t)mock_NetWritev_shouldReturn > total))
+    {
+        return total;
+    }
+    return mock_NetWritev_shouldReturn;
+}
+void
+mock_NetWritev_Reset(void)
+{
+    mock_NetWritev_wasCalled = false;
+    mock_NetWritev_in_hNet = NULL;
+    mock_NetWritev_in_iovCnt = 0;
+    memset(mock_NetWritev_in_iov, 0, sizeof(mock_NetWritev_in_iov));
+    mock_NetWritev_dataLen = 0;
+    mock_NetWritev_shouldReturn = 0;
+}
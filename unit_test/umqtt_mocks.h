@@ -2,11 +2,21 @@
 #ifndef _UMQTT_MOCKS_H_
 #define _UMQTT_MOCKS_H_
 
-// this private structure is used in the library (copied here)
+// these private structures are used in the library (copied here)
 // need to be able to compute its size for test
+typedef struct Timer
+{
+    struct Timer *next;
+    struct Timer **pprev;
+    uint32_t expires;
+} Timer_t;
+
 typedef struct PktBuf
 {
     struct PktBuf *next;
+    struct PktBuf *prev;
+    struct PktBuf *idNext;
+    Timer_t timer;
     uint16_t packetId;
     uint32_t ticks;
     unsigned int ttl;
@@ -22,6 +32,7 @@ extern void *mock_malloc(size_t size);
 extern void mock_malloc_Reset(void);
 
 extern bool mock_free_wasCalled;
+extern unsigned int mock_free_count;
 extern void *mock_free_in_ptr;
 extern void mock_free(void *ptr);
 extern void mock_free_Reset(void);
@@ -33,7 +44,38 @@ extern int mock_NetRead_shouldReturn;
 extern int mock_NetRead(void *hNet, uint8_t **ppBuf);
 extern void mock_NetRead_Reset(void);
 
+// optional sequence of chunks for NetRead, one chunk is returned per call
+// when the sequence is used up, NetRead returns 0 (no data)
+#define MOCK_NETREAD_MAX_CHUNKS 8
+extern unsigned int mock_NetRead_chunkCount;
+extern unsigned int mock_NetRead_callCount;
+extern uint8_t *mock_NetRead_chunk_pBuf[];
+extern int mock_NetRead_chunk_len[];
+extern void mock_NetRead_AddChunk(uint8_t *pBuf, int len);
+
+// NetReadInto takes its data from the NetRead chunk sequence
+extern bool mock_NetReadInto_wasCalled;
+extern void *mock_NetReadInto_in_hNet;
+extern uint8_t *mock_NetReadInto_in_pBuf;
+extern uint32_t mock_NetReadInto_in_len;
+extern int mock_NetReadInto(void *hNet, uint8_t *pBuf, uint32_t len);
+extern void mock_NetReadInto_Reset(void);
+
+// NetReadSegment returns each chunk of the NetRead chunk sequence
+// as one segment
+extern bool mock_NetReadSegment_wasCalled;
+extern void *mock_NetReadSegment_in_hNet;
+extern int mock_NetReadSegment(void *hNet, const uint8_t **ppData, void **ppSeg);
+extern void mock_NetReadSegment_Reset(void);
+
+extern unsigned int mock_NetReleaseSegment_count;
+extern void *mock_NetReleaseSegment_in_hNet;
+extern void *mock_NetReleaseSegment_in_pSeg;
+extern void mock_NetReleaseSegment(void *hNet, void *pSeg);
+extern void mock_NetReleaseSegment_Reset(void);
+
 extern bool mock_NetWrite_wasCalled;
+extern unsigned int mock_NetWrite_count;
 extern void *mock_NetWrite_in_hNet;
 extern const uint8_t *mock_NetWrite_in_pBuf;
 extern uint16_t mock_NetWrite_in_len;
@@ -44,4 +86,18 @@ extern uint16_t mock_NetWrite_copyLen;
 extern int mock_NetWrite(void *hNet, const uint8_t *pBuf, uint32_t len, bool isMore);
 extern void mock_NetWrite_Reset(void);
 
+// NetWritev records up to MAX_IOV segments and gathers all of the
+// segment data into mock_NetWritev_data
+#define MOCK_NETWRITEV_MAX_IOV 4
+#define MOCK_NETWRITEV_MAX_DATA 4096
+extern bool mock_NetWritev_wasCalled;
+extern void *mock_NetWritev_in_hNet;
+extern unsigned int mock_NetWritev_in_iovCnt;
+extern umqtt_IoVec_t mock_NetWritev_in_iov[];
+extern uint8_t mock_NetWritev_data[];
+extern uint32_t mock_NetWritev_dataLen;
+extern int mock_NetWritev_shouldReturn;
+extern int mock_NetWritev(void *hNet, const umqtt_IoVec_t *pIov, unsigned int iovCnt);
+extern void mock_NetWritev_Reset(void);
+
 #endif
@@ -14,7 +14,7 @@ TEST_GROUP(PacketHandling);
 static umqtt_Handle_t h = NULL;
 
 static void *instBuf = NULL;
-#define SIZE_INSTBUF 200
+#define SIZE_INSTBUF UMQTT_INSTANCE_SIZE
 static uint8_t *pktBuf1 = NULL;
 static uint8_t *pktBuf2 = NULL;
 static uint8_t *pktBuf3 = NULL;
@@ -140,6 +140,9 @@ TEST(PacketHandling, EnqueueTwo)
     TEST_ASSERT_EQUAL_PTR(pktBuf1, pkt);
     TEST_ASSERT_EQUAL(123, pkt->packetId);
     TEST_ASSERT_EQUAL(456, pkt->ticks);
+    // oldest packet is at the tail and links back to the newer one
+    TEST_ASSERT_EQUAL_PTR(pktBuf1, wrap_getLastPktBuf(h));
+    TEST_ASSERT_EQUAL_PTR(pktBuf2, pkt->prev);
 }
 
 // enq a packet, verify bad parms for null inputs
@@ -275,6 +278,188 @@ TEST(PacketHandling, DequeueMultiple)
     TEST_ASSERT_NULL(pkt);
 }
 
+// verify the list links in both directions and return the count
+static unsigned int
+CheckLinks(void)
+{
+    unsigned int count = 0;
+    PktBuf_t *prev = NULL;
+    PktBuf_t *pkt = wrap_getNextPktBuf(h);
+    while (pkt)
+    {
+        TEST_ASSERT_EQUAL_PTR(prev, pkt->prev);
+        prev = pkt;
+        pkt = pkt->next;
+        ++count;
+    }
+    TEST_ASSERT_EQUAL_PTR(prev, wrap_getLastPktBuf(h));
+    return count;
+}
+
+// packet IDs that land in the same index bucket
+TEST(PacketHandling, DequeueByIdSameBucket)
+{
+    uint8_t *buf;
+    uint8_t *buf1;
+    uint8_t *buf2;
+    uint8_t *buf3;
+    mock_malloc_shouldReturn[0] = pktBuf1;
+    mock_malloc_shouldReturn[1] = pktBuf2;
+    mock_malloc_shouldReturn[2] = pktBuf3;
+    buf1 = wrap_newPacket(h, 10);
+    buf2 = wrap_newPacket(h, 10);
+    buf3 = wrap_newPacket(h, 10);
+    // ids are 256 apart so they share a bucket for any power of 2
+    // bucket count up to 256
+    wrap_enqueuePacket(h, buf1, 7, 100);
+    wrap_enqueuePacket(h, buf2, 7 + 256, 200);
+    wrap_enqueuePacket(h, buf3, 7 + 512, 300);
+    TEST_ASSERT_EQUAL(3, CheckLinks());
+
+    // not present but same bucket
+    buf = wrap_dequeuePacketById(h, 7 + 768);
+    TEST_ASSERT_NULL(buf);
+    TEST_ASSERT_EQUAL(3, CheckLinks());
+
+    buf = wrap_dequeuePacketById(h, 7 + 256);
+    TEST_ASSERT_EQUAL_PTR(buf2, buf);
+    TEST_ASSERT_EQUAL(2, CheckLinks());
+    buf = wrap_dequeuePacketById(h, 7 + 256);
+    TEST_ASSERT_NULL(buf);
+    buf = wrap_dequeuePacketById(h, 7);
+    TEST_ASSERT_EQUAL_PTR(buf1, buf);
+    TEST_ASSERT_EQUAL(1, CheckLinks());
+    buf = wrap_dequeuePacketById(h, 7 + 512);
+    TEST_ASSERT_EQUAL_PTR(buf3, buf);
+    TEST_ASSERT_EQUAL(0, CheckLinks());
+    TEST_ASSERT_NULL(wrap_getLastPktBuf(h));
+}
+
+// a few hundred packets in flight, acked out of order
+#define NUM_INFLIGHT 300
+typedef struct
+{
+    PktBuf_t hdr;
+    uint8_t data[8];
+} InflightPkt_t;
+static InflightPkt_t inflight[NUM_INFLIGHT];
+
+TEST(PacketHandling, DequeueByIdMany)
+{
+    uint8_t *buf;
+    unsigned int idx;
+
+    for (idx = 0; idx < NUM_INFLIGHT; idx++)
+    {
+        buf = (uint8_t *)&inflight[idx] + sizeof(PktBuf_t);
+        wrap_enqueuePacket(h, buf, idx + 1, idx);
+    }
+    TEST_ASSERT_EQUAL(NUM_INFLIGHT, CheckLinks());
+    // oldest is at the tail
+    TEST_ASSERT_EQUAL_PTR(&inflight[0], wrap_getLastPktBuf(h));
+
+    // 7 and NUM_INFLIGHT have no common factor so this visits
+    // every packet once, in scrambled order
+    for (unsigned int n = 0; n < NUM_INFLIGHT; n++)
+    {
+        idx = (n * 7) % NUM_INFLIGHT;
+        buf = wrap_dequeuePacketById(h, idx + 1);
+        TEST_ASSERT_EQUAL_PTR((uint8_t *)&inflight[idx] + sizeof(PktBuf_t), buf);
+        buf = wrap_dequeuePacketById(h, idx + 1);
+        TEST_ASSERT_NULL(buf);
+    }
+    TEST_ASSERT_EQUAL(0, CheckLinks());
+    TEST_ASSERT_FALSE(mock_free_wasCalled);
+}
+
+// ID index doubles its buckets when it holds more packets than buckets
+TEST(PacketHandling, DequeueByIdGrow)
+{
+    static PktBuf_t *table16[16];
+    static PktBuf_t *table32[32];
+    uint8_t *buf;
+    unsigned int idx;
+
+    TEST_ASSERT_EQUAL(8, wrap_getIdBuckets(h));
+    mock_malloc_shouldReturn[0] = table16;
+    mock_malloc_shouldReturn[1] = table32;
+    for (idx = 0; idx < 8; idx++)
+    {
+        buf = (uint8_t *)&inflight[idx] + sizeof(PktBuf_t);
+        wrap_enqueuePacket(h, buf, idx + 1, idx);
+        TEST_ASSERT_EQUAL(0, mock_malloc_count);
+    }
+    // 9th packet would put 9 in 8 buckets
+    buf = (uint8_t *)&inflight[8] + sizeof(PktBuf_t);
+    wrap_enqueuePacket(h, buf, 9, 8);
+    TEST_ASSERT_EQUAL(1, mock_malloc_count);
+    TEST_ASSERT_EQUAL(16 * sizeof(PktBuf_t *), mock_malloc_in_size);
+    TEST_ASSERT_EQUAL(16, wrap_getIdBuckets(h));
+    // the instance table is not freed
+    TEST_ASSERT_FALSE(mock_free_wasCalled);
+    for (idx = 9; idx < 18; idx++)
+    {
+        buf = (uint8_t *)&inflight[idx] + sizeof(PktBuf_t);
+        wrap_enqueuePacket(h, buf, idx + 1, idx);
+    }
+    TEST_ASSERT_EQUAL(2, mock_malloc_count);
+    TEST_ASSERT_EQUAL(32, wrap_getIdBuckets(h));
+    // the first grown table is freed
+    TEST_ASSERT_EQUAL(1, mock_free_count);
+    TEST_ASSERT_EQUAL_PTR(table16, mock_free_in_ptr);
+    TEST_ASSERT_EQUAL(18, CheckLinks());
+
+    // every packet is still found after the moves
+    for (idx = 0; idx < 18; idx++)
+    {
+        buf = wrap_dequeuePacketById(h, idx + 1);
+        TEST_ASSERT_EQUAL_PTR((uint8_t *)&inflight[idx] + sizeof(PktBuf_t), buf);
+    }
+    TEST_ASSERT_EQUAL(0, CheckLinks());
+}
+
+// ID index keeps working in its table when it cannot grow
+TEST(PacketHandling, DequeueByIdGrowFail)
+{
+    uint8_t *buf;
+    unsigned int idx;
+
+    for (idx = 0; idx < 20; idx++)
+    {
+        buf = (uint8_t *)&inflight[idx] + sizeof(PktBuf_t);
+        wrap_enqueuePacket(h, buf, idx + 1, idx);
+    }
+    TEST_ASSERT_NOT_EQUAL(0, mock_malloc_count);
+    TEST_ASSERT_EQUAL(8, wrap_getIdBuckets(h));
+    for (idx = 0; idx < 20; idx++)
+    {
+        buf = wrap_dequeuePacketById(h, idx + 1);
+        TEST_ASSERT_EQUAL_PTR((uint8_t *)&inflight[idx] + sizeof(PktBuf_t), buf);
+    }
+    TEST_ASSERT_EQUAL(0, CheckLinks());
+}
+
+// in-flight window sizes the ID index up front
+TEST(PacketHandling, WindowSizesIndex)
+{
+    static PktBuf_t *table128[128];
+    mock_malloc_shouldReturn[0] = table128;
+    umqtt_Error_t err = umqtt_SetInflightWindow(h, 100);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1, mock_malloc_count);
+    TEST_ASSERT_EQUAL(128 * sizeof(PktBuf_t *), mock_malloc_in_size);
+    TEST_ASSERT_EQUAL(128, wrap_getIdBuckets(h));
+    // a smaller window keeps the table
+    err = umqtt_SetInflightWindow(h, 4);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1, mock_malloc_count);
+    TEST_ASSERT_EQUAL(128, wrap_getIdBuckets(h));
+    // and it is freed with the instance
+    umqtt_Delete(h);
+    TEST_ASSERT_EQUAL(2, mock_free_count);
+    h = NULL;
+}
+
 TEST_GROUP_RUNNER(PacketHandling)
 {
     RUN_TEST_CASE(PacketHandling, NewPacketNull);
@@ -290,4 +475,9 @@ TEST_GROUP_RUNNER(PacketHandling)
     RUN_TEST_CASE(PacketHandling, DequeueByTypeBadType);
     RUN_TEST_CASE(PacketHandling, DequeueByTypeGood);
     RUN_TEST_CASE(PacketHandling, DequeueMultiple);
+    RUN_TEST_CASE(PacketHandling, DequeueByIdSameBucket);
+    RUN_TEST_CASE(PacketHandling, DequeueByIdMany);
+    RUN_TEST_CASE(PacketHandling, DequeueByIdGrow);
+    RUN_TEST_CASE(PacketHandling, DequeueByIdGrowFail);
+    RUN_TEST_CASE(PacketHandling, WindowSizesIndex);
 }
@@ -0,0 +1,447 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "unity_fixture.h"
+#include "umqtt/umqtt.h"
+#include "umqtt_mocks.h"
+#include "umqtt_wrapper.h"
+
+/*
+partial write test cases
+
+With partial writes enabled, a write that takes fewer bytes than asked,
+including none, is not an error.  The rest of the packet is held by the
+instance transmit cursor and umqtt_Run() writes it before doing anything
+else.  While the cursor is busy Run does not read, ping or retry, and API
+calls that need to send return UMQTT_ERR_TX_BUSY without allocating.  Acks
+for packets that are received while it is busy are queued and written
+after it, so no received packet is dropped.  A negative return from the
+transport is still a network error.
+
+-null parameters
+-short write is a network error when not enabled
+-short qos 0 publish is finished by run, then freed
+-nothing written at all
+-publish and subscribe while busy
+-run only writes while busy
+-short ping
+-short puback from decode, and decode while busy queues its puback
+-short puback does not drop the rest of the read
+-network error while finishing a packet
+-deadline is a short retry time while busy
+-short scatter/gather write keeps a copy of the rest
+ */
+
+TEST_GROUP(Partial);
+
+static umqtt_Handle_t h = NULL;
+static void *instBuf = NULL;
+#define SIZE_INSTBUF UMQTT_INSTANCE_SIZE
+static uint8_t *pktBuf = NULL;
+#define SIZE_PKTBUF 1024
+static uint8_t rxBuf[32];
+static uint8_t txCopy[32];
+
+// length of qos 0 publish of "message" to "topic"
+#define PUBLISH_LEN 16
+
+static const uint8_t publishPacket0[] =
+{
+    0x30, 14, // fixed header
+    0, 5, 't','o','p','i','c',
+    'm','e','s','s','a','g','e',
+};
+
+static unsigned int Publish_count;
+static void
+PublishCb(umqtt_Handle_t h, void *pUser, bool dup, bool retain, uint8_t qos,
+          const char *pTopic, uint16_t topicLen, const uint8_t *pMsg, uint16_t msgLen)
+{   (void)h; (void)pUser; (void)dup; (void)retain; (void)qos; (void)pTopic;
+    (void)topicLen; (void)pMsg; (void)msgLen; ++Publish_count; }
+
+static umqtt_Callbacks_t callbacks =
+{
+    NULL, PublishCb, NULL, NULL, NULL, NULL
+};
+
+TEST_SETUP(Partial)
+{
+    // allocate memory for the instance that will be created
+    // init the instance so it will be ready for all tests
+    mock_malloc_Reset();
+    instBuf = malloc(SIZE_INSTBUF);
+    mock_hNet = &mock_hNet;
+    transportConfig.hNet = mock_hNet;
+    mock_malloc_shouldReturn[0] = instBuf;
+    h = umqtt_New(&transportConfig, &callbacks, NULL);
+    TEST_ASSERT_NOT_NULL(h);
+    // clear all mocks
+    mock_malloc_Reset();
+    mock_free_Reset();
+    mock_NetRead_Reset();
+    mock_NetWrite_Reset();
+    mock_NetWritev_Reset();
+    Publish_count = 0;
+    // ready a buffer that can be used for packet allocation
+    pktBuf = malloc(SIZE_PKTBUF);
+    TEST_ASSERT_NOT_NULL(pktBuf);
+    // fake an existing connection, and long keep alive so that
+    // ping packets do not interfere
+    wrap_setConnected(h, true);
+    wrap_setKeepAlive(h, 1000);
+}
+
+TEST_TEAR_DOWN(Partial)
+{
+    if (instBuf) { free(instBuf); instBuf = NULL; }
+    if (pktBuf) { free(pktBuf); pktBuf = NULL; }
+    h = NULL;
+}
+
+// qos 0 publish of "message" to "topic" from pktBuf, where the
+// transport takes writeReturn bytes
+static umqtt_Error_t
+Publish(int writeReturn)
+{
+    mock_malloc_Reset();
+    mock_free_Reset();
+    mock_NetWrite_Reset();
+    mock_malloc_shouldReturn[0] = pktBuf;
+    mock_NetWrite_shouldReturn = writeReturn;
+    return umqtt_Publish(h, "topic", (const uint8_t *)"message", 7, 0, false, NULL);
+}
+
+// run where the transport takes writeReturn bytes, and the written
+// data is copied to txCopy
+static umqtt_Error_t
+Run(uint32_t ticks, int writeReturn)
+{
+    mock_malloc_Reset();
+    mock_free_Reset();
+    mock_NetRead_Reset();
+    mock_NetWrite_Reset();
+    memset(txCopy, 0, sizeof(txCopy));
+    mock_NetWrite_shouldReturn = writeReturn;
+    mock_NetWrite_pCopy = txCopy;
+    mock_NetWrite_copyLen = (writeReturn > 0) ? writeReturn : 0;
+    return umqtt_Run(h, ticks);
+}
+
+static void
+Enable(void)
+{
+    umqtt_Error_t err = umqtt_SetPartialWrites(h, true);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+}
+
+TEST(Partial, NullParms)
+{
+    umqtt_Error_t err = umqtt_SetPartialWrites(NULL, true);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+}
+
+TEST(Partial, Disabled)
+{
+    umqtt_Error_t err = Publish(5);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_NETWORK, err);
+    TEST_ASSERT_TRUE(mock_free_wasCalled);
+
+    // nothing is left to finish
+    err = Run(1000, 11);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+}
+
+TEST(Partial, Publish)
+{
+    umqtt_Error_t err;
+    Enable();
+    err = Publish(5);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(PUBLISH_LEN, mock_NetWrite_in_len);
+    // packet is kept until it is all written
+    TEST_ASSERT_FALSE(mock_free_wasCalled);
+
+    // still not all of it
+    err = Run(1000, 4);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1, mock_NetWrite_count);
+    TEST_ASSERT_EQUAL(PUBLISH_LEN - 5, mock_NetWrite_in_len);
+    TEST_ASSERT_EQUAL_MEMORY(&publishPacket0[5], txCopy, 4);
+    TEST_ASSERT_FALSE(mock_free_wasCalled);
+
+    // rest of it
+    err = Run(1010, PUBLISH_LEN - 9);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1, mock_NetWrite_count);
+    TEST_ASSERT_EQUAL(PUBLISH_LEN - 9, mock_NetWrite_in_len);
+    TEST_ASSERT_EQUAL_MEMORY(&publishPacket0[9], txCopy, PUBLISH_LEN - 9);
+    TEST_ASSERT_TRUE(mock_free_wasCalled);
+    TEST_ASSERT_EQUAL_PTR(pktBuf, mock_free_in_ptr);
+
+    // and nothing after that
+    err = Run(1020, PUBLISH_LEN);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+}
+
+// full send buffer, nothing taken
+TEST(Partial, NoneWritten)
+{
+    umqtt_Error_t err;
+    Enable();
+    err = Publish(0);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    err = Run(1000, 0);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(PUBLISH_LEN, mock_NetWrite_in_len);
+    err = Run(1010, PUBLISH_LEN);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL_MEMORY(publishPacket0, txCopy, PUBLISH_LEN);
+    TEST_ASSERT_TRUE(mock_free_wasCalled);
+}
+
+TEST(Partial, Busy)
+{
+    umqtt_Error_t err;
+    Enable();
+    err = Publish(5);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+
+    // nothing else can go out until the publish is finished
+    err = Publish(PUBLISH_LEN);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_TX_BUSY, err);
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+
+    char *topics[1] = { "topic" };
+    uint8_t qoss[1] = { 1 };
+    err = umqtt_Subscribe(h, 1, topics, qoss, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_TX_BUSY, err);
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+
+    // once it is done the next one can be sent
+    err = Run(1000, PUBLISH_LEN - 5);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    err = Publish(PUBLISH_LEN);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_TRUE(mock_NetWrite_wasCalled);
+}
+
+// while busy, run does not read or ping
+TEST(Partial, RunOnlyWrites)
+{
+    umqtt_Error_t err;
+    Enable();
+    wrap_setKeepAlive(h, 30);
+    err = Publish(5);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+
+    err = Run(20000, 0);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1, mock_NetWrite_count);
+    TEST_ASSERT_EQUAL(PUBLISH_LEN - 5, mock_NetWrite_in_len);
+    TEST_ASSERT_FALSE(mock_NetRead_wasCalled);
+
+    // publish was finished at 20010, so that restarts the keep alive
+    err = Run(20010, PUBLISH_LEN - 5);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1, mock_NetWrite_count);
+    TEST_ASSERT_TRUE(mock_NetRead_wasCalled);
+    err = Run(35009, 2);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+}
+
+TEST(Partial, Ping)
+{
+    umqtt_Error_t err;
+    Enable();
+    wrap_setKeepAlive(h, 30);
+    err = Run(15000, 1);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(2, mock_NetWrite_in_len);
+    TEST_ASSERT_EQUAL(12 << 4, txCopy[0]);
+
+    err = Run(15010, 1);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1, mock_NetWrite_count);
+    TEST_ASSERT_EQUAL(1, mock_NetWrite_in_len);
+    TEST_ASSERT_EQUAL(0, txCopy[0]);
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+}
+
+TEST(Partial, Puback)
+{
+    static const uint8_t pubPkt[] =
+    {
+        0x32, 10, // qos 1
+        0, 5, 't', 'o', 'p', 'i', 'c',
+        0x12, 0x34, // packet ID
+        'x'
+    };
+    umqtt_Error_t err;
+    Enable();
+    memcpy(rxBuf, pubPkt, sizeof(pubPkt));
+    mock_NetWrite_shouldReturn = 3;
+    err = umqtt_DecodePacket(h, rxBuf, sizeof(pubPkt));
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1, Publish_count);
+    TEST_ASSERT_EQUAL(4, mock_NetWrite_in_len);
+
+    // busy, so the puback for another publish waits for the first
+    mock_NetWrite_Reset();
+    mock_malloc_Reset();
+    mock_malloc_shouldReturn[0] = pktBuf;
+    rxBuf[10] = 0x35;
+    err = umqtt_DecodePacket(h, rxBuf, sizeof(pubPkt));
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(2, Publish_count);
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+
+    // last byte of the first puback, then the second one
+    err = Run(1000, 4);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(2, mock_NetWrite_count);
+    static const uint8_t ack[4] = { 0x40, 2, 0x12, 0x35 };
+    TEST_ASSERT_EQUAL_MEMORY(ack, txCopy, 4);
+    TEST_ASSERT_TRUE(mock_free_wasCalled);
+    TEST_ASSERT_EQUAL_PTR(pktBuf, mock_free_in_ptr);
+}
+
+// a short puback in the middle of a read does not drop the packets
+// after it
+TEST(Partial, PubackInChunk)
+{
+    static const uint8_t chunkPkts[] =
+    {
+        0x32, 10, 0, 5, 't', 'o', 'p', 'i', 'c', 0x12, 0x34, 'x',
+        0x32, 10, 0, 5, 't', 'o', 'p', 'i', 'c', 0x12, 0x35, 'y',
+        0x30, 8, 0, 5, 't', 'o', 'p', 'i', 'c', 'z',
+    };
+    static uint8_t chunk[sizeof(chunkPkts)];
+    umqtt_Error_t err;
+    Enable();
+    memcpy(chunk, chunkPkts, sizeof(chunkPkts));
+    mock_NetRead_AddChunk(chunk, sizeof(chunk));
+    mock_malloc_shouldReturn[0] = pktBuf;
+    mock_NetWrite_shouldReturn = 3;
+    err = umqtt_Run(h, 1000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(3, Publish_count);
+    TEST_ASSERT_EQUAL(1, mock_NetWrite_count);
+    TEST_ASSERT_EQUAL(1, mock_malloc_count);
+
+    err = Run(1010, 4);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(2, mock_NetWrite_count);
+    static const uint8_t ack[4] = { 0x40, 2, 0x12, 0x35 };
+    TEST_ASSERT_EQUAL_MEMORY(ack, txCopy, 4);
+    TEST_ASSERT_EQUAL_PTR(pktBuf, mock_free_in_ptr);
+
+    // nothing left
+    err = Run(1020, 4);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+}
+
+TEST(Partial, NetError)
+{
+    umqtt_Error_t err;
+    Enable();
+    err = Publish(5);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    err = Run(1000, -1);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_NETWORK, err);
+    TEST_ASSERT_TRUE(mock_free_wasCalled);
+    TEST_ASSERT_EQUAL_PTR(pktBuf, mock_free_in_ptr);
+
+    // nothing is left to finish
+    err = Run(1010, PUBLISH_LEN);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+}
+
+TEST(Partial, Deadline)
+{
+    umqtt_Error_t err;
+    uint32_t ticks;
+    Enable();
+    err = Run(1000, 0);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    err = Publish(5);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    err = umqtt_GetNextDeadline(h, &ticks);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1010, ticks);
+}
+
+TEST(Partial, Writev)
+{
+    umqtt_Error_t err;
+    static umqtt_TransportConfig_t iovTransport;
+    uint8_t *iovInstBuf = malloc(SIZE_INSTBUF);
+    TEST_ASSERT_NOT_NULL(iovInstBuf);
+    iovTransport = transportConfig;
+    iovTransport.pfnNetWritev = mock_NetWritev;
+    mock_malloc_Reset();
+    mock_malloc_shouldReturn[0] = iovInstBuf;
+    umqtt_Handle_t hv = umqtt_New(&iovTransport, NULL, NULL);
+    TEST_ASSERT_NOT_NULL(hv);
+    wrap_setConnected(hv, true);
+    wrap_setKeepAlive(hv, 1000);
+    err = umqtt_SetPartialWrites(hv, true);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+
+    // payload belongs to the caller, so the rest is copied
+    uint8_t msg[8];
+    memcpy(msg, "message", 8);
+    mock_malloc_Reset();
+    mock_malloc_shouldReturn[0] = pktBuf;
+    mock_NetWritev_shouldReturn = 10;
+    err = umqtt_Publish(hv, "topic", msg, 7, 0, false, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1, mock_malloc_count);
+    memset(msg, 0, sizeof(msg));
+
+    // rest is written with the plain write
+    mock_free_Reset();
+    mock_NetWrite_Reset();
+    mock_NetWrite_shouldReturn = PUBLISH_LEN - 10;
+    mock_NetWrite_pCopy = txCopy;
+    mock_NetWrite_copyLen = PUBLISH_LEN - 10;
+    err = umqtt_Run(hv, 1000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(PUBLISH_LEN - 10, mock_NetWrite_in_len);
+    TEST_ASSERT_EQUAL_MEMORY(&publishPacket0[10], txCopy, PUBLISH_LEN - 10);
+    TEST_ASSERT_TRUE(mock_free_wasCalled);
+    TEST_ASSERT_EQUAL_PTR(pktBuf, mock_free_in_ptr);
+
+    // no memory for the copy, the packet can not be finished
+    mock_malloc_Reset();
+    mock_malloc_shouldReturn[0] = NULL;
+    mock_NetWritev_shouldReturn = 10;
+    err = umqtt_Publish(hv, "topic", msg, 7, 0, false, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_NETWORK, err);
+    free(iovInstBuf);
+}
+
+TEST_GROUP_RUNNER(Partial)
+{
+    RUN_TEST_CASE(Partial, NullParms);
+    RUN_TEST_CASE(Partial, Disabled);
+    RUN_TEST_CASE(Partial, Publish);
+    RUN_TEST_CASE(Partial, NoneWritten);
+    RUN_TEST_CASE(Partial, Busy);
+    RUN_TEST_CASE(Partial, RunOnlyWrites);
+    RUN_TEST_CASE(Partial, Ping);
+    RUN_TEST_CASE(Partial, Puback);
+    RUN_TEST_CASE(Partial, PubackInChunk);
+    RUN_TEST_CASE(Partial, NetError);
+    RUN_TEST_CASE(Partial, Deadline);
+    RUN_TEST_CASE(Partial, Writev);
+}
@@ -0,0 +1,199 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "unity_fixture.h"
+#include "umqtt/umqtt.h"
+#include "umqtt_mocks.h"
+#include "umqtt_wrapper.h"
+
+/*
+packet ID allocation test cases
+
+IDs are handed out in sequence, skipping 0 and any ID that still belongs
+to a queued packet.  Each in-use check is an O(1) lookup in the packet ID
+table, which grows to at least one bucket per queued packet.  Normally
+one check is enough, after the sequence wraps into a run of queued IDs
+each ID of the run is checked once.
+
+-IDs are sequential
+-0 is skipped at wrap
+-IDs of queued packets are skipped
+-long run of queued IDs is skipped
+-ID is available again once its packet is acked
+-subscribe and unsubscribe use the same allocator
+ */
+
+TEST_GROUP(PktId);
+
+static umqtt_Handle_t h = NULL;
+static void *instBuf = NULL;
+#define SIZE_INSTBUF UMQTT_INSTANCE_SIZE
+static uint8_t *pktBuf = NULL;
+#define SIZE_PKTBUF 2048
+static uint8_t rxBuf[8];
+
+// length of qos 1 publish of "message" to "topic"
+#define PUBLISH_LEN 18
+
+static umqtt_Callbacks_t callbacks =
+{
+    NULL, NULL, NULL, NULL, NULL, NULL
+};
+
+TEST_SETUP(PktId)
+{
+    // allocate memory for the instance that will be created
+    // init the instance so it will be ready for all tests
+    mock_malloc_Reset();
+    instBuf = malloc(SIZE_INSTBUF);
+    mock_hNet = &mock_hNet;
+    transportConfig.hNet = mock_hNet;
+    mock_malloc_shouldReturn[0] = instBuf;
+    h = umqtt_New(&transportConfig, &callbacks, NULL);
+    TEST_ASSERT_NOT_NULL(h);
+    // clear all mocks
+    mock_malloc_Reset();
+    mock_free_Reset();
+    mock_NetRead_Reset();
+    mock_NetWrite_Reset();
+    // ready a buffer that can be used for packet allocation
+    pktBuf = malloc(SIZE_PKTBUF);
+    TEST_ASSERT_NOT_NULL(pktBuf);
+    // fake an existing connection, and long keep alive so that
+    // ping packets do not interfere
+    wrap_setConnected(h, true);
+    wrap_setKeepAlive(h, 1000);
+}
+
+TEST_TEAR_DOWN(PktId)
+{
+    if (instBuf) { free(instBuf); instBuf = NULL; }
+    if (pktBuf) { free(pktBuf); pktBuf = NULL; }
+    h = NULL;
+}
+
+// qos 1 publish, each one uses its own slice of pktBuf
+static uint16_t
+Publish(unsigned int slot)
+{
+    uint16_t msgId = 0;
+    mock_malloc_Reset();
+    mock_NetWrite_Reset();
+    mock_malloc_shouldReturn[0] = &pktBuf[slot * 100];
+    mock_NetWrite_shouldReturn = PUBLISH_LEN;
+    umqtt_Error_t err = umqtt_Publish(h, "topic", (const uint8_t *)"message", 7, 1, false, &msgId);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    return msgId;
+}
+
+// fake packet queued with the specified ID, does not use pktBuf
+static void
+Enqueue(uint8_t *pBuf, uint16_t pktId)
+{
+    mock_malloc_Reset();
+    mock_malloc_shouldReturn[0] = pBuf;
+    uint8_t *buf = wrap_newPacket(h, 4);
+    TEST_ASSERT_NOT_NULL(buf);
+    buf[0] = 0x32;
+    wrap_enqueuePacket(h, buf, pktId, 0);
+}
+
+TEST(PktId, Sequential)
+{
+    uint16_t first = Publish(0);
+    TEST_ASSERT_NOT_EQUAL(0, first);
+    TEST_ASSERT_EQUAL(first + 1, Publish(1));
+    TEST_ASSERT_EQUAL(first + 2, Publish(2));
+}
+
+TEST(PktId, SkipZero)
+{
+    wrap_setNextPacketId(h, 65535);
+    TEST_ASSERT_EQUAL(65535, Publish(0));
+    TEST_ASSERT_EQUAL(1, Publish(1));
+}
+
+TEST(PktId, SkipQueued)
+{
+    Publish(0);
+    Publish(1);
+    Publish(2);
+    uint16_t id = Publish(3);
+    // the first three are still waiting for puback
+    wrap_setNextPacketId(h, id - 3);
+    TEST_ASSERT_EQUAL(id + 1, Publish(4));
+    TEST_ASSERT_EQUAL(id + 2, Publish(5));
+}
+
+TEST(PktId, SkipMany)
+{
+    static uint8_t fakeBufs[400][sizeof(PktBuf_t) + 4];
+    for (unsigned int idx = 0; idx < 400; idx++)
+    {
+        Enqueue(fakeBufs[idx], 1000 + idx);
+    }
+    wrap_setNextPacketId(h, 1000);
+    TEST_ASSERT_EQUAL(1400, Publish(0));
+
+    // and across the wrap
+    for (unsigned int idx = 0; idx < 8; idx++)
+    {
+        wrap_dequeuePacketById(h, 1000 + idx);
+        Enqueue(fakeBufs[idx], (idx < 4) ? (65532 + idx) : (idx - 3));
+    }
+    wrap_setNextPacketId(h, 65532);
+    TEST_ASSERT_EQUAL(5, Publish(1));
+}
+
+TEST(PktId, Reuse)
+{
+    umqtt_Error_t err;
+    uint16_t id = Publish(0);
+    rxBuf[0] = 4 << 4;
+    rxBuf[1] = 2;
+    rxBuf[2] = id >> 8;
+    rxBuf[3] = id & 0xFF;
+    err = umqtt_DecodePacket(h, rxBuf, 4);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    wrap_setNextPacketId(h, id);
+    TEST_ASSERT_EQUAL(id, Publish(1));
+}
+
+TEST(PktId, SubscribeUnsubscribe)
+{
+    umqtt_Error_t err;
+    uint16_t msgId = 0;
+    uint16_t id = Publish(0);
+    wrap_setNextPacketId(h, id);
+
+    char *subTopics[1] = { "topic" };
+    uint8_t qoss[1] = { 1 };
+    mock_malloc_Reset();
+    mock_malloc_shouldReturn[0] = &pktBuf[200];
+    mock_NetWrite_shouldReturn = 12;
+    err = umqtt_Subscribe(h, 1, subTopics, qoss, &msgId);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(id + 1, msgId);
+
+    const char *unsubTopics[1] = { "topic" };
+    wrap_setNextPacketId(h, id);
+    mock_malloc_Reset();
+    mock_malloc_shouldReturn[0] = &pktBuf[400];
+    mock_NetWrite_shouldReturn = 11;
+    err = umqtt_Unsubscribe(h, 1, unsubTopics, &msgId);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(id + 2, msgId);
+}
+
+TEST_GROUP_RUNNER(PktId)
+{
+    RUN_TEST_CASE(PktId, Sequential);
+    RUN_TEST_CASE(PktId, SkipZero);
+    RUN_TEST_CASE(PktId, SkipQueued);
+    RUN_TEST_CASE(PktId, SkipMany);
+    RUN_TEST_CASE(PktId, Reuse);
+    RUN_TEST_CASE(PktId, SubscribeUnsubscribe);
+}
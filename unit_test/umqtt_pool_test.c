@@ -0,0 +1,235 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "unity_fixture.h"
+#include "umqtt/umqtt.h"
+#include "umqtt_mocks.h"
+#include "umqtt_wrapper.h"
+
+/*
+packet pool test cases
+
+These use a transport config with pool size classes so that packets
+come from fixed blocks that are carved once at init.
+
+-pool memory allocated once at init
+-pool allocation failure at init
+-bad pool config
+-packet comes from smallest class that fits
+-freed block is reused
+-class exhausted falls back to malloc and is counted
+-packet bigger than any class falls back to malloc
+ */
+
+TEST_GROUP(Pool);
+
+static umqtt_Handle_t h = NULL;
+static void *instBuf = NULL;
+#define SIZE_INSTBUF UMQTT_INSTANCE_SIZE
+static uint8_t *pktBuf = NULL;
+#define SIZE_PKTBUF 1024
+static umqtt_TransportConfig_t poolTransport;
+
+// pool sizes are multiples of 8 so blocks need no alignment padding
+static const umqtt_PoolClass_t poolClasses[] =
+{
+    { 32, 4 },
+    { 128, 2 },
+};
+#define STRIDE_SMALL (32 + sizeof(PktBuf_t))
+#define STRIDE_LARGE (128 + sizeof(PktBuf_t))
+#define SIZE_POOL ((4 * STRIDE_SMALL) + (2 * STRIDE_LARGE))
+static uint64_t poolMem[(SIZE_POOL + 7) / 8];
+#define POOL_BASE ((uint8_t *)poolMem)
+
+TEST_SETUP(Pool)
+{
+    // set up a transport that uses the packet pool
+    poolTransport = transportConfig;
+    poolTransport.pPoolClasses = poolClasses;
+    poolTransport.numPoolClasses = 2;
+    // allocate memory for the instance that will be created
+    // init the instance so it will be ready for all tests
+    mock_malloc_Reset();
+    instBuf = malloc(SIZE_INSTBUF);
+    mock_hNet = &mock_hNet;
+    poolTransport.hNet = mock_hNet;
+    mock_malloc_shouldReturn[0] = instBuf;
+    mock_malloc_shouldReturn[1] = poolMem;
+    h = umqtt_New(&poolTransport, NULL, NULL);
+    TEST_ASSERT_NOT_NULL(h);
+    // clear all mocks
+    mock_malloc_Reset();
+    mock_free_Reset();
+    mock_NetRead_Reset();
+    mock_NetWrite_Reset();
+    // ready a buffer that can be used for fallback allocation
+    pktBuf = malloc(SIZE_PKTBUF);
+    TEST_ASSERT_NOT_NULL(pktBuf);
+}
+
+TEST_TEAR_DOWN(Pool)
+{
+    if (instBuf) { free(instBuf); instBuf = NULL; }
+    if (pktBuf) { free(pktBuf); pktBuf = NULL; }
+    h = NULL;
+}
+
+// get the fallback count and check for expected value
+static void
+CheckFallbacks(uint32_t expected)
+{
+    uint32_t count = 5555;
+    umqtt_Error_t err = umqtt_GetPoolFallbacks(h, &count);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(expected, count);
+}
+
+// pool memory for all blocks is allocated once, right after instance
+TEST(Pool, InitAllocOnce)
+{
+    uint8_t poolBuf[SIZE_POOL];
+    mock_malloc_shouldReturn[0] = instBuf;
+    mock_malloc_shouldReturn[1] = poolBuf;
+    umqtt_Handle_t h2 = umqtt_New(&poolTransport, NULL, NULL);
+    TEST_ASSERT_EQUAL_PTR(instBuf, h2);
+    TEST_ASSERT_EQUAL(2, mock_malloc_count);
+    TEST_ASSERT_EQUAL(SIZE_POOL, mock_malloc_in_size);
+}
+
+// pool cannot be allocated, instance is released
+TEST(Pool, InitAllocFail)
+{
+    mock_malloc_shouldReturn[0] = instBuf;
+    mock_malloc_shouldReturn[1] = NULL;
+    umqtt_Handle_t h2 = umqtt_New(&poolTransport, NULL, NULL);
+    TEST_ASSERT_NULL(h2);
+    TEST_ASSERT_EQUAL(2, mock_malloc_count);
+    TEST_ASSERT_TRUE(mock_free_wasCalled);
+    TEST_ASSERT_EQUAL_PTR(instBuf, mock_free_in_ptr);
+}
+
+// class count without classes, or class with no blocks
+TEST(Pool, InitBadConfig)
+{
+    static const umqtt_PoolClass_t emptyClass[] = { { 32, 0 } };
+    umqtt_TransportConfig_t badTransport = poolTransport;
+    badTransport.pPoolClasses = NULL;
+    umqtt_Handle_t h2 = umqtt_New(&badTransport, NULL, NULL);
+    TEST_ASSERT_NULL(h2);
+    badTransport.pPoolClasses = emptyClass;
+    badTransport.numPoolClasses = 1;
+    h2 = umqtt_New(&badTransport, NULL, NULL);
+    TEST_ASSERT_NULL(h2);
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+}
+
+// packets come from the smallest class that can hold them
+TEST(Pool, SizeClass)
+{
+    uint8_t *buf;
+    // 20 + 5 fits in small block
+    buf = wrap_newPacket(h, 20);
+    TEST_ASSERT_NOT_NULL(buf);
+    TEST_ASSERT_TRUE(buf >= POOL_BASE);
+    TEST_ASSERT_TRUE(buf < (POOL_BASE + (4 * STRIDE_SMALL)));
+    TEST_ASSERT_EQUAL(0, (buf - POOL_BASE - sizeof(PktBuf_t)) % STRIDE_SMALL);
+    // 27 + 5 exactly fills small block
+    buf = wrap_newPacket(h, 27);
+    TEST_ASSERT_TRUE(buf < (POOL_BASE + (4 * STRIDE_SMALL)));
+    // 28 + 5 needs a large block
+    buf = wrap_newPacket(h, 28);
+    TEST_ASSERT_TRUE(buf >= (POOL_BASE + (4 * STRIDE_SMALL)));
+    TEST_ASSERT_TRUE(buf < (POOL_BASE + SIZE_POOL));
+    // no allocation, no fallback
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+    CheckFallbacks(0);
+}
+
+// freed block goes back to its class and is used again
+TEST(Pool, Reuse)
+{
+    uint8_t *buf1 = wrap_newPacket(h, 10);
+    uint8_t *buf2 = wrap_newPacket(h, 10);
+    TEST_ASSERT_NOT_EQUAL(buf1, buf2);
+    wrap_deletePacket(h, buf1);
+    TEST_ASSERT_FALSE(mock_free_wasCalled);
+    uint8_t *buf3 = wrap_newPacket(h, 10);
+    TEST_ASSERT_EQUAL_PTR(buf1, buf3);
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+}
+
+// once a class is used up, packets come from malloc and are counted
+TEST(Pool, Exhausted)
+{
+    uint8_t *bufs[4];
+    uint8_t *buf;
+    for (unsigned int idx = 0; idx < 4; idx++)
+    {
+        bufs[idx] = wrap_newPacket(h, 10);
+        TEST_ASSERT_NOT_NULL(bufs[idx]);
+    }
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+    CheckFallbacks(0);
+
+    // small class is empty, falls back to malloc
+    mock_malloc_shouldReturn[0] = pktBuf;
+    buf = wrap_newPacket(h, 10);
+    TEST_ASSERT_EQUAL_PTR(pktBuf + sizeof(PktBuf_t), buf);
+    TEST_ASSERT_EQUAL(1, mock_malloc_count);
+    TEST_ASSERT_EQUAL(10 + 5 + sizeof(PktBuf_t), mock_malloc_in_size);
+    CheckFallbacks(1);
+
+    // malloc packet is freed with free, pool packet is not
+    wrap_deletePacket(h, buf);
+    TEST_ASSERT_TRUE(mock_free_wasCalled);
+    TEST_ASSERT_EQUAL_PTR(pktBuf, mock_free_in_ptr);
+    mock_free_Reset();
+    wrap_deletePacket(h, bufs[2]);
+    TEST_ASSERT_FALSE(mock_free_wasCalled);
+
+    // block is available again so no more fallback
+    buf = wrap_newPacket(h, 10);
+    TEST_ASSERT_EQUAL_PTR(bufs[2], buf);
+    TEST_ASSERT_EQUAL(1, mock_malloc_count);
+    CheckFallbacks(1);
+}
+
+// larger than the biggest class
+TEST(Pool, TooBig)
+{
+    uint8_t *buf;
+    mock_malloc_shouldReturn[0] = pktBuf;
+    buf = wrap_newPacket(h, 200);
+    TEST_ASSERT_EQUAL_PTR(pktBuf + sizeof(PktBuf_t), buf);
+    CheckFallbacks(1);
+
+    // fallback malloc fails
+    buf = wrap_newPacket(h, 200);
+    TEST_ASSERT_NULL(buf);
+    CheckFallbacks(2);
+}
+
+TEST(Pool, FallbacksNullParms)
+{
+    uint32_t count;
+    umqtt_Error_t err = umqtt_GetPoolFallbacks(NULL, &count);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+    err = umqtt_GetPoolFallbacks(h, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+}
+
+TEST_GROUP_RUNNER(Pool)
+{
+    RUN_TEST_CASE(Pool, InitAllocOnce);
+    RUN_TEST_CASE(Pool, InitAllocFail);
+    RUN_TEST_CASE(Pool, InitBadConfig);
+    RUN_TEST_CASE(Pool, SizeClass);
+    RUN_TEST_CASE(Pool, Reuse);
+    RUN_TEST_CASE(Pool, Exhausted);
+    RUN_TEST_CASE(Pool, TooBig);
+    RUN_TEST_CASE(Pool, FallbacksNullParms);
+}
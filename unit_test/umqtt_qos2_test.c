@@ -0,0 +1,457 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "unity_fixture.h"
+#include "umqtt/umqtt.h"
+#include "umqtt_mocks.h"
+#include "umqtt_wrapper.h"
+
+/*
+qos 2 test cases
+
+Outbound: PUBLISH -> PUBREC -> PUBREL -> PUBCOMP.  The publish packet
+stays queued until PUBREC, then the same buffer is rewritten as the
+PUBREL and stays queued until PUBCOMP.  PUBCOMP is reported with the
+puback callback.
+
+Inbound: PUBLISH -> PUBREC -> PUBREL -> PUBCOMP.  The message is delivered
+when the PUBLISH first arrives and the PUBREC is queued until PUBREL, so
+a resent PUBLISH with the same packet ID is acknowledged but not
+delivered again.
+
+-publish qos 2 is sent and queued
+-pubrec rewrites queued publish as pubrel
+-pubcomp completes publish
+-pubrel is resent on timeout
+-qos 2 publish counts in the in-flight window until pubcomp
+-pubrec, pubrel and pubcomp bad length or flags
+-pubrec for unknown packet ID
+-inbound publish delivered once and pubrec queued
+-inbound duplicate is acknowledged but not delivered
+-inbound pubrel sends pubcomp and clears state
+-inbound pubrel for unknown packet ID still gets pubcomp
+-inbound pubrec is not resent and does not expire
+-inbound and outbound use the same packet ID
+-inbound alloc failure
+ */
+
+TEST_GROUP(Qos2);
+
+static umqtt_Handle_t h = NULL;
+static void *instBuf = NULL;
+#define SIZE_INSTBUF UMQTT_INSTANCE_SIZE
+static uint8_t *pktBuf = NULL;
+#define SIZE_PKTBUF 1024
+static uint8_t rxBuf[32];
+static uint8_t txCopy[32];
+
+// length of qos 2 publish of "message" to "topic"
+#define PUBLISH_LEN 18
+
+static unsigned int Publish_count;
+static uint8_t Publish_qos;
+static void
+PublishCb(umqtt_Handle_t h, void *pUser, bool dup, bool retain, uint8_t qos,
+          const char *pTopic, uint16_t topicLen, const uint8_t *pMsg, uint16_t msgLen)
+{   (void)h; (void)pUser; (void)dup; (void)retain; (void)pTopic; (void)topicLen;
+    (void)pMsg; (void)msgLen; ++Publish_count; Publish_qos = qos; }
+
+static unsigned int Puback_count;
+static uint16_t Puback_msgId;
+static void
+PubackCb(umqtt_Handle_t h, void *pUser, uint16_t msgId)
+{   (void)h; (void)pUser; ++Puback_count; Puback_msgId = msgId; }
+
+static umqtt_Callbacks_t callbacks =
+{
+    NULL, PublishCb, PubackCb, NULL, NULL, NULL
+};
+
+TEST_SETUP(Qos2)
+{
+    // allocate memory for the instance that will be created
+    // init the instance so it will be ready for all tests
+    mock_malloc_Reset();
+    instBuf = malloc(SIZE_INSTBUF);
+    mock_hNet = &mock_hNet;
+    transportConfig.hNet = mock_hNet;
+    mock_malloc_shouldReturn[0] = instBuf;
+    h = umqtt_New(&transportConfig, &callbacks, NULL);
+    TEST_ASSERT_NOT_NULL(h);
+    // clear all mocks
+    mock_malloc_Reset();
+    mock_free_Reset();
+    mock_NetRead_Reset();
+    mock_NetWrite_Reset();
+    Publish_count = 0;
+    Publish_qos = 0;
+    Puback_count = 0;
+    Puback_msgId = 0;
+    // ready a buffer that can be used for packet allocation
+    pktBuf = malloc(SIZE_PKTBUF);
+    TEST_ASSERT_NOT_NULL(pktBuf);
+    // fake an existing connection, and long keep alive so that
+    // ping packets do not interfere
+    wrap_setConnected(h, true);
+    wrap_setKeepAlive(h, 1000);
+}
+
+TEST_TEAR_DOWN(Qos2)
+{
+    if (instBuf) { free(instBuf); instBuf = NULL; }
+    if (pktBuf) { free(pktBuf); pktBuf = NULL; }
+    h = NULL;
+}
+
+// qos 2 publish of "message" to "topic" using pktBuf
+static uint16_t
+Publish(void)
+{
+    uint16_t msgId = 0;
+    mock_malloc_Reset();
+    mock_NetWrite_Reset();
+    mock_malloc_shouldReturn[0] = pktBuf;
+    mock_NetWrite_shouldReturn = PUBLISH_LEN;
+    umqtt_Error_t err = umqtt_Publish(h, "topic", (const uint8_t *)"message", 7, 2, false, &msgId);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    return msgId;
+}
+
+// decode a packet that has only a packet ID, and capture what is written
+static umqtt_Error_t
+DecodeAck(uint8_t hdr, uint16_t pktId)
+{
+    mock_malloc_Reset();
+    mock_free_Reset();
+    mock_NetWrite_Reset();
+    memset(txCopy, 0, sizeof(txCopy));
+    mock_NetWrite_shouldReturn = 4;
+    mock_NetWrite_pCopy = txCopy;
+    mock_NetWrite_copyLen = 4;
+    rxBuf[0] = hdr;
+    rxBuf[1] = 2;
+    rxBuf[2] = pktId >> 8;
+    rxBuf[3] = pktId & 0xFF;
+    return umqtt_DecodePacket(h, rxBuf, 4);
+}
+
+// decode a qos 2 publish of "message" to "topic", any pubrec is
+// allocated from pAlloc
+static umqtt_Error_t
+DecodePublish(uint16_t pktId, bool dup, uint8_t *pAlloc)
+{
+    static const uint8_t pubPkt[] =
+    {
+        0x34, 16, // qos 2
+        0, 5, 't', 'o', 'p', 'i', 'c',
+        0, 0, // packet ID
+        'm', 'e', 's', 's', 'a', 'g', 'e',
+    };
+    memcpy(rxBuf, pubPkt, sizeof(pubPkt));
+    rxBuf[0] |= dup ? 0x08 : 0;
+    rxBuf[9] = pktId >> 8;
+    rxBuf[10] = pktId & 0xFF;
+    mock_malloc_Reset();
+    mock_free_Reset();
+    mock_NetWrite_Reset();
+    memset(txCopy, 0, sizeof(txCopy));
+    mock_malloc_shouldReturn[0] = pAlloc;
+    mock_NetWrite_shouldReturn = 4;
+    mock_NetWrite_pCopy = txCopy;
+    mock_NetWrite_copyLen = 4;
+    return umqtt_DecodePacket(h, rxBuf, sizeof(pubPkt));
+}
+
+static void
+CheckAck(uint8_t hdr, uint16_t pktId)
+{
+    uint8_t ack[4] = { hdr, 2, pktId >> 8, pktId & 0xFF };
+    TEST_ASSERT_TRUE(mock_NetWrite_wasCalled);
+    TEST_ASSERT_EQUAL(4, mock_NetWrite_in_len);
+    TEST_ASSERT_EQUAL_MEMORY(ack, txCopy, 4);
+}
+
+TEST(Qos2, Publish)
+{
+    uint16_t msgId = Publish();
+    TEST_ASSERT_NOT_EQUAL(0, msgId);
+    TEST_ASSERT_EQUAL(PUBLISH_LEN, mock_NetWrite_in_len);
+    TEST_ASSERT_EQUAL(0x34, pktBuf[sizeof(PktBuf_t)]);
+    TEST_ASSERT_EQUAL_PTR(pktBuf, wrap_getNextPktBuf(h));
+    TEST_ASSERT_FALSE(mock_free_wasCalled);
+}
+
+TEST(Qos2, Pubrec)
+{
+    umqtt_Error_t err;
+    uint16_t msgId = Publish();
+    err = DecodeAck(0x50, msgId);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    CheckAck(0x62, msgId);
+    // the same buffer is now the queued pubrel, nothing else
+    // was allocated or freed and the publish is not complete
+    TEST_ASSERT_EQUAL_PTR(pktBuf, wrap_getNextPktBuf(h));
+    TEST_ASSERT_NULL(wrap_getNextPktBuf(h)->next);
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+    TEST_ASSERT_FALSE(mock_free_wasCalled);
+    TEST_ASSERT_EQUAL(0, Puback_count);
+
+    // resent pubrec gets another pubrel
+    err = DecodeAck(0x50, msgId);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    CheckAck(0x62, msgId);
+    TEST_ASSERT_EQUAL_PTR(pktBuf, wrap_getNextPktBuf(h));
+}
+
+TEST(Qos2, Pubcomp)
+{
+    umqtt_Error_t err;
+    uint16_t msgId = Publish();
+    err = DecodeAck(0x50, msgId);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    err = DecodeAck(0x70, msgId);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+    TEST_ASSERT_NULL(wrap_getNextPktBuf(h));
+    TEST_ASSERT_TRUE(mock_free_wasCalled);
+    TEST_ASSERT_EQUAL_PTR(pktBuf, mock_free_in_ptr);
+    TEST_ASSERT_EQUAL(1, Puback_count);
+    TEST_ASSERT_EQUAL(msgId, Puback_msgId);
+}
+
+TEST(Qos2, PubrelRetry)
+{
+    umqtt_Error_t err;
+    uint16_t msgId;
+    err = umqtt_Run(h, 1000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    msgId = Publish();
+    err = DecodeAck(0x50, msgId);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+
+    // pubrel was sent at 1000 so it is resent at 6000
+    mock_NetWrite_Reset();
+    mock_NetWrite_shouldReturn = 4;
+    mock_NetWrite_pCopy = txCopy;
+    mock_NetWrite_copyLen = 4;
+    err = umqtt_Run(h, 5999);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+    err = umqtt_Run(h, 6000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    CheckAck(0x62, msgId);
+    TEST_ASSERT_EQUAL_PTR(pktBuf, wrap_getNextPktBuf(h));
+}
+
+TEST(Qos2, Window)
+{
+    umqtt_Error_t err;
+    unsigned int count;
+    err = umqtt_SetInflightWindow(h, 1);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    uint16_t msgId = Publish();
+    err = DecodeAck(0x50, msgId);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    err = umqtt_GetInflightCount(h, &count);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1, count);
+    err = umqtt_Publish(h, "topic", (const uint8_t *)"message", 7, 2, false, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_WINDOW_FULL, err);
+
+    err = DecodeAck(0x70, msgId);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    err = umqtt_GetInflightCount(h, &count);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(0, count);
+}
+
+TEST(Qos2, BadAck)
+{
+    umqtt_Error_t err;
+    uint16_t msgId = Publish();
+
+    // pubrec with extra byte
+    rxBuf[0] = 0x50;
+    rxBuf[1] = 3;
+    rxBuf[2] = msgId >> 8;
+    rxBuf[3] = msgId & 0xFF;
+    rxBuf[4] = 0;
+    err = umqtt_DecodePacket(h, rxBuf, 5);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PACKET_ERROR, err);
+    // pubrel must have flags of 2
+    err = DecodeAck(0x60, msgId);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PACKET_ERROR, err);
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+    // pubcomp with no packet ID
+    rxBuf[0] = 0x70;
+    rxBuf[1] = 0;
+    err = umqtt_DecodePacket(h, rxBuf, 2);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PACKET_ERROR, err);
+
+    // publish is still waiting for pubrec
+    TEST_ASSERT_EQUAL_PTR(pktBuf, wrap_getNextPktBuf(h));
+    TEST_ASSERT_EQUAL(0x34, pktBuf[sizeof(PktBuf_t)]);
+    TEST_ASSERT_EQUAL(0, Puback_count);
+}
+
+// pubrec or pubcomp for something that is not queued is ignored
+TEST(Qos2, UnknownAck)
+{
+    umqtt_Error_t err;
+    err = DecodeAck(0x50, 0x1234);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+    err = DecodeAck(0x70, 0x1234);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(0, Puback_count);
+
+    // pubcomp before pubrec does not complete the publish
+    uint16_t msgId = Publish();
+    err = DecodeAck(0x70, msgId);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(0, Puback_count);
+    TEST_ASSERT_EQUAL_PTR(pktBuf, wrap_getNextPktBuf(h));
+}
+
+TEST(Qos2, InboundPublish)
+{
+    umqtt_Error_t err = DecodePublish(0x1234, false, pktBuf);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1, Publish_count);
+    TEST_ASSERT_EQUAL(2, Publish_qos);
+    CheckAck(0x50, 0x1234);
+    // pubrec is kept until pubrel
+    TEST_ASSERT_EQUAL(1, mock_malloc_count);
+    TEST_ASSERT_EQUAL_PTR(pktBuf, wrap_getNextPktBuf(h));
+    TEST_ASSERT_FALSE(mock_free_wasCalled);
+}
+
+TEST(Qos2, InboundDuplicate)
+{
+    umqtt_Error_t err = DecodePublish(0x1234, false, pktBuf);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    err = DecodePublish(0x1234, true, pktBuf);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1, Publish_count);
+    CheckAck(0x50, 0x1234);
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+    TEST_ASSERT_EQUAL_PTR(pktBuf, wrap_getNextPktBuf(h));
+    TEST_ASSERT_NULL(wrap_getNextPktBuf(h)->next);
+}
+
+TEST(Qos2, InboundPubrel)
+{
+    umqtt_Error_t err = DecodePublish(0x1234, false, pktBuf);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    err = DecodeAck(0x62, 0x1234);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    CheckAck(0x70, 0x1234);
+    TEST_ASSERT_NULL(wrap_getNextPktBuf(h));
+    TEST_ASSERT_TRUE(mock_free_wasCalled);
+    TEST_ASSERT_EQUAL_PTR(pktBuf, mock_free_in_ptr);
+    // pubcomp completes an outbound publish, not this
+    TEST_ASSERT_EQUAL(0, Puback_count);
+
+    // same packet ID can now be used for a new message
+    err = DecodePublish(0x1234, false, pktBuf);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(2, Publish_count);
+}
+
+// pubrel is resent if our pubcomp was lost, so answer it anyway
+TEST(Qos2, InboundUnknownPubrel)
+{
+    umqtt_Error_t err = DecodeAck(0x62, 0x4321);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    CheckAck(0x70, 0x4321);
+    TEST_ASSERT_FALSE(mock_free_wasCalled);
+}
+
+// the server resends the publish, not the client the pubrec, so the
+// pubrec is kept for as long as it takes to get the pubrel
+TEST(Qos2, InboundPubrecKept)
+{
+    umqtt_Error_t err;
+    err = umqtt_Run(h, 1000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    err = DecodePublish(0x1234, false, pktBuf);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+
+    // well past the last retry of a sent packet
+    mock_NetWrite_Reset();
+    err = umqtt_Run(h, 6000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    err = umqtt_Run(h, 100000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+    TEST_ASSERT_FALSE(mock_free_wasCalled);
+
+    // still a duplicate
+    err = DecodePublish(0x1234, true, pktBuf);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    CheckAck(0x50, 0x1234);
+    TEST_ASSERT_EQUAL(1, Publish_count);
+    err = DecodeAck(0x62, 0x1234);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    CheckAck(0x70, 0x1234);
+    TEST_ASSERT_EQUAL_PTR(pktBuf, mock_free_in_ptr);
+}
+
+// packet IDs are separate in each direction
+TEST(Qos2, SameIdBothWays)
+{
+    umqtt_Error_t err;
+    uint8_t *pubrecBuf = &pktBuf[200];
+    uint16_t msgId = Publish();
+    err = DecodePublish(msgId, false, pubrecBuf);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1, Publish_count);
+
+    // pubrec from the server is for our publish
+    err = DecodeAck(0x50, msgId);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    CheckAck(0x62, msgId);
+    // pubrel from the server is for its publish
+    err = DecodeAck(0x62, msgId);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    CheckAck(0x70, msgId);
+    TEST_ASSERT_EQUAL_PTR(pubrecBuf, mock_free_in_ptr);
+    // pubcomp finishes ours
+    err = DecodeAck(0x70, msgId);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL_PTR(pktBuf, mock_free_in_ptr);
+    TEST_ASSERT_EQUAL(1, Puback_count);
+    TEST_ASSERT_NULL(wrap_getNextPktBuf(h));
+}
+
+// with no memory to hold the pubrec the message is not delivered
+// and not acknowledged, so the server will send it again
+TEST(Qos2, InboundAllocFail)
+{
+    umqtt_Error_t err = DecodePublish(0x1234, false, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_BUFSIZE, err);
+    TEST_ASSERT_EQUAL(0, Publish_count);
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+    TEST_ASSERT_NULL(wrap_getNextPktBuf(h));
+}
+
+TEST_GROUP_RUNNER(Qos2)
+{
+    RUN_TEST_CASE(Qos2, Publish);
+    RUN_TEST_CASE(Qos2, Pubrec);
+    RUN_TEST_CASE(Qos2, Pubcomp);
+    RUN_TEST_CASE(Qos2, PubrelRetry);
+    RUN_TEST_CASE(Qos2, Window);
+    RUN_TEST_CASE(Qos2, BadAck);
+    RUN_TEST_CASE(Qos2, UnknownAck);
+    RUN_TEST_CASE(Qos2, InboundPublish);
+    RUN_TEST_CASE(Qos2, InboundDuplicate);
+    RUN_TEST_CASE(Qos2, InboundPubrel);
+    RUN_TEST_CASE(Qos2, InboundUnknownPubrel);
+    RUN_TEST_CASE(Qos2, InboundPubrecKept);
+    RUN_TEST_CASE(Qos2, SameIdBothWays);
+    RUN_TEST_CASE(Qos2, InboundAllocFail);
+}
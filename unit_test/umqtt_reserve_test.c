@@ -0,0 +1,344 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "unity_fixture.h"
+#include "umqtt/umqtt.h"
+#include "umqtt_mocks.h"
+#include "umqtt_wrapper.h"
+
+/*
+reserve and commit publish test cases
+
+umqtt_PublishReserve() allocates a publish packet big enough for maxLen
+bytes of payload and returns a pointer to where the payload goes.  The
+caller writes the payload there, then umqtt_PublishCommit() sets the
+remaining length for the actual payload length and sends it.  The
+length field is sized for maxLen, so when the actual length needs fewer
+length bytes the fixed header is moved up against the topic and the
+packet is written starting from the new header.  Only one reservation
+can be outstanding.
+
+-null and bad parameters
+-allocation fails
+-reserve while not connected, or with a full window
+-payload pointer is in the packet buffer after topic and packet ID
+-qos 0 commit writes and frees the packet
+-qos 1 commit has packet ID and is queued
+-shorter payload uses fewer length bytes
+-commit longer than reserved is refused
+-commit after the window filled up is refused and keeps the reservation
+-only one reservation at a time
+-cancel frees the packet
+ */
+
+TEST_GROUP(Reserve);
+
+static umqtt_Handle_t h = NULL;
+static void *instBuf = NULL;
+#define SIZE_INSTBUF UMQTT_INSTANCE_SIZE
+static uint8_t *pktBuf = NULL;
+#define SIZE_PKTBUF 1024
+static uint8_t txCopy[256];
+
+static const uint8_t publishPacket0[] =
+{
+    0x30, 14, // fixed header
+    0, 5, 't','o','p','i','c',
+    'm','e','s','s','a','g','e',
+};
+
+static umqtt_Callbacks_t callbacks =
+{
+    NULL, NULL, NULL, NULL, NULL, NULL
+};
+
+TEST_SETUP(Reserve)
+{
+    // allocate memory for the instance that will be created
+    // init the instance so it will be ready for all tests
+    mock_malloc_Reset();
+    instBuf = malloc(SIZE_INSTBUF);
+    mock_hNet = &mock_hNet;
+    transportConfig.hNet = mock_hNet;
+    mock_malloc_shouldReturn[0] = instBuf;
+    h = umqtt_New(&transportConfig, &callbacks, NULL);
+    TEST_ASSERT_NOT_NULL(h);
+    // clear all mocks
+    mock_malloc_Reset();
+    mock_free_Reset();
+    mock_NetRead_Reset();
+    mock_NetWrite_Reset();
+    // ready a buffer that can be used for packet allocation
+    pktBuf = malloc(SIZE_PKTBUF);
+    TEST_ASSERT_NOT_NULL(pktBuf);
+    // fake an existing connection, and long keep alive so that
+    // ping packets do not interfere
+    wrap_setConnected(h, true);
+    wrap_setKeepAlive(h, 1000);
+}
+
+TEST_TEAR_DOWN(Reserve)
+{
+    if (instBuf) { free(instBuf); instBuf = NULL; }
+    if (pktBuf) { free(pktBuf); pktBuf = NULL; }
+    h = NULL;
+}
+
+static uint8_t *
+Reserve(uint32_t maxLen, uint8_t qos)
+{
+    uint8_t *pPayload = NULL;
+    mock_malloc_Reset();
+    mock_free_Reset();
+    mock_NetWrite_Reset();
+    mock_malloc_shouldReturn[0] = pktBuf;
+    umqtt_Error_t err = umqtt_PublishReserve(h, "topic", maxLen, qos, false, &pPayload);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_NOT_NULL(pPayload);
+    TEST_ASSERT_EQUAL(1, mock_malloc_count);
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+    return pPayload;
+}
+
+static umqtt_Error_t
+Commit(uint32_t actualLen, uint16_t *pId, int writeReturn)
+{
+    mock_NetWrite_Reset();
+    memset(txCopy, 0, sizeof(txCopy));
+    mock_NetWrite_shouldReturn = writeReturn;
+    mock_NetWrite_pCopy = txCopy;
+    mock_NetWrite_copyLen = (writeReturn > 0) ? writeReturn : 0;
+    return umqtt_PublishCommit(h, actualLen, pId);
+}
+
+TEST(Reserve, NullParms)
+{
+    umqtt_Error_t err;
+    uint8_t *pPayload = NULL;
+    err = umqtt_PublishReserve(NULL, "topic", 10, 0, false, &pPayload);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+    err = umqtt_PublishReserve(h, NULL, 10, 0, false, &pPayload);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+    err = umqtt_PublishReserve(h, "", 10, 0, false, &pPayload);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+    err = umqtt_PublishReserve(h, "topic", 10, 3, false, &pPayload);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+    err = umqtt_PublishReserve(h, "topic", 10, 0, false, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+
+    // nothing reserved
+    err = umqtt_PublishCommit(NULL, 0, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+    err = umqtt_PublishCommit(h, 0, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+    err = umqtt_PublishCancel(NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+    err = umqtt_PublishCancel(h);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+    TEST_ASSERT_FALSE(mock_free_wasCalled);
+}
+
+TEST(Reserve, AllocFail)
+{
+    umqtt_Error_t err;
+    uint8_t *pPayload = NULL;
+    mock_malloc_shouldReturn[0] = NULL;
+    err = umqtt_PublishReserve(h, "topic", 10, 0, false, &pPayload);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_BUFSIZE, err);
+    TEST_ASSERT_NULL(pPayload);
+    // nothing is left reserved
+    err = umqtt_PublishCommit(h, 0, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+}
+
+TEST(Reserve, NotReady)
+{
+    umqtt_Error_t err;
+    uint8_t *pPayload = NULL;
+    wrap_setConnected(h, false);
+    err = umqtt_PublishReserve(h, "topic", 10, 0, false, &pPayload);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_DISCONNECTED, err);
+    wrap_setConnected(h, true);
+
+    // window is checked at reserve so the payload is not encoded
+    // for nothing
+    umqtt_SetInflightWindow(h, 1);
+    Reserve(10, 1);
+    err = Commit(7, NULL, 18);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    mock_malloc_Reset();
+    mock_malloc_shouldReturn[0] = &pktBuf[100];
+    err = umqtt_PublishReserve(h, "topic", 10, 1, false, &pPayload);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_WINDOW_FULL, err);
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+    // qos 0 does not count against the window
+    err = umqtt_PublishReserve(h, "topic", 10, 0, false, &pPayload);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+}
+
+TEST(Reserve, PayloadPointer)
+{
+    uint8_t *pPayload = Reserve(100, 0);
+    // header with one length byte, then topic
+    TEST_ASSERT_EQUAL_PTR(&pktBuf[sizeof(PktBuf_t) + 2 + 7], pPayload);
+    TEST_ASSERT_TRUE(mock_malloc_in_size >= (sizeof(PktBuf_t) + 2 + 7 + 100));
+
+    umqtt_PublishCancel(h);
+    pPayload = Reserve(100, 1);
+    // packet ID after the topic
+    TEST_ASSERT_EQUAL_PTR(&pktBuf[sizeof(PktBuf_t) + 2 + 7 + 2], pPayload);
+
+    umqtt_PublishCancel(h);
+    pPayload = Reserve(200, 0);
+    // two length bytes
+    TEST_ASSERT_EQUAL_PTR(&pktBuf[sizeof(PktBuf_t) + 3 + 7], pPayload);
+}
+
+TEST(Reserve, Qos0)
+{
+    umqtt_Error_t err;
+    uint8_t *pPayload = Reserve(7, 0);
+    memcpy(pPayload, "message", 7);
+    err = Commit(7, NULL, sizeof(publishPacket0));
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1, mock_NetWrite_count);
+    TEST_ASSERT_EQUAL(sizeof(publishPacket0), mock_NetWrite_in_len);
+    TEST_ASSERT_EQUAL_MEMORY(publishPacket0, txCopy, sizeof(publishPacket0));
+    TEST_ASSERT_TRUE(mock_free_wasCalled);
+    TEST_ASSERT_EQUAL_PTR(pktBuf, mock_free_in_ptr);
+    // reservation is used up
+    err = umqtt_PublishCommit(h, 7, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+}
+
+TEST(Reserve, Qos1)
+{
+    umqtt_Error_t err;
+    uint16_t msgId = 0;
+    uint8_t *pPayload = Reserve(7, 1);
+    memcpy(pPayload, "message", 7);
+    err = Commit(7, &msgId, 18);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_NOT_EQUAL(0, msgId);
+    TEST_ASSERT_EQUAL(18, mock_NetWrite_in_len);
+    TEST_ASSERT_EQUAL(0x32, txCopy[0]);
+    TEST_ASSERT_EQUAL(16, txCopy[1]);
+    TEST_ASSERT_EQUAL_MEMORY(&publishPacket0[2], &txCopy[2], 7);
+    TEST_ASSERT_EQUAL(msgId >> 8, txCopy[9]);
+    TEST_ASSERT_EQUAL(msgId & 0xFF, txCopy[10]);
+    TEST_ASSERT_EQUAL_MEMORY("message", &txCopy[11], 7);
+    // kept for puback
+    TEST_ASSERT_FALSE(mock_free_wasCalled);
+    TEST_ASSERT_EQUAL_PTR(pktBuf, wrap_getNextPktBuf(h));
+}
+
+// reserved for two length bytes but only one is needed
+TEST(Reserve, Shorter)
+{
+    umqtt_Error_t err;
+    uint8_t *pPayload = Reserve(200, 0);
+    memcpy(pPayload, "message", 7);
+    err = Commit(7, NULL, sizeof(publishPacket0));
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(sizeof(publishPacket0), mock_NetWrite_in_len);
+    TEST_ASSERT_EQUAL_PTR(&pktBuf[sizeof(PktBuf_t) + 1], mock_NetWrite_in_pBuf);
+    TEST_ASSERT_EQUAL_MEMORY(publishPacket0, txCopy, sizeof(publishPacket0));
+
+    // and the other way, all of the reserved space is used
+    pPayload = Reserve(200, 0);
+    memset(pPayload, 'x', 200);
+    err = Commit(200, NULL, 210);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(210, mock_NetWrite_in_len);
+    TEST_ASSERT_EQUAL_PTR(&pktBuf[sizeof(PktBuf_t)], mock_NetWrite_in_pBuf);
+    TEST_ASSERT_EQUAL(0x30, txCopy[0]);
+    TEST_ASSERT_EQUAL((207 & 0x7F) | 0x80, txCopy[1]);
+    TEST_ASSERT_EQUAL(207 >> 7, txCopy[2]);
+    TEST_ASSERT_EQUAL('x', txCopy[209]);
+}
+
+TEST(Reserve, TooLong)
+{
+    umqtt_Error_t err;
+    Reserve(10, 0);
+    err = Commit(11, NULL, 20);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+    TEST_ASSERT_FALSE(mock_free_wasCalled);
+    // still reserved
+    err = Commit(10, NULL, 19);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(19, mock_NetWrite_in_len);
+}
+
+TEST(Reserve, OnlyOne)
+{
+    umqtt_Error_t err;
+    uint8_t *pPayload = NULL;
+    Reserve(10, 0);
+    mock_malloc_Reset();
+    mock_malloc_shouldReturn[0] = &pktBuf[100];
+    err = umqtt_PublishReserve(h, "topic", 10, 0, false, &pPayload);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_TX_BUSY, err);
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+    // other publishes are not held up
+    mock_malloc_shouldReturn[0] = &pktBuf[100];
+    mock_NetWrite_shouldReturn = sizeof(publishPacket0);
+    err = umqtt_Publish(h, "topic", (const uint8_t *)"message", 7, 0, false, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+}
+
+TEST(Reserve, WindowAtCommit)
+{
+    umqtt_Error_t err;
+    umqtt_SetInflightWindow(h, 1);
+    Reserve(10, 1);
+    // another publish takes the last slot before the commit
+    mock_malloc_Reset();
+    mock_malloc_shouldReturn[0] = &pktBuf[200];
+    mock_NetWrite_shouldReturn = 20;
+    err = umqtt_Publish(h, "topic", (const uint8_t *)"message", 7, 1, false, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    err = Commit(7, NULL, 18);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_WINDOW_FULL, err);
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+    // the reservation is kept for a retry or cancel
+    mock_free_Reset();
+    err = umqtt_PublishCancel(h);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL_PTR(pktBuf, mock_free_in_ptr);
+}
+
+TEST(Reserve, Cancel)
+{
+    umqtt_Error_t err;
+    Reserve(10, 1);
+    err = umqtt_PublishCancel(h);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_TRUE(mock_free_wasCalled);
+    TEST_ASSERT_EQUAL_PTR(pktBuf, mock_free_in_ptr);
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+    TEST_ASSERT_NULL(wrap_getNextPktBuf(h));
+    err = umqtt_PublishCommit(h, 10, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+}
+
+TEST_GROUP_RUNNER(Reserve)
+{
+    RUN_TEST_CASE(Reserve, NullParms);
+    RUN_TEST_CASE(Reserve, AllocFail);
+    RUN_TEST_CASE(Reserve, NotReady);
+    RUN_TEST_CASE(Reserve, PayloadPointer);
+    RUN_TEST_CASE(Reserve, Qos0);
+    RUN_TEST_CASE(Reserve, Qos1);
+    RUN_TEST_CASE(Reserve, Shorter);
+    RUN_TEST_CASE(Reserve, TooLong);
+    RUN_TEST_CASE(Reserve, OnlyOne);
+    RUN_TEST_CASE(Reserve, WindowAtCommit);
+    RUN_TEST_CASE(Reserve, Cancel);
+}
@@ -0,0 +1,315 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "unity_fixture.h"
+#include "umqtt/umqtt.h"
+#include "umqtt_mocks.h"
+#include "umqtt_wrapper.h"
+
+/*
+adaptive retry timeout test cases
+
+Round trip samples come from CONNACK, PUBACK, SUBACK, UNSUBACK and
+PINGRESP.  Packets that were resent give no sample.  The estimate
+follows TCP in whole milliseconds:
+
+first sample R: SRTT = R, RTTVAR = R / 2
+after that:     RTTVAR = (3 * RTTVAR + |SRTT - R|) / 4
+                SRTT = (7 * SRTT + R) / 8
+RTO = SRTT + 4 * RTTVAR, clamped to the retry bounds
+
+Default bounds are 5000 to 5000, the same fixed timeout as before.
+Each resend of a packet doubles its timeout, up to the max bound.
+
+-null parameters and bad bounds
+-default bounds keep fixed timeout but samples are still taken
+-connack sample
+-puback samples smoothed
+-pingresp sample
+-timeout clamped to min bound
+-retry uses rto with exponential backoff, no sample from resent packet
+ */
+
+TEST_GROUP(Rto);
+
+static umqtt_Handle_t h = NULL;
+static void *instBuf = NULL;
+#define SIZE_INSTBUF UMQTT_INSTANCE_SIZE
+static uint8_t *pktBuf = NULL;
+#define SIZE_PKTBUF 1024
+static uint8_t rxBuf[8];
+static uint32_t srtt;
+static uint32_t rttVar;
+static uint32_t rto;
+
+static umqtt_Callbacks_t callbacks =
+{
+    NULL, NULL, NULL, NULL, NULL, NULL
+};
+
+TEST_SETUP(Rto)
+{
+    // allocate memory for the instance that will be created
+    // init the instance so it will be ready for all tests
+    mock_malloc_Reset();
+    instBuf = malloc(SIZE_INSTBUF);
+    mock_hNet = &mock_hNet;
+    transportConfig.hNet = mock_hNet;
+    mock_malloc_shouldReturn[0] = instBuf;
+    h = umqtt_New(&transportConfig, &callbacks, NULL);
+    TEST_ASSERT_NOT_NULL(h);
+    // clear all mocks
+    mock_malloc_Reset();
+    mock_free_Reset();
+    mock_NetRead_Reset();
+    mock_NetWrite_Reset();
+    // ready a buffer that can be used for packet allocation
+    pktBuf = malloc(SIZE_PKTBUF);
+    TEST_ASSERT_NOT_NULL(pktBuf);
+    srtt = 5555;
+    rttVar = 5555;
+    rto = 5555;
+}
+
+TEST_TEAR_DOWN(Rto)
+{
+    if (instBuf) { free(instBuf); instBuf = NULL; }
+    if (pktBuf) { free(pktBuf); pktBuf = NULL; }
+    h = NULL;
+}
+
+// fake a connection with long keep alive so pings do not interfere
+static void
+SetConnected(void)
+{
+    wrap_setConnected(h, true);
+    wrap_setKeepAlive(h, 1000);
+}
+
+static void
+GetRtt(void)
+{
+    umqtt_Error_t err = umqtt_GetRtt(h, &srtt, &rttVar, &rto);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+}
+
+// enqueue a publish packet as if it was sent at ticks
+static void
+SendAt(uint16_t pktId, uint32_t ticks)
+{
+    mock_malloc_Reset();
+    mock_malloc_shouldReturn[0] = &pktBuf[pktId * 100];
+    uint8_t *buf = wrap_newPacket(h, 30);
+    TEST_ASSERT_NOT_NULL(buf);
+    buf[0] = 0x32;
+    buf[1] = 28;
+    wrap_enqueuePacket(h, buf, pktId, ticks);
+}
+
+// puback arrives in the run at ticks
+static void
+AckAt(uint16_t pktId, uint32_t ticks)
+{
+    mock_NetRead_Reset();
+    rxBuf[0] = 4 << 4;
+    rxBuf[1] = 2;
+    rxBuf[2] = pktId >> 8;
+    rxBuf[3] = pktId & 0xFF;
+    mock_NetRead_AddChunk(rxBuf, 4);
+    umqtt_Error_t err = umqtt_Run(h, ticks);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+}
+
+static void
+CheckDeadline(uint32_t expected)
+{
+    uint32_t ticks;
+    umqtt_Error_t err = umqtt_GetNextDeadline(h, &ticks);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(expected, ticks);
+}
+
+TEST(Rto, NullParms)
+{
+    umqtt_Error_t err;
+    err = umqtt_GetRtt(NULL, &srtt, &rttVar, &rto);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+    err = umqtt_SetRetryBounds(NULL, 100, 1000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+    err = umqtt_SetRetryBounds(h, 0, 1000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+    err = umqtt_SetRetryBounds(h, 1001, 1000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+
+    // any output can be skipped
+    err = umqtt_GetRtt(h, NULL, NULL, &rto);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(5000, rto);
+}
+
+// default is the fixed 5 second retry
+TEST(Rto, DefaultFixed)
+{
+    SetConnected();
+    GetRtt();
+    TEST_ASSERT_EQUAL(0, srtt);
+    TEST_ASSERT_EQUAL(0, rttVar);
+    TEST_ASSERT_EQUAL(5000, rto);
+
+    SendAt(1, 1000);
+    AckAt(1, 1200);
+    GetRtt();
+    TEST_ASSERT_EQUAL(200, srtt);
+    TEST_ASSERT_EQUAL(100, rttVar);
+    TEST_ASSERT_EQUAL(5000, rto);
+
+    SendAt(2, 2000);
+    CheckDeadline(7000);
+}
+
+TEST(Rto, Connack)
+{
+    umqtt_Error_t err;
+    err = umqtt_SetRetryBounds(h, 100, 60000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    err = umqtt_Run(h, 1000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+
+    // lazy way to get required packet length
+    mock_malloc_shouldReturn[0] = pktBuf;
+    mock_malloc_shouldReturn[1] = &pktBuf[600];
+    err = umqtt_Connect(h, false, false, 0, 30, "testClient", NULL, NULL, 0, NULL, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_NETWORK, err);
+    mock_NetWrite_shouldReturn = mock_NetWrite_in_len;
+    mock_malloc_Reset();
+    mock_malloc_shouldReturn[0] = pktBuf;
+    mock_malloc_shouldReturn[1] = &pktBuf[600];
+    err = umqtt_Connect(h, false, false, 0, 30, "testClient", NULL, NULL, 0, NULL, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+
+    mock_NetRead_Reset();
+    rxBuf[0] = 2 << 4;
+    rxBuf[1] = 2;
+    rxBuf[2] = 0;
+    rxBuf[3] = 0;
+    mock_NetRead_AddChunk(rxBuf, 4);
+    err = umqtt_Run(h, 1300);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_CONNECTED, umqtt_GetConnectedStatus(h));
+    GetRtt();
+    TEST_ASSERT_EQUAL(300, srtt);
+    TEST_ASSERT_EQUAL(150, rttVar);
+    TEST_ASSERT_EQUAL(900, rto);
+}
+
+TEST(Rto, Smoothed)
+{
+    umqtt_Error_t err;
+    SetConnected();
+    err = umqtt_SetRetryBounds(h, 100, 60000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+
+    SendAt(1, 1000);
+    AckAt(1, 1200);
+    GetRtt();
+    TEST_ASSERT_EQUAL(200, srtt);
+    TEST_ASSERT_EQUAL(100, rttVar);
+    TEST_ASSERT_EQUAL(600, rto);
+
+    SendAt(2, 2000);
+    CheckDeadline(2600);
+    AckAt(2, 2100);
+    GetRtt();
+    TEST_ASSERT_EQUAL(187, srtt);
+    TEST_ASSERT_EQUAL(100, rttVar);
+    TEST_ASSERT_EQUAL(587, rto);
+}
+
+TEST(Rto, Pingresp)
+{
+    umqtt_Error_t err;
+    wrap_setConnected(h, true);
+    err = umqtt_SetRetryBounds(h, 100, 60000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    wrap_setKeepAlive(h, 30);
+
+    // ping at 15000
+    mock_NetWrite_shouldReturn = 2;
+    err = umqtt_Run(h, 15000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1, mock_NetWrite_count);
+
+    mock_NetRead_Reset();
+    rxBuf[0] = 13 << 4;
+    rxBuf[1] = 0;
+    mock_NetRead_AddChunk(rxBuf, 2);
+    err = umqtt_Run(h, 15080);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    GetRtt();
+    TEST_ASSERT_EQUAL(80, srtt);
+    TEST_ASSERT_EQUAL(40, rttVar);
+    TEST_ASSERT_EQUAL(240, rto);
+}
+
+TEST(Rto, MinBound)
+{
+    umqtt_Error_t err;
+    SetConnected();
+    err = umqtt_SetRetryBounds(h, 100, 60000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+
+    // 10 + 4 * 5 is under the min
+    SendAt(1, 1000);
+    AckAt(1, 1010);
+    GetRtt();
+    TEST_ASSERT_EQUAL(10, srtt);
+    TEST_ASSERT_EQUAL(100, rto);
+    SendAt(2, 2000);
+    CheckDeadline(2100);
+}
+
+// each resend doubles the timeout, and the ack of a resent packet
+// is not used as a sample since it is not known which send it is for
+TEST(Rto, Backoff)
+{
+    umqtt_Error_t err;
+    SetConnected();
+    err = umqtt_SetRetryBounds(h, 100, 2000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    SendAt(1, 1000);
+    AckAt(1, 1200);
+
+    SendAt(2, 2000);
+    CheckDeadline(2600);
+    mock_NetWrite_Reset();
+    mock_NetWrite_shouldReturn = 30;
+    err = umqtt_Run(h, 2600);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1, mock_NetWrite_count);
+    CheckDeadline(3800);
+    err = umqtt_Run(h, 3800);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(2, mock_NetWrite_count);
+    // 2400 would be over the max
+    CheckDeadline(5800);
+
+    AckAt(2, 5000);
+    GetRtt();
+    TEST_ASSERT_EQUAL(200, srtt);
+    TEST_ASSERT_EQUAL(100, rttVar);
+    TEST_ASSERT_EQUAL(600, rto);
+}
+
+TEST_GROUP_RUNNER(Rto)
+{
+    RUN_TEST_CASE(Rto, NullParms);
+    RUN_TEST_CASE(Rto, DefaultFixed);
+    RUN_TEST_CASE(Rto, Connack);
+    RUN_TEST_CASE(Rto, Smoothed);
+    RUN_TEST_CASE(Rto, Pingresp);
+    RUN_TEST_CASE(Rto, MinBound);
+    RUN_TEST_CASE(Rto, Backoff);
+}
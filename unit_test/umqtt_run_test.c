@@ -14,10 +14,20 @@ run test cases
 
 -basic rx and decode
 -basic rx network error
+-rx multiple packets in one read
+-rx packet split across reads (body and header)
+-rx packet split across reads mixed with whole packets
+-rx malformed remaining length
 
 -ping timeout (pings sent normally)
 -ping timeout w network error
 -ping timeout resume after network error
+-ping with long keep alive (deadline in a high wheel level, moved
+ down the levels as it comes near)
+-ping deadline across tick counter wrap
+-ping suppressed while publishing, sent once idle
+-failed write does not restart keep alive
+-receive restarts keep alive only when enabled
 
 -nominal connect/connack
 -connect timeout
@@ -25,6 +35,8 @@ run test cases
 -nominal publish/puback
 -publish retry
 -publish timeout
+-only due packets are retried, oldest first
+-retries fire at their exact deadline, stepping or jumping past them
 
  */
 
@@ -32,7 +44,7 @@ TEST_GROUP(Run);
 
 static umqtt_Handle_t h = NULL;
 static void *instBuf = NULL;
-#define SIZE_INSTBUF 200
+#define SIZE_INSTBUF UMQTT_INSTANCE_SIZE
 static uint8_t *pktBuf = NULL;
 #define SIZE_PKTBUF 1024
 static char *clientBuf = NULL;
@@ -233,6 +245,193 @@ TEST(Run, RxNetError)
     TEST_ASSERT_NULL(Pingresp_h);
 }
 
+// several complete packets arrive in a single read
+// verify every packet in the chunk is decoded
+TEST(Run, RxCoalesced)
+{
+    umqtt_Error_t err;
+    initiateConnect();
+    completeConnect();
+    wrap_setKeepAlive(h, 1000);
+
+    static const uint8_t chunk[] =
+    {
+        13 << 4, 0, // pingresp
+        9 << 4, 3, 0x12, 0x34, 1, // suback
+        11 << 4, 2, 0x56, 0x78, // unsuback
+    };
+    memcpy(&pktBuf[900], chunk, sizeof(chunk));
+    mock_NetRead_AddChunk(&pktBuf[900], sizeof(chunk));
+
+    err = umqtt_Run(h, 1000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL_PTR(instBuf, Pingresp_h);
+    TEST_ASSERT_EQUAL_PTR(instBuf, Suback_h);
+    TEST_ASSERT_EQUAL(0x1234, Suback_msgId);
+    TEST_ASSERT_EQUAL(1, Suback_retCount);
+    TEST_ASSERT_EQUAL(1, Suback_pRetCodes[0]);
+    TEST_ASSERT_EQUAL_PTR(instBuf, Unsuback_h);
+    TEST_ASSERT_EQUAL(0x5678, Unsuback_msgId);
+
+    // all packets were complete so nothing should be allocated
+    // and the read buffer should be freed
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+    TEST_ASSERT_EQUAL(1, mock_free_count);
+    TEST_ASSERT_EQUAL_PTR(&pktBuf[900], mock_free_in_ptr);
+}
+
+// packet body is split across two reads
+// verify nothing is decoded until the packet is complete
+TEST(Run, RxSplitPacket)
+{
+    umqtt_Error_t err;
+    initiateConnect();
+    completeConnect();
+    wrap_setKeepAlive(h, 1000);
+
+    static const uint8_t part1[] = { 9 << 4, 3, 0x12 }; // suback start
+    static const uint8_t part2[] = { 0x34, 1 }; // rest of suback
+    memcpy(&pktBuf[900], part1, sizeof(part1));
+    memcpy(&pktBuf[950], part2, sizeof(part2));
+    mock_NetRead_AddChunk(&pktBuf[900], sizeof(part1));
+    mock_NetRead_AddChunk(&pktBuf[950], sizeof(part2));
+    // memory used to reassemble the partial packet
+    mock_malloc_shouldReturn[0] = &pktBuf[500];
+
+    // first part, should be held but not decoded
+    err = umqtt_Run(h, 1000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_NULL(Suback_h);
+    TEST_ASSERT_EQUAL(1, mock_malloc_count);
+    TEST_ASSERT_GREATER_OR_EQUAL(5, mock_malloc_in_size);
+    // read buffer is released even though packet is not complete
+    TEST_ASSERT_EQUAL(1, mock_free_count);
+    TEST_ASSERT_EQUAL_PTR(&pktBuf[900], mock_free_in_ptr);
+
+    // second part completes the packet
+    err = umqtt_Run(h, 1100);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL_PTR(instBuf, Suback_h);
+    TEST_ASSERT_EQUAL(0x1234, Suback_msgId);
+    TEST_ASSERT_EQUAL(1, Suback_retCount);
+    TEST_ASSERT_EQUAL(1, Suback_pRetCodes[0]);
+    // no more allocations, and both reassembly and read buffer freed
+    TEST_ASSERT_EQUAL(1, mock_malloc_count);
+    TEST_ASSERT_EQUAL(3, mock_free_count);
+}
+
+// split in the middle of the fixed header
+TEST(Run, RxSplitHeader)
+{
+    umqtt_Error_t err;
+    initiateConnect();
+    completeConnect();
+    wrap_setKeepAlive(h, 1000);
+
+    pktBuf[900] = 13 << 4; // pingresp, first byte only
+    pktBuf[950] = 0; // remaining length
+    mock_NetRead_AddChunk(&pktBuf[900], 1);
+    mock_NetRead_AddChunk(&pktBuf[950], 1);
+
+    err = umqtt_Run(h, 1000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_NULL(Pingresp_h);
+
+    err = umqtt_Run(h, 1100);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL_PTR(instBuf, Pingresp_h);
+    // partial fixed header is held in the instance, no allocation needed
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+    TEST_ASSERT_EQUAL(2, mock_free_count);
+}
+
+// whole packet followed by a partial one, then the remainder
+// followed by another whole packet
+TEST(Run, RxSplitCoalesced)
+{
+    umqtt_Error_t err;
+    initiateConnect();
+    completeConnect();
+    wrap_setKeepAlive(h, 1000);
+
+    static const uint8_t part1[] =
+    {
+        13 << 4, 0, // pingresp
+        4 << 4, 2, // puback, without packet id
+    };
+    static const uint8_t part2[] =
+    {
+        0x56, 0x78, // rest of puback
+        11 << 4, 2, 0x9A, 0xBC, // unsuback
+    };
+    memcpy(&pktBuf[900], part1, sizeof(part1));
+    memcpy(&pktBuf[950], part2, sizeof(part2));
+    mock_NetRead_AddChunk(&pktBuf[900], sizeof(part1));
+    mock_NetRead_AddChunk(&pktBuf[950], sizeof(part2));
+    mock_malloc_shouldReturn[0] = &pktBuf[500];
+
+    err = umqtt_Run(h, 1000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL_PTR(instBuf, Pingresp_h);
+    TEST_ASSERT_NULL(Puback_h);
+    TEST_ASSERT_NULL(Unsuback_h);
+
+    err = umqtt_Run(h, 1100);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL_PTR(instBuf, Puback_h);
+    TEST_ASSERT_EQUAL(0x5678, Puback_msgId);
+    TEST_ASSERT_EQUAL_PTR(instBuf, Unsuback_h);
+    TEST_ASSERT_EQUAL(0x9ABC, Unsuback_msgId);
+
+    // nothing left over, next run has nothing to decode
+    Pingresp_Reset();
+    Puback_Reset();
+    Unsuback_Reset();
+    err = umqtt_Run(h, 1200);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_NULL(Pingresp_h);
+    TEST_ASSERT_NULL(Puback_h);
+    TEST_ASSERT_NULL(Unsuback_h);
+}
+
+// remaining length field uses more than 4 bytes
+TEST(Run, RxBadLength)
+{
+    umqtt_Error_t err;
+    initiateConnect();
+    completeConnect();
+    wrap_setKeepAlive(h, 1000);
+
+    static const uint8_t chunk[] = { 3 << 4, 0xFF, 0xFF, 0xFF, 0xFF, 0x01 };
+    memcpy(&pktBuf[900], chunk, sizeof(chunk));
+    mock_NetRead_AddChunk(&pktBuf[900], sizeof(chunk));
+
+    err = umqtt_Run(h, 1000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PACKET_ERROR, err);
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+    TEST_ASSERT_EQUAL_PTR(&pktBuf[900], mock_free_in_ptr);
+}
+
+// partial packet but no memory to hold it
+TEST(Run, RxSplitAllocFail)
+{
+    umqtt_Error_t err;
+    initiateConnect();
+    completeConnect();
+    wrap_setKeepAlive(h, 1000);
+
+    static const uint8_t part1[] = { 9 << 4, 3, 0x12 }; // suback start
+    memcpy(&pktBuf[900], part1, sizeof(part1));
+    mock_NetRead_AddChunk(&pktBuf[900], sizeof(part1));
+    mock_malloc_shouldReturn[0] = NULL;
+
+    err = umqtt_Run(h, 1000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_BUFSIZE, err);
+    TEST_ASSERT_EQUAL(1, mock_malloc_count);
+    TEST_ASSERT_NULL(Suback_h);
+    TEST_ASSERT_EQUAL_PTR(&pktBuf[900], mock_free_in_ptr);
+}
+
 static const uint8_t pingPacket[] =
 { 12 << 4, 0 };
 
@@ -383,6 +582,147 @@ TEST(Run, PingNetError)
     TEST_ASSERT_EQUAL_MEMORY(pingPacket, pktBuf, 2);
 }
 
+// run once at ticks and verify whether a ping was sent
+static void
+CheckPing(uint32_t ticks, bool expectPing)
+{
+    mock_NetWrite_Reset();
+    mock_NetWrite_pCopy = pktBuf;
+    mock_NetWrite_copyLen = 2;
+    mock_NetWrite_shouldReturn = 2;
+    umqtt_Error_t err = umqtt_Run(h, ticks);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+    if (expectPing)
+    {
+        TEST_ASSERT_EQUAL(1, mock_NetWrite_count);
+        TEST_ASSERT_EQUAL(2, mock_NetWrite_in_len);
+        TEST_ASSERT_EQUAL_MEMORY(pingPacket, pktBuf, 2);
+    }
+    else
+    {
+        TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+    }
+}
+
+// keep alive of 1000 seconds puts the ping deadline far out in
+// the timer wheel.  verify it still fires at the right time
+TEST(Run, PingLongKeepAlive)
+{
+    initiateConnect();
+    completeConnect();
+    wrap_setKeepAlive(h, 1000);
+
+    // ping interval is half the keep alive, 500 seconds
+    CheckPing(1000, false);
+    CheckPing(250000, false);
+    CheckPing(499999, false);
+    CheckPing(500001, true);
+    // and the next one is rescheduled
+    CheckPing(999999, false);
+    CheckPing(1000002, true);
+}
+
+// tick counter wraps between pings
+TEST(Run, PingTickWrap)
+{
+    initiateConnect();
+    completeConnect();
+
+    // move time forward in steps less than half the tick range
+    CheckPing(0x7FFF0000, true);
+    CheckPing(0xC0000000, true);
+    // ping at 0xFFFFE000, next due at 0xFFFFE000 + 15000 = 0x1A98
+    CheckPing(0xFFFFE000, true);
+    CheckPing(0xFFFFF000, false);
+    CheckPing(0x10, false);
+    CheckPing(0x1A97, false);
+    CheckPing(0x1A99, true);
+}
+
+// publish a qos 0 message from the application
+static void
+PublishQos0(umqtt_Error_t expectErr, int writeReturn)
+{
+    mock_malloc_Reset();
+    mock_free_Reset();
+    mock_NetWrite_Reset();
+    mock_malloc_shouldReturn[0] = pktBuf;
+    mock_NetWrite_shouldReturn = writeReturn;
+    umqtt_Error_t err = umqtt_Publish(h, "topic", (uint8_t *)"message", 7, 0, false, NULL);
+    TEST_ASSERT_EQUAL(expectErr, err);
+    mock_malloc_Reset();
+    mock_free_Reset();
+}
+
+// any packet sent restarts the keep alive timer, so a client
+// that keeps publishing never needs to ping
+TEST(Run, PingSuppressedByTraffic)
+{
+    initiateConnect();
+    completeConnect();
+
+    // without traffic the ping would be at 15000
+    CheckPing(10000, false);
+    PublishQos0(UMQTT_ERR_OK, 16);
+    CheckPing(15000, false);
+    CheckPing(20000, false);
+    PublishQos0(UMQTT_ERR_OK, 16);
+    CheckPing(30000, false);
+    // idle since 20000
+    CheckPing(34999, false);
+    CheckPing(35000, true);
+    CheckPing(49999, false);
+    CheckPing(50000, true);
+}
+
+// nothing was sent, so the ping is still due on time
+TEST(Run, PingFailedWrite)
+{
+    initiateConnect();
+    completeConnect();
+
+    CheckPing(10000, false);
+    PublishQos0(UMQTT_ERR_NETWORK, -1);
+    CheckPing(15000, true);
+}
+
+// by default only sending restarts keep alive, it can also be
+// enabled for received packets
+TEST(Run, PingOnReceive)
+{
+    umqtt_Error_t err;
+    static const uint8_t pubPkt[] = { 0x30, 7, 0, 5, 't', 'o', 'p', 'i', 'c' };
+    initiateConnect();
+    completeConnect();
+
+    err = umqtt_SetKeepAliveOnReceive(NULL, true);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+
+    // received publish does not change the ping time
+    memcpy(&pktBuf[500], pubPkt, sizeof(pubPkt));
+    mock_NetRead_AddChunk(&pktBuf[500], sizeof(pubPkt));
+    CheckPing(10000, false);
+    CheckPing(15000, true);
+
+    // enabled, received publish restarts the timer
+    err = umqtt_SetKeepAliveOnReceive(h, true);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    mock_NetRead_Reset();
+    mock_NetRead_AddChunk(&pktBuf[500], sizeof(pubPkt));
+    CheckPing(20000, false);
+    CheckPing(30000, false);
+    CheckPing(35000, true);
+
+    // and can be turned off again
+    err = umqtt_SetKeepAliveOnReceive(h, false);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    mock_NetRead_Reset();
+    mock_NetRead_AddChunk(&pktBuf[500], sizeof(pubPkt));
+    CheckPing(40000, false);
+    CheckPing(50000, true);
+}
+
 // initiate connect but no connack within timeout
 TEST(Run, ConnectTimeout)
 {
@@ -452,8 +792,7 @@ TEST(Run, Connect)
 }
 
 // only test qos 1.  qos 0 was essentially tested with publish unit test
-// so there is no point to repeat that here.  qos 2 is not supported at this
-// time
+// so there is no point to repeat that here.  qos 2 has its own tests
 
 // verify packet times out and retries
 TEST(Run, PublishTimeout)
@@ -984,19 +1323,160 @@ TEST(Run, PublishExpire)
     TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
 }
 
+// several packets in flight, verify each run only resends the
+// packets whose retry time has passed
+TEST(Run, RetryOnlyDue)
+{
+    umqtt_Error_t err;
+    uint16_t msgId1;
+    uint16_t msgId2;
+    uint8_t sent[11];
+
+    initiateConnect();
+    completeConnect();
+    wrap_setKeepAlive(h, 1000);
+
+    // lazy way to get required packet length
+    mock_malloc_shouldReturn[0] = pktBuf;
+    err = umqtt_Publish(h, "topic", (uint8_t *)"message", sizeof("message"), 1, false, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_NETWORK, err);
+    size_t len = mock_NetWrite_in_len;
+
+    // first publish sent at 1000, second at 3000
+    mock_malloc_Reset();
+    mock_free_Reset();
+    mock_NetWrite_Reset();
+    mock_NetWrite_shouldReturn = len;
+    mock_malloc_shouldReturn[0] = pktBuf;
+    mock_malloc_shouldReturn[1] = &pktBuf[512];
+    err = umqtt_Run(h, 1000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    err = umqtt_Publish(h, "topic", (uint8_t *)"message", sizeof("message"), 1, false, &msgId1);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    err = umqtt_Run(h, 3000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    err = umqtt_Publish(h, "topic", (uint8_t *)"message", sizeof("message"), 1, false, &msgId2);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL_PTR(pktBuf, wrap_getLastPktBuf(h));
+
+    // only the first one is due
+    mock_NetWrite_Reset();
+    mock_NetWrite_shouldReturn = len;
+    mock_NetWrite_pCopy = sent;
+    mock_NetWrite_copyLen = sizeof(sent);
+    err = umqtt_Run(h, 6500);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1, mock_NetWrite_count);
+    TEST_ASSERT_EQUAL(0x32, sent[0]);
+    TEST_ASSERT_EQUAL(msgId1 >> 8, sent[9]);
+    TEST_ASSERT_EQUAL(msgId1 & 0xFF, sent[10]);
+    // resent packet is now the newest
+    TEST_ASSERT_EQUAL_PTR(pktBuf, wrap_getNextPktBuf(h));
+    TEST_ASSERT_EQUAL_PTR(&pktBuf[512], wrap_getLastPktBuf(h));
+
+    // nothing due
+    mock_NetWrite_Reset();
+    err = umqtt_Run(h, 7000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(0, mock_NetWrite_count);
+
+    // now the second one is due
+    mock_NetWrite_shouldReturn = len;
+    mock_NetWrite_pCopy = sent;
+    mock_NetWrite_copyLen = sizeof(sent);
+    err = umqtt_Run(h, 8500);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1, mock_NetWrite_count);
+    TEST_ASSERT_EQUAL(msgId2 >> 8, sent[9]);
+    TEST_ASSERT_EQUAL(msgId2 & 0xFF, sent[10]);
+    TEST_ASSERT_FALSE(mock_free_wasCalled);
+}
+
+// packets whose deadlines are in higher wheel levels are resent at the
+// exact deadline, whether runs step up to each deadline or jump past
+// several of them at once
+TEST(Run, RetryAtDeadline)
+{
+    static struct { PktBuf_t hdr; uint8_t data[4]; } pkts[3];
+    umqtt_Error_t err;
+
+    initiateConnect();
+    completeConnect();
+    wrap_setKeepAlive(h, 1000);
+    err = umqtt_Run(h, 100);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+
+    // retry timeout is 5000
+    for (unsigned int idx = 0; idx < 3; idx++)
+    {
+        uint8_t *buf = pkts[idx].data;
+        buf[0] = 0x82;
+        buf[1] = 2;
+        buf[2] = 0;
+        buf[3] = idx + 1;
+    }
+    wrap_enqueuePacket(h, pkts[0].data, 1, 4090);
+    wrap_enqueuePacket(h, pkts[1].data, 2, 4095);
+    wrap_enqueuePacket(h, pkts[2].data, 3, 60000);
+    mock_NetWrite_Reset();
+    mock_NetWrite_shouldReturn = 4;
+
+    // runs that cross slot boundaries of the levels below
+    static const uint32_t quiet[] = { 4096, 8191, 8192, 8960, 9088, 9089 };
+    for (unsigned int idx = 0; idx < (sizeof(quiet) / sizeof(quiet[0])); idx++)
+    {
+        err = umqtt_Run(h, quiet[idx]);
+        TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    }
+    TEST_ASSERT_EQUAL(0, mock_NetWrite_count);
+    err = umqtt_Run(h, 9090);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1, mock_NetWrite_count);
+    TEST_ASSERT_EQUAL_PTR(pkts[0].data, mock_NetWrite_in_pBuf);
+    err = umqtt_Run(h, 9094);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1, mock_NetWrite_count);
+    err = umqtt_Run(h, 9095);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(2, mock_NetWrite_count);
+    TEST_ASSERT_EQUAL_PTR(pkts[1].data, mock_NetWrite_in_pBuf);
+
+    // jump past the resends at 14090 and 14095 and the first send of
+    // the third packet at 65000, the latest deadline is handled last
+    err = umqtt_Run(h, 70000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(5, mock_NetWrite_count);
+    TEST_ASSERT_EQUAL_PTR(pkts[2].data, mock_NetWrite_in_pBuf);
+    err = umqtt_Run(h, 70000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(5, mock_NetWrite_count);
+}
 
 TEST_GROUP_RUNNER(Run)
 {
     RUN_TEST_CASE(Run, NothingHappens);
     RUN_TEST_CASE(Run, BasicRx);
     RUN_TEST_CASE(Run, RxNetError);
+    RUN_TEST_CASE(Run, RxCoalesced);
+    RUN_TEST_CASE(Run, RxSplitPacket);
+    RUN_TEST_CASE(Run, RxSplitHeader);
+    RUN_TEST_CASE(Run, RxSplitCoalesced);
+    RUN_TEST_CASE(Run, RxBadLength);
+    RUN_TEST_CASE(Run, RxSplitAllocFail);
     RUN_TEST_CASE(Run, Ping);
     RUN_TEST_CASE(Run, PingExclusive);
     RUN_TEST_CASE(Run, PingInclusive);
     RUN_TEST_CASE(Run, PingNetError);
+    RUN_TEST_CASE(Run, PingLongKeepAlive);
+    RUN_TEST_CASE(Run, PingTickWrap);
+    RUN_TEST_CASE(Run, PingSuppressedByTraffic);
+    RUN_TEST_CASE(Run, PingFailedWrite);
+    RUN_TEST_CASE(Run, PingOnReceive);
     RUN_TEST_CASE(Run, ConnectTimeout);
     RUN_TEST_CASE(Run, Connect);
     RUN_TEST_CASE(Run, PublishTimeout);
+    RUN_TEST_CASE(Run, RetryOnlyDue);
+    RUN_TEST_CASE(Run, RetryAtDeadline);
     RUN_TEST_CASE(Run, Publish);
     RUN_TEST_CASE(Run, SubscribeTimeout);
     RUN_TEST_CASE(Run, Subscribe);
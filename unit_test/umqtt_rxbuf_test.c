@@ -0,0 +1,274 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "unity_fixture.h"
+#include "umqtt/umqtt.h"
+#include "umqtt_mocks.h"
+#include "umqtt_wrapper.h"
+
+/*
+receive buffer test cases
+
+These use the transport "read into" function with a receive buffer
+that is owned by umqtt.  There should be no allocation on the
+receive path.
+
+-whole packets, no allocation or free
+-packet split across reads, continues reading after partial packet
+-partial packet is moved to start of buffer after whole packets
+-read data bigger than buffer, remainder read on next run
+-packet too big for receive buffer
+-publish decoded in place
+ */
+
+TEST_GROUP(RxBuf);
+
+static umqtt_Handle_t h = NULL;
+static void *instBuf = NULL;
+#define SIZE_INSTBUF UMQTT_INSTANCE_SIZE
+static uint8_t *pktBuf = NULL;
+#define SIZE_PKTBUF 1024
+static uint8_t rxBuf[64];
+static umqtt_TransportConfig_t rxTransport;
+
+static umqtt_Handle_t Publish_h;
+static const char *Publish_pTopic;
+static uint16_t Publish_topicLen;
+static const uint8_t *Publish_pMsg;
+static uint16_t Publish_msgLen;
+static void Publish_Reset(void)
+{   Publish_h = NULL; Publish_pTopic = NULL; Publish_topicLen = 0; Publish_pMsg = NULL; Publish_msgLen = 0; }
+static void
+PublishCb(umqtt_Handle_t h, void *pUser, bool dup, bool retain, uint8_t qos,
+          const char *pTopic, uint16_t topicLen, const uint8_t *pMsg, uint16_t msgLen)
+{   (void)pUser; (void)dup; (void)retain; (void)qos;
+    Publish_h = h; Publish_pTopic = pTopic; Publish_topicLen = topicLen; Publish_pMsg = pMsg; Publish_msgLen = msgLen; }
+
+static umqtt_Handle_t Suback_h;
+static const uint8_t *Suback_pRetCodes;
+static uint16_t Suback_retCount;
+static uint16_t Suback_msgId;
+static void Suback_Reset(void)
+{ Suback_h = NULL; Suback_pRetCodes = NULL; Suback_retCount = 0; Suback_msgId = 0; }
+static void
+SubackCb(umqtt_Handle_t h, void *pUser, const uint8_t *pRetCodes, uint16_t retCount, uint16_t msgId)
+{   (void)pUser; Suback_h = h; Suback_pRetCodes = pRetCodes; Suback_retCount = retCount; Suback_msgId = msgId; }
+
+static umqtt_Handle_t Pingresp_h;
+static unsigned int Pingresp_count;
+static void Pingresp_Reset(void) { Pingresp_h = NULL; Pingresp_count = 0; }
+static void
+PingrespCb(umqtt_Handle_t h, void *pUser)
+{   (void)pUser; Pingresp_h = h; ++Pingresp_count; }
+
+static umqtt_Callbacks_t callbacks =
+{
+    NULL, PublishCb, NULL, SubackCb, NULL, PingrespCb
+};
+
+TEST_SETUP(RxBuf)
+{
+    // set up a transport that reads into a caller provided buffer
+    rxTransport = transportConfig;
+    rxTransport.pfnNetReadInto = mock_NetReadInto;
+    rxTransport.pRxBuf = rxBuf;
+    rxTransport.rxBufLen = sizeof(rxBuf);
+    // allocate memory for the instance that will be created
+    // init the instance so it will be ready for all tests
+    mock_malloc_Reset();
+    instBuf = malloc(SIZE_INSTBUF);
+    mock_hNet = &mock_hNet;
+    rxTransport.hNet = mock_hNet;
+    mock_malloc_shouldReturn[0] = instBuf;
+    h = umqtt_New(&rxTransport, &callbacks, NULL);
+    TEST_ASSERT_NOT_NULL(h);
+    // clear all mocks
+    mock_malloc_Reset();
+    mock_free_Reset();
+    mock_NetRead_Reset();
+    mock_NetReadInto_Reset();
+    mock_NetWrite_Reset();
+    Publish_Reset();
+    Suback_Reset();
+    Pingresp_Reset();
+    // ready a buffer that can be used for staging incoming data
+    pktBuf = malloc(SIZE_PKTBUF);
+    TEST_ASSERT_NOT_NULL(pktBuf);
+    memset(rxBuf, 0, sizeof(rxBuf));
+    // fake an existing connection, and long keep alive so that
+    // ping packets do not interfere
+    wrap_setConnected(h, true);
+    wrap_setKeepAlive(h, 1000);
+}
+
+TEST_TEAR_DOWN(RxBuf)
+{
+    if (instBuf) { free(instBuf); instBuf = NULL; }
+    if (pktBuf) { free(pktBuf); pktBuf = NULL; }
+    h = NULL;
+}
+
+// whole packets are read and decoded without allocating anything
+TEST(RxBuf, NoAllocation)
+{
+    umqtt_Error_t err;
+    static const uint8_t chunk[] =
+    {
+        13 << 4, 0, // pingresp
+        9 << 4, 3, 0x12, 0x34, 1, // suback
+    };
+    memcpy(pktBuf, chunk, sizeof(chunk));
+    mock_NetRead_AddChunk(pktBuf, sizeof(chunk));
+
+    err = umqtt_Run(h, 1000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    // read into function used instead of read packet
+    TEST_ASSERT_FALSE(mock_NetRead_wasCalled);
+    TEST_ASSERT_TRUE(mock_NetReadInto_wasCalled);
+    TEST_ASSERT_EQUAL_PTR(mock_hNet, mock_NetReadInto_in_hNet);
+    TEST_ASSERT_EQUAL_PTR(rxBuf, mock_NetReadInto_in_pBuf);
+    TEST_ASSERT_EQUAL(sizeof(rxBuf), mock_NetReadInto_in_len);
+    // both packets decoded
+    TEST_ASSERT_EQUAL_PTR(instBuf, Pingresp_h);
+    TEST_ASSERT_EQUAL_PTR(instBuf, Suback_h);
+    TEST_ASSERT_EQUAL(0x1234, Suback_msgId);
+    // nothing allocated or freed
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+    TEST_ASSERT_FALSE(mock_free_wasCalled);
+}
+
+// partial packet stays in the buffer and the next read appends to it
+TEST(RxBuf, SplitPacket)
+{
+    umqtt_Error_t err;
+    static const uint8_t part1[] = { 9 << 4, 3, 0x12 }; // suback start
+    static const uint8_t part2[] = { 0x34, 1 }; // rest of suback
+    memcpy(&pktBuf[0], part1, sizeof(part1));
+    memcpy(&pktBuf[100], part2, sizeof(part2));
+    mock_NetRead_AddChunk(&pktBuf[0], sizeof(part1));
+    mock_NetRead_AddChunk(&pktBuf[100], sizeof(part2));
+
+    err = umqtt_Run(h, 1000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_NULL(Suback_h);
+
+    err = umqtt_Run(h, 1100);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    // second read goes right after the partial packet
+    TEST_ASSERT_EQUAL_PTR(&rxBuf[3], mock_NetReadInto_in_pBuf);
+    TEST_ASSERT_EQUAL(sizeof(rxBuf) - 3, mock_NetReadInto_in_len);
+    // packet decoded in place
+    TEST_ASSERT_EQUAL_PTR(instBuf, Suback_h);
+    TEST_ASSERT_EQUAL(0x1234, Suback_msgId);
+    TEST_ASSERT_EQUAL(1, Suback_retCount);
+    TEST_ASSERT_EQUAL_PTR(&rxBuf[4], Suback_pRetCodes);
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+    TEST_ASSERT_FALSE(mock_free_wasCalled);
+}
+
+// partial packet that follows whole packets is moved to the start
+// of the buffer so that the buffer is not used up
+TEST(RxBuf, PartialMovedToFront)
+{
+    umqtt_Error_t err;
+    static const uint8_t part1[] =
+    {
+        13 << 4, 0, // pingresp
+        9 << 4, 3, 0x12, // suback start
+    };
+    static const uint8_t part2[] = { 0x34, 1 }; // rest of suback
+    memcpy(&pktBuf[0], part1, sizeof(part1));
+    memcpy(&pktBuf[100], part2, sizeof(part2));
+    mock_NetRead_AddChunk(&pktBuf[0], sizeof(part1));
+    mock_NetRead_AddChunk(&pktBuf[100], sizeof(part2));
+
+    err = umqtt_Run(h, 1000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL_PTR(instBuf, Pingresp_h);
+    TEST_ASSERT_NULL(Suback_h);
+    TEST_ASSERT_EQUAL_MEMORY(&part1[2], rxBuf, 3);
+
+    err = umqtt_Run(h, 1100);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL_PTR(&rxBuf[3], mock_NetReadInto_in_pBuf);
+    TEST_ASSERT_EQUAL_PTR(instBuf, Suback_h);
+    TEST_ASSERT_EQUAL(0x1234, Suback_msgId);
+}
+
+// more incoming data than fits in the buffer
+// remainder is read on the next run
+TEST(RxBuf, MoreThanBuffer)
+{
+    umqtt_Error_t err;
+    // 50 pingresp packets, 100 bytes
+    for (unsigned int i = 0; i < 100; i += 2)
+    {
+        pktBuf[i] = 13 << 4;
+        pktBuf[i + 1] = 0;
+    }
+    mock_NetRead_AddChunk(pktBuf, 100);
+
+    err = umqtt_Run(h, 1000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(sizeof(rxBuf) / 2, Pingresp_count);
+
+    err = umqtt_Run(h, 1100);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(50, Pingresp_count);
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+    TEST_ASSERT_FALSE(mock_free_wasCalled);
+}
+
+// packet that can never fit in the buffer
+TEST(RxBuf, PacketTooBig)
+{
+    umqtt_Error_t err;
+    pktBuf[0] = 3 << 4; // publish
+    pktBuf[1] = 100; // remaining length bigger than rx buffer
+    pktBuf[2] = 0;
+    pktBuf[3] = 5;
+    memcpy(&pktBuf[4], "topic", 5);
+    mock_NetRead_AddChunk(pktBuf, 20);
+
+    err = umqtt_Run(h, 1000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_BUFSIZE, err);
+    TEST_ASSERT_NULL(Publish_h);
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+}
+
+// publish topic and message point into the receive buffer
+TEST(RxBuf, PublishInPlace)
+{
+    umqtt_Error_t err;
+    static const uint8_t pubPkt[] =
+    {
+        0x30, 14,
+        0, 5, 't', 'o', 'p', 'i', 'c',
+        'm', 'e', 's', 's', 'a', 'g', 'e',
+    };
+    memcpy(pktBuf, pubPkt, sizeof(pubPkt));
+    mock_NetRead_AddChunk(pktBuf, sizeof(pubPkt));
+
+    err = umqtt_Run(h, 1000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL_PTR(instBuf, Publish_h);
+    TEST_ASSERT_EQUAL_PTR(&rxBuf[4], Publish_pTopic);
+    TEST_ASSERT_EQUAL(5, Publish_topicLen);
+    TEST_ASSERT_EQUAL_PTR(&rxBuf[9], Publish_pMsg);
+    TEST_ASSERT_EQUAL(7, Publish_msgLen);
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+    TEST_ASSERT_FALSE(mock_free_wasCalled);
+}
+
+TEST_GROUP_RUNNER(RxBuf)
+{
+    RUN_TEST_CASE(RxBuf, NoAllocation);
+    RUN_TEST_CASE(RxBuf, SplitPacket);
+    RUN_TEST_CASE(RxBuf, PartialMovedToFront);
+    RUN_TEST_CASE(RxBuf, MoreThanBuffer);
+    RUN_TEST_CASE(RxBuf, PacketTooBig);
+    RUN_TEST_CASE(RxBuf, PublishInPlace);
+}
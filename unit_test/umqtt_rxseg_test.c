@@ -0,0 +1,230 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "unity_fixture.h"
+#include "umqtt/umqtt.h"
+#include "umqtt_mocks.h"
+#include "umqtt_wrapper.h"
+
+/*
+receive segment test cases
+
+These use the transport "read segment" function where the transport
+lends umqtt its own receive buffers (for example lwip pbufs) and umqtt
+hands them back with the release function when it is done.
+
+-packet decoded in place, segment released after callback returns
+-consecutive segments of a chain
+-packet that spans two segments
+-segment released when there is a decode error
+ */
+
+TEST_GROUP(RxSeg);
+
+static umqtt_Handle_t h = NULL;
+static void *instBuf = NULL;
+#define SIZE_INSTBUF UMQTT_INSTANCE_SIZE
+static uint8_t *pktBuf = NULL;
+#define SIZE_PKTBUF 1024
+static umqtt_TransportConfig_t segTransport;
+
+static umqtt_Handle_t Publish_h;
+static const char *Publish_pTopic;
+static uint16_t Publish_topicLen;
+static const uint8_t *Publish_pMsg;
+static uint16_t Publish_msgLen;
+static unsigned int Publish_releaseCount; // release count when cb was called
+static void Publish_Reset(void)
+{   Publish_h = NULL; Publish_pTopic = NULL; Publish_topicLen = 0;
+    Publish_pMsg = NULL; Publish_msgLen = 0; Publish_releaseCount = 0; }
+static void
+PublishCb(umqtt_Handle_t h, void *pUser, bool dup, bool retain, uint8_t qos,
+          const char *pTopic, uint16_t topicLen, const uint8_t *pMsg, uint16_t msgLen)
+{   (void)pUser; (void)dup; (void)retain; (void)qos;
+    Publish_h = h; Publish_pTopic = pTopic; Publish_topicLen = topicLen; Publish_pMsg = pMsg; Publish_msgLen = msgLen;
+    Publish_releaseCount = mock_NetReleaseSegment_count; }
+
+static umqtt_Handle_t Suback_h;
+static uint16_t Suback_msgId;
+static void Suback_Reset(void) { Suback_h = NULL; Suback_msgId = 0; }
+static void
+SubackCb(umqtt_Handle_t h, void *pUser, const uint8_t *pRetCodes, uint16_t retCount, uint16_t msgId)
+{   (void)pUser; (void)pRetCodes; (void)retCount; Suback_h = h; Suback_msgId = msgId; }
+
+static umqtt_Handle_t Pingresp_h;
+static void Pingresp_Reset(void) { Pingresp_h = NULL; }
+static void
+PingrespCb(umqtt_Handle_t h, void *pUser)
+{   (void)pUser; Pingresp_h = h; }
+
+static umqtt_Callbacks_t callbacks =
+{
+    NULL, PublishCb, NULL, SubackCb, NULL, PingrespCb
+};
+
+static const uint8_t pubPkt[] =
+{
+    0x30, 14,
+    0, 5, 't', 'o', 'p', 'i', 'c',
+    'm', 'e', 's', 's', 'a', 'g', 'e',
+};
+
+TEST_SETUP(RxSeg)
+{
+    // set up a transport that lends its buffers to umqtt
+    segTransport = transportConfig;
+    segTransport.pfnNetReadSegment = mock_NetReadSegment;
+    segTransport.pfnNetReleaseSegment = mock_NetReleaseSegment;
+    // allocate memory for the instance that will be created
+    // init the instance so it will be ready for all tests
+    mock_malloc_Reset();
+    instBuf = malloc(SIZE_INSTBUF);
+    mock_hNet = &mock_hNet;
+    segTransport.hNet = mock_hNet;
+    mock_malloc_shouldReturn[0] = instBuf;
+    h = umqtt_New(&segTransport, &callbacks, NULL);
+    TEST_ASSERT_NOT_NULL(h);
+    // clear all mocks
+    mock_malloc_Reset();
+    mock_free_Reset();
+    mock_NetRead_Reset();
+    mock_NetReadSegment_Reset();
+    mock_NetReleaseSegment_Reset();
+    mock_NetWrite_Reset();
+    Publish_Reset();
+    Suback_Reset();
+    Pingresp_Reset();
+    // ready a buffer that can be used for staging incoming data
+    pktBuf = malloc(SIZE_PKTBUF);
+    TEST_ASSERT_NOT_NULL(pktBuf);
+    // fake an existing connection, and long keep alive so that
+    // ping packets do not interfere
+    wrap_setConnected(h, true);
+    wrap_setKeepAlive(h, 1000);
+}
+
+TEST_TEAR_DOWN(RxSeg)
+{
+    if (instBuf) { free(instBuf); instBuf = NULL; }
+    if (pktBuf) { free(pktBuf); pktBuf = NULL; }
+    h = NULL;
+}
+
+// publish is decoded straight out of the transport segment
+// and the segment is not released until the callback returns
+TEST(RxSeg, InPlace)
+{
+    umqtt_Error_t err;
+    memcpy(pktBuf, pubPkt, sizeof(pubPkt));
+    mock_NetRead_AddChunk(pktBuf, sizeof(pubPkt));
+
+    err = umqtt_Run(h, 1000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_FALSE(mock_NetRead_wasCalled);
+    TEST_ASSERT_TRUE(mock_NetReadSegment_wasCalled);
+    TEST_ASSERT_EQUAL_PTR(mock_hNet, mock_NetReadSegment_in_hNet);
+
+    // topic and message point into the segment
+    TEST_ASSERT_EQUAL_PTR(instBuf, Publish_h);
+    TEST_ASSERT_EQUAL_PTR(&pktBuf[4], Publish_pTopic);
+    TEST_ASSERT_EQUAL(5, Publish_topicLen);
+    TEST_ASSERT_EQUAL_PTR(&pktBuf[9], Publish_pMsg);
+    TEST_ASSERT_EQUAL(7, Publish_msgLen);
+
+    // segment was still held while the callback ran
+    // and was released afterwards
+    TEST_ASSERT_EQUAL(0, Publish_releaseCount);
+    TEST_ASSERT_EQUAL(1, mock_NetReleaseSegment_count);
+    TEST_ASSERT_EQUAL_PTR(mock_hNet, mock_NetReleaseSegment_in_hNet);
+    TEST_ASSERT_EQUAL_PTR(pktBuf, mock_NetReleaseSegment_in_pSeg);
+
+    // no copy was needed
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+    TEST_ASSERT_FALSE(mock_free_wasCalled);
+}
+
+// each segment in a chain holds whole packets
+TEST(RxSeg, Chain)
+{
+    umqtt_Error_t err;
+    static const uint8_t seg1[] = { 13 << 4, 0 }; // pingresp
+    static const uint8_t seg2[] = { 9 << 4, 3, 0x12, 0x34, 1 }; // suback
+    memcpy(&pktBuf[0], seg1, sizeof(seg1));
+    memcpy(&pktBuf[100], seg2, sizeof(seg2));
+    mock_NetRead_AddChunk(&pktBuf[0], sizeof(seg1));
+    mock_NetRead_AddChunk(&pktBuf[100], sizeof(seg2));
+
+    err = umqtt_Run(h, 1000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL_PTR(instBuf, Pingresp_h);
+    TEST_ASSERT_EQUAL(1, mock_NetReleaseSegment_count);
+    TEST_ASSERT_EQUAL_PTR(&pktBuf[0], mock_NetReleaseSegment_in_pSeg);
+
+    err = umqtt_Run(h, 1100);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL_PTR(instBuf, Suback_h);
+    TEST_ASSERT_EQUAL(0x1234, Suback_msgId);
+    TEST_ASSERT_EQUAL(2, mock_NetReleaseSegment_count);
+    TEST_ASSERT_EQUAL_PTR(&pktBuf[100], mock_NetReleaseSegment_in_pSeg);
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+}
+
+// packet spans a segment boundary, it must be copied so that the
+// callback gets contiguous topic and message
+TEST(RxSeg, SpanSegments)
+{
+    umqtt_Error_t err;
+    memcpy(&pktBuf[0], pubPkt, 6);
+    memcpy(&pktBuf[100], &pubPkt[6], sizeof(pubPkt) - 6);
+    mock_NetRead_AddChunk(&pktBuf[0], 6);
+    mock_NetRead_AddChunk(&pktBuf[100], sizeof(pubPkt) - 6);
+    mock_malloc_shouldReturn[0] = &pktBuf[500];
+
+    // first segment is released once its bytes are copied
+    err = umqtt_Run(h, 1000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_NULL(Publish_h);
+    TEST_ASSERT_EQUAL(1, mock_NetReleaseSegment_count);
+    TEST_ASSERT_EQUAL(1, mock_malloc_count);
+
+    // second segment completes the packet
+    err = umqtt_Run(h, 1100);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL_PTR(instBuf, Publish_h);
+    TEST_ASSERT_EQUAL_STRING_LEN("topic", Publish_pTopic, Publish_topicLen);
+    TEST_ASSERT_EQUAL_MEMORY("message", Publish_pMsg, 7);
+    TEST_ASSERT_EQUAL(7, Publish_msgLen);
+    TEST_ASSERT_EQUAL(1, Publish_releaseCount);
+    TEST_ASSERT_EQUAL(2, mock_NetReleaseSegment_count);
+    TEST_ASSERT_EQUAL_PTR(&pktBuf[100], mock_NetReleaseSegment_in_pSeg);
+    // reassembly buffer freed
+    TEST_ASSERT_TRUE(mock_free_wasCalled);
+    TEST_ASSERT_EQUAL_PTR(&pktBuf[500], mock_free_in_ptr);
+}
+
+// bad packet in a segment, segment must still be returned
+TEST(RxSeg, ReleaseOnError)
+{
+    umqtt_Error_t err;
+    pktBuf[0] = 15 << 4; // bogus packet type
+    pktBuf[1] = 2;
+    pktBuf[2] = 1;
+    pktBuf[3] = 2;
+    mock_NetRead_AddChunk(pktBuf, 4);
+
+    err = umqtt_Run(h, 1000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PACKET_ERROR, err);
+    TEST_ASSERT_EQUAL(1, mock_NetReleaseSegment_count);
+    TEST_ASSERT_EQUAL_PTR(pktBuf, mock_NetReleaseSegment_in_pSeg);
+}
+
+TEST_GROUP_RUNNER(RxSeg)
+{
+    RUN_TEST_CASE(RxSeg, InPlace);
+    RUN_TEST_CASE(RxSeg, Chain);
+    RUN_TEST_CASE(RxSeg, SpanSegments);
+    RUN_TEST_CASE(RxSeg, ReleaseOnError);
+}
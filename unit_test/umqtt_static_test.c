@@ -0,0 +1,288 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "unity_fixture.h"
+#include "umqtt/umqtt.h"
+#include "umqtt_mocks.h"
+#include "umqtt_wrapper.h"
+
+/*
+static arena test cases
+
+These create the instance with umqtt_NewStatic() where the caller
+provides one arena for the instance, the receive buffer and the
+packet pool.  No allocation is allowed after that.
+
+-null and bad parameters, arena too small
+-instance and receive buffer are in the arena
+-publish uses only the pool, never malloc
+-packet split across segments reassembled in the arena
+-packet ID index sized for the pool, in the arena
+-delete does not free anything
+ */
+
+TEST_GROUP(Static);
+
+static umqtt_Handle_t h = NULL;
+static uint8_t *pktBuf = NULL;
+#define SIZE_PKTBUF 1024
+static umqtt_TransportConfig_t staticTransport;
+
+static const umqtt_PoolClass_t poolClasses[] =
+{
+    { 32, 2 },
+    { 128, 1 },
+};
+#define RX_LEN 64
+#define POOL_BYTES (UMQTT_POOL_BYTES(32, 2) + UMQTT_POOL_BYTES(128, 1))
+#define SIZE_ARENA UMQTT_ARENA_SIZE(RX_LEN, POOL_BYTES)
+static uint64_t arena[(SIZE_ARENA + 7) / 8];
+#define ARENA_BASE ((uint8_t *)arena)
+
+static umqtt_Handle_t Publish_h;
+static const char *Publish_pTopic;
+static uint16_t Publish_topicLen;
+static void Publish_Reset(void)
+{ Publish_h = NULL; Publish_pTopic = NULL; Publish_topicLen = 0; }
+static void
+PublishCb(umqtt_Handle_t h, void *pUser, bool dup, bool retain, uint8_t qos,
+          const char *pTopic, uint16_t topicLen, const uint8_t *pMsg, uint16_t msgLen)
+{   (void)pUser; (void)dup; (void)retain; (void)qos; (void)pMsg; (void)msgLen;
+    Publish_h = h; Publish_pTopic = pTopic; Publish_topicLen = topicLen; }
+
+static umqtt_Callbacks_t callbacks =
+{
+    NULL, PublishCb, NULL, NULL, NULL, NULL
+};
+
+TEST_SETUP(Static)
+{
+    // transport reads into the arena receive buffer and uses the pool
+    // malloc and free are left in place to prove they are never used
+    staticTransport = transportConfig;
+    staticTransport.pfnNetReadInto = mock_NetReadInto;
+    staticTransport.pRxBuf = NULL;
+    staticTransport.rxBufLen = RX_LEN;
+    staticTransport.pPoolClasses = poolClasses;
+    staticTransport.numPoolClasses = 2;
+    mock_hNet = &mock_hNet;
+    staticTransport.hNet = mock_hNet;
+    // clear all mocks
+    mock_malloc_Reset();
+    mock_free_Reset();
+    mock_NetRead_Reset();
+    mock_NetReadInto_Reset();
+    mock_NetReadSegment_Reset();
+    mock_NetReleaseSegment_Reset();
+    mock_NetWrite_Reset();
+    Publish_Reset();
+    memset(arena, 0xA5, sizeof(arena));
+    h = NULL;
+    // ready a buffer that can be used for staging incoming data
+    pktBuf = malloc(SIZE_PKTBUF);
+    TEST_ASSERT_NOT_NULL(pktBuf);
+}
+
+TEST_TEAR_DOWN(Static)
+{
+    if (pktBuf) { free(pktBuf); pktBuf = NULL; }
+    h = NULL;
+}
+
+// public packet overhead used for sizing must match the library
+TEST(Static, PktBufSize)
+{
+    TEST_ASSERT_EQUAL(sizeof(PktBuf_t), UMQTT_PKTBUF_SIZE);
+}
+
+TEST(Static, NullParms)
+{
+    h = umqtt_NewStatic(NULL, SIZE_ARENA, &staticTransport, &callbacks, NULL);
+    TEST_ASSERT_NULL(h);
+    h = umqtt_NewStatic(arena, SIZE_ARENA, NULL, &callbacks, NULL);
+    TEST_ASSERT_NULL(h);
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+}
+
+// arena must hold instance, receive buffer and all pool blocks
+TEST(Static, ArenaTooSmall)
+{
+    h = umqtt_NewStatic(arena, SIZE_ARENA - 1, &staticTransport, &callbacks, NULL);
+    TEST_ASSERT_NULL(h);
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+}
+
+// config that would need allocation or is incomplete
+TEST(Static, BadConfig)
+{
+    uint8_t rxBuf[RX_LEN];
+    umqtt_TransportConfig_t badTransport;
+
+    // no receive buffer length
+    badTransport = staticTransport;
+    badTransport.rxBufLen = 0;
+    h = umqtt_NewStatic(arena, SIZE_ARENA, &badTransport, &callbacks, NULL);
+    TEST_ASSERT_NULL(h);
+
+    // receive buffer comes from the arena, not the caller
+    badTransport = staticTransport;
+    badTransport.pRxBuf = rxBuf;
+    h = umqtt_NewStatic(arena, SIZE_ARENA, &badTransport, &callbacks, NULL);
+    TEST_ASSERT_NULL(h);
+
+    // packet pool is required
+    badTransport = staticTransport;
+    badTransport.pPoolClasses = NULL;
+    badTransport.numPoolClasses = 0;
+    h = umqtt_NewStatic(arena, SIZE_ARENA, &badTransport, &callbacks, NULL);
+    TEST_ASSERT_NULL(h);
+
+    // packet read mode would need allocation
+    badTransport = staticTransport;
+    badTransport.pfnNetReadInto = NULL;
+    h = umqtt_NewStatic(arena, SIZE_ARENA, &badTransport, &callbacks, NULL);
+    TEST_ASSERT_NULL(h);
+
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+}
+
+// instance is at the start of the arena and reads go into the arena
+TEST(Static, Nominal)
+{
+    umqtt_Error_t err;
+    h = umqtt_NewStatic(arena, SIZE_ARENA, &staticTransport, &callbacks, NULL);
+    TEST_ASSERT_EQUAL_PTR(arena, h);
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+    err = umqtt_GetConnectedStatus(h);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_DISCONNECTED, err);
+
+    err = umqtt_Run(h, 1000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_TRUE(mock_NetReadInto_wasCalled);
+    TEST_ASSERT_TRUE(mock_NetReadInto_in_pBuf >= ARENA_BASE);
+    TEST_ASSERT_TRUE((mock_NetReadInto_in_pBuf + RX_LEN) <= (ARENA_BASE + SIZE_ARENA));
+    TEST_ASSERT_EQUAL(RX_LEN, mock_NetReadInto_in_len);
+}
+
+// publish packets come from the pool.  when it is used up the publish
+// fails instead of allocating
+TEST(Static, PublishNoAlloc)
+{
+    umqtt_Error_t err;
+    uint32_t fallbacks;
+    h = umqtt_NewStatic(arena, SIZE_ARENA, &staticTransport, &callbacks, NULL);
+    TEST_ASSERT_NOT_NULL(h);
+    wrap_setConnected(h, true);
+
+    // lazy way to get required packet length
+    err = umqtt_Publish(h, "topic", (const uint8_t *)"message", 7, 1, false, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_NETWORK, err);
+    mock_NetWrite_shouldReturn = mock_NetWrite_in_len;
+
+    // packet fits the small class which has two blocks
+    for (unsigned int idx = 0; idx < 2; idx++)
+    {
+        err = umqtt_Publish(h, "topic", (const uint8_t *)"message", 7, 1, false, NULL);
+        TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+        TEST_ASSERT_TRUE(mock_NetWrite_in_pBuf >= ARENA_BASE);
+        TEST_ASSERT_TRUE(mock_NetWrite_in_pBuf < (ARENA_BASE + SIZE_ARENA));
+    }
+
+    // small class is empty and there is no malloc fallback
+    err = umqtt_Publish(h, "topic", (const uint8_t *)"message", 7, 1, false, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_BUFSIZE, err);
+    err = umqtt_GetPoolFallbacks(h, &fallbacks);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1, fallbacks);
+
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+    TEST_ASSERT_FALSE(mock_free_wasCalled);
+}
+
+// in segment mode the arena receive buffer is used to reassemble a
+// packet that spans segments
+TEST(Static, SegmentReassembly)
+{
+    umqtt_Error_t err;
+    static const uint8_t pubPkt[] =
+    {
+        0x30, 14,
+        0, 5, 't', 'o', 'p', 'i', 'c',
+        'm', 'e', 's', 's', 'a', 'g', 'e',
+    };
+    staticTransport.pfnNetReadInto = NULL;
+    staticTransport.pfnNetReadSegment = mock_NetReadSegment;
+    staticTransport.pfnNetReleaseSegment = mock_NetReleaseSegment;
+    h = umqtt_NewStatic(arena, SIZE_ARENA, &staticTransport, &callbacks, NULL);
+    TEST_ASSERT_NOT_NULL(h);
+    wrap_setConnected(h, true);
+    wrap_setKeepAlive(h, 1000);
+
+    memcpy(&pktBuf[0], pubPkt, 6);
+    memcpy(&pktBuf[100], &pubPkt[6], sizeof(pubPkt) - 6);
+    mock_NetRead_AddChunk(&pktBuf[0], 6);
+    mock_NetRead_AddChunk(&pktBuf[100], sizeof(pubPkt) - 6);
+    err = umqtt_Run(h, 1000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    err = umqtt_Run(h, 1100);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+
+    // topic was delivered out of the arena
+    TEST_ASSERT_EQUAL_PTR(h, Publish_h);
+    TEST_ASSERT_TRUE((const uint8_t *)Publish_pTopic >= ARENA_BASE);
+    TEST_ASSERT_TRUE((const uint8_t *)Publish_pTopic < (ARENA_BASE + SIZE_ARENA));
+    TEST_ASSERT_EQUAL_STRING_LEN("topic", Publish_pTopic, Publish_topicLen);
+    TEST_ASSERT_EQUAL(2, mock_NetReleaseSegment_count);
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+    TEST_ASSERT_FALSE(mock_free_wasCalled);
+}
+
+// arena belongs to the caller
+TEST(Static, Delete)
+{
+    h = umqtt_NewStatic(arena, SIZE_ARENA, &staticTransport, &callbacks, NULL);
+    TEST_ASSERT_NOT_NULL(h);
+    umqtt_Delete(h);
+    TEST_ASSERT_FALSE(mock_free_wasCalled);
+}
+
+// ID index gets a bucket per pool block from the arena
+TEST(Static, IdIndexInArena)
+{
+    static const umqtt_PoolClass_t manyClasses[] = { { 16, 20 } };
+#define MANY_POOL_BYTES UMQTT_POOL_BYTES(16, 20)
+#define MANY_ARENA UMQTT_ARENA_SIZE(RX_LEN, MANY_POOL_BYTES)
+    static uint64_t manyArena[(MANY_ARENA + 7) / 8];
+    staticTransport.pPoolClasses = manyClasses;
+    staticTransport.numPoolClasses = 1;
+    h = umqtt_NewStatic(manyArena, MANY_ARENA, &staticTransport, &callbacks, NULL);
+    TEST_ASSERT_NOT_NULL(h);
+    wrap_setConnected(h, true);
+    TEST_ASSERT_EQUAL(32, wrap_getIdBuckets(h));
+
+    // publish until the pool is empty, the index never allocates
+    mock_NetWrite_shouldReturn = 10;
+    for (unsigned int idx = 0; idx < 20; idx++)
+    {
+        umqtt_Error_t err = umqtt_Publish(h, "t", (const uint8_t *)"msg", 3, 1, false, NULL);
+        TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    }
+    TEST_ASSERT_EQUAL(32, wrap_getIdBuckets(h));
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+}
+
+TEST_GROUP_RUNNER(Static)
+{
+    RUN_TEST_CASE(Static, PktBufSize);
+    RUN_TEST_CASE(Static, NullParms);
+    RUN_TEST_CASE(Static, ArenaTooSmall);
+    RUN_TEST_CASE(Static, BadConfig);
+    RUN_TEST_CASE(Static, Nominal);
+    RUN_TEST_CASE(Static, PublishNoAlloc);
+    RUN_TEST_CASE(Static, SegmentReassembly);
+    RUN_TEST_CASE(Static, IdIndexInArena);
+    RUN_TEST_CASE(Static, Delete);
+}
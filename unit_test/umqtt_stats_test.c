@@ -0,0 +1,239 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "unity_fixture.h"
+#include "umqtt/umqtt.h"
+#include "umqtt_mocks.h"
+#include "umqtt_wrapper.h"
+
+/*
+statistics counter test cases
+
+The counters only exist when umqtt is built with UMQTT_ENABLE_STATS,
+which the unit test Makefile defines.
+
+-null parameters
+-all zero after init
+-sent packets and bytes by type
+-received packets and bytes by type
+-retries and expired packets
+-connack timeout
+-network write error and allocation failure
+ */
+
+#ifdef UMQTT_ENABLE_STATS
+
+TEST_GROUP(Stats);
+
+static umqtt_Handle_t h = NULL;
+static void *instBuf = NULL;
+#define SIZE_INSTBUF UMQTT_INSTANCE_SIZE
+static uint8_t *pktBuf = NULL;
+#define SIZE_PKTBUF 1024
+static umqtt_Stats_t stats;
+
+static umqtt_Callbacks_t callbacks =
+{
+    NULL, NULL, NULL, NULL, NULL, NULL
+};
+
+TEST_SETUP(Stats)
+{
+    // allocate memory for the instance that will be created
+    // init the instance so it will be ready for all tests
+    mock_malloc_Reset();
+    instBuf = malloc(SIZE_INSTBUF);
+    memset(instBuf, 0xA5, SIZE_INSTBUF); // make sure counters are cleared
+    mock_hNet = &mock_hNet;
+    transportConfig.hNet = mock_hNet;
+    mock_malloc_shouldReturn[0] = instBuf;
+    h = umqtt_New(&transportConfig, &callbacks, NULL);
+    TEST_ASSERT_NOT_NULL(h);
+    // clear all mocks
+    mock_malloc_Reset();
+    mock_free_Reset();
+    mock_NetRead_Reset();
+    mock_NetWrite_Reset();
+    // ready a buffer that can be used for packet allocation
+    pktBuf = malloc(SIZE_PKTBUF);
+    TEST_ASSERT_NOT_NULL(pktBuf);
+    memset(&stats, 0xA5, sizeof(stats));
+}
+
+TEST_TEAR_DOWN(Stats)
+{
+    if (instBuf) { free(instBuf); instBuf = NULL; }
+    if (pktBuf) { free(pktBuf); pktBuf = NULL; }
+    h = NULL;
+}
+
+static void
+GetStats(void)
+{
+    umqtt_Error_t err = umqtt_GetStats(h, &stats);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+}
+
+TEST(Stats, NullParms)
+{
+    umqtt_Error_t err;
+    err = umqtt_GetStats(NULL, &stats);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+    err = umqtt_GetStats(h, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+}
+
+TEST(Stats, Init)
+{
+    umqtt_Stats_t zero;
+    memset(&zero, 0, sizeof(zero));
+    GetStats();
+    TEST_ASSERT_EQUAL_MEMORY(&zero, &stats, sizeof(stats));
+}
+
+// counts are per packet type, and the snapshot does not change
+// when more packets are sent
+TEST(Stats, Sent)
+{
+    umqtt_Error_t err;
+    wrap_setConnected(h, true);
+    mock_NetWrite_shouldReturn = 9;
+    mock_malloc_shouldReturn[0] = pktBuf;
+    err = umqtt_Publish(h, "topic", NULL, 0, 0, false, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    GetStats();
+    TEST_ASSERT_EQUAL(1, stats.pktsSent[3]);
+    TEST_ASSERT_EQUAL(9, stats.bytesSent);
+
+    // ping is sent by run
+    umqtt_Stats_t snapshot = stats;
+    wrap_setKeepAlive(h, 30);
+    mock_NetWrite_shouldReturn = 2;
+    err = umqtt_Run(h, 20000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(0, snapshot.pktsSent[12]);
+    TEST_ASSERT_EQUAL(9, snapshot.bytesSent);
+    GetStats();
+    TEST_ASSERT_EQUAL(1, stats.pktsSent[3]);
+    TEST_ASSERT_EQUAL(1, stats.pktsSent[12]);
+    TEST_ASSERT_EQUAL(11, stats.bytesSent);
+    TEST_ASSERT_EQUAL(0, stats.writeErrors);
+}
+
+TEST(Stats, Received)
+{
+    umqtt_Error_t err;
+    static const uint8_t rxPkts[] =
+    {
+        13 << 4, 0, // pingresp
+        0x30, 7, 0, 5, 't', 'o', 'p', 'i', 'c', // publish
+        13 << 4, 0, // pingresp
+    };
+    wrap_setConnected(h, true);
+    wrap_setKeepAlive(h, 1000);
+    memcpy(pktBuf, rxPkts, sizeof(rxPkts));
+    mock_NetRead_AddChunk(pktBuf, sizeof(rxPkts));
+    err = umqtt_Run(h, 1000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    GetStats();
+    TEST_ASSERT_EQUAL(2, stats.pktsRcvd[13]);
+    TEST_ASSERT_EQUAL(1, stats.pktsRcvd[3]);
+    TEST_ASSERT_EQUAL(sizeof(rxPkts), stats.bytesRcvd);
+    TEST_ASSERT_EQUAL(0, stats.bytesSent);
+}
+
+// qos 1 publish that is never acked is retried and then expires
+TEST(Stats, RetryExpire)
+{
+    umqtt_Error_t err;
+    wrap_setConnected(h, true);
+    wrap_setKeepAlive(h, 1000);
+
+    // lazy way to get required packet length
+    mock_malloc_shouldReturn[0] = pktBuf;
+    err = umqtt_Publish(h, "topic", (uint8_t *)"message", 7, 1, false, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_NETWORK, err);
+    int len = mock_NetWrite_in_len;
+    mock_malloc_Reset();
+    mock_malloc_shouldReturn[0] = pktBuf;
+    mock_NetWrite_shouldReturn = len;
+    err = umqtt_Publish(h, "topic", (uint8_t *)"message", 7, 1, false, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+
+    // go through all the retries until it gives up
+    uint32_t ticks;
+    for (ticks = 5000; ticks <= 50000; ticks += 5000)
+    {
+        err = umqtt_Run(h, ticks);
+        TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    }
+    err = umqtt_Run(h, ticks);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_TIMEOUT, err);
+
+    GetStats();
+    TEST_ASSERT_EQUAL(10, stats.retries);
+    TEST_ASSERT_EQUAL(1, stats.expired);
+    // writeErrors 1 is the first failed publish
+    TEST_ASSERT_EQUAL(1, stats.writeErrors);
+    // pktsSent[3] 11 is the second publish plus 10 retries
+    TEST_ASSERT_EQUAL(11, stats.pktsSent[3]);
+    TEST_ASSERT_EQUAL(11 * len, stats.bytesSent);
+}
+
+TEST(Stats, ConnackTimeout)
+{
+    umqtt_Error_t err;
+    mock_malloc_shouldReturn[0] = pktBuf;
+    mock_malloc_shouldReturn[1] = &pktBuf[600];
+    err = umqtt_Connect(h, false, false, 0, 30, "testClient", NULL, NULL, 0, NULL, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_NETWORK, err);
+    mock_NetWrite_shouldReturn = mock_NetWrite_in_len;
+    mock_malloc_Reset();
+    mock_malloc_shouldReturn[0] = pktBuf;
+    mock_malloc_shouldReturn[1] = &pktBuf[600];
+    err = umqtt_Connect(h, false, false, 0, 30, "testClient", NULL, NULL, 0, NULL, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+
+    err = umqtt_Run(h, 5001);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_TIMEOUT, err);
+    GetStats();
+    TEST_ASSERT_EQUAL(1, stats.connackTimeouts);
+    TEST_ASSERT_EQUAL(1, stats.pktsSent[1]);
+    TEST_ASSERT_EQUAL(0, stats.expired);
+}
+
+TEST(Stats, Failures)
+{
+    umqtt_Error_t err;
+    wrap_setConnected(h, true);
+
+    // malloc fails
+    err = umqtt_Publish(h, "topic", NULL, 0, 0, false, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_BUFSIZE, err);
+    // network write fails
+    mock_malloc_shouldReturn[1] = pktBuf;
+    err = umqtt_Publish(h, "topic", NULL, 0, 0, false, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_NETWORK, err);
+
+    GetStats();
+    TEST_ASSERT_EQUAL(1, stats.allocFails);
+    TEST_ASSERT_EQUAL(1, stats.writeErrors);
+    TEST_ASSERT_EQUAL(0, stats.pktsSent[3]);
+    TEST_ASSERT_EQUAL(0, stats.bytesSent);
+}
+
+TEST_GROUP_RUNNER(Stats)
+{
+    RUN_TEST_CASE(Stats, NullParms);
+    RUN_TEST_CASE(Stats, Init);
+    RUN_TEST_CASE(Stats, Sent);
+    RUN_TEST_CASE(Stats, Received);
+    RUN_TEST_CASE(Stats, RetryExpire);
+    RUN_TEST_CASE(Stats, ConnackTimeout);
+    RUN_TEST_CASE(Stats, Failures);
+}
+
+#endif
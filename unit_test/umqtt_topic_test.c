@@ -0,0 +1,286 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "unity_fixture.h"
+#include "umqtt/umqtt.h"
+#include "umqtt_mocks.h"
+#include "umqtt_wrapper.h"
+
+/*
+topic handle test cases
+
+umqtt_NewTopic() allocates a handle holding the topic already encoded
+with its length prefix, and umqtt_PublishTopic() copies those bytes
+into the packet as they are, or with pfnNetWritev writes them as their
+own segment.  The packets must be the same as the ones made by
+umqtt_Publish() for the same topic.
+
+-null and bad parameters
+-allocation fails
+-handle is allocated and freed by the instance
+-qos 0 publish
+-qos 1 publish has packet ID and is queued
+-retain flag
+-same packet as umqtt_Publish
+-one handle used for many publishes
+-qos 0 with writev uses the handle as the topic segment
+ */
+
+TEST_GROUP(Topic);
+
+static umqtt_Handle_t h = NULL;
+static void *instBuf = NULL;
+#define SIZE_INSTBUF UMQTT_INSTANCE_SIZE
+static uint8_t *pktBuf = NULL;
+#define SIZE_PKTBUF 1024
+static uint8_t topicBuf[64];
+static uint8_t txCopy[64];
+
+static const uint8_t publishPacket0[] =
+{
+    0x30, 14, // fixed header
+    0, 5, 't','o','p','i','c',
+    'm','e','s','s','a','g','e',
+};
+
+static umqtt_Callbacks_t callbacks =
+{
+    NULL, NULL, NULL, NULL, NULL, NULL
+};
+
+TEST_SETUP(Topic)
+{
+    // allocate memory for the instance that will be created
+    // init the instance so it will be ready for all tests
+    mock_malloc_Reset();
+    instBuf = malloc(SIZE_INSTBUF);
+    mock_hNet = &mock_hNet;
+    transportConfig.hNet = mock_hNet;
+    mock_malloc_shouldReturn[0] = instBuf;
+    h = umqtt_New(&transportConfig, &callbacks, NULL);
+    TEST_ASSERT_NOT_NULL(h);
+    // clear all mocks
+    mock_malloc_Reset();
+    mock_free_Reset();
+    mock_NetRead_Reset();
+    mock_NetWrite_Reset();
+    // ready a buffer that can be used for packet allocation
+    pktBuf = malloc(SIZE_PKTBUF);
+    TEST_ASSERT_NOT_NULL(pktBuf);
+    // fake an existing connection, and long keep alive so that
+    // ping packets do not interfere
+    wrap_setConnected(h, true);
+    wrap_setKeepAlive(h, 1000);
+}
+
+TEST_TEAR_DOWN(Topic)
+{
+    if (instBuf) { free(instBuf); instBuf = NULL; }
+    if (pktBuf) { free(pktBuf); pktBuf = NULL; }
+    h = NULL;
+}
+
+static umqtt_TopicHandle_t
+NewTopic(const char *pTopic)
+{
+    mock_malloc_Reset();
+    memset(topicBuf, 0, sizeof(topicBuf));
+    mock_malloc_shouldReturn[0] = topicBuf;
+    umqtt_TopicHandle_t hTopic = umqtt_NewTopic(h, pTopic);
+    TEST_ASSERT_EQUAL_PTR(topicBuf, hTopic);
+    TEST_ASSERT_TRUE(mock_malloc_in_size <= sizeof(topicBuf));
+    return hTopic;
+}
+
+// publish "message" with the topic handle, and copy what is written
+static umqtt_Error_t
+Publish(umqtt_TopicHandle_t hTopic, uint8_t qos, bool retain, uint16_t *pId, int writeReturn)
+{
+    mock_malloc_Reset();
+    mock_free_Reset();
+    mock_NetWrite_Reset();
+    memset(txCopy, 0, sizeof(txCopy));
+    mock_malloc_shouldReturn[0] = pktBuf;
+    mock_NetWrite_shouldReturn = writeReturn;
+    mock_NetWrite_pCopy = txCopy;
+    mock_NetWrite_copyLen = writeReturn;
+    return umqtt_PublishTopic(h, hTopic, (const uint8_t *)"message", 7, qos, retain, pId);
+}
+
+TEST(Topic, NullParms)
+{
+    umqtt_Error_t err;
+    TEST_ASSERT_NULL(umqtt_NewTopic(NULL, "topic"));
+    TEST_ASSERT_NULL(umqtt_NewTopic(h, NULL));
+    // empty topic is not allowed for publish
+    TEST_ASSERT_NULL(umqtt_NewTopic(h, ""));
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+
+    umqtt_TopicHandle_t hTopic = NewTopic("topic");
+    err = umqtt_PublishTopic(NULL, hTopic, (const uint8_t *)"message", 7, 0, false, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+    err = umqtt_PublishTopic(h, NULL, (const uint8_t *)"message", 7, 0, false, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+    // bad qos
+    err = Publish(hTopic, 3, false, NULL, 16);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+    // deleting null handle is harmless
+    umqtt_DeleteTopic(h, NULL);
+    TEST_ASSERT_FALSE(mock_free_wasCalled);
+}
+
+TEST(Topic, AllocFail)
+{
+    mock_malloc_Reset();
+    mock_malloc_shouldReturn[0] = NULL;
+    TEST_ASSERT_NULL(umqtt_NewTopic(h, "topic"));
+    TEST_ASSERT_EQUAL(1, mock_malloc_count);
+}
+
+TEST(Topic, NewDelete)
+{
+    umqtt_TopicHandle_t hTopic = NewTopic("topic");
+    // encoded topic and its length prefix are in the handle
+    TEST_ASSERT_TRUE(mock_malloc_in_size >= 7);
+    mock_free_Reset();
+    umqtt_DeleteTopic(h, hTopic);
+    TEST_ASSERT_TRUE(mock_free_wasCalled);
+    TEST_ASSERT_EQUAL_PTR(topicBuf, mock_free_in_ptr);
+}
+
+TEST(Topic, Qos0)
+{
+    umqtt_Error_t err;
+    umqtt_TopicHandle_t hTopic = NewTopic("topic");
+    err = Publish(hTopic, 0, false, NULL, sizeof(publishPacket0));
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(1, mock_NetWrite_count);
+    TEST_ASSERT_EQUAL(sizeof(publishPacket0), mock_NetWrite_in_len);
+    TEST_ASSERT_EQUAL_MEMORY(publishPacket0, txCopy, sizeof(publishPacket0));
+    // qos 0 packet is not kept
+    TEST_ASSERT_TRUE(mock_free_wasCalled);
+    TEST_ASSERT_EQUAL_PTR(pktBuf, mock_free_in_ptr);
+}
+
+TEST(Topic, Qos1)
+{
+    umqtt_Error_t err;
+    uint16_t msgId = 0;
+    umqtt_TopicHandle_t hTopic = NewTopic("topic");
+    err = Publish(hTopic, 1, false, &msgId, 18);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_NOT_EQUAL(0, msgId);
+    TEST_ASSERT_EQUAL(18, mock_NetWrite_in_len);
+    TEST_ASSERT_EQUAL(0x32, txCopy[0]);
+    TEST_ASSERT_EQUAL(16, txCopy[1]);
+    TEST_ASSERT_EQUAL_MEMORY(&publishPacket0[2], &txCopy[2], 7);
+    TEST_ASSERT_EQUAL(msgId >> 8, txCopy[9]);
+    TEST_ASSERT_EQUAL(msgId & 0xFF, txCopy[10]);
+    TEST_ASSERT_EQUAL_MEMORY("message", &txCopy[11], 7);
+    // kept for puback
+    TEST_ASSERT_FALSE(mock_free_wasCalled);
+    TEST_ASSERT_EQUAL_PTR(pktBuf, wrap_getNextPktBuf(h));
+}
+
+TEST(Topic, Retain)
+{
+    umqtt_Error_t err;
+    umqtt_TopicHandle_t hTopic = NewTopic("topic");
+    err = Publish(hTopic, 0, true, NULL, sizeof(publishPacket0));
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(0x31, txCopy[0]);
+    TEST_ASSERT_EQUAL_MEMORY(&publishPacket0[1], &txCopy[1], sizeof(publishPacket0) - 1);
+}
+
+TEST(Topic, SameAsPublish)
+{
+    umqtt_Error_t err;
+    uint8_t expected[64];
+    uint16_t msgId = 0;
+    uint16_t topicId = 0;
+    const char *pTopic = "a/longer/topic/name";
+
+    mock_malloc_Reset();
+    mock_NetWrite_Reset();
+    memset(expected, 0, sizeof(expected));
+    mock_malloc_shouldReturn[0] = pktBuf;
+    mock_NetWrite_shouldReturn = 32;
+    mock_NetWrite_pCopy = expected;
+    mock_NetWrite_copyLen = 32;
+    err = umqtt_Publish(h, pTopic, (const uint8_t *)"message", 7, 1, false, &msgId);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(32, mock_NetWrite_in_len);
+
+    umqtt_TopicHandle_t hTopic = NewTopic(pTopic);
+    wrap_setNextPacketId(h, msgId);
+    wrap_dequeuePacketById(h, msgId);
+    err = Publish(hTopic, 1, false, &topicId, 32);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(msgId, topicId);
+    TEST_ASSERT_EQUAL(32, mock_NetWrite_in_len);
+    TEST_ASSERT_EQUAL_MEMORY(expected, txCopy, 32);
+}
+
+TEST(Topic, Reuse)
+{
+    umqtt_Error_t err;
+    umqtt_TopicHandle_t hTopic = NewTopic("topic");
+    for (unsigned int idx = 0; idx < 3; idx++)
+    {
+        err = Publish(hTopic, 0, false, NULL, sizeof(publishPacket0));
+        TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+        TEST_ASSERT_EQUAL_MEMORY(publishPacket0, txCopy, sizeof(publishPacket0));
+        // topic is not allocated again
+        TEST_ASSERT_EQUAL(1, mock_malloc_count);
+    }
+}
+
+TEST(Topic, Writev)
+{
+    umqtt_Error_t err;
+    static umqtt_TransportConfig_t iovTransport;
+    uint8_t *iovInstBuf = malloc(SIZE_INSTBUF);
+    TEST_ASSERT_NOT_NULL(iovInstBuf);
+    iovTransport = transportConfig;
+    iovTransport.pfnNetWritev = mock_NetWritev;
+    mock_malloc_Reset();
+    mock_malloc_shouldReturn[0] = iovInstBuf;
+    umqtt_Handle_t hv = umqtt_New(&iovTransport, NULL, NULL);
+    TEST_ASSERT_NOT_NULL(hv);
+    wrap_setConnected(hv, true);
+
+    mock_malloc_Reset();
+    mock_malloc_shouldReturn[0] = topicBuf;
+    umqtt_TopicHandle_t hTopic = umqtt_NewTopic(hv, "topic");
+    TEST_ASSERT_EQUAL_PTR(topicBuf, hTopic);
+    mock_malloc_Reset();
+    mock_NetWritev_Reset();
+    mock_NetWritev_shouldReturn = sizeof(publishPacket0);
+    err = umqtt_PublishTopic(hv, hTopic, (const uint8_t *)"message", 7, 0, false, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+    TEST_ASSERT_EQUAL(3, mock_NetWritev_in_iovCnt);
+    TEST_ASSERT_EQUAL(2, mock_NetWritev_in_iov[0].len);
+    TEST_ASSERT_EQUAL_PTR(topicBuf, mock_NetWritev_in_iov[1].pBuf);
+    TEST_ASSERT_EQUAL(7, mock_NetWritev_in_iov[1].len);
+    TEST_ASSERT_EQUAL(sizeof(publishPacket0), mock_NetWritev_dataLen);
+    TEST_ASSERT_EQUAL_MEMORY(publishPacket0, mock_NetWritev_data, sizeof(publishPacket0));
+    free(iovInstBuf);
+}
+
+TEST_GROUP_RUNNER(Topic)
+{
+    RUN_TEST_CASE(Topic, NullParms);
+    RUN_TEST_CASE(Topic, AllocFail);
+    RUN_TEST_CASE(Topic, NewDelete);
+    RUN_TEST_CASE(Topic, Qos0);
+    RUN_TEST_CASE(Topic, Qos1);
+    RUN_TEST_CASE(Topic, Retain);
+    RUN_TEST_CASE(Topic, SameAsPublish);
+    RUN_TEST_CASE(Topic, Reuse);
+    RUN_TEST_CASE(Topic, Writev);
+}
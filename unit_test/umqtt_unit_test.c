@@ -16,6 +16,29 @@ RunAllTests(void)
     RUN_TEST_GROUP(Unsubscribe);
     RUN_TEST_GROUP(Decode);
     RUN_TEST_GROUP(Run);
+    RUN_TEST_GROUP(RxBuf);
+    RUN_TEST_GROUP(RxSeg);
+    RUN_TEST_GROUP(Writev);
+    RUN_TEST_GROUP(Deadline);
+    RUN_TEST_GROUP(Pool);
+    RUN_TEST_GROUP(Static);
+    RUN_TEST_GROUP(Loopback);
+    RUN_TEST_GROUP(Rto);
+    RUN_TEST_GROUP(Window);
+    RUN_TEST_GROUP(Qos2);
+    RUN_TEST_GROUP(PktId);
+    RUN_TEST_GROUP(Partial);
+    RUN_TEST_GROUP(Coalesce);
+    RUN_TEST_GROUP(Topic);
+    RUN_TEST_GROUP(Reserve);
+    RUN_TEST_GROUP(Batch);
+#ifdef UMQTT_ENABLE_STATS
+    RUN_TEST_GROUP(Stats);
+    RUN_TEST_GROUP(Latency);
+#endif
+#ifdef UMQTT_ENABLE_DUP_FILTER
+    RUN_TEST_GROUP(DupFilter);
+#endif
 }
 
 int
@@ -0,0 +1,220 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "unity_fixture.h"
+#include "umqtt/umqtt.h"
+#include "umqtt_mocks.h"
+#include "umqtt_wrapper.h"
+
+/*
+qos 1 in-flight window test cases
+
+-null parameters
+-no limit by default
+-publish past the window fails without allocating or writing
+-failed publish does not use a window slot
+-puback opens the window
+-expired packet opens the window
+-qos 0 publish and subscribe do not count
+ */
+
+TEST_GROUP(Window);
+
+static umqtt_Handle_t h = NULL;
+static void *instBuf = NULL;
+#define SIZE_INSTBUF UMQTT_INSTANCE_SIZE
+static uint8_t *pktBuf = NULL;
+#define SIZE_PKTBUF 2048
+static uint8_t rxBuf[8];
+
+// length of qos 1 publish of "message" to "topic"
+#define PUBLISH_LEN 18
+
+static umqtt_Callbacks_t callbacks =
+{
+    NULL, NULL, NULL, NULL, NULL, NULL
+};
+
+TEST_SETUP(Window)
+{
+    // allocate memory for the instance that will be created
+    // init the instance so it will be ready for all tests
+    mock_malloc_Reset();
+    instBuf = malloc(SIZE_INSTBUF);
+    mock_hNet = &mock_hNet;
+    transportConfig.hNet = mock_hNet;
+    mock_malloc_shouldReturn[0] = instBuf;
+    h = umqtt_New(&transportConfig, &callbacks, NULL);
+    TEST_ASSERT_NOT_NULL(h);
+    // clear all mocks
+    mock_malloc_Reset();
+    mock_free_Reset();
+    mock_NetRead_Reset();
+    mock_NetWrite_Reset();
+    // ready a buffer that can be used for packet allocation
+    pktBuf = malloc(SIZE_PKTBUF);
+    TEST_ASSERT_NOT_NULL(pktBuf);
+    // fake an existing connection, and long keep alive so that
+    // ping packets do not interfere
+    wrap_setConnected(h, true);
+    wrap_setKeepAlive(h, 1000);
+}
+
+TEST_TEAR_DOWN(Window)
+{
+    if (instBuf) { free(instBuf); instBuf = NULL; }
+    if (pktBuf) { free(pktBuf); pktBuf = NULL; }
+    h = NULL;
+}
+
+// qos 1 publish, each one uses its own slice of pktBuf
+static umqtt_Error_t
+Publish(unsigned int slot, int writeReturn, uint16_t *pMsgId)
+{
+    mock_malloc_Reset();
+    mock_NetWrite_Reset();
+    mock_malloc_shouldReturn[0] = &pktBuf[slot * 100];
+    mock_NetWrite_shouldReturn = writeReturn;
+    return umqtt_Publish(h, "topic", (const uint8_t *)"message", 7, 1, false, pMsgId);
+}
+
+static void
+CheckInflight(unsigned int expected)
+{
+    unsigned int count = 5555;
+    umqtt_Error_t err = umqtt_GetInflightCount(h, &count);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(expected, count);
+}
+
+TEST(Window, NullParms)
+{
+    umqtt_Error_t err;
+    unsigned int count;
+    err = umqtt_SetInflightWindow(NULL, 4);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+    err = umqtt_GetInflightCount(NULL, &count);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+    err = umqtt_GetInflightCount(h, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_PARM, err);
+}
+
+TEST(Window, Unlimited)
+{
+    for (unsigned int idx = 0; idx < 16; idx++)
+    {
+        umqtt_Error_t err = Publish(idx, PUBLISH_LEN, NULL);
+        TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    }
+    CheckInflight(16);
+}
+
+TEST(Window, Full)
+{
+    umqtt_Error_t err;
+    err = umqtt_SetInflightWindow(h, 2);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    CheckInflight(0);
+
+    // failed write does not take a slot
+    err = Publish(0, -1, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_NETWORK, err);
+    CheckInflight(0);
+
+    err = Publish(1, PUBLISH_LEN, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    err = Publish(2, PUBLISH_LEN, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    CheckInflight(2);
+
+    // window is full, nothing is allocated or sent
+    uint16_t msgId = 5555;
+    err = Publish(3, PUBLISH_LEN, &msgId);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_WINDOW_FULL, err);
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+    TEST_ASSERT_EQUAL(5555, msgId);
+    CheckInflight(2);
+
+    // qos 0 still goes out
+    mock_malloc_Reset();
+    mock_malloc_shouldReturn[0] = &pktBuf[1000];
+    mock_NetWrite_shouldReturn = 16;
+    err = umqtt_Publish(h, "topic", (const uint8_t *)"message", 7, 0, false, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+
+    // and so does subscribe
+    char *topics[1] = { "topic" };
+    uint8_t qoss[1] = { 1 };
+    mock_malloc_Reset();
+    mock_malloc_shouldReturn[0] = &pktBuf[1200];
+    mock_NetWrite_shouldReturn = 12;
+    err = umqtt_Subscribe(h, 1, topics, qoss, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    CheckInflight(2);
+}
+
+TEST(Window, PubackOpens)
+{
+    umqtt_Error_t err;
+    uint16_t msgId;
+    err = umqtt_SetInflightWindow(h, 1);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    err = Publish(0, PUBLISH_LEN, &msgId);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    err = Publish(1, PUBLISH_LEN, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_WINDOW_FULL, err);
+
+    rxBuf[0] = 4 << 4;
+    rxBuf[1] = 2;
+    rxBuf[2] = msgId >> 8;
+    rxBuf[3] = msgId & 0xFF;
+    err = umqtt_DecodePacket(h, rxBuf, 4);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    CheckInflight(0);
+    err = Publish(1, PUBLISH_LEN, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    CheckInflight(1);
+
+    // window can be made larger while packets are in flight
+    err = umqtt_SetInflightWindow(h, 2);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    err = Publish(2, PUBLISH_LEN, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    CheckInflight(2);
+}
+
+// packet that runs out of retries gives its slot back
+TEST(Window, ExpireOpens)
+{
+    umqtt_Error_t err;
+    err = umqtt_SetInflightWindow(h, 1);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    err = Publish(0, PUBLISH_LEN, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+
+    mock_NetWrite_shouldReturn = PUBLISH_LEN;
+    for (uint32_t ticks = 5000; ticks <= 50000; ticks += 5000)
+    {
+        err = umqtt_Run(h, ticks);
+        TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+        CheckInflight(1);
+    }
+    err = umqtt_Run(h, 55000);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_TIMEOUT, err);
+    CheckInflight(0);
+    err = Publish(1, PUBLISH_LEN, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+}
+
+TEST_GROUP_RUNNER(Window)
+{
+    RUN_TEST_CASE(Window, NullParms);
+    RUN_TEST_CASE(Window, Unlimited);
+    RUN_TEST_CASE(Window, Full);
+    RUN_TEST_CASE(Window, PubackOpens);
+    RUN_TEST_CASE(Window, ExpireOpens);
+}
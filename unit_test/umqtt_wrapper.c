@@ -26,7 +26,8 @@ uint8_t *
 wrap_dequeuePacketById(umqtt_Handle_t h, uint16_t packetId)
 {
     umqtt_Instance_t *this = (umqtt_Instance_t *)h;
-    return dequeuePacketById(this, packetId);
+    PktBuf_t *pPkt = dequeuePacket(this, packetId, 0);
+    return pPkt ? (uint8_t *)&pPkt[1] : NULL;
 }
 
 uint8_t *
@@ -43,6 +44,13 @@ wrap_getNextPktBuf(umqtt_Handle_t h)
     return this->pktList.next;
 }
 
+PktBuf_t *
+wrap_getLastPktBuf(umqtt_Handle_t h)
+{
+    umqtt_Instance_t *this = (umqtt_Instance_t *)h;
+    return this->pktTail;
+}
+
 void
 wrap_setConnected(umqtt_Handle_t h, bool connected)
 {
@@ -55,4 +63,21 @@ wrap_setKeepAlive(umqtt_Handle_t h, uint16_t keepAlive)
 {
     umqtt_Instance_t *this = (umqtt_Instance_t *)h;
     this->keepAlive = keepAlive;
+    // ping deadline is held in the timer wheel so it has to be
+    // rescheduled for the new interval
+    restartKeepAlive(this);
+}
+
+void
+wrap_setNextPacketId(umqtt_Handle_t h, uint16_t packetId)
+{
+    umqtt_Instance_t *this = (umqtt_Instance_t *)h;
+    this->packetId = packetId;
+}
+
+unsigned int
+wrap_getIdBuckets(umqtt_Handle_t h)
+{
+    umqtt_Instance_t *this = (umqtt_Instance_t *)h;
+    return this->idMask + 1;
 }
@@ -8,7 +8,10 @@ extern void wrap_enqueuePacket(umqtt_Handle_t h, uint8_t *pbuf, uint16_t packetI
 extern uint8_t *wrap_dequeuePacketById(umqtt_Handle_t h, uint16_t packetId);
 extern uint8_t *wrap_dequeuePacketByType(umqtt_Handle_t h, uint8_t type);
 extern PktBuf_t *wrap_getNextPktBuf(umqtt_Handle_t h);
+extern PktBuf_t *wrap_getLastPktBuf(umqtt_Handle_t h);
 extern void wrap_setConnected(umqtt_Handle_t h, bool connected);
 extern void wrap_setKeepAlive(umqtt_Handle_t h, uint16_t keepAlive);
+extern void wrap_setNextPacketId(umqtt_Handle_t h, uint16_t packetId);
+extern unsigned int wrap_getIdBuckets(umqtt_Handle_t h);
 
 #endif
@@ -0,0 +1,206 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "unity_fixture.h"
+#include "umqtt/umqtt.h"
+#include "umqtt_mocks.h"
+#include "umqtt_wrapper.h"
+
+/*
+scatter/gather write test cases
+
+These use the transport "writev" function where a publish is handed
+to the transport as separate header, topic and payload segments instead
+of being copied into an allocated packet.
+
+-qos 0 publish has no allocation and no copy of topic or payload
+-qos 0 publish without payload
+-multi-byte remaining length in the header segment
+-qos 1 publish keeps one copy for retry
+-incomplete write
+ */
+
+TEST_GROUP(Writev);
+
+static umqtt_Handle_t h = NULL;
+static void *instBuf = NULL;
+#define SIZE_INSTBUF UMQTT_INSTANCE_SIZE
+static uint8_t *pktBuf = NULL;
+#define SIZE_PKTBUF 1024
+static umqtt_TransportConfig_t iovTransport;
+
+static const uint8_t publishPacket0[] =
+{
+    0x30, 14, // fixed header
+    0, 5, 't','o','p','i','c',
+    'm','e','s','s','a','g','e',
+};
+
+static const uint8_t publishPacket1[] =
+{
+    0x33, 16, // qos 1, retain
+    0, 5, 't','o','p','i','c',
+    0, 1, // packet id
+    'm','e','s','s','a','g','e',
+};
+
+TEST_SETUP(Writev)
+{
+    // set up a transport that can write separate segments
+    iovTransport = transportConfig;
+    iovTransport.pfnNetWritev = mock_NetWritev;
+    // allocate memory for the instance that will be created
+    // init the instance so it will be ready for all tests
+    mock_malloc_Reset();
+    instBuf = malloc(SIZE_INSTBUF);
+    mock_hNet = &mock_hNet;
+    iovTransport.hNet = mock_hNet;
+    mock_malloc_shouldReturn[0] = instBuf;
+    h = umqtt_New(&iovTransport, NULL, NULL);
+    TEST_ASSERT_NOT_NULL(h);
+    // clear all mocks
+    mock_malloc_Reset();
+    mock_free_Reset();
+    mock_NetRead_Reset();
+    mock_NetWrite_Reset();
+    mock_NetWritev_Reset();
+    // ready a buffer that can be used for packet allocation
+    pktBuf = malloc(SIZE_PKTBUF);
+    TEST_ASSERT_NOT_NULL(pktBuf);
+    // fake an existing connection
+    wrap_setConnected(h, true);
+}
+
+TEST_TEAR_DOWN(Writev)
+{
+    if (instBuf) { free(instBuf); instBuf = NULL; }
+    if (pktBuf) { free(pktBuf); pktBuf = NULL; }
+    h = NULL;
+}
+
+// qos 0 goes straight from caller topic and payload to the transport
+TEST(Writev, Qos0NoCopy)
+{
+    umqtt_Error_t err;
+    uint16_t msgId = 5555;
+    const char *topic = "topic";
+    const uint8_t *message = (const uint8_t *)"message";
+
+    mock_NetWritev_shouldReturn = sizeof(publishPacket0);
+    err = umqtt_Publish(h, topic, message, 7, 0, false, &msgId);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(0, msgId);
+
+    // nothing allocated, single write packet path not used
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+    TEST_ASSERT_FALSE(mock_free_wasCalled);
+    TEST_ASSERT_FALSE(mock_NetWrite_wasCalled);
+
+    // header, topic and payload segments
+    TEST_ASSERT_TRUE(mock_NetWritev_wasCalled);
+    TEST_ASSERT_EQUAL_PTR(mock_hNet, mock_NetWritev_in_hNet);
+    TEST_ASSERT_EQUAL(3, mock_NetWritev_in_iovCnt);
+    TEST_ASSERT_EQUAL(4, mock_NetWritev_in_iov[0].len);
+    TEST_ASSERT_EQUAL_PTR(topic, mock_NetWritev_in_iov[1].pBuf);
+    TEST_ASSERT_EQUAL(5, mock_NetWritev_in_iov[1].len);
+    TEST_ASSERT_EQUAL_PTR(message, mock_NetWritev_in_iov[2].pBuf);
+    TEST_ASSERT_EQUAL(7, mock_NetWritev_in_iov[2].len);
+
+    // gathered segments are the publish packet
+    TEST_ASSERT_EQUAL(sizeof(publishPacket0), mock_NetWritev_dataLen);
+    TEST_ASSERT_EQUAL_MEMORY(publishPacket0, mock_NetWritev_data, sizeof(publishPacket0));
+}
+
+// empty payload does not need a segment
+TEST(Writev, Qos0TopicOnly)
+{
+    umqtt_Error_t err;
+    static const uint8_t expected[] = { 0x31, 7, 0, 5, 't','o','p','i','c' };
+
+    mock_NetWritev_shouldReturn = sizeof(expected);
+    err = umqtt_Publish(h, "topic", NULL, 0, 0, true, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+    TEST_ASSERT_EQUAL(2, mock_NetWritev_in_iovCnt);
+    TEST_ASSERT_EQUAL(sizeof(expected), mock_NetWritev_dataLen);
+    TEST_ASSERT_EQUAL_MEMORY(expected, mock_NetWritev_data, sizeof(expected));
+}
+
+// large payload needs more than one byte of remaining length
+// and is still not copied
+TEST(Writev, Qos0LargePayload)
+{
+    umqtt_Error_t err;
+    static uint8_t payload[3000];
+    memset(payload, 0x5A, sizeof(payload));
+
+    // remaining length 2 + 5 + 3000 = 3007 = 0xBBF
+    mock_NetWritev_shouldReturn = 4 + 1 + 5 + sizeof(payload);
+    err = umqtt_Publish(h, "topic", payload, sizeof(payload), 0, false, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+    TEST_ASSERT_EQUAL(3, mock_NetWritev_in_iovCnt);
+    TEST_ASSERT_EQUAL(5, mock_NetWritev_in_iov[0].len);
+    TEST_ASSERT_EQUAL(0x30, mock_NetWritev_data[0]);
+    TEST_ASSERT_EQUAL(0xBF, mock_NetWritev_data[1]);
+    TEST_ASSERT_EQUAL(0x17, mock_NetWritev_data[2]);
+    TEST_ASSERT_EQUAL(0, mock_NetWritev_data[3]);
+    TEST_ASSERT_EQUAL(5, mock_NetWritev_data[4]);
+    TEST_ASSERT_EQUAL_PTR(payload, mock_NetWritev_in_iov[2].pBuf);
+    TEST_ASSERT_EQUAL(sizeof(payload), mock_NetWritev_in_iov[2].len);
+}
+
+// qos 1 must keep the packet for retry, so it is encoded once into
+// an allocated packet and that copy is written
+TEST(Writev, Qos1Retained)
+{
+    umqtt_Error_t err;
+    uint16_t msgId = 5555;
+
+    mock_NetWritev_shouldReturn = sizeof(publishPacket1);
+    mock_malloc_shouldReturn[0] = pktBuf;
+    err = umqtt_Publish(h, "topic", (const uint8_t *)"message", 7, 1, true, &msgId);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_OK, err);
+    TEST_ASSERT_NOT_EQUAL(0, msgId);
+    TEST_ASSERT_NOT_EQUAL(5555, msgId);
+
+    // one allocation which is kept
+    TEST_ASSERT_EQUAL(1, mock_malloc_count);
+    TEST_ASSERT_EQUAL(sizeof(publishPacket1) + 3 + sizeof(PktBuf_t), mock_malloc_in_size);
+    TEST_ASSERT_FALSE(mock_free_wasCalled);
+
+    // retained packet written as a single segment
+    TEST_ASSERT_TRUE(mock_NetWritev_wasCalled);
+    TEST_ASSERT_EQUAL(1, mock_NetWritev_in_iovCnt);
+    TEST_ASSERT_TRUE(mock_NetWritev_in_iov[0].pBuf > pktBuf);
+    TEST_ASSERT_TRUE(mock_NetWritev_in_iov[0].pBuf < &pktBuf[SIZE_PKTBUF]);
+    TEST_ASSERT_EQUAL(sizeof(publishPacket1), mock_NetWritev_dataLen);
+    TEST_ASSERT_EQUAL_MEMORY(publishPacket1, mock_NetWritev_data, sizeof(publishPacket1));
+}
+
+// transport did not take the whole packet
+TEST(Writev, Incomplete)
+{
+    umqtt_Error_t err;
+
+    mock_NetWritev_shouldReturn = 4;
+    err = umqtt_Publish(h, "topic", (const uint8_t *)"message", 7, 0, false, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_NETWORK, err);
+    TEST_ASSERT_EQUAL(0, mock_malloc_count);
+
+    mock_NetWritev_shouldReturn = -1;
+    err = umqtt_Publish(h, "topic", (const uint8_t *)"message", 7, 0, false, NULL);
+    TEST_ASSERT_EQUAL(UMQTT_ERR_NETWORK, err);
+}
+
+TEST_GROUP_RUNNER(Writev)
+{
+    RUN_TEST_CASE(Writev, Qos0NoCopy);
+    RUN_TEST_CASE(Writev, Qos0TopicOnly);
+    RUN_TEST_CASE(Writev, Qos0LargePayload);
+    RUN_TEST_CASE(Writev, Qos1Retained);
+    RUN_TEST_CASE(Writev, Incomplete);
+}